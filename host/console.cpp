@@ -0,0 +1,154 @@
+// vim: tabstop=4 shiftwidth=4 noexpandtab colorcolumn=120 :
+// This file is part of the Sim800 (https://github.com/beranat/sim800).
+// Copyright (c) 2021 Anatoly L. Berenblit.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 3.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <esp_console.h>
+#include <linenoise/linenoise.h>
+
+// esp_console command registry and a plain stdin line reader for the host build
+
+namespace {
+
+struct Command {
+	std::string help;
+	esp_console_cmd_func_t func;
+};
+
+std::map<std::string, Command> commands;
+size_t argsMax = 8;
+
+int help(int, char **) {
+	for (const auto &[name, command] : commands)
+		printf("%s\n  %s\n\n", name.c_str(), command.help.c_str());
+	return 0;
+}
+
+} // namespace
+
+esp_err_t esp_console_init(const esp_console_config_t *config) {
+	if (nullptr == config)
+		return ESP_ERR_INVALID_ARG;
+	argsMax = config->max_cmdline_args;
+	return ESP_OK;
+}
+
+esp_err_t esp_console_deinit(void) {
+	commands.clear();
+	return ESP_OK;
+}
+
+esp_err_t esp_console_cmd_register(const esp_console_cmd_t *cmd) {
+	if (nullptr == cmd || nullptr == cmd->command || nullptr != strchr(cmd->command, ' '))
+		return ESP_ERR_INVALID_ARG;
+	commands[cmd->command] = Command { (nullptr != cmd->help) ? cmd->help : "", cmd->func };
+	return ESP_OK;
+}
+
+esp_err_t esp_console_register_help_command(void) {
+	const esp_console_cmd_t cmd = { "help", "Print the list of registered commands", nullptr, &help, nullptr };
+	return esp_console_cmd_register(&cmd);
+}
+
+esp_err_t esp_console_run(const char *cmdline, int *ret) {
+	std::string line(cmdline);
+	std::vector<char *> argv;
+
+	// whitespace separated, double quotes group words
+	for (size_t i = 0; i < line.length() && argv.size() < argsMax;) {
+		while (i < line.length() && isspace(static_cast<unsigned char>(line[i])))
+			++i;
+		if (i >= line.length())
+			break;
+
+		const bool isQuoted = ('"' == line[i]);
+		if (isQuoted)
+			++i;
+		argv.push_back(&line[i]);
+		while (i < line.length() && (isQuoted ? '"' != line[i] : !isspace(static_cast<unsigned char>(line[i]))))
+			++i;
+		if (i < line.length())
+			line[i++] = 0;
+	}
+
+	if (argv.empty())
+		return ESP_ERR_INVALID_ARG;
+
+	const auto i = commands.find(argv[0]);
+	if (commands.end() == i)
+		return ESP_ERR_NOT_FOUND;
+
+	argv.push_back(nullptr);
+	*ret = i->second.func(static_cast<int>(argv.size() - 1), argv.data());
+	return ESP_OK;
+}
+
+void esp_console_get_completion(const char *, void *) {
+}
+
+const char *esp_console_get_hint(const char *, int *, int *) {
+	return nullptr;
+}
+
+char *linenoise(const char *prompt) {
+	fputs(prompt, stdout);
+	fflush(stdout);
+
+	char buffer[1024];
+	if (nullptr == fgets(buffer, sizeof(buffer), stdin)) {
+		// end of script
+		fflush(stdout);
+		exit(EXIT_SUCCESS);
+	}
+
+	buffer[strcspn(buffer, "\r\n")] = 0;
+	return strdup(buffer);
+}
+
+void linenoiseFree(void *ptr) {
+	free(ptr);
+}
+
+int linenoiseProbe(void) {
+	return -1;
+}
+
+void linenoiseSetMultiLine(int) {
+}
+
+void linenoiseSetDumbMode(int) {
+}
+
+void linenoiseSetCompletionCallback(void (*)(const char *, void *)) {
+}
+
+void linenoiseSetHintsCallback(linenoiseHintsCallback *) {
+}
+
+int linenoiseHistoryAdd(const char *) {
+	return 0;
+}
+
+int linenoiseHistorySetMaxLen(int) {
+	return 0;
+}
+
+void linenoiseAllowEmpty(bool) {
+}
@@ -0,0 +1,1356 @@
+// vim: tabstop=4 shiftwidth=4 noexpandtab colorcolumn=120 :
+// This file is part of the Sim800 (https://github.com/beranat/sim800).
+// Copyright (c) 2021 Anatoly L. Berenblit.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 3.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <esp_log.h>
+
+#include "sdkconfig.h"
+
+#include "emulator.hpp"
+
+constexpr const char *MODULE = "emulator";
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+constexpr unsigned int powerKeyMinMs = 1000;
+constexpr unsigned int escapeGuardMs = 1000;	// S12
+constexpr size_t sendMax = 1460;
+constexpr int linkMax = 6;	// AT+CIPMUX=1 connections
+constexpr int mqttPort = 1883;	// AT+CIPSTART to it connects to the MQTT broker
+constexpr int smsMax = 50;	// SIM message storage
+constexpr char smsEnd = 0x1A;		// Ctrl-Z sends the PDU
+constexpr char smsCancel = 0x1B;	// ESC
+constexpr const char *cellLac = "1A2B";	// serving cell of AT+CREG=2/AT+CGREG=2
+constexpr const char *cellId = "03E8";
+constexpr int signalRssi = 17;
+
+// GSM 07.10 basic option
+constexpr uint8_t muxFlag = 0xF9;
+constexpr uint8_t muxSabm = 0x2F;
+constexpr uint8_t muxUa = 0x63;
+constexpr uint8_t muxDisc = 0x43;
+constexpr uint8_t muxUih = 0xEF;
+constexpr uint8_t muxPf = 0x10;
+constexpr uint8_t muxMsc = 0xE1;
+constexpr uint8_t muxCld = 0xC1;
+constexpr uint8_t muxCr = 0x02;
+constexpr size_t muxFrameMax = 127;
+constexpr int muxChannels = 4;	// DLCI 0 (control) .. 3
+
+uint8_t muxFcs(const uint8_t *data, size_t length) {
+	uint8_t crc = 0xFF;
+	while (0 != length--) {
+		crc ^= *data++;
+		for (unsigned int bit = 0; bit < 8; ++bit)
+			crc = (crc & 1) ? (crc >> 1) ^ 0xE0 : (crc >> 1);
+	}
+	return crc;
+}
+
+// Modem is the responder: its responses have C/R set, its commands and data do not
+std::string muxFrame(int dlci, uint8_t control, bool isResponse, const std::string &data = std::string()) {
+	std::string frame;
+	frame.push_back(static_cast<char>(muxFlag));
+	frame.push_back(static_cast<char>((dlci << 2) | (isResponse ? muxCr : 0) | 1));
+	frame.push_back(static_cast<char>(control));
+	frame.push_back(static_cast<char>((data.length() << 1) | 1));
+	frame += data;
+	frame.push_back(static_cast<char>(0xFF - muxFcs(reinterpret_cast<const uint8_t *>(frame.data()) + 1, 3)));
+	frame.push_back(static_cast<char>(muxFlag));
+	return frame;
+}
+
+size_t hexOctet(const std::string &hex, size_t pos) {
+	return (pos + 2 <= hex.length()) ? strtoul(hex.substr(pos, 2).c_str(), nullptr, 16) : 0;
+}
+
+// SMS-SUBMIT PDU hex (with SMSC) as SMS-DELIVER from the same address, empty - malformed or not TPDU octets long
+std::string smsDeliver(const std::string &submit, size_t octets) {
+	size_t pos = 2 + 2 * hexOctet(submit, 0);
+	if (submit.length() < pos + 2 * 3 || submit.length() - pos != 2 * octets)
+		return std::string();
+
+	const size_t first = hexOctet(submit, pos);
+	const size_t validity = (2 == ((first >> 3) & 3)) ? 1 : (0 == ((first >> 3) & 3)) ? 0 : 7;
+	const size_t address = 2 * (2 + (hexOctet(submit, pos + 4) + 1) / 2);
+	if (1 != (first & 3) || submit.length() < pos + 4 + address + 2 * (3 + validity))
+		return std::string();
+
+	// SMSC, SMS-DELIVER (TP-UDHI kept), OA, PID, DCS, SCTS 26/10/16 12:34:56+00, UDL and UD
+	char deliver[3];
+	snprintf(deliver, sizeof(deliver), "%02X", static_cast<unsigned int>(0x04 | (first & 0x40)));
+	pos += 4;
+	return "07911326040000F0" + std::string(deliver) + submit.substr(pos, address + 4) + "62016121436500" +
+		   submit.substr(pos + address + 4 + 2 * validity);
+}
+
+// Path of the URL in SIM800_FILES directory, the local file server
+bool readFile(const std::string &url, std::string *body) {
+	const char *directory = getenv("SIM800_FILES");
+	const size_t scheme = url.find("://");
+	const size_t slash = url.find('/', (std::string::npos != scheme) ? scheme + 3 : 0);
+	if (nullptr == directory || std::string::npos == slash || std::string::npos != url.find("..", slash))
+		return false;
+
+	FILE *file = fopen((directory + url.substr(slash)).c_str(), "rb");
+	if (nullptr == file)
+		return false;
+	body->clear();
+	char buffer[4096];
+	size_t length;
+	while (0 < (length = fread(buffer, 1, sizeof(buffer), file)))
+		body->append(buffer, length);
+	fclose(file);
+	return true;
+}
+
+size_t mqttWord(const std::string &data, size_t pos) {
+	return (pos + 2 <= data.length()) ? (static_cast<uint8_t>(data[pos]) << 8) | static_cast<uint8_t>(data[pos + 1]) : 0;
+}
+
+// MQTT remaining length
+std::string mqttLength(size_t length) {
+	std::string encoded;
+	do {
+		encoded += static_cast<char>((length & 0x7F) | ((0x80 <= length) ? 0x80 : 0));
+		length >>= 7;
+	} while (0 != length);
+	return encoded;
+}
+
+// One direction of the serial line: bytes leave at the baud rate (10 bits per byte), about a millisecond per chunk
+class Wire final {
+public:
+	typedef std::function<void(const uint8_t *data, size_t length, bool isIdle)> Sink;
+
+private:
+	std::mutex lock_;
+	std::condition_variable cv_;
+	std::deque<uint8_t> queue_;
+	bool isBusy_ = false;
+	int baudRate_;
+	Sink sink_;
+
+	void run() {
+		uint8_t chunk[128];
+		Clock::time_point free = Clock::now();
+
+		std::unique_lock<std::mutex> lock(lock_);
+		while (true) {
+			cv_.wait(lock, [this]() {
+				return !queue_.empty();
+			});
+
+			const size_t perMs = std::max(1, baudRate_ / 10 / 1000);
+			const size_t length = std::min({ queue_.size(), perMs, sizeof(chunk) });
+			std::copy_n(queue_.begin(), length, chunk);
+			queue_.erase(queue_.begin(), queue_.begin() + length);
+			isBusy_ = true;
+
+			free = std::max(free, Clock::now());
+			free += std::chrono::nanoseconds(static_cast<int64_t>(length) * 10 * 1000000000LL / baudRate_);
+
+			lock.unlock();
+			std::this_thread::sleep_until(free);
+			lock.lock();
+
+			const bool isIdle = queue_.empty();
+			lock.unlock();
+			sink_(chunk, length, isIdle);
+			lock.lock();
+
+			isBusy_ = false;
+			cv_.notify_all();
+		}
+	}
+
+public:
+	Wire(int baudRate, Sink sink) : baudRate_(baudRate), sink_(std::move(sink)) {
+		std::thread(&Wire::run, this).detach();
+	}
+
+	void send(const void *data, size_t length) {
+		const uint8_t *bytes = reinterpret_cast<const uint8_t *>(data);
+		std::lock_guard<std::mutex> guard(lock_);
+		queue_.insert(queue_.end(), bytes, bytes + length);
+		cv_.notify_all();
+	}
+
+	void baud(int baudRate) {
+		std::lock_guard<std::mutex> guard(lock_);
+		baudRate_ = baudRate;
+	}
+
+	bool drain(TickType_t wait) {
+		std::unique_lock<std::mutex> lock(lock_);
+		const auto isDrained = [this]() {
+			return queue_.empty() && !isBusy_;
+		};
+		if (portMAX_DELAY == wait) {
+			cv_.wait(lock, isDrained);
+			return true;
+		}
+		return cv_.wait_for(lock, std::chrono::milliseconds(wait), isDrained);
+	}
+};
+
+struct Rule {
+	std::string prefix;
+	unsigned int delayMs;
+	std::vector<std::string> lines;
+};
+
+struct Unsolicited {
+	unsigned int delayMs;
+	std::string line;
+};
+
+struct Outage {
+	unsigned int delayMs;	// after RDY
+	unsigned int durationMs;
+};
+
+std::string trim(const std::string &s) {
+	const size_t begin = s.find_first_not_of(" \t\r\n");
+	if (std::string::npos == begin)
+		return std::string();
+	return s.substr(begin, s.find_last_not_of(" \t\r\n") - begin + 1);
+}
+
+std::string upper(std::string s) {
+	std::transform(s.begin(), s.end(), s.begin(), [](unsigned char c) {
+		return static_cast<char>(toupper(c));
+	});
+	return s;
+}
+
+class Modem final {
+	std::mutex lock_;
+	std::condition_variable cv_;
+
+	// script
+	unsigned int bootMs_ = 2500;
+	bool echoDefault_ = true;
+	std::string default_ = "OK";
+	std::vector<Rule> rules_;
+	std::vector<Unsolicited> unsolicited_;
+	std::vector<Outage> outages_;
+	int linkMax_ = 460800;	// modem output is corrupted at faster rates
+	unsigned int sendMs_ = 0;
+
+	// state
+	int baudRate_ = 0;		// AT+IPR, 0 - autobaud (follows DTE), kept over power cycles like modem NVRAM
+	int dteBaudRate_ = 57600;
+	bool isPowered_ = false;
+	bool isReset_ = false;
+	bool isBooted_ = false;
+	bool isEcho_ = true;
+	bool isKeyDown_ = false;
+	Clock::time_point keyDown_;
+	std::string line_;
+	unsigned int generation_ = 0;	// scheduled output of previous power cycle is dropped
+
+	// AT+CMUX: commands of every DLCI get their responses on it, URCs go to DLCI 1
+	bool isMux_ = false;
+	int channel_ = 0;	// of the command being run, 0 - not multiplexed/URC
+	std::string muxRx_;
+	std::string muxLines_[muxChannels];
+
+	// ATD data mode on the UART (0) or a DLCI, -1 - command mode; data is counted and dropped
+	int dataChannel_ = -1;
+	Clock::time_point dataLast_;
+	unsigned int escape_ = 0;	// `+' received after the guard time
+	uint64_t dataBytes_ = 0;
+
+	// AT+CIPSEND=[<link>,]<n> data after the prompt
+	size_t sendLength_ = 0;
+	int sendChannel_ = 0;
+	int sendLink_ = 0;
+	std::string sendData_;
+
+	// AT+CMGS=<n> PDU till Ctrl-Z, sent messages come back (+CMTI) to the SIM storage (AT+CMGR, AT+CMGD)
+	bool isPdu_ = false;	// AT+CMGF=0
+	bool isSmsInput_ = false;
+	int smsChannel_ = 0;
+	size_t smsOctets_ = 0;
+	std::string smsData_;
+	unsigned int smsReference_ = 0;
+	std::map<int, std::string> smsStored_;
+
+	// AT+HTTP* on the AT+SAPBR bearer: POST body comes back, GET of a URL ending in /<n> gets n bytes, 404 otherwise
+	bool isBearer_ = false;
+	bool isHttp_ = false;
+	std::string httpUrl_;
+	size_t httpLength_ = 0;	// AT+HTTPDATA bytes left
+	int httpChannel_ = 0;
+	std::string httpPosted_;
+	std::string httpBody_;
+
+	// connections to an echo server: sent data comes back a round trip (send <ms>) later, QUIT closes
+	struct Link {
+		bool isConnected = false;
+		std::string inbound;	// AT+CIPRXGET=1: data waits for AT+CIPRXGET=2
+		bool isBroker = false;	// port 1883
+		std::string mqtt;		// broker input till the packet is complete
+		std::vector<std::string> subscriptions;
+		unsigned int mqttId = 0;
+	};
+	Link links_[linkMax];
+	bool isCovered_ = true;		// registered, outage: PDP and connections are gone, no new ones
+	int cregMode_ = 0;			// AT+CREG=<n>: 1 - +CREG: <stat>, 2 - with the location
+	int cgregMode_ = 0;
+	bool isSignalUrc_ = false;	// AT+EXUNSOL="SQ",1: +CSQN on a change
+	bool isLinkMux_ = false;	// AT+CIPMUX=1: results and data carry the link number
+	bool isRxGet_ = false;
+	bool isQuickSend_ = false;	// AT+CIPQSEND=1: DATA ACCEPT right away
+
+	struct Output {
+		unsigned int generation;
+		std::string text;
+		int baudRate;	// AT+IPR switch after the text is sent, 0 - none
+		int channel;	// UIH frames of DLCI in mux mode (0 - DLCI 1), -1 - raw frame
+		int mux;		// mux mode after the text is sent: 1 - enter, -1 - leave
+		int data;		// data mode after the text: 1 - enter, -1 - leave, -2 - escape (dropped if data followed)
+		std::string received;	// server data arriving with the output
+		int link = 0;			// of the received data
+		bool isClose = false;	// server closes the link
+		bool isUrc = false;		// script unsolicited line
+		int coverage = 0;		// network coverage: -1 lost, 1 back
+	};
+	std::multimap<Clock::time_point, Output> scheduled_;
+	std::vector<Output> held_;	// URCs wait while the modem prompts for and takes AT+CIPSEND/AT+CMGS data
+
+	Wire toDte_;
+	Wire toModem_;
+
+	void schedule(unsigned int delayMs, std::string text, int baudRate = 0, int mux = 0) {
+		scheduled_.emplace(Clock::now() + std::chrono::milliseconds(delayMs),
+						   Output { generation_, std::move(text), baudRate, channel_, mux, 0 });
+		cv_.notify_all();
+	}
+
+	void scheduleFrame(std::string frame, int mux = 0) {
+		scheduled_.emplace(Clock::now(), Output { generation_, std::move(frame), 0, -1, mux, 0 });
+		cv_.notify_all();
+	}
+
+	void scheduleData(unsigned int delayMs, const std::string &line, int channel, int data) {
+		scheduled_.emplace(Clock::now() + std::chrono::milliseconds(delayMs),
+						   Output { generation_, "\r\n" + line + "\r\n", 0, channel, 0, data });
+		cv_.notify_all();
+	}
+
+	// Both sides must use the same rate
+	bool isMismatch() const {
+		return 0 != baudRate_ && baudRate_ != dteBaudRate_;
+	}
+
+	// DTE samples modem output badly over linkMax_ (the modem still gets commands)
+	bool isGarbled() const {
+		return isMismatch() || dteBaudRate_ > linkMax_;
+	}
+
+	void respond(unsigned int delayMs, const std::string &line) {
+		schedule(delayMs, "\r\n" + line + "\r\n");
+	}
+
+	void powerOff() {
+		isBooted_ = false;
+		isMux_ = false;
+		dataChannel_ = -1;
+		sendLength_ = 0;
+		isPdu_ = isSmsInput_ = false;
+		isBearer_ = isHttp_ = false;
+		httpLength_ = 0;
+		isLinkMux_ = isRxGet_ = isQuickSend_ = false;
+		for (Link &link : links_)
+			link = Link();
+		isCovered_ = true;
+		cregMode_ = cgregMode_ = 0;
+		isSignalUrc_ = false;
+		line_.clear();
+		++generation_;
+		scheduled_.clear();
+		held_.clear();
+	}
+
+	void boot() {
+		isEcho_ = echoDefault_;
+		respond(bootMs_, "RDY");
+		for (const Unsolicited &u : unsolicited_) {
+			scheduled_.emplace(Clock::now() + std::chrono::milliseconds(bootMs_ + u.delayMs),
+							   Output { generation_, "\r\n" + u.line + "\r\n", 0, 0, 0, 0, std::string(), 0, false,
+										true });
+		}
+		for (const Outage &o : outages_) {
+			for (const int coverage : { -1, 1 }) {
+				const unsigned int ms = bootMs_ + o.delayMs + ((0 < coverage) ? o.durationMs : 0);
+				scheduled_.emplace(Clock::now() + std::chrono::milliseconds(ms),
+								   Output { generation_, std::string(), 0, 0, 0, 0, std::string(), 0, false, true,
+											coverage });
+			}
+		}
+		ESP_LOGI(MODULE, "Power on, RDY in %u ms", bootMs_);
+	}
+
+	void command(const std::string &text) {
+		if (isEcho_)
+			schedule(0, text + "\r");
+
+		const std::string command = upper(text);
+		if (0 != command.compare(0, 2, "AT"))
+			return;
+
+		if ("ATE0" == command || "ATE1" == command) {
+			isEcho_ = ('1' == command[3]);
+			respond(0, "OK");
+			return;
+		}
+
+		if ("AT+IPR?" == command) {
+			respond(0, "+IPR: " + std::to_string(baudRate_));
+			respond(0, "OK");
+			return;
+		}
+
+		if (0 == command.compare(0, 8, "AT+CMUX=")) {
+			if ('0' != command[8] || isMux_) {
+				respond(0, "ERROR");
+				return;
+			}
+			schedule(0, "\r\nOK\r\n", 0, 1);
+			return;
+		}
+
+		if (0 == command.compare(0, 4, "ATD*")) {
+			if (0 <= dataChannel_) {
+				respond(0, "BUSY");
+				return;
+			}
+			scheduleData(0, "CONNECT", channel_, 1);
+			return;
+		}
+
+		if ("ATH" == command || "ATH0" == command) {
+			// hang-up of the data call from another DLCI
+			if (0 < dataChannel_ && channel_ != dataChannel_)
+				scheduleData(0, "NO CARRIER", dataChannel_, -1);
+			respond(0, "OK");
+			return;
+		}
+
+		if (0 == command.compare(0, 11, "AT+CIPSEND=")) {
+			const char *args = command.c_str() + 11;
+			const int link = linkOf(args);
+			const int length = atoi(args);
+			if (link < 0 || !links_[link].isConnected || length <= 0 || static_cast<int>(sendMax) < length) {
+				respond(0, "ERROR");
+				return;
+			}
+			sendLength_ = static_cast<size_t>(length);
+			sendChannel_ = channel_;
+			sendLink_ = link;
+			sendData_.clear();
+			schedule(0, "\r\n> ");
+			return;
+		}
+
+		if (!isCovered_ && ("AT+CIICR" == command || "AT+SAPBR=1,1" == command)) {
+			respond(sendMs_, "ERROR");
+			return;
+		}
+		if (!isCovered_ && "AT+CSQ" == command) {
+			respond(0, "+CSQ: 0,99");
+			respond(0, "OK");
+			return;
+		}
+		if (networkCommand(command))
+			return;
+
+		if (ipCommand(command) || smsCommand(command) || httpCommand(text, command))
+			return;
+
+		if (0 == command.compare(0, 7, "AT+IPR=")) {
+			const int baudRate = atoi(command.c_str() + 7);
+			if (0 != baudRate && (baudRate < 1200 || 460800 < baudRate)) {
+				respond(0, "ERROR");
+				return;
+			}
+			schedule(0, "\r\nOK\r\n", (0 != baudRate) ? baudRate : -1);
+			return;
+		}
+
+		const Rule *rule = nullptr;
+		for (const Rule &r : rules_) {
+			if (0 == command.compare(0, r.prefix.length(), r.prefix) &&
+					(nullptr == rule || r.prefix.length() > rule->prefix.length()))
+				rule = &r;
+		}
+
+		if (nullptr == rule) {
+			respond(0, default_);
+			return;
+		}
+
+		for (const std::string &line : rule->lines)
+			respond(rule->delayMs, line);
+	}
+
+	// Link number of AT+CIPMUX=1 commands (`<link>,' is skipped), 0 in single mode, -1 - bad one
+	int linkOf(const char *&args) const {
+		if (!isLinkMux_)
+			return 0;
+		const int link = atoi(args);
+		const char *comma = strchr(args, ',');
+		if (nullptr == comma || link < 0 || linkMax <= link)
+			return -1;
+		args = comma + 1;
+		return link;
+	}
+
+	// "<link>, " of AT+CIPMUX=1 results
+	std::string linkPrefix(int link) const {
+		return isLinkMux_ ? std::to_string(link) + ", " : std::string();
+	}
+
+	// Modem IP stack (AT+CIP*), false - not one of them
+	bool ipCommand(const std::string &command) {
+		if (0 == command.compare(0, 12, "AT+CIPSTART=")) {
+			const char *args = command.c_str() + 12;
+			const int link = linkOf(args);
+			if (link < 0) {
+				respond(0, "ERROR");
+				return true;
+			}
+			respond(0, "OK");
+			if (!isCovered_) {
+				respond(sendMs_, linkPrefix(link) + "CONNECT FAIL");
+				return true;
+			}
+			respond(sendMs_, linkPrefix(link) + (links_[link].isConnected ? "ALREADY CONNECT" : "CONNECT OK"));
+			if (!links_[link].isConnected) {
+				const char *port = strrchr(args, ',');
+				links_[link].isBroker = (nullptr != port && mqttPort == atoi(port + 1));
+			}
+			links_[link].isConnected = true;
+		} else if ("AT+CIPCLOSE" == command.substr(0, 11)) {
+			const int link = isLinkMux_ ? atoi(command.c_str() + 12) : 0;
+			if ((isLinkMux_ && '=' != command[11]) || link < 0 || linkMax <= link || !links_[link].isConnected) {
+				respond(0, "ERROR");
+				return true;
+			}
+			respond(0, linkPrefix(link) + "CLOSE OK");
+			links_[link] = Link();
+		} else if ("AT+CIPSHUT" == command) {
+			respond(0, "SHUT OK");
+			for (Link &link : links_)
+				link = Link();
+		} else if ("AT+CIPMUX=0" == command || "AT+CIPMUX=1" == command) {
+			isLinkMux_ = ('1' == command[10]);
+			respond(0, "OK");
+		} else if ("AT+CIFSR" == command) {
+			respond(0, "10.64.0.2");
+		} else if (0 == command.compare(0, 12, "AT+CIPQSEND=")) {
+			isQuickSend_ = ('1' == command[12]);
+			respond(0, "OK");
+		} else if ("AT+CIPRXGET=0" == command || "AT+CIPRXGET=1" == command) {
+			isRxGet_ = ('1' == command[12]);
+			respond(0, "OK");
+		} else if (0 == command.compare(0, 14, "AT+CIPRXGET=2,")) {
+			if (!isRxGet_) {
+				respond(0, "ERROR");
+				return true;
+			}
+			const char *args = command.c_str() + 14;
+			const int link = linkOf(args);
+			if (link < 0) {
+				respond(0, "ERROR");
+				return true;
+			}
+			std::string &inbound = links_[link].inbound;
+			const size_t length = std::min<size_t>(std::min<size_t>(atoi(args), sendMax), inbound.length());
+			schedule(0, "\r\n+CIPRXGET: 2," + (isLinkMux_ ? std::to_string(link) + "," : std::string()) +
+					 std::to_string(length) + "," + std::to_string(inbound.length() - length) + "\r\n" +
+					 inbound.substr(0, length) + "\r\nOK\r\n");
+			inbound.erase(0, length);
+		} else
+			return false;
+		return true;
+	}
+
+	// SMS in PDU mode (AT+CMGF, AT+CMGS, AT+CMGR, AT+CMGD), false - not one of them
+	bool smsCommand(const std::string &command) {
+		if ("AT+CMGF=0" == command || "AT+CMGF=1" == command) {
+			isPdu_ = ('0' == command[8]);
+			respond(0, "OK");
+		} else if (0 == command.compare(0, 8, "AT+CMGS=")) {
+			const int octets = atoi(command.c_str() + 8);
+			if (!isPdu_ || octets <= 0 || 164 < octets) {
+				respond(0, isPdu_ ? "+CMS ERROR: 304" : "+CMS ERROR: 302");
+				return true;
+			}
+			isSmsInput_ = true;
+			smsChannel_ = channel_;
+			smsOctets_ = static_cast<size_t>(octets);
+			smsData_.clear();
+			schedule(0, "\r\n> ");
+		} else if (0 == command.compare(0, 8, "AT+CMGR=")) {
+			const auto stored = smsStored_.find(atoi(command.c_str() + 8));
+			if (!isPdu_ || smsStored_.end() == stored) {
+				respond(0, isPdu_ ? "+CMS ERROR: 321" : "+CMS ERROR: 302");
+				return true;
+			}
+			respond(0, "+CMGR: 0,," + std::to_string(stored->second.length() / 2 - 1 - hexOctet(stored->second, 0)));
+			respond(0, stored->second);
+			respond(0, "OK");
+		} else if (0 == command.compare(0, 8, "AT+CMGL=")) {
+			// <stat> 4 - all, received ones are read and stored SMS-SUBMIT is sent
+			const int status = atoi(command.c_str() + 8);
+			if (!isPdu_ || status < 0 || 4 < status) {
+				respond(0, "+CMS ERROR: 302");
+				return true;
+			}
+			std::string text;
+			for (const auto &stored : smsStored_) {
+				const size_t smsc = hexOctet(stored.second, 0);
+				const int stat = (1 == (hexOctet(stored.second, 2 + 2 * smsc) & 3)) ? 3 : 1;
+				if (4 != status && stat != status)
+					continue;
+				text += "\r\n+CMGL: " + std::to_string(stored.first) + "," + std::to_string(stat) + ",," +
+						std::to_string(stored.second.length() / 2 - 1 - smsc) + "\r\n" + stored.second;
+			}
+			schedule(0, text + "\r\n\r\nOK\r\n");
+		} else if (0 == command.compare(0, 8, "AT+CMGD=")) {
+			smsStored_.erase(atoi(command.c_str() + 8));
+			respond(0, "OK");
+		} else
+			return false;
+		return true;
+	}
+
+	// HTTP service (AT+SAPBR, AT+HTTP*), false - not one of them; text keeps the URL case
+	bool httpCommand(const std::string &text, const std::string &command) {
+		if ("AT+SAPBR=1,1" == command) {
+			isBearer_ = true;
+			respond(sendMs_, "OK");
+		} else if ("AT+SAPBR=0,1" == command) {
+			isBearer_ = isHttp_ = false;
+			respond(0, "OK");
+		} else if ("AT+SAPBR=2,1" == command) {
+			respond(0, isBearer_ ? "+SAPBR: 1,1,\"10.64.0.3\"" : "+SAPBR: 1,3,\"0.0.0.0\"");
+			respond(0, "OK");
+		} else if ("AT+HTTPINIT" == command || "AT+HTTPTERM" == command) {
+			const bool isInit = ("AT+HTTPINIT" == command);
+			respond(0, (isInit != isHttp_ && (!isInit || isBearer_)) ? "OK" : "ERROR");
+			if (isInit != isHttp_ && (!isInit || isBearer_)) {
+				isHttp_ = isInit;
+				httpUrl_.clear();
+				httpPosted_.clear();
+				httpBody_.clear();
+			}
+		} else if (0 == command.compare(0, 18, "AT+HTTPPARA=\"URL\",")) {
+			const size_t begin = text.find('"', 18);
+			const size_t end = text.rfind('"');
+			httpUrl_ = (std::string::npos != begin && begin < end) ? text.substr(begin + 1, end - begin - 1) : "";
+			respond(0, isHttp_ ? "OK" : "ERROR");
+		} else if (0 == command.compare(0, 12, "AT+HTTPDATA=")) {
+			const long length = atol(command.c_str() + 12);
+			if (!isHttp_ || length <= 0 || 319488 < length) {
+				respond(0, "ERROR");
+				return true;
+			}
+			httpLength_ = static_cast<size_t>(length);
+			httpChannel_ = channel_;
+			httpPosted_.clear();
+			respond(0, "DOWNLOAD");
+		} else if (0 == command.compare(0, 14, "AT+HTTPACTION=")) {
+			const int method = atoi(command.c_str() + 14);
+			if (!isHttp_ || method < 0 || 2 < method) {
+				respond(0, "ERROR");
+				return true;
+			}
+			int status = 200;
+			const size_t slash = httpUrl_.rfind('/');
+			const std::string last = (std::string::npos != slash) ? httpUrl_.substr(slash + 1) : std::string();
+			if (1 == method)
+				httpBody_ = httpPosted_;
+			else if (readFile(httpUrl_, &httpBody_))
+				;
+			else if (!last.empty() && std::all_of(last.begin(), last.end(), ::isdigit)) {
+				httpBody_.resize(std::stoul(last));
+				for (size_t i = 0; i < httpBody_.length(); ++i)
+					httpBody_[i] = (63 == i % 64) ? '\n' : static_cast<char>('a' + i % 26);
+			} else {
+				status = 404;
+				httpBody_.clear();
+			}
+			respond(0, "OK");
+			scheduled_.emplace(Clock::now() + std::chrono::milliseconds(2 * sendMs_),
+							   Output { generation_, "\r\n+HTTPACTION: " + std::to_string(method) + "," +
+										std::to_string(status) + "," + std::to_string(httpBody_.length()) + "\r\n",
+										0, 0, 0, 0, std::string(), 0, false, true });
+		} else if (0 == command.compare(0, 12, "AT+HTTPREAD=")) {
+			const size_t offset = std::min<size_t>(atol(command.c_str() + 12), httpBody_.length());
+			const char *comma = strchr(command.c_str() + 12, ',');
+			const size_t length = std::min<size_t>((nullptr != comma) ? atol(comma + 1) : httpBody_.length(),
+												   httpBody_.length() - offset);
+			if (!isHttp_) {
+				respond(0, "ERROR");
+				return true;
+			}
+			schedule(0, "\r\n+HTTPREAD: " + std::to_string(length) + "\r\n" + httpBody_.substr(offset, length) +
+					 "\r\nOK\r\n");
+		} else if (0 == command.compare(0, 7, "AT+HTTP") && !isHttp_) {
+			respond(0, "ERROR");
+		} else
+			return false;
+		return true;
+	}
+
+	// Escape is `+++' between two guard times without data
+	void dataInput(const uint8_t *data, size_t length) {
+		const Clock::time_point now = Clock::now();
+		const bool isGuarded = now - dataLast_ >= std::chrono::milliseconds(escapeGuardMs);
+		for (size_t i = 0; i < length; ++i) {
+			if ('+' == data[i] && escape_ < 3 && (0 != escape_ || (0 == i && isGuarded)))
+				++escape_;
+			else
+				escape_ = 0;
+		}
+		dataBytes_ += length;
+		dataLast_ = now;
+		if (3 == escape_)
+			scheduleData(escapeGuardMs, "OK", dataChannel_, -2);
+	}
+
+	// AT+CIPSEND data is echoed (ATE1) and acknowledged, returns consumed length
+	size_t sendInput(const uint8_t *data, size_t length) {
+		const size_t consumed = std::min(length, sendLength_);
+		if (isEcho_)
+			schedule(0, std::string(reinterpret_cast<const char *>(data), consumed));
+		sendData_.append(reinterpret_cast<const char *>(data), consumed);
+		sendLength_ -= consumed;
+		dataBytes_ += consumed;
+		if (0 != sendLength_)
+			return consumed;
+
+		if (isQuickSend_) {
+			respond(0, "DATA ACCEPT:" + (isLinkMux_ ? std::to_string(sendLink_) + "," : std::string()) +
+					std::to_string(sendData_.length()));
+		} else
+			respond(sendMs_, linkPrefix(sendLink_) + "SEND OK");
+		release();
+		Link &link = links_[sendLink_];
+		const bool isQuit = !link.isBroker && (0 == sendData_.compare(0, 4, "QUIT"));
+		std::string received = link.isBroker ? broker(link, sendData_) : isQuit ? std::string() : std::move(sendData_);
+		scheduled_.emplace(Clock::now() + std::chrono::milliseconds(sendMs_),
+						   Output { generation_, std::string(), 0, channel_, 0, 0, std::move(received), sendLink_,
+									isQuit });
+		sendData_.clear();
+		cv_.notify_all();
+		return consumed;
+	}
+
+	// MQTT 3.1.1 broker of the link: answers of the complete packets
+	static std::string broker(Link &link, const std::string &data) {
+		link.mqtt += data;
+		std::string answer;
+		while (true) {
+			size_t pos = 1;
+			size_t remaining = 0;
+			unsigned int shift = 0;
+			uint8_t byte = 0x80;
+			while (0 != (byte & 0x80) && pos < link.mqtt.length() && shift < 28) {
+				byte = static_cast<uint8_t>(link.mqtt[pos++]);
+				remaining |= static_cast<size_t>(byte & 0x7F) << shift;
+				shift += 7;
+			}
+			if (0 != (byte & 0x80) || link.mqtt.length() < pos + remaining)
+				break;
+
+			const uint8_t type = static_cast<uint8_t>(link.mqtt[0]);
+			const std::string body = link.mqtt.substr(pos, remaining);
+			link.mqtt.erase(0, pos + remaining);
+			switch (type >> 4) {
+				case 1:		// CONNECT
+					answer += std::string("\x20\x02\x00\x00", 4);
+					break;
+				case 3: {	// PUBLISH
+					const size_t topicLength = (2 <= body.length()) ? mqttWord(body, 0) : 0;
+					const std::string topic = body.substr(2, topicLength);
+					size_t payload = 2 + topicLength;
+					if (0 != (type & 0x06)) {
+						answer += std::string("\x40\x02", 2) + body.substr(payload, 2);
+						payload += 2;
+					}
+					const bool isSubscribed = std::any_of(link.subscriptions.begin(), link.subscriptions.end(),
+						[&topic](const std::string &filter) {
+							return filter == topic || (!filter.empty() && '#' == filter.back() &&
+													   0 == topic.compare(0, filter.length() - 1, filter, 0,
+																		  filter.length() - 1));
+						});
+					if (isSubscribed) {
+						const unsigned int id = 1 + link.mqttId++ % 0xFFFF;
+						const std::string packet = body.substr(0, 2 + topicLength) +
+												   static_cast<char>(id >> 8) + static_cast<char>(id & 0xFF) +
+												   body.substr(std::min(payload, body.length()));
+						answer += '\x32' + mqttLength(packet.length()) + packet;
+					}
+					break;
+				}
+				case 8: {	// SUBSCRIBE, QoS 1 at most
+					std::string codes;
+					for (size_t filter = 2; filter + 2 <= body.length();) {
+						const size_t length = mqttWord(body, filter);
+						link.subscriptions.push_back(body.substr(filter + 2, length));
+						filter += 2 + length;
+						codes += static_cast<char>((filter < body.length() && 0 != body[filter]) ? 1 : 0);
+						++filter;
+					}
+					answer += '\x90' + mqttLength(2 + codes.length()) + body.substr(0, 2) + codes;
+					break;
+				}
+				case 12:	// PINGREQ
+					answer += std::string("\xD0\x00", 2);
+					break;
+				case 14:	// DISCONNECT, the client closes the link (a late close would hit its next connection)
+					link.mqtt.clear();
+					return answer;
+				default:	// PUBACK of a delivered one
+					break;
+			}
+		}
+		return answer;
+	}
+
+	// +CREG/+CGREG: [<n>,]<stat>[,"<lac>","<ci>"] of the query or the URC (mode 2 adds the location)
+	std::string registration(const char *name, int mode, bool isQuery) const {
+		std::string line = std::string(name) + ": ";
+		if (isQuery)
+			line += std::to_string(mode) + ",";
+		line += isCovered_ ? "1" : "0";
+		if (2 == mode && isCovered_)
+			line += std::string(",\"") + cellLac + "\",\"" + cellId + "\"";
+		return line;
+	}
+
+	// Registration and signal reporting (AT+CREG, AT+CGREG, AT+EXUNSOL="SQ"), false - not one of them
+	bool networkCommand(const std::string &command) {
+		for (const auto &[name, mode] : { std::pair<std::string, int *> { "+CREG", &cregMode_ },
+										  std::pair<std::string, int *> { "+CGREG", &cgregMode_ } }) {
+			const std::string rest = command.substr(std::min(command.length(), 2 + name.length()));
+			if (0 != command.compare(2, name.length(), name) || ("?" != rest && '=' != rest[0]))
+				continue;
+			if ("?" == rest) {
+				respond(0, registration(name.c_str(), *mode, true));
+				respond(0, "OK");
+				return true;
+			}
+			if (2 != rest.length() || rest[1] < '0' || '2' < rest[1]) {
+				respond(0, "ERROR");
+				return true;
+			}
+			*mode = rest[1] - '0';
+			respond(0, "OK");
+			return true;
+		}
+
+		if (0 == command.compare(0, 16, "AT+EXUNSOL=\"SQ\",")) {
+			isSignalUrc_ = ('1' == command[16]);
+			respond(0, "OK");
+			return true;
+		}
+		return false;
+	}
+
+	// Registration change URCs, the lost network takes the PDP context and the connections along
+	std::string coverage(bool isCovered) {
+		isCovered_ = isCovered;
+		ESP_LOGI(MODULE, "Coverage %s", isCovered ? "is back" : "lost");
+
+		std::string urcs;
+		if (isSignalUrc_)
+			urcs += "\r\n+CSQN: " + std::string(isCovered ? std::to_string(signalRssi) + ",0" : "0,99") + "\r\n";
+		if (0 != cregMode_)
+			urcs += "\r\n" + registration("+CREG", cregMode_, false) + "\r\n";
+		if (0 != cgregMode_)
+			urcs += "\r\n" + registration("+CGREG", cgregMode_, false) + "\r\n";
+		if (isCovered)
+			return urcs;
+
+		const bool isPdp = isBearer_ || std::any_of(links_, links_ + linkMax, [](const Link &link) {
+			return link.isConnected;
+		});
+		isBearer_ = isHttp_ = false;
+		for (Link &link : links_)
+			link = Link();
+		return (isPdp ? "\r\n+PDP: DEACT\r\n" : "") + urcs;
+	}
+
+	// Outputs held during the data entry go now
+	void release() {
+		for (Output &out : held_)
+			scheduled_.emplace(Clock::now(), std::move(out));
+		held_.clear();
+	}
+
+	// AT+CMGS PDU is echoed (ATE1) up to Ctrl-Z, the network delivers it back to the sender, returns consumed length
+	size_t smsInput(const uint8_t *data, size_t length) {
+		const uint8_t *end = static_cast<const uint8_t *>(memchr(data, smsEnd, length));
+		const uint8_t *cancel = static_cast<const uint8_t *>(memchr(data, smsCancel, length));
+		if (nullptr != cancel && (nullptr == end || cancel < end))
+			end = cancel;
+		const size_t consumed = (nullptr != end) ? end - data + 1 : length;
+		if (isEcho_)
+			schedule(0, std::string(reinterpret_cast<const char *>(data), consumed));
+		if (nullptr == end) {
+			smsData_.append(reinterpret_cast<const char *>(data), consumed);
+			return consumed;
+		}
+
+		isSmsInput_ = false;
+		smsData_.append(reinterpret_cast<const char *>(data), consumed - 1);
+		if (smsCancel == *end) {
+			respond(0, "OK");
+			release();
+			return consumed;
+		}
+
+		const std::string deliver = smsDeliver(upper(smsData_), smsOctets_);
+		if (deliver.empty()) {
+			respond(0, "+CMS ERROR: 304");
+			release();
+			return consumed;
+		}
+		smsReference_ = (smsReference_ + 1) % 256;
+		respond(sendMs_, "+CMGS: " + std::to_string(smsReference_));
+		respond(sendMs_, "OK");
+		release();
+
+		int index = 1;
+		while (index <= smsMax && 0 != smsStored_.count(index))
+			++index;
+		if (index <= smsMax) {
+			smsStored_[index] = deliver;
+			scheduled_.emplace(Clock::now() + std::chrono::milliseconds(2 * sendMs_),
+							   Output { generation_, "\r\n+CMTI: \"SM\"," + std::to_string(index) + "\r\n", 0, 0, 0, 0,
+										std::string(), 0, false, true });
+		}
+		cv_.notify_all();
+		return consumed;
+	}
+
+	void lineInput(std::string &line, const uint8_t *data, size_t length) {
+		for (size_t i = 0; i < length; ++i) {
+			if (0 != sendLength_ && sendChannel_ == channel_) {
+				i += sendInput(data + i, length - i) - 1;
+				continue;
+			}
+			if (0 != httpLength_ && httpChannel_ == channel_) {
+				const size_t consumed = std::min(length - i, httpLength_);
+				httpPosted_.append(reinterpret_cast<const char *>(data + i), consumed);
+				httpLength_ -= consumed;
+				i += consumed - 1;
+				if (0 == httpLength_) {
+					respond(0, "OK");
+					release();
+				}
+				continue;
+			}
+			if (isSmsInput_ && smsChannel_ == channel_) {
+				i += smsInput(data + i, length - i) - 1;
+				continue;
+			}
+
+			const char c = static_cast<char>(data[i]);
+			if ('\r' == c) {
+				const std::string text = trim(line);
+				line.clear();
+				if (!text.empty())
+					command(text);
+			} else if ('\n' != c)
+				line.push_back(c);
+		}
+	}
+
+	void muxControl(const std::string &message) {
+		if (message.length() < 2 || 0 == (message[0] & muxCr))
+			return;
+		const uint8_t type = message[0] & ~muxCr;
+		std::string response = message;
+		response[0] = static_cast<char>(type);
+		scheduleFrame(muxFrame(0, muxUih, false, response), (muxCld == type) ? -1 : 0);
+		if (muxMsc != type && muxCld != type)
+			ESP_LOGD(MODULE, "Mux message %02x", type);
+	}
+
+	void muxReceived(uint8_t address, uint8_t control, const std::string &data) {
+		const int dlci = address >> 2;
+		if (dlci >= muxChannels)
+			return;
+
+		switch (control & ~muxPf) {
+			case muxSabm:
+				scheduleFrame(muxFrame(dlci, muxUa | muxPf, true));
+				break;
+			case muxDisc:
+				scheduleFrame(muxFrame(dlci, muxUa | muxPf, true), (0 == dlci) ? -1 : 0);
+				muxLines_[dlci].clear();
+				break;
+			case muxUih:
+				if (0 == dlci)
+					muxControl(data);
+				else if (dlci == dataChannel_)
+					dataInput(reinterpret_cast<const uint8_t *>(data.data()), data.length());
+				else {
+					channel_ = dlci;
+					lineInput(muxLines_[dlci], reinterpret_cast<const uint8_t *>(data.data()), data.length());
+					channel_ = 0;
+				}
+				break;
+			default:
+				break;
+		}
+	}
+
+	// Frames are found by the length field, flags between them are skipped
+	void muxInput(const uint8_t *data, size_t length) {
+		for (size_t i = 0; i < length; ++i) {
+			if (muxRx_.empty() && muxFlag == data[i])
+				continue;
+			muxRx_.push_back(static_cast<char>(data[i]));
+			if (muxRx_.length() < 3)
+				continue;
+
+			const uint8_t *frame = reinterpret_cast<const uint8_t *>(muxRx_.data());
+			const size_t header = (0 != (frame[2] & 1)) ? 3 : 4;
+			if (muxRx_.length() < header)
+				continue;
+			const size_t dataLength = (3 == header) ? (frame[2] >> 1) : ((frame[2] >> 1) | (frame[3] << 7));
+			if (muxRx_.length() < header + dataLength + 1)
+				continue;
+
+			// FCS covers the header only
+			uint8_t check[5];
+			std::copy_n(frame, header, check);
+			check[header] = frame[header + dataLength];
+			if (0xCF != muxFcs(check, header + 1))
+				ESP_LOGW(MODULE, "Mux FCS error");
+			else
+				muxReceived(frame[0], frame[1], muxRx_.substr(header, dataLength));
+			muxRx_.clear();
+		}
+	}
+
+	void onReceive(const uint8_t *data, size_t length) {
+		std::lock_guard<std::mutex> guard(lock_);
+		if (!isBooted_)
+			return;
+
+		if (isMismatch()) {
+			line_.clear();
+			muxRx_.clear();
+			return;
+		}
+
+		if (isMux_)
+			muxInput(data, length);
+		else if (0 == dataChannel_)
+			dataInput(data, length);
+		else
+			lineInput(line_, data, length);
+	}
+
+	void run() {
+		std::unique_lock<std::mutex> lock(lock_);
+		while (true) {
+			if (scheduled_.empty())
+				cv_.wait(lock);
+			else
+				cv_.wait_until(lock, scheduled_.begin()->first);
+
+			const Clock::time_point now = Clock::now();
+			while (!scheduled_.empty() && scheduled_.begin()->first <= now) {
+				Output out = std::move(scheduled_.begin()->second);
+				scheduled_.erase(scheduled_.begin());
+				if ((!out.received.empty() || out.isClose || out.isUrc) && (0 != sendLength_ || isSmsInput_ || 0 != httpLength_)) {
+					held_.push_back(std::move(out));
+					continue;
+				}
+				if (out.generation != generation_ || (-2 == out.data && 3 != escape_))
+					continue;
+
+				if (!isBooted_ && std::string::npos != out.text.find("RDY"))
+					isBooted_ = true;
+				if (0 != out.coverage)
+					out.text = coverage(0 < out.coverage);
+				Link &link = links_[out.link];
+				if (out.isClose && link.isConnected) {
+					out.text = "\r\n" + linkPrefix(out.link) + "CLOSED\r\n";
+					link = Link();
+				}
+				if (!out.received.empty() && link.isConnected) {
+					// pulled data is announced when the buffer gets it, pushed goes as is (+RECEIVE header of links)
+					if (isRxGet_) {
+						if (link.inbound.empty()) {
+							const std::string id = isLinkMux_ ? "," + std::to_string(out.link) : std::string();
+							out.text = "\r\n+CIPRXGET: 1" + id + "\r\n";
+						}
+						link.inbound += out.received;
+					} else if (isLinkMux_) {
+						out.text = "\r\n+RECEIVE," + std::to_string(out.link) + "," +
+								   std::to_string(out.received.length()) + ":\r\n" + out.received;
+					} else
+						out.text = out.received;
+				}
+				if (isMux_ && 0 <= out.channel) {
+					std::string frames;
+					for (size_t pos = 0; pos < out.text.length(); pos += muxFrameMax)
+						frames += muxFrame((0 != out.channel) ? out.channel : 1, muxUih, false,
+										   out.text.substr(pos, muxFrameMax));
+					out.text = frames;
+				}
+				if (isGarbled()) {
+					for (char &c : out.text)
+						c ^= 0x55;
+				}
+				toDte_.send(out.text.data(), out.text.length());
+
+				if (0 < out.data) {
+					dataChannel_ = out.channel;
+					dataLast_ = Clock::now();
+					escape_ = 0;
+					dataBytes_ = 0;
+					ESP_LOGI(MODULE, "Data mode on %s %d", isMux_ ? "DLCI" : "UART", dataChannel_);
+				} else if (0 > out.data && 0 <= dataChannel_) {
+					ESP_LOGI(MODULE, "Data mode off, %llu bytes", static_cast<unsigned long long>(dataBytes_));
+					dataChannel_ = -1;
+					escape_ = 0;
+				}
+
+				if (0 != out.mux) {
+					isMux_ = (0 < out.mux);
+					dataChannel_ = -1;
+					muxRx_.clear();
+					for (std::string &line : muxLines_)
+						line.clear();
+					ESP_LOGI(MODULE, "Multiplexer %s", isMux_ ? "on" : "off");
+				}
+
+				if (0 != out.baudRate) {
+					baudRate_ = std::max(0, out.baudRate);
+					ESP_LOGI(MODULE, "Rate %d", baudRate_);
+				}
+			}
+		}
+	}
+
+public:
+	// isIdle of the DTE to modem wire is ignored by bind
+	explicit Modem(EmulatorOutput output) : toDte_(57600, output),
+		toModem_(57600, std::bind(&Modem::onReceive, this, std::placeholders::_1, std::placeholders::_2)) {
+		std::thread(&Modem::run, this).detach();
+	}
+
+	bool load(const char *script) {
+		FILE *f = fopen(script, "r");
+		if (nullptr == f) {
+			ESP_LOGE(MODULE, "Script `%s' open error %s", script, strerror(errno));
+			return false;
+		}
+
+		std::lock_guard<std::mutex> guard(lock_);
+		unsolicited_.clear();
+		outages_.clear();
+
+		char buffer[2048];
+		for (unsigned int number = 1; nullptr != fgets(buffer, sizeof(buffer), f); ++number) {
+			const std::string line = trim(buffer);
+			if (line.empty() || '#' == line[0])
+				continue;
+
+			const size_t space = line.find_first_of(" \t");
+			const std::string keyword = line.substr(0, space);
+			const std::string args = (std::string::npos != space) ? trim(line.substr(space)) : std::string();
+
+			if ("boot" == keyword)
+				bootMs_ = std::stoul(args);
+			else if ("baud" == keyword)
+				baudRate_ = std::stoi(args);
+			else if ("link" == keyword)
+				linkMax_ = std::stoi(args);
+			else if ("send" == keyword)
+				sendMs_ = std::stoul(args);
+			else if ("echo" == keyword)
+				echoDefault_ = ("on" == args);
+			else if ("default" == keyword)
+				default_ = args;
+			else if ("outage" == keyword) {
+				size_t pos = 0;
+				const unsigned int delayMs = std::stoul(args, &pos);
+				outages_.push_back(Outage { delayMs, static_cast<unsigned int>(std::stoul(args.substr(pos))) });
+			} else if ("urc" == keyword) {
+				size_t pos = 0;
+				const unsigned int delayMs = std::stoul(args, &pos);
+				unsolicited_.push_back(Unsolicited { delayMs, trim(args.substr(pos)) });
+			} else if ("sms" == keyword) {
+				int index = 1;
+				while (0 != smsStored_.count(index))
+					++index;
+				smsStored_[index] = upper(args);
+			} else if ("cmd" == keyword && std::string::npos != args.find('=')) {
+				const size_t equal = args.find(" = ");
+				if (std::string::npos == equal) {
+					ESP_LOGW(MODULE, "%s:%u `cmd <prefix> [@<ms>] = <lines>' expected", script, number);
+					continue;
+				}
+
+				Rule rule { std::string(), 0, {} };
+				const std::string head = trim(args.substr(0, equal));
+				const size_t at = head.find(" @");
+				rule.prefix = upper(trim(head.substr(0, at)));
+				if (std::string::npos != at)
+					rule.delayMs = std::stoul(head.substr(at + 2));
+
+				const std::string body = args.substr(equal + 3);
+				for (size_t begin = 0; begin <= body.length();) {
+					size_t end = body.find('|', begin);
+					if (std::string::npos == end)
+						end = body.length();
+					const std::string text = trim(body.substr(begin, end - begin));
+					if (!text.empty())
+						rule.lines.push_back(text);
+					begin = end + 1;
+				}
+				rules_.push_back(std::move(rule));
+			} else
+				ESP_LOGW(MODULE, "%s:%u unknown `%s'", script, number, keyword.c_str());
+		}
+		fclose(f);
+
+		if (unsolicited_.empty())
+			defaults();
+		return true;
+	}
+
+	void defaults() {
+		unsolicited_ = {
+			{ 200, "+CFUN: 1" },
+			{ 400, "+CPIN: READY" },
+			{ 2000, "Call Ready" },
+			{ 2500, "SMS Ready" },
+		};
+	}
+
+	void gpio(int pin, bool level) {
+		std::lock_guard<std::mutex> guard(lock_);
+		const bool wasOn = isPowered_ && !isReset_;
+
+		if (CONFIG_SIM800_POWER_GPIO == pin)
+			isPowered_ = level;
+		else if (CONFIG_SIM800_RESET_GPIO == pin)
+			isReset_ = !level;
+		else if (CONFIG_SIM800_POWERKEY_GPIO == pin) {
+			if (!level && !isKeyDown_) {
+				isKeyDown_ = true;
+				keyDown_ = Clock::now();
+			} else if (level && isKeyDown_) {
+				isKeyDown_ = false;
+				const auto pressed = std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - keyDown_);
+				if (wasOn && pressed.count() >= powerKeyMinMs) {
+					if (isBooted_) {
+						respond(0, "NORMAL POWER DOWN");
+						isBooted_ = false;
+					} else
+						boot();
+				}
+			}
+			return;
+		}
+
+		if (wasOn && !(isPowered_ && !isReset_))
+			powerOff();
+	}
+
+	void baud(int baudRate) {
+		{
+			std::lock_guard<std::mutex> guard(lock_);
+			dteBaudRate_ = baudRate;
+		}
+		toDte_.baud(baudRate);
+		toModem_.baud(baudRate);
+	}
+
+	void write(const void *data, size_t length) {
+		toModem_.send(data, length);
+	}
+
+	bool drain(TickType_t wait) {
+		return toModem_.drain(wait);
+	}
+};
+
+Modem *modem = nullptr;
+
+} // namespace
+
+esp_err_t emulatorInit(const char *script, EmulatorOutput output) noexcept {
+	if (nullptr == output || nullptr != modem)
+		return ESP_ERR_INVALID_STATE;
+
+	modem = new Modem(output);
+	if (nullptr == script)
+		modem->defaults();
+	else if (!modem->load(script))
+		return ESP_ERR_NOT_FOUND;
+	return ESP_OK;
+}
+
+void emulatorGpio(int pin, bool level) noexcept {
+	if (nullptr != modem)
+		modem->gpio(pin, level);
+}
+
+void emulatorBaud(int baudRate) noexcept {
+	if (nullptr != modem && 0 < baudRate)
+		modem->baud(baudRate);
+}
+
+size_t emulatorWrite(const void *data, size_t length) noexcept {
+	if (nullptr == modem)
+		return 0;
+	modem->write(data, length);
+	return length;
+}
+
+bool emulatorWaitTx(TickType_t wait) noexcept {
+	return (nullptr != modem) ? modem->drain(wait) : false;
+}
@@ -0,0 +1,71 @@
+// vim: tabstop=4 shiftwidth=4 noexpandtab colorcolumn=120 :
+// This file is part of the Sim800 (https://github.com/beranat/sim800).
+// Copyright (c) 2021 Anatoly L. Berenblit.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 3.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <freertos/FreeRTOS.h>
+#include <esp_err.h>
+
+// Scriptable SIM800 on the far end of the host HAL UART (in-process, both directions paced at the baud rate).
+// Rate mismatch of the host and the modem (AT+IPR) corrupts data in both directions.
+// AT+CMUX=0 switches to GSM 07.10 basic option: SABM/DISC/UIH on DLCI 0..3, commands are answered on their DLCI,
+// URCs go to DLCI 1, close down (CLD) or DISC of DLCI 0 returns to AT mode.
+// ATD*... answers CONNECT and the UART (DLCI) carries data till `+++' (1 s guard times) or ATH on another DLCI,
+// data is counted and dropped. AT+CIPSTART connects to an echo server: AT+CIPSEND=<n> prompts `> ', takes n bytes,
+// answers SEND OK (DATA ACCEPT with AT+CIPQSEND=1) and the data comes back a round trip later, announced by
+// +CIPRXGET: 1 and read with AT+CIPRXGET=2 when AT+CIPRXGET=1. Data starting with QUIT makes the server close.
+// AT+CIPMUX=1 gives 6 such connections, commands take the link number first and results are `<link>, CONNECT OK',
+// DATA ACCEPT:<link>,<n>, +CIPRXGET: 1,<link>, pushed data is +RECEIVE,<link>,<n>:.
+// Connections to port 1883 go to an MQTT 3.1.1 broker instead: CONNACK, PUBACK, SUBACK (QoS 1 at most), PINGRESP a
+// round trip later, publishes to a subscribed topic (exact or `prefix/#') come back at QoS 1.
+// AT+CMGS=<n> (PDU mode, AT+CMGF=0) prompts `> ' and takes the PDU hex till Ctrl-Z (ESC cancels), answers +CMGS: <mr>
+// a round trip later and the network delivers the message back: it is stored on the SIM (+CMTI: "SM",<index>) as
+// SMS-DELIVER from the same address, read by AT+CMGR=<index>, listed by AT+CMGL=<stat> and deleted by
+// AT+CMGD=<index>.
+// AT+HTTPINIT needs the bearer (AT+SAPBR=1,1), AT+HTTPDATA=<n>,<ms> answers DOWNLOAD and takes n bytes, AT+HTTPACTION
+// is followed by +HTTPACTION: <method>,<status>,<length> a round trip later: POST gets its body back, GET of a URL
+// ending in /<n> gets n bytes of text, other ones 404. AT+HTTPREAD=<offset>,<size> reads the body. With SIM800_FILES
+// in the environment GET serves the files of that directory first (URL path, e.g. http://any.host/firmware.bin).
+//
+// Script (see host/scripts/sim800.at):
+//   boot <ms>                           power key release to RDY
+//   echo on|off                         initial ATE state
+//   baud <rate>                         initial AT+IPR, 0 - autobaud (default)
+//   link <rate>                         fastest reliable rate, modem output is corrupted above
+//   urc <ms> <line>                     unsolicited line <ms> after RDY, default +CFUN/+CPIN/Call Ready/SMS Ready
+//   cmd <prefix> [@<ms>] = <line>|...   response of commands starting with prefix (longest wins), after <ms>
+//   send <ms>                           network round trip: CIPSTART to CONNECT OK, CIPSEND data to SEND OK/echo, SMS, HTTP
+//   default <line>                      final result of unknown commands (OK)
+//   sms <pdu>                           message stored on the SIM (hex with SMSC, SMS-DELIVER or SMS-SUBMIT)
+//   outage <ms> <duration ms>           network is lost <ms> after RDY: +PDP: DEACT (connections are gone),
+//                                       +CREG: 0, AT+CIICR/AT+SAPBR=1,1 fail, CIPSTART is CONNECT FAIL;
+//                                       +CREG: 1 when it is back
+// AT+CREG=<n>/AT+CGREG=<n> enable the registration URCs of the outage (n=2 with the location), AT+CREG?/AT+CGREG?
+// answer the current state, AT+EXUNSOL="SQ",1 adds +CSQN: <rssi>,<ber> and AT+CSQ is 0,99 during the outage.
+
+// Modem to DTE bytes, isIdle - nothing more is queued on the wire (RX timeout)
+typedef void (*EmulatorOutput)(const uint8_t *data, size_t length, bool isIdle);
+
+esp_err_t emulatorInit(const char *script, EmulatorOutput output) noexcept;
+
+void emulatorGpio(int pin, bool level) noexcept;
+void emulatorBaud(int baudRate) noexcept;
+
+// DTE to modem
+size_t emulatorWrite(const void *data, size_t length) noexcept;
+bool emulatorWaitTx(TickType_t wait) noexcept;
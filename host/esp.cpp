@@ -0,0 +1,208 @@
+// vim: tabstop=4 shiftwidth=4 noexpandtab colorcolumn=120 :
+// This file is part of the Sim800 (https://github.com/beranat/sim800).
+// Copyright (c) 2021 Anatoly L. Berenblit.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 3.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <string>
+
+#include <poll.h>
+#include <unistd.h>
+
+#include <esp_crc.h>
+#include <esp_err.h>
+#include <esp_log.h>
+#include <esp_ota_ops.h>
+#include <esp_system.h>
+#include <esp_sleep.h>
+#include <esp_timer.h>
+#include <esp_vfs_dev.h>
+#include <driver/uart.h>
+
+// ESP-IDF system services of the host build: error names, log, timer, CRC, restart
+
+namespace {
+
+const std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+
+std::mutex logLock;
+esp_log_level_t logLevel = ESP_LOG_INFO;
+std::map<std::string, esp_log_level_t> logLevels;
+
+uint32_t consoleBaudRate = 115200;
+
+} // namespace
+
+const char *esp_err_to_name(esp_err_t code) {
+	switch (code) {
+		case ESP_OK:
+			return "ESP_OK";
+		case ESP_FAIL:
+			return "ESP_FAIL";
+		case ESP_ERR_NO_MEM:
+			return "ESP_ERR_NO_MEM";
+		case ESP_ERR_INVALID_ARG:
+			return "ESP_ERR_INVALID_ARG";
+		case ESP_ERR_INVALID_STATE:
+			return "ESP_ERR_INVALID_STATE";
+		case ESP_ERR_INVALID_SIZE:
+			return "ESP_ERR_INVALID_SIZE";
+		case ESP_ERR_NOT_FOUND:
+			return "ESP_ERR_NOT_FOUND";
+		case ESP_ERR_NOT_SUPPORTED:
+			return "ESP_ERR_NOT_SUPPORTED";
+		case ESP_ERR_TIMEOUT:
+			return "ESP_ERR_TIMEOUT";
+		case ESP_ERR_INVALID_RESPONSE:
+			return "ESP_ERR_INVALID_RESPONSE";
+		case ESP_ERR_INVALID_CRC:
+			return "ESP_ERR_INVALID_CRC";
+		case ESP_ERR_INVALID_VERSION:
+			return "ESP_ERR_INVALID_VERSION";
+		case ESP_ERR_OTA_PARTITION_CONFLICT:
+			return "ESP_ERR_OTA_PARTITION_CONFLICT";
+		case ESP_ERR_OTA_SELECT_INFO_INVALID:
+			return "ESP_ERR_OTA_SELECT_INFO_INVALID";
+		case ESP_ERR_OTA_VALIDATE_FAILED:
+			return "ESP_ERR_OTA_VALIDATE_FAILED";
+		case ESP_ERR_NVS_NOT_INITIALIZED:
+			return "ESP_ERR_NVS_NOT_INITIALIZED";
+		case ESP_ERR_NVS_NOT_FOUND:
+			return "ESP_ERR_NVS_NOT_FOUND";
+		case ESP_ERR_NVS_TYPE_MISMATCH:
+			return "ESP_ERR_NVS_TYPE_MISMATCH";
+		case ESP_ERR_NVS_INVALID_HANDLE:
+			return "ESP_ERR_NVS_INVALID_HANDLE";
+		case ESP_ERR_NVS_INVALID_LENGTH:
+			return "ESP_ERR_NVS_INVALID_LENGTH";
+		case ESP_ERR_NVS_NO_FREE_PAGES:
+			return "ESP_ERR_NVS_NO_FREE_PAGES";
+		default:
+			return "UNKNOWN ERROR";
+	}
+}
+
+void esp_log_level_set(const char *tag, esp_log_level_t level) {
+	std::lock_guard<std::mutex> guard(logLock);
+	if (0 == strcmp(tag, "*")) {
+		logLevel = level;
+		logLevels.clear();
+	} else
+		logLevels[tag] = level;
+}
+
+void esp_log_write(esp_log_level_t level, const char *tag, const char *format, ...) {
+	static constexpr char letters[] = "NEWIDV";
+
+	std::lock_guard<std::mutex> guard(logLock);
+	const auto i = logLevels.find(tag);
+	if (level > ((logLevels.end() != i) ? i->second : logLevel))
+		return;
+
+	fprintf(stderr, "%c (%u) %s: ", letters[level], static_cast<unsigned>(esp_timer_get_time() / 1000), tag);
+	va_list args;
+	va_start(args, format);
+	vfprintf(stderr, format, args);
+	va_end(args);
+	fputc('\n', stderr);
+}
+
+int64_t esp_timer_get_time(void) {
+	return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - started).count();
+}
+
+uint32_t esp_crc32_le(uint32_t crc, uint8_t const *buf, uint32_t len) {
+	crc = ~crc;
+	for (uint32_t i = 0; i < len; ++i) {
+		crc ^= buf[i];
+		for (unsigned int bit = 0; bit < 8; ++bit)
+			crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+	}
+	return ~crc;
+}
+
+esp_reset_reason_t esp_reset_reason(void) {
+	return ESP_RST_POWERON;
+}
+
+esp_err_t esp_register_shutdown_handler(shutdown_handler_t handler) {
+	return (0 == atexit(handler)) ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+void esp_restart(void) {
+	fflush(stdout);
+	exit(EXIT_SUCCESS);
+}
+
+esp_err_t esp_sleep_enable_timer_wakeup(uint64_t) {
+	return ESP_OK;
+}
+
+void esp_deep_sleep_start(void) {
+	fflush(stdout);
+	exit(EXIT_FAILURE);
+}
+
+// Console goes to stdin/stdout
+esp_err_t uart_driver_install(uart_port_t, int, int, int, QueueHandle_t *, int) {
+	return ESP_OK;
+}
+
+esp_err_t uart_param_config(uart_port_t, const uart_config_t *config) {
+	consoleBaudRate = config->baud_rate;
+	return ESP_OK;
+}
+
+esp_err_t uart_set_baudrate(uart_port_t, uint32_t baudRate) {
+	consoleBaudRate = baudRate;
+	return ESP_OK;
+}
+
+esp_err_t uart_get_baudrate(uart_port_t, uint32_t *baudRate) {
+	*baudRate = consoleBaudRate;
+	return ESP_OK;
+}
+
+int uart_read_bytes(uart_port_t, void *buffer, uint32_t length, TickType_t wait) {
+	pollfd fd = {STDIN_FILENO, POLLIN, 0};
+	const int ready = poll(&fd, 1, static_cast<int>(wait * portTICK_PERIOD_MS));
+	if (ready <= 0)
+		return (ready < 0) ? -1 : 0;
+	const ssize_t received = read(STDIN_FILENO, buffer, length);
+	return (received > 0) ? static_cast<int>(received) : -1;
+}
+
+int uart_write_bytes(uart_port_t, const void *data, size_t length) {
+	fflush(stdout);
+	return static_cast<int>(write(STDOUT_FILENO, data, length));
+}
+
+esp_err_t uart_wait_tx_done(uart_port_t, TickType_t) {
+	fflush(stdout);
+	return ESP_OK;
+}
+
+void esp_vfs_dev_uart_port_set_rx_line_endings(int, esp_line_endings_t) {
+}
+
+void esp_vfs_dev_uart_port_set_tx_line_endings(int, esp_line_endings_t) {
+}
+
+void esp_vfs_dev_uart_use_driver(int) {
+}
@@ -0,0 +1,427 @@
+// vim: tabstop=4 shiftwidth=4 noexpandtab colorcolumn=120 :
+// This file is part of the Sim800 (https://github.com/beranat/sim800).
+// Copyright (c) 2021 Anatoly L. Berenblit.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 3.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <list>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
+#include <freertos/timers.h>
+
+// FreeRTOS API subset on POSIX threads, enough for the modem layer. Priorities are ignored.
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+const Clock::time_point started = Clock::now();
+
+Clock::time_point deadline(TickType_t wait) noexcept {
+	return (portMAX_DELAY == wait) ? Clock::time_point::max() : Clock::now() + std::chrono::milliseconds(wait);
+}
+
+template <class Predicate> bool waitFor(std::condition_variable &cv, std::unique_lock<std::mutex> &lock,
+										TickType_t wait, Predicate predicate) {
+	if (portMAX_DELAY == wait) {
+		cv.wait(lock, predicate);
+		return true;
+	}
+	return cv.wait_until(lock, deadline(wait), predicate);
+}
+
+std::recursive_mutex critical;
+
+} // namespace
+
+struct tskTaskControlBlock {
+	std::mutex lock;
+	std::condition_variable cv;
+	uint32_t value = 0;
+	bool isPending = false;
+};
+
+static thread_local tskTaskControlBlock *currentTask = nullptr;
+
+void vPortEnterCritical(portMUX_TYPE *) {
+	critical.lock();
+}
+
+void vPortExitCritical(portMUX_TYPE *) {
+	critical.unlock();
+}
+
+TickType_t xTaskGetTickCount(void) {
+	return static_cast<TickType_t>(std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() -
+								   started).count());
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void) {
+	// tasks are never deleted in the host build, main thread gets its block on demand
+	if (nullptr == currentTask)
+		currentTask = new tskTaskControlBlock;
+	return currentTask;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t code, const char *, uint32_t, void *parameters, UBaseType_t,
+					   TaskHandle_t *handle) {
+	tskTaskControlBlock *task = new tskTaskControlBlock;
+	if (nullptr != handle)
+		*handle = task;
+
+	std::thread([code, parameters, task]() {
+		currentTask = task;
+		code(parameters);
+	}).detach();
+	return pdPASS;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t code, const char *name, uint32_t stack, void *parameters,
+								   UBaseType_t priority, TaskHandle_t *handle, BaseType_t) {
+	return xTaskCreate(code, name, stack, parameters, priority, handle);
+}
+
+void vTaskDelete(TaskHandle_t handle) {
+	if (nullptr == handle || handle == currentTask) {
+		// thread exits, its control block stays valid for notifiers
+		while (true)
+			std::this_thread::sleep_for(std::chrono::hours(24));
+	}
+}
+
+void vTaskDelay(TickType_t ticks) {
+	std::this_thread::sleep_for(std::chrono::milliseconds(ticks));
+}
+
+void vTaskDelayUntil(TickType_t *previous, TickType_t increment) {
+	*previous += increment;
+	const TickType_t now = xTaskGetTickCount();
+	if (static_cast<int32_t>(*previous - now) > 0)
+		vTaskDelay(*previous - now);
+}
+
+BaseType_t xTaskNotify(TaskHandle_t task, uint32_t value, eNotifyAction action) {
+	std::lock_guard<std::mutex> guard(task->lock);
+	switch (action) {
+		case eNoAction:
+			break;
+		case eSetBits:
+			task->value |= value;
+			break;
+		case eIncrement:
+			++task->value;
+			break;
+		case eSetValueWithOverwrite:
+			task->value = value;
+			break;
+		case eSetValueWithoutOverwrite:
+			if (task->isPending)
+				return pdFAIL;
+			task->value = value;
+			break;
+	}
+	task->isPending = true;
+	task->cv.notify_all();
+	return pdPASS;
+}
+
+BaseType_t xTaskNotifyWait(uint32_t clearOnEntry, uint32_t clearOnExit, uint32_t *value, TickType_t wait) {
+	tskTaskControlBlock *task = xTaskGetCurrentTaskHandle();
+	std::unique_lock<std::mutex> lock(task->lock);
+	if (!task->isPending)
+		task->value &= ~clearOnEntry;
+
+	const auto isReady = [task]() {
+		return task->isPending;
+	};
+	if (!waitFor(task->cv, lock, wait, isReady))
+		return pdFALSE;
+
+	if (nullptr != value)
+		*value = task->value;
+	task->value &= ~clearOnExit;
+	task->isPending = false;
+	return pdTRUE;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clearOnExit, TickType_t wait) {
+	tskTaskControlBlock *task = xTaskGetCurrentTaskHandle();
+	std::unique_lock<std::mutex> lock(task->lock);
+	const auto isReady = [task]() {
+		return 0 != task->value;
+	};
+	if (!waitFor(task->cv, lock, wait, isReady))
+		return 0;
+
+	const uint32_t value = task->value;
+	task->value = (pdFALSE != clearOnExit) ? 0 : value - 1;
+	task->isPending = (0 != task->value);
+	return value;
+}
+
+// Queues and semaphores (semaphore is a queue of zero sized items)
+struct QueueDefinition {
+	std::mutex lock;
+	std::condition_variable cv;
+	std::vector<uint8_t> data;
+	size_t itemSize;
+	size_t length;
+	size_t head = 0;
+	size_t count = 0;
+
+	QueueDefinition(size_t l, size_t size) : data(l * size), itemSize(size), length(l) {
+	}
+};
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t itemSize) {
+	return new QueueDefinition(length, itemSize);
+}
+
+void vQueueDelete(QueueHandle_t queue) {
+	delete queue;
+}
+
+static BaseType_t queueSend(QueueHandle_t queue, const void *item, TickType_t wait, bool isFront) {
+	std::unique_lock<std::mutex> lock(queue->lock);
+	const auto isReady = [queue]() {
+		return queue->count < queue->length;
+	};
+	if (!waitFor(queue->cv, lock, wait, isReady))
+		return pdFALSE;
+
+	size_t index;
+	if (isFront) {
+		queue->head = (queue->head + queue->length - 1) % queue->length;
+		index = queue->head;
+	} else
+		index = (queue->head + queue->count) % queue->length;
+
+	if (0 != queue->itemSize)
+		memcpy(queue->data.data() + index * queue->itemSize, item, queue->itemSize);
+	++queue->count;
+	queue->cv.notify_all();
+	return pdTRUE;
+}
+
+static BaseType_t queueReceive(QueueHandle_t queue, void *item, TickType_t wait, bool isPeek) {
+	std::unique_lock<std::mutex> lock(queue->lock);
+	const auto isReady = [queue]() {
+		return 0 != queue->count;
+	};
+	if (!waitFor(queue->cv, lock, wait, isReady))
+		return pdFALSE;
+
+	if (0 != queue->itemSize)
+		memcpy(item, queue->data.data() + queue->head * queue->itemSize, queue->itemSize);
+	if (!isPeek) {
+		queue->head = (queue->head + 1) % queue->length;
+		--queue->count;
+		queue->cv.notify_all();
+	}
+	return pdTRUE;
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t wait) {
+	return queueSend(queue, item, wait, false);
+}
+
+BaseType_t xQueueSendToFront(QueueHandle_t queue, const void *item, TickType_t wait) {
+	return queueSend(queue, item, wait, true);
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t wait) {
+	return queueReceive(queue, item, wait, false);
+}
+
+BaseType_t xQueuePeek(QueueHandle_t queue, void *item, TickType_t wait) {
+	return queueReceive(queue, item, wait, true);
+}
+
+BaseType_t xQueueReset(QueueHandle_t queue) {
+	std::lock_guard<std::mutex> guard(queue->lock);
+	queue->head = queue->count = 0;
+	queue->cv.notify_all();
+	return pdPASS;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue) {
+	std::lock_guard<std::mutex> guard(queue->lock);
+	return queue->count;
+}
+
+UBaseType_t uxQueueSpacesAvailable(QueueHandle_t queue) {
+	std::lock_guard<std::mutex> guard(queue->lock);
+	return queue->length - queue->count;
+}
+
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t maxCount, UBaseType_t initialCount) {
+	QueueHandle_t queue = xQueueCreate(maxCount, 0);
+	queue->count = initialCount;
+	return queue;
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void) {
+	return xSemaphoreCreateCounting(1, 0);
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void) {
+	return xSemaphoreCreateCounting(1, 1);
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t wait) {
+	return xQueueReceive(semaphore, nullptr, wait);
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore) {
+	return xQueueSend(semaphore, nullptr, 0);
+}
+
+// Software timers, callbacks run on one service thread like the FreeRTOS timer task
+struct tmrTimerControl {
+	TimerCallbackFunction_t callback;
+	void *id;
+	TickType_t period;
+	bool isAutoReload;
+	bool isActive = false;
+	Clock::time_point expiry;
+};
+
+namespace {
+
+class TimerService final {
+	std::mutex lock_;
+	std::condition_variable cv_;
+	std::list<tmrTimerControl *> timers_;
+
+	void run() {
+		std::unique_lock<std::mutex> lock(lock_);
+		while (true) {
+			Clock::time_point next = Clock::time_point::max();
+			for (const tmrTimerControl *t : timers_) {
+				if (t->isActive)
+					next = std::min(next, t->expiry);
+			}
+
+			if (Clock::time_point::max() == next)
+				cv_.wait(lock);
+			else
+				cv_.wait_until(lock, next);
+
+			const Clock::time_point now = Clock::now();
+			for (tmrTimerControl *t : timers_) {
+				if (!t->isActive || t->expiry > now)
+					continue;
+
+				if (t->isAutoReload)
+					t->expiry += std::chrono::milliseconds(t->period);
+				else
+					t->isActive = false;
+
+				lock.unlock();
+				t->callback(t);
+				lock.lock();
+			}
+		}
+	}
+
+public:
+	TimerService() {
+		std::thread([this]() {
+			currentTask = new tskTaskControlBlock;
+			run();
+		}).detach();
+	}
+
+	static TimerService &getInstance() {
+		static TimerService *instance = new TimerService;
+		return *instance;
+	}
+
+	void add(tmrTimerControl *timer) {
+		std::lock_guard<std::mutex> guard(lock_);
+		timers_.push_back(timer);
+	}
+
+	void remove(tmrTimerControl *timer) {
+		std::lock_guard<std::mutex> guard(lock_);
+		timers_.remove(timer);
+	}
+
+	template <class Fn> void update(Fn &&fn) {
+		std::lock_guard<std::mutex> guard(lock_);
+		fn();
+		cv_.notify_all();
+	}
+};
+
+} // namespace
+
+TimerHandle_t xTimerCreate(const char *, TickType_t period, UBaseType_t isAutoReload, void *id,
+						   TimerCallbackFunction_t callback) {
+	tmrTimerControl *timer = new tmrTimerControl { callback, id, period, pdFALSE != isAutoReload };
+	TimerService::getInstance().add(timer);
+	return timer;
+}
+
+BaseType_t xTimerStart(TimerHandle_t timer, TickType_t) {
+	TimerService::getInstance().update([timer]() {
+		timer->expiry = Clock::now() + std::chrono::milliseconds(timer->period);
+		timer->isActive = true;
+	});
+	return pdPASS;
+}
+
+BaseType_t xTimerReset(TimerHandle_t timer, TickType_t wait) {
+	return xTimerStart(timer, wait);
+}
+
+BaseType_t xTimerStop(TimerHandle_t timer, TickType_t) {
+	TimerService::getInstance().update([timer]() {
+		timer->isActive = false;
+	});
+	return pdPASS;
+}
+
+BaseType_t xTimerChangePeriod(TimerHandle_t timer, TickType_t period, TickType_t wait) {
+	TimerService::getInstance().update([timer, period]() {
+		timer->period = period;
+	});
+	return xTimerStart(timer, wait);
+}
+
+BaseType_t xTimerDelete(TimerHandle_t timer, TickType_t) {
+	TimerService::getInstance().remove(timer);
+	delete timer;
+	return pdPASS;
+}
+
+BaseType_t xTimerIsTimerActive(TimerHandle_t timer) {
+	BaseType_t isActive = pdFALSE;
+	TimerService::getInstance().update([timer, &isActive]() {
+		isActive = timer->isActive ? pdTRUE : pdFALSE;
+	});
+	return isActive;
+}
+
+void *pvTimerGetTimerID(TimerHandle_t timer) {
+	return timer->id;
+}
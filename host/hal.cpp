@@ -0,0 +1,164 @@
+// vim: tabstop=4 shiftwidth=4 noexpandtab colorcolumn=120 :
+// This file is part of the Sim800 (https://github.com/beranat/sim800).
+// Copyright (c) 2021 Anatoly L. Berenblit.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 3.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+#include <esp_log.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+
+#include "hal.hpp"
+#include "emulator.hpp"
+
+// Modem link of the host build: UART driver model (RX buffer, events) connected to the emulator
+
+constexpr const char *MODULE = "hal";
+
+namespace {
+
+constexpr unsigned int eventsLength = 16;
+constexpr size_t fifoThreshold = 64;
+
+std::mutex lock;
+std::condition_variable cv;
+std::deque<uint8_t> rx;
+size_t rxBuffer = 0;
+size_t rxNotified = 0;	// received since the last event
+bool isOpen = false;
+QueueHandle_t events = nullptr;
+
+void post(HalUartEvent event) noexcept {
+	if (nullptr != events)
+		xQueueSend(events, &event, 0);
+}
+
+void output(const uint8_t *data, size_t length, bool isIdle) noexcept {
+	std::lock_guard<std::mutex> guard(lock);
+	if (!isOpen)
+		return;
+
+	if (rx.size() + length > rxBuffer) {
+		ESP_LOGD(MODULE, "RX buffer overflow");
+		length = rxBuffer - rx.size();
+		post(HalUartEvent::Overflow);
+	}
+	rx.insert(rx.end(), data, data + length);
+	cv.notify_all();
+
+	rxNotified += length;
+	if (std::find(data, data + length, '\n') != data + length)
+		post(HalUartEvent::Line);
+	else if (rxNotified >= fifoThreshold || isIdle)
+		post(HalUartEvent::Data);
+	else
+		return;
+	rxNotified = 0;
+}
+
+} // namespace
+
+// Called once before anything else by the host application
+esp_err_t halHostInit(const char *script) noexcept {
+	return emulatorInit(script, &output);
+}
+
+esp_err_t halUartInit(const HalUartConfig &config) noexcept {
+	std::lock_guard<std::mutex> guard(lock);
+	if (isOpen)
+		return ESP_ERR_INVALID_STATE;
+
+	if (config.isEvents) {
+		events = xQueueCreate(eventsLength, sizeof(HalUartEvent));
+		if (nullptr == events)
+			return ESP_ERR_NO_MEM;
+	}
+
+	// ESP32 driver keeps at least hardware FIFO
+	rxBuffer = std::max<size_t>(config.rxBuffer, 128);
+	emulatorBaud(config.baudRate);
+	isOpen = true;
+	return ESP_OK;
+}
+
+esp_err_t halUartBaud(int baudRate) noexcept {
+	if (!isOpen || baudRate <= 0)
+		return ESP_ERR_INVALID_ARG;
+	emulatorBaud(baudRate);
+	return ESP_OK;
+}
+
+// In-process wire never loses data on the modem side, RTS/CTS is accepted as is
+esp_err_t halUartFlowControl(bool) noexcept {
+	return isOpen ? ESP_OK : ESP_ERR_INVALID_STATE;
+}
+
+int halUartRead(void *data, size_t length, TickType_t wait) noexcept {
+	std::unique_lock<std::mutex> guard(lock);
+	if (!isOpen)
+		return -1;
+
+	const auto isReady = [length]() {
+		return rx.size() >= length;
+	};
+	if (portMAX_DELAY == wait)
+		cv.wait(guard, isReady);
+	else
+		cv.wait_for(guard, std::chrono::milliseconds(wait), isReady);
+
+	length = std::min(length, rx.size());
+	std::copy_n(rx.begin(), length, reinterpret_cast<uint8_t *>(data));
+	rx.erase(rx.begin(), rx.begin() + length);
+	return static_cast<int>(length);
+}
+
+int halUartWrite(const void *data, size_t length) noexcept {
+	if (!isOpen)
+		return -1;
+	return static_cast<int>(emulatorWrite(data, length));
+}
+
+esp_err_t halUartWaitTx(TickType_t wait) noexcept {
+	return emulatorWaitTx(wait) ? ESP_OK : ESP_ERR_TIMEOUT;
+}
+
+size_t halUartBuffered() noexcept {
+	std::lock_guard<std::mutex> guard(lock);
+	return rx.size();
+}
+
+void halUartFlush() noexcept {
+	std::lock_guard<std::mutex> guard(lock);
+	rx.clear();
+	rxNotified = 0;
+	if (nullptr != events)
+		xQueueReset(events);
+}
+
+bool halUartWait(HalUartEvent &event, TickType_t wait) noexcept {
+	return nullptr != events && pdTRUE == xQueueReceive(events, &event, wait);
+}
+
+esp_err_t halGpioOutput(uint64_t) noexcept {
+	return ESP_OK;
+}
+
+void halGpioSet(int pin, bool level) noexcept {
+	emulatorGpio(pin, level);
+}
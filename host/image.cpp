@@ -0,0 +1,76 @@
+// vim: tabstop=4 shiftwidth=4 noexpandtab colorcolumn=120 :
+// This file is part of the Sim800 (https://github.com/beranat/sim800).
+// Copyright (c) 2021 Anatoly L. Berenblit.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 3.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include <esp_app_format.h>
+
+// esp-image <file> <size> [project] [version]: app image for the host OTA (`make ota'), one segment of the app
+// description and filler, checksum, no hash
+
+int main(int argc, char **argv) {
+	if (argc < 3 || 5 < argc) {
+		fprintf(stderr, "Usage: %s <file> <size> [project] [version]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	const size_t size = strtoul(argv[2], nullptr, 0);
+	const size_t overhead = sizeof(esp_image_header_t) + sizeof(esp_image_segment_header_t) + 16;
+	if (size < overhead + sizeof(esp_app_desc_t)) {
+		fprintf(stderr, "%s: size is under %zu\n", argv[0], overhead + sizeof(esp_app_desc_t));
+		return EXIT_FAILURE;
+	}
+
+	esp_image_header_t header = {};
+	header.magic = ESP_IMAGE_HEADER_MAGIC;
+	header.segment_count = 1;
+	header.entry_addr = 0x400d0000;
+
+	// segment data is a multiple of 4, the checksum pads the image to 16 bytes
+	esp_image_segment_header_t segment = { 0x3f400020, static_cast<uint32_t>((size - overhead) & ~3u) };
+	std::vector<uint8_t> data(segment.data_len);
+	for (size_t i = 0; i < data.size(); ++i)
+		data[i] = static_cast<uint8_t>(i * 31 + 7);
+
+	esp_app_desc_t description = {};
+	description.magic_word = ESP_APP_DESC_MAGIC_WORD;
+	strncpy(description.project_name, (3 < argc) ? argv[3] : "sim800", sizeof(description.project_name) - 1);
+	strncpy(description.version, (4 < argc) ? argv[4] : "next", sizeof(description.version) - 1);
+	strncpy(description.idf_ver, "host", sizeof(description.idf_ver) - 1);
+	memcpy(data.data(), &description, sizeof(description));
+
+	std::vector<uint8_t> image(reinterpret_cast<const uint8_t *>(&header),
+							   reinterpret_cast<const uint8_t *>(&header) + sizeof(header));
+	image.insert(image.end(), reinterpret_cast<const uint8_t *>(&segment),
+				 reinterpret_cast<const uint8_t *>(&segment) + sizeof(segment));
+	image.insert(image.end(), data.begin(), data.end());
+
+	uint8_t checksum = ESP_IMAGE_CHECKSUM_SEED;
+	for (uint8_t byte : data)
+		checksum ^= byte;
+	image.resize(image.size() + 15 - image.size() % 16, 0);
+	image.push_back(checksum);
+
+	FILE *file = fopen(argv[1], "wb");
+	if (nullptr == file || image.size() != fwrite(image.data(), 1, image.size(), file)) {
+		perror(argv[1]);
+		return EXIT_FAILURE;
+	}
+	fclose(file);
+	return EXIT_SUCCESS;
+}
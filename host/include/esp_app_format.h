@@ -0,0 +1,60 @@
+// vim: tabstop=4 shiftwidth=4 noexpandtab colorcolumn=120 :
+// This file is part of the Sim800 (https://github.com/beranat/sim800).
+// Copyright (c) 2021 Anatoly L. Berenblit.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 3.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+// App image layout (esp_image_format.h): image header, segments (the first one starts with the app description),
+// checksum byte at the 16 byte boundary and the SHA-256 if hash_appended
+
+#include <cstdint>
+
+#define ESP_IMAGE_HEADER_MAGIC 0xE9
+#define ESP_APP_DESC_MAGIC_WORD 0xABCD5432
+#define ESP_IMAGE_CHECKSUM_SEED 0xEF
+
+typedef struct {
+	uint8_t magic;
+	uint8_t segment_count;
+	uint8_t spi_mode;
+	uint8_t spi_speed: 4;
+	uint8_t spi_size: 4;
+	uint32_t entry_addr;
+	uint8_t wp_pin;
+	uint8_t spi_pin_drv[3];
+	uint16_t chip_id;
+	uint8_t min_chip_rev;
+	uint8_t reserved[8];
+	uint8_t hash_appended;
+} __attribute__((packed)) esp_image_header_t;
+
+typedef struct {
+	uint32_t load_addr;
+	uint32_t data_len;
+} esp_image_segment_header_t;
+
+typedef struct {
+	uint32_t magic_word;
+	uint32_t secure_version;
+	uint32_t reserv1[2];
+	char version[32];
+	char project_name[32];
+	char time[16];
+	char date[16];
+	char idf_ver[32];
+	uint8_t app_elf_sha256[32];
+	uint32_t reserv2[20];
+} esp_app_desc_t;
+
+static_assert(sizeof(esp_image_header_t) == 24, "Image header is 24 bytes");
+static_assert(sizeof(esp_app_desc_t) == 256, "App description is 256 bytes");
@@ -0,0 +1,45 @@
+// vim: tabstop=4 shiftwidth=4 noexpandtab colorcolumn=120 :
+// This file is part of the Sim800 (https://github.com/beranat/sim800).
+// Copyright (c) 2021 Anatoly L. Berenblit.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 3.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+
+#include <cstddef>
+
+#include "esp_err.h"
+
+typedef int (*esp_console_cmd_func_t)(int argc, char **argv);
+
+typedef struct {
+	size_t max_cmdline_length;
+	size_t max_cmdline_args;
+	int hint_color;
+	int hint_bold;
+} esp_console_config_t;
+
+typedef struct {
+	const char *command;
+	const char *help;
+	const char *hint;
+	esp_console_cmd_func_t func;
+	void *argtable;
+} esp_console_cmd_t;
+
+esp_err_t esp_console_init(const esp_console_config_t *config);
+esp_err_t esp_console_deinit(void);
+esp_err_t esp_console_cmd_register(const esp_console_cmd_t *cmd);
+esp_err_t esp_console_run(const char *cmdline, int *ret);
+esp_err_t esp_console_register_help_command(void);
+void esp_console_get_completion(const char *buf, void *lc);
+const char *esp_console_get_hint(const char *buf, int *color, int *bold);
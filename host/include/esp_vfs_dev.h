@@ -0,0 +1,26 @@
+// vim: tabstop=4 shiftwidth=4 noexpandtab colorcolumn=120 :
+// This file is part of the Sim800 (https://github.com/beranat/sim800).
+// Copyright (c) 2021 Anatoly L. Berenblit.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 3.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+
+typedef enum {
+	ESP_LINE_ENDINGS_CRLF,
+	ESP_LINE_ENDINGS_CR,
+	ESP_LINE_ENDINGS_LF,
+} esp_line_endings_t;
+
+void esp_vfs_dev_uart_port_set_rx_line_endings(int port, esp_line_endings_t mode);
+void esp_vfs_dev_uart_port_set_tx_line_endings(int port, esp_line_endings_t mode);
+void esp_vfs_dev_uart_use_driver(int port);
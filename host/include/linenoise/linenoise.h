@@ -0,0 +1,31 @@
+// vim: tabstop=4 shiftwidth=4 noexpandtab colorcolumn=120 :
+// This file is part of the Sim800 (https://github.com/beranat/sim800).
+// Copyright (c) 2021 Anatoly L. Berenblit.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 3.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+// Line reader over stdin: no editing, end of input terminates the host application
+
+typedef void(linenoiseCompletionCallback)(const char *, void *);
+typedef char *(linenoiseHintsCallback)(const char *, int *color, int *bold);
+
+char *linenoise(const char *prompt);
+void linenoiseFree(void *ptr);
+int linenoiseProbe(void);
+void linenoiseSetMultiLine(int ml);
+void linenoiseSetDumbMode(int set);
+void linenoiseSetCompletionCallback(void (*fn)(const char *, void *));
+void linenoiseSetHintsCallback(linenoiseHintsCallback *fn);
+int linenoiseHistoryAdd(const char *line);
+int linenoiseHistorySetMaxLen(int len);
+void linenoiseAllowEmpty(bool);
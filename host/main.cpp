@@ -0,0 +1,122 @@
+// vim: tabstop=4 shiftwidth=4 noexpandtab colorcolumn=120 :
+// This file is part of the Sim800 (https://github.com/beranat/sim800).
+// Copyright (c) 2021 Anatoly L. Berenblit.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 3.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <system_error>
+
+#include <unistd.h>
+
+#include <esp_log.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include "main.hpp"
+#include "console.hpp"
+#include "config.hpp"
+#include "journal.hpp"
+#include "dlog.hpp"
+#include "stats.hpp"
+#include "bridge.hpp"
+#include "outbox.hpp"
+#include "sim.hpp"
+
+// Host application: modem layer + console (stdin) against the emulator.
+// Usage: sim800-host [-s script] [-w] [-v|-q]   e.g. echo "simbench 100" | sim800-host -w -s scripts/sim800.at
+
+constexpr const char *APP = "app";
+constexpr unsigned int readyTimeoutMs = 60000;
+
+esp_err_t halHostInit(const char *script) noexcept;
+
+void fatalError(const char *message, const char *tag) noexcept {
+	ESP_LOGE((nullptr != tag) ? tag : APP, "%s", (nullptr != message && 0 != *message) ? message : "Internal");
+	journalAppendf(JournalKind::Fatal, "%s: %s", (nullptr != tag) ? tag : APP, message);
+	journalSync();
+	exit(EXIT_FAILURE);
+}
+
+void fatalError(esp_err_t code, const char *message, const char *tag) noexcept {
+	if (ESP_OK != code) {
+		ESP_LOGE((nullptr != tag) ? tag : APP, "%s error %s (%d)", message, esp_err_to_name(code),
+				 static_cast<int>(code));
+		journalAppendf(JournalKind::Fatal, "%s: %s error %s (%d)", (nullptr != tag) ? tag : APP, message,
+					   esp_err_to_name(code), static_cast<int>(code));
+		journalSync();
+		exit(EXIT_FAILURE);
+	}
+}
+
+void throwError(esp_err_t code, const char *message, const char *tag) {
+	if (ESP_OK != code) {
+		ESP_LOGE((nullptr != tag) ? tag : APP, "%s error %s (%d)", message, esp_err_to_name(code),
+				 static_cast<int>(code));
+		throw std::system_error(code, std::system_category(), message);
+	}
+}
+
+int main(int argc, char *argv[]) {
+	const char *script = getenv("SIM800_SCRIPT");
+	bool isWait = false;
+
+	for (int opt; -1 != (opt = getopt(argc, argv, "s:wvq"));) {
+		switch (opt) {
+			case 's':
+				script = optarg;
+				break;
+			case 'w':
+				isWait = true;
+				break;
+			case 'v':
+				esp_log_level_set("*", ESP_LOG_DEBUG);
+				dlogLevel = DlogLevel::Debug;
+				break;
+			case 'q':
+				esp_log_level_set("*", ESP_LOG_WARN);
+				dlogLevel = DlogLevel::Warn;
+				break;
+			default:
+				fprintf(stderr, "Usage: %s [-s script] [-w] [-v|-q]\n", argv[0]);
+				return EXIT_FAILURE;
+		}
+	}
+
+	ESP_LOGI(APP, "Initialization");
+	fatalError(halHostInit(script), "Emulator");
+	fatalError(consoleInit(), "Console");
+	fatalError(dlogInit(), "Log");
+	fatalError(statsInit(), "Stats");
+
+	if (ESP_OK != journalInit())
+		ESP_LOGW(APP, "Journal is not available");
+	fatalError(configInit(), "Config");
+	fatalError(simInit(), "SIM800");
+	fatalError(bridgeInit(), "Bridge");
+	if (ESP_OK != outboxInit())
+		ESP_LOGW(APP, "Outbox is not available");
+
+	// piped commands need the modem
+	for (unsigned int waitMs = 0; isWait && !simIsReady(); waitMs += 10) {
+		if (waitMs >= readyTimeoutMs)
+			fatalError("Modem is not ready", APP);
+		vTaskDelay(pdMS_TO_TICKS(10));
+	}
+
+	consoleLoop();
+	fatalError("System halted", APP);
+}
@@ -0,0 +1,247 @@
+// vim: tabstop=4 shiftwidth=4 noexpandtab colorcolumn=120 :
+// This file is part of the Sim800 (https://github.com/beranat/sim800).
+// Copyright (c) 2021 Anatoly L. Berenblit.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 3.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <nvs.h>
+#include <nvs_flash.h>
+
+// In-memory NVS. Values are kept as typed blobs per "namespace/key", the file named by SIM800_NVS (if set)
+// is loaded on init and rewritten on every commit.
+
+namespace {
+
+enum class Type : uint8_t {
+	I32,
+	U32,
+	Str,
+	Blob,
+};
+
+struct Value {
+	Type type;
+	std::vector<uint8_t> data;
+};
+
+constexpr size_t keyMax = 15;
+
+std::mutex lock;
+bool isInited = false;
+std::map<std::string, Value> values;
+std::vector<std::string> namespaces;
+
+const char *fileName() noexcept {
+	return getenv("SIM800_NVS");
+}
+
+void load() {
+	FILE *f = (nullptr != fileName()) ? fopen(fileName(), "rb") : nullptr;
+	if (nullptr == f)
+		return;
+
+	while (true) {
+		uint8_t type;
+		uint32_t keyLength, dataLength;
+		if (1 != fread(&type, sizeof(type), 1, f) || 1 != fread(&keyLength, sizeof(keyLength), 1, f))
+			break;
+		std::string key(keyLength, 0);
+		if (keyLength != fread(key.data(), 1, keyLength, f) || 1 != fread(&dataLength, sizeof(dataLength), 1, f))
+			break;
+		Value value { static_cast<Type>(type), std::vector<uint8_t>(dataLength) };
+		if (dataLength != fread(value.data.data(), 1, dataLength, f))
+			break;
+		values[key] = std::move(value);
+	}
+	fclose(f);
+}
+
+void save() {
+	FILE *f = (nullptr != fileName()) ? fopen(fileName(), "wb") : nullptr;
+	if (nullptr == f)
+		return;
+
+	for (const auto &[key, value] : values) {
+		const uint8_t type = static_cast<uint8_t>(value.type);
+		const uint32_t keyLength = key.length(), dataLength = value.data.size();
+		fwrite(&type, sizeof(type), 1, f);
+		fwrite(&keyLength, sizeof(keyLength), 1, f);
+		fwrite(key.data(), 1, keyLength, f);
+		fwrite(&dataLength, sizeof(dataLength), 1, f);
+		fwrite(value.data.data(), 1, dataLength, f);
+	}
+	fclose(f);
+}
+
+esp_err_t path(nvs_handle_t handle, const char *key, std::string &result) {
+	if (!isInited)
+		return ESP_ERR_NVS_NOT_INITIALIZED;
+	if (0 == handle || handle > namespaces.size())
+		return ESP_ERR_NVS_INVALID_HANDLE;
+	if (nullptr == key || 0 == *key)
+		return ESP_ERR_NVS_INVALID_NAME;
+	if (strlen(key) > keyMax)
+		return ESP_ERR_NVS_KEY_TOO_LONG;
+
+	result = namespaces[handle - 1] + "/" + key;
+	return ESP_OK;
+}
+
+esp_err_t get(nvs_handle_t handle, const char *key, Type type, void *data, size_t *length, bool isExact) {
+	std::lock_guard<std::mutex> guard(lock);
+	std::string name;
+	const esp_err_t result = path(handle, key, name);
+	if (ESP_OK != result)
+		return result;
+
+	const auto i = values.find(name);
+	if (values.end() == i)
+		return ESP_ERR_NVS_NOT_FOUND;
+	if (type != i->second.type)
+		return ESP_ERR_NVS_TYPE_MISMATCH;
+
+	const size_t size = i->second.data.size();
+	if (isExact) {
+		memcpy(data, i->second.data.data(), size);
+		return ESP_OK;
+	}
+
+	if (nullptr == data) {
+		*length = size;
+		return ESP_OK;
+	}
+
+	if (*length < size) {
+		*length = size;
+		return ESP_ERR_NVS_INVALID_LENGTH;
+	}
+	memcpy(data, i->second.data.data(), size);
+	*length = size;
+	return ESP_OK;
+}
+
+esp_err_t set(nvs_handle_t handle, const char *key, Type type, const void *data, size_t length) {
+	std::lock_guard<std::mutex> guard(lock);
+	std::string name;
+	const esp_err_t result = path(handle, key, name);
+	if (ESP_OK != result)
+		return result;
+
+	const uint8_t *bytes = reinterpret_cast<const uint8_t *>(data);
+	values[name] = Value { type, std::vector<uint8_t>(bytes, bytes + length) };
+	return ESP_OK;
+}
+
+} // namespace
+
+esp_err_t nvs_flash_init(void) {
+	std::lock_guard<std::mutex> guard(lock);
+	if (!isInited) {
+		load();
+		isInited = true;
+	}
+	return ESP_OK;
+}
+
+esp_err_t nvs_flash_deinit(void) {
+	std::lock_guard<std::mutex> guard(lock);
+	isInited = false;
+	return ESP_OK;
+}
+
+esp_err_t nvs_flash_erase(void) {
+	std::lock_guard<std::mutex> guard(lock);
+	values.clear();
+	save();
+	return ESP_OK;
+}
+
+esp_err_t nvs_open(const char *name, nvs_open_mode_t, nvs_handle_t *handle) {
+	std::lock_guard<std::mutex> guard(lock);
+	if (!isInited)
+		return ESP_ERR_NVS_NOT_INITIALIZED;
+	if (nullptr == name || strlen(name) > keyMax)
+		return ESP_ERR_NVS_INVALID_NAME;
+
+	namespaces.push_back(name);
+	*handle = namespaces.size();
+	return ESP_OK;
+}
+
+void nvs_close(nvs_handle_t) {
+}
+
+esp_err_t nvs_commit(nvs_handle_t) {
+	std::lock_guard<std::mutex> guard(lock);
+	save();
+	return ESP_OK;
+}
+
+esp_err_t nvs_erase_key(nvs_handle_t handle, const char *key) {
+	std::lock_guard<std::mutex> guard(lock);
+	std::string name;
+	const esp_err_t result = path(handle, key, name);
+	if (ESP_OK != result)
+		return result;
+	return (0 != values.erase(name)) ? ESP_OK : ESP_ERR_NVS_NOT_FOUND;
+}
+
+esp_err_t nvs_erase_all(nvs_handle_t handle) {
+	std::lock_guard<std::mutex> guard(lock);
+	if (0 == handle || handle > namespaces.size())
+		return ESP_ERR_NVS_INVALID_HANDLE;
+
+	const std::string prefix = namespaces[handle - 1] + "/";
+	for (auto i = values.begin(); values.end() != i;)
+		i = (0 == i->first.compare(0, prefix.length(), prefix)) ? values.erase(i) : std::next(i);
+	return ESP_OK;
+}
+
+esp_err_t nvs_get_i32(nvs_handle_t handle, const char *key, int32_t *value) {
+	return get(handle, key, Type::I32, value, nullptr, true);
+}
+
+esp_err_t nvs_get_u32(nvs_handle_t handle, const char *key, uint32_t *value) {
+	return get(handle, key, Type::U32, value, nullptr, true);
+}
+
+esp_err_t nvs_get_str(nvs_handle_t handle, const char *key, char *value, size_t *length) {
+	return get(handle, key, Type::Str, value, length, false);
+}
+
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char *key, void *value, size_t *length) {
+	return get(handle, key, Type::Blob, value, length, false);
+}
+
+esp_err_t nvs_set_i32(nvs_handle_t handle, const char *key, int32_t value) {
+	return set(handle, key, Type::I32, &value, sizeof(value));
+}
+
+esp_err_t nvs_set_u32(nvs_handle_t handle, const char *key, uint32_t value) {
+	return set(handle, key, Type::U32, &value, sizeof(value));
+}
+
+esp_err_t nvs_set_str(nvs_handle_t handle, const char *key, const char *value) {
+	return set(handle, key, Type::Str, value, strlen(value) + 1);
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char *key, const void *value, size_t length) {
+	return set(handle, key, Type::Blob, value, length);
+}
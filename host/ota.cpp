@@ -0,0 +1,180 @@
+// vim: tabstop=4 shiftwidth=4 noexpandtab colorcolumn=120 :
+// This file is part of the Sim800 (https://github.com/beranat/sim800).
+// Copyright (c) 2021 Anatoly L. Berenblit.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 3.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+#include <chrono>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <esp_log.h>
+#include <esp_ota_ops.h>
+
+// OTA of the host build, see include/esp_ota_ops.h
+
+constexpr const char *MODULE = "ota";
+
+namespace {
+
+constexpr size_t sectorSize = 4096;
+// SPI flash timing (typical): writes take as long as on the chip, so the download overlaps them as on the target
+constexpr unsigned int sectorEraseUs = 45000;
+constexpr unsigned int pageProgramUs = 700;	// 256 bytes
+
+std::mutex lock;
+const esp_partition_t *boot = nullptr;
+const esp_app_desc_t description = { ESP_APP_DESC_MAGIC_WORD, 0, { 0, 0 }, PROJECT_VERSION, "sim800", __TIME__,
+									 __DATE__, "host", {}, {} };
+
+// One update at a time
+esp_ota_handle_t active = 0;
+esp_ota_handle_t last = 0;
+const esp_partition_t *target = nullptr;
+size_t written = 0;
+size_t erased = 0;
+bool isSequential = false;
+
+const esp_partition_t *running() {
+	return esp_partition_find_first(ESP_PARTITION_TYPE_APP, ESP_PARTITION_SUBTYPE_APP_OTA_0, nullptr);
+}
+
+// Header, segments and the checksum of the image in the partition
+bool validate(const esp_partition_t *partition, size_t length) {
+	std::vector<uint8_t> image(length);
+	if (length < sizeof(esp_image_header_t) || ESP_OK != esp_partition_read(partition, 0, image.data(), length))
+		return false;
+
+	esp_image_header_t header;
+	memcpy(&header, image.data(), sizeof(header));
+	if (ESP_IMAGE_HEADER_MAGIC != header.magic || 0 == header.segment_count)
+		return false;
+
+	size_t pos = sizeof(header);
+	uint8_t checksum = ESP_IMAGE_CHECKSUM_SEED;
+	for (unsigned int i = 0; i < header.segment_count; ++i) {
+		esp_image_segment_header_t segment;
+		if (length < pos + sizeof(segment))
+			return false;
+		memcpy(&segment, image.data() + pos, sizeof(segment));
+		pos += sizeof(segment);
+		if (length - pos < segment.data_len)
+			return false;
+		for (size_t j = 0; j < segment.data_len; ++j)
+			checksum ^= image[pos + j];
+		pos += segment.data_len;
+	}
+
+	// checksum is the last byte of the 16 byte block
+	pos += 15 - pos % 16;
+	return pos < length && checksum == image[pos] && (0 == header.hash_appended || pos + 1 + 32 <= length);
+}
+
+} // namespace
+
+const esp_app_desc_t *esp_ota_get_app_description(void) {
+	return &description;
+}
+
+const esp_partition_t *esp_ota_get_running_partition(void) {
+	return running();
+}
+
+const esp_partition_t *esp_ota_get_boot_partition(void) {
+	std::lock_guard<std::mutex> guard(lock);
+	return (nullptr != boot) ? boot : running();
+}
+
+const esp_partition_t *esp_ota_get_next_update_partition(const esp_partition_t *start_from) {
+	const esp_partition_t *from = (nullptr != start_from) ? start_from : running();
+	return esp_partition_find_first(ESP_PARTITION_TYPE_APP, (ESP_PARTITION_SUBTYPE_APP_OTA_0 == from->subtype) ?
+									ESP_PARTITION_SUBTYPE_APP_OTA_1 : ESP_PARTITION_SUBTYPE_APP_OTA_0, nullptr);
+}
+
+esp_err_t esp_ota_begin(const esp_partition_t *partition, size_t image_size, esp_ota_handle_t *out_handle) {
+	if (nullptr == partition || nullptr == out_handle || ESP_PARTITION_TYPE_APP != partition->type)
+		return ESP_ERR_INVALID_ARG;
+	if (partition == running())
+		return ESP_ERR_OTA_PARTITION_CONFLICT;
+
+	std::lock_guard<std::mutex> guard(lock);
+	if (0 != active)
+		return ESP_ERR_INVALID_STATE;
+
+	isSequential = (OTA_WITH_SEQUENTIAL_WRITES == image_size);
+	const size_t size = (isSequential || OTA_SIZE_UNKNOWN == image_size) ? partition->size : image_size;
+	if (partition->size < size)
+		return ESP_ERR_INVALID_SIZE;
+	erased = isSequential ? 0 : (size + sectorSize - 1) / sectorSize * sectorSize;
+	if (0 != erased) {
+		const esp_err_t result = esp_partition_erase_range(partition, 0, erased);
+		if (ESP_OK != result)
+			return result;
+	}
+
+	target = partition;
+	written = 0;
+	active = *out_handle = ++last;
+	return ESP_OK;
+}
+
+esp_err_t esp_ota_write(esp_ota_handle_t handle, const void *data, size_t size) {
+	std::lock_guard<std::mutex> guard(lock);
+	if (0 == handle || handle != active || nullptr == data)
+		return ESP_ERR_INVALID_ARG;
+	if (target->size - written < size)
+		return ESP_ERR_INVALID_SIZE;
+
+	unsigned int us = (size + 255) / 256 * pageProgramUs;
+	while (erased < written + size) {
+		const esp_err_t result = esp_partition_erase_range(target, erased, sectorSize);
+		if (ESP_OK != result)
+			return result;
+		erased += sectorSize;
+		us += sectorEraseUs;
+	}
+	const esp_err_t result = esp_partition_write(target, written, data, size);
+	if (ESP_OK == result)
+		written += size;
+	std::this_thread::sleep_for(std::chrono::microseconds(us));
+	return result;
+}
+
+esp_err_t esp_ota_end(esp_ota_handle_t handle) {
+	std::lock_guard<std::mutex> guard(lock);
+	if (0 == handle || handle != active)
+		return ESP_ERR_NOT_FOUND;
+	active = 0;
+	return validate(target, written) ? ESP_OK : ESP_ERR_OTA_VALIDATE_FAILED;
+}
+
+esp_err_t esp_ota_abort(esp_ota_handle_t handle) {
+	std::lock_guard<std::mutex> guard(lock);
+	if (0 == handle || handle != active)
+		return ESP_ERR_NOT_FOUND;
+	active = 0;
+	return ESP_OK;
+}
+
+esp_err_t esp_ota_set_boot_partition(const esp_partition_t *partition) {
+	if (nullptr == partition || ESP_PARTITION_TYPE_APP != partition->type)
+		return ESP_ERR_INVALID_ARG;
+
+	std::lock_guard<std::mutex> guard(lock);
+	if (partition != running() && (partition != target || !validate(partition, written)))
+		return ESP_ERR_OTA_VALIDATE_FAILED;
+	boot = partition;
+	ESP_LOGI(MODULE, "Boot partition %s", partition->label);
+	return ESP_OK;
+}
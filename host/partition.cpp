@@ -0,0 +1,149 @@
+// vim: tabstop=4 shiftwidth=4 noexpandtab colorcolumn=120 :
+// This file is part of the Sim800 (https://github.com/beranat/sim800).
+// Copyright (c) 2021 Anatoly L. Berenblit.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 3.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+#include <esp_log.h>
+#include <esp_partition.h>
+
+// Flash partitions of the host build, see include/esp_partition.h
+
+constexpr const char *MODULE = "flash";
+
+namespace {
+
+constexpr size_t sectorSize = 4096;
+
+// Partitions of partitions.csv (the system ones are not needed), the journal stays first in the image file
+const esp_partition_t partitions[] = {
+	{ nullptr, ESP_PARTITION_TYPE_DATA, static_cast<esp_partition_subtype_t>(0x40), 0x1B2000, 0x40000, "journal",
+	  false },
+	{ nullptr, ESP_PARTITION_TYPE_APP, ESP_PARTITION_SUBTYPE_APP_OTA_0, 0x10000, 0xD0000, "ota_0", false },
+	{ nullptr, ESP_PARTITION_TYPE_APP, ESP_PARTITION_SUBTYPE_APP_OTA_1, 0xE0000, 0xD0000, "ota_1", false },
+	{ nullptr, ESP_PARTITION_TYPE_DATA, static_cast<esp_partition_subtype_t>(0x41), 0x1F2000, 0xE000, "outbox",
+	  false },
+};
+
+std::mutex lock;
+std::vector<uint8_t> image;	// all partitions, by index in the table
+FILE *file = nullptr;
+
+size_t base(const esp_partition_t *partition) {
+	size_t offset = 0;
+	for (const esp_partition_t &p : partitions) {
+		if (&p == partition)
+			break;
+		offset += p.size;
+	}
+	return offset;
+}
+
+void open() {
+	if (!image.empty())
+		return;
+
+	size_t size = 0;
+	for (const esp_partition_t &p : partitions)
+		size += p.size;
+	image.assign(size, 0xff);
+
+	const char *name = getenv("SIM800_FLASH");
+	if (nullptr == name)
+		return;
+
+	file = fopen(name, "r+b");
+	if (nullptr != file) {
+		if (size != fread(image.data(), 1, size, file))
+			ESP_LOGW(MODULE, "`%s' is short, erased tail", name);
+		return;
+	}
+
+	file = fopen(name, "w+b");
+	if (nullptr == file || size != fwrite(image.data(), 1, size, file))
+		ESP_LOGE(MODULE, "`%s' create error %s", name, strerror(errno));
+	if (nullptr != file)
+		fflush(file);
+}
+
+void save(size_t offset, size_t size) {
+	if (nullptr == file)
+		return;
+	if (0 != fseek(file, static_cast<long>(offset), SEEK_SET) || size != fwrite(image.data() + offset, 1, size, file))
+		ESP_LOGE(MODULE, "Image write error %s", strerror(errno));
+	fflush(file);
+}
+
+esp_err_t check(const esp_partition_t *partition, size_t offset, size_t size) {
+	if (nullptr == partition)
+		return ESP_ERR_INVALID_ARG;
+	return (offset > partition->size || size > partition->size - offset) ? ESP_ERR_INVALID_SIZE : ESP_OK;
+}
+
+} // namespace
+
+const esp_partition_t *esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype,
+		const char *label) {
+	for (const esp_partition_t &p : partitions) {
+		if (type == p.type && (ESP_PARTITION_SUBTYPE_ANY == subtype || subtype == p.subtype) &&
+				(nullptr == label || 0 == strcmp(label, p.label)))
+			return &p;
+	}
+	return nullptr;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t *partition, size_t src_offset, void *dst, size_t size) {
+	const esp_err_t result = check(partition, src_offset, size);
+	if (ESP_OK != result)
+		return result;
+
+	std::lock_guard<std::mutex> guard(lock);
+	open();
+	memcpy(dst, image.data() + base(partition) + src_offset, size);
+	return ESP_OK;
+}
+
+esp_err_t esp_partition_write(const esp_partition_t *partition, size_t dst_offset, const void *src, size_t size) {
+	const esp_err_t result = check(partition, dst_offset, size);
+	if (ESP_OK != result)
+		return result;
+
+	std::lock_guard<std::mutex> guard(lock);
+	open();
+	const size_t offset = base(partition) + dst_offset;
+	const uint8_t *bytes = reinterpret_cast<const uint8_t *>(src);
+	for (size_t i = 0; i < size; ++i)
+		image[offset + i] &= bytes[i];
+	save(offset, size);
+	return ESP_OK;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t *partition, size_t offset, size_t size) {
+	esp_err_t result = check(partition, offset, size);
+	if (ESP_OK == result && (0 != offset % sectorSize || 0 != size % sectorSize))
+		result = ESP_ERR_INVALID_ARG;
+	if (ESP_OK != result)
+		return result;
+
+	std::lock_guard<std::mutex> guard(lock);
+	open();
+	const size_t start = base(partition) + offset;
+	memset(image.data() + start, 0xff, size);
+	save(start, size);
+	return ESP_OK;
+}
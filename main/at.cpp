@@ -0,0 +1,429 @@
+// vim: tabstop=4 shiftwidth=4 noexpandtab colorcolumn=120 :
+// This file is part of the Sim800 (https://github.com/beranat/sim800).
+// Copyright (c) 2021 Anatoly L. Berenblit.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 3.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+#include <cstring>
+#include <string_view>
+
+#include <esp_log.h>
+#include <esp_timer.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
+#include <freertos/timers.h>
+
+#include "sim.hpp"
+#include "dlog.hpp"
+#include "stats.hpp"
+#include "journal.hpp"
+#include "at.hpp"
+
+constexpr const char *MODULE = "at";
+
+static QueueHandle_t atQueue = nullptr;
+static SemaphoreHandle_t atLock = nullptr;
+static TimerHandle_t atTimer = nullptr;
+static TimerHandle_t atRetryTimer = nullptr;
+
+constexpr TickType_t atRetryPeriod = pdMS_TO_TICKS(10);
+
+// Active transaction, guarded by atLock
+static AtRequest atActive;
+static bool atIsActive = false;
+static bool atIsEchoed = false;		// modem echoes commands (ATE1), the prompted data as well
+static bool atIsPrompted = false;
+static TickType_t atStarted = 0;
+static int64_t atStartedUs = 0;
+
+// Output of the active transaction (command line, prompted data) is never waited for on the receiver task: while
+// the modem stops the AT channel (CMUX flow control) the rest is sent by the retry timer
+static char atLine[atCommandMax + 1];	// command with CR
+static const char *atOutput = nullptr;
+static size_t atOutputLength = 0;
+static size_t atOutputSent = 0;
+static bool atIsOutputData = false;
+
+static bool atFinal(std::string_view line, AtResult &result, int &code) noexcept {
+	struct Final {
+		std::string_view text;
+		AtResult result;
+	};
+
+	static constexpr Final finals[] = {
+		{ "OK", AtResult::Ok },
+		{ "ERROR", AtResult::Error },
+		{ "NO CARRIER", AtResult::NoCarrier },
+		{ "BUSY", AtResult::Busy },
+		{ "NO ANSWER", AtResult::NoAnswer },
+		{ "NO DIALTONE", AtResult::NoDialtone },
+		{ "CLOSE OK", AtResult::Ok },
+		{ "SHUT OK", AtResult::Ok },
+	};
+
+	for (const Final &f : finals) {
+		if (line == f.text) {
+			result = f.result;
+			code = 0;
+			return true;
+		}
+	}
+
+	constexpr std::string_view connect = "CONNECT";
+	constexpr std::string_view cme = "+CME ERROR:";
+	constexpr std::string_view cms = "+CMS ERROR:";
+
+	if (0 == line.compare(0, connect.length(), connect)) {
+		result = AtResult::Connect;
+		code = 0;
+		return true;
+	}
+
+	const bool isCme = (0 == line.compare(0, cme.length(), cme));
+	if (isCme || 0 == line.compare(0, cms.length(), cms)) {
+		result = isCme ? AtResult::CmeError : AtResult::CmsError;
+		code = 0;
+		for (const char c : line.substr(cme.length())) {
+			if ('0' <= c && c <= '9')
+				code = code * 10 + (c - '0');
+		}
+		return true;
+	}
+	return false;
+}
+
+// AT+CIPMUX=1 results are prefixed by the connection: "<n>, CLOSE OK"
+static std::string_view atUnlink(std::string_view line) noexcept {
+	if (3 < line.length() && '0' <= line[0] && line[0] <= '9' && ',' == line[1] && ' ' == line[2])
+		line.remove_prefix(3);
+	return line;
+}
+
+// Results of the prompted data (AT+CIPSEND), SEND OK/FAIL are URCs otherwise
+static bool atDataFinal(std::string_view line, AtResult &result) noexcept {
+	constexpr std::string_view accept = "DATA ACCEPT:";	// AT+CIPQSEND=1
+	line = atUnlink(line);
+	if ("SEND OK" == line || 0 == line.compare(0, accept.length(), accept))
+		result = AtResult::Ok;
+	else if ("SEND FAIL" == line)
+		result = AtResult::Error;
+	else
+		return false;
+	return true;
+}
+
+static void atCollect(AtResponse &response, std::string_view line) noexcept {
+	++response.lines;
+
+	const size_t separator = (0 != response.length) ? 1 : 0;
+	if (response.length + separator + line.length() >= sizeof(response.text)) {
+		DLOG(Warn, MODULE, "Response over %zu bytes, line dropped", sizeof(response.text));
+		return;
+	}
+
+	if (0 != separator)
+		response.text[response.length++] = '\n';
+	memcpy(response.text + response.length, line.data(), line.length());
+	response.length += line.length();
+	response.text[response.length] = 0;
+}
+
+static void atComplete(const AtRequest &request, AtResult result, int code) noexcept {
+	if (AtResult::Ok != result && request.isQuiet)
+		DLOG(Debug, MODULE, "%s - %s (%d)", request.command, atResultName(result), code);
+	else if (AtResult::Ok != result)
+		DLOG(Warn, MODULE, "%s - %s (%d)", request.command, atResultName(result), code);
+	journalAppendf(JournalKind::Result, "%s %s %d", request.command, atResultName(result), code);
+
+	if (nullptr != request.response) {
+		request.response->result = result;
+		request.response->code = code;
+	}
+
+	if (nullptr != request.onDone)
+		request.onDone(result, code, request.arg);
+
+	if (nullptr != request.notify)
+		xTaskNotify(request.notify, static_cast<uint32_t>(result), eSetValueWithOverwrite);
+}
+
+// Sends the rest of the output, ESP_ERR_TIMEOUT while the modem stops the flow. Caller holds atLock
+static esp_err_t atPump() noexcept {
+	if (atOutputSent >= atOutputLength)
+		return ESP_OK;
+
+	size_t sent = 0;
+	const esp_err_t result = simTrySend(atOutput + atOutputSent, atOutputLength - atOutputSent, sent);
+	atOutputSent += sent;
+	if (ESP_ERR_TIMEOUT == result) {
+		xTimerReset(atRetryTimer, 0);
+		return result;
+	}
+
+	atOutputLength = atOutputSent = 0;
+	if (ESP_OK == result && !atIsOutputData)
+		journalAppend(JournalKind::Tx, std::string_view(atActive.command));
+	else if (ESP_OK != result && atIsOutputData)
+		DLOG(Warn, MODULE, "%s data is not sent", atActive.command);
+	return result;
+}
+
+// Send next queued command if modem is idle
+static void atKick() noexcept {
+	while (true) {
+		xSemaphoreTake(atLock, portMAX_DELAY);
+		if (atIsActive || pdTRUE != xQueueReceive(atQueue, &atActive, 0)) {
+			xSemaphoreGive(atLock);
+			return;
+		}
+
+		atIsActive = true;
+		atIsEchoed = false;
+		atIsPrompted = false;
+		atStarted = xTaskGetTickCount();
+		atStartedUs = esp_timer_get_time();
+		xTimerChangePeriod(atTimer, (0 != atActive.timeout) ? atActive.timeout : 1, 0);
+
+		const size_t length = strlen(atActive.command);
+		memcpy(atLine, atActive.command, length);
+		atLine[length] = '\r';
+		atOutput = atLine;
+		atOutputLength = length + 1;
+		atOutputSent = 0;
+		atIsOutputData = false;
+
+		const esp_err_t sent = atPump();
+		if (ESP_OK == sent || ESP_ERR_TIMEOUT == sent) {
+			xSemaphoreGive(atLock);
+			return;
+		}
+
+		const AtRequest request = atActive;
+		atIsActive = false;
+		statsRecord(StatsHistogram::AtCommand, esp_timer_get_time() - atStartedUs);
+		xTimerStop(atTimer, 0);
+		xSemaphoreGive(atLock);
+		atComplete(request, AtResult::Error, 0);
+	}
+}
+
+static void atTimeout(TimerHandle_t) noexcept {
+	xSemaphoreTake(atLock, portMAX_DELAY);
+	if (!atIsActive || xTaskGetTickCount() - atStarted < atActive.timeout) {
+		xSemaphoreGive(atLock);
+		return;
+	}
+
+	const AtRequest request = atActive;
+	atIsActive = false;
+	statsRecord(StatsHistogram::AtCommand, esp_timer_get_time() - atStartedUs);
+	xSemaphoreGive(atLock);
+
+	atComplete(request, AtResult::Timeout, 0);
+	atKick();
+}
+
+static void atRetry(TimerHandle_t) noexcept {
+	xSemaphoreTake(atLock, portMAX_DELAY);
+	const esp_err_t result = atIsActive ? atPump() : ESP_OK;
+	if (ESP_OK == result || ESP_ERR_TIMEOUT == result || atIsOutputData) {
+		xSemaphoreGive(atLock);
+		return;
+	}
+
+	// command is not sent
+	const AtRequest request = atActive;
+	atIsActive = false;
+	statsRecord(StatsHistogram::AtCommand, esp_timer_get_time() - atStartedUs);
+	xTimerStop(atTimer, 0);
+	xSemaphoreGive(atLock);
+
+	atComplete(request, AtResult::Error, 0);
+	atKick();
+}
+
+esp_err_t atInit() noexcept {
+	atQueue = xQueueCreate(atQueueLength, sizeof(AtRequest));
+	atLock = xSemaphoreCreateMutex();
+	atTimer = xTimerCreate("at", atDefaultTimeout, pdFALSE, nullptr, &atTimeout);
+	atRetryTimer = xTimerCreate("at-retry", atRetryPeriod, pdFALSE, nullptr, &atRetry);
+	if (nullptr == atQueue || nullptr == atLock || nullptr == atTimer || nullptr == atRetryTimer) {
+		ESP_LOGE(MODULE, "Init error");
+		return ESP_ERR_NO_MEM;
+	}
+	return ESP_OK;
+}
+
+esp_err_t atSubmit(const AtRequest &request, TickType_t wait) noexcept {
+	if (nullptr == atQueue)
+		return ESP_ERR_INVALID_STATE;
+
+	if (0 == request.command[0] || nullptr == memchr(request.command, 0, sizeof(request.command) - 1))
+		return ESP_ERR_INVALID_ARG;
+
+	if (pdTRUE != xQueueSend(atQueue, &request, wait)) {
+		ESP_LOGW(MODULE, "Queue full, %s rejected", request.command);
+		return ESP_ERR_TIMEOUT;
+	}
+
+	atKick();
+	return ESP_OK;
+}
+
+esp_err_t atSubmit(const char *command, AtDoneCallback onDone, void *arg, TickType_t timeout) noexcept {
+	AtRequest request;
+	if (nullptr == command || strlen(command) >= sizeof(request.command))
+		return ESP_ERR_INVALID_ARG;
+
+	strcpy(request.command, command);
+	request.timeout = timeout;
+	request.onDone = onDone;
+	request.arg = arg;
+	return atSubmit(request);
+}
+
+AtResult atCommand(const char *command, AtResponse *response, TickType_t timeout) noexcept {
+	AtRequest request;
+	if (nullptr == command || strlen(command) >= sizeof(request.command))
+		return AtResult::Error;
+
+	strcpy(request.command, command);
+	request.timeout = timeout;
+	request.response = response;
+	return atCommand(request);
+}
+
+AtResult atCommand(AtRequest request) noexcept {
+	request.onDone = nullptr;
+	request.notify = xTaskGetCurrentTaskHandle();
+	if (nullptr != request.response)
+		*request.response = AtResponse();
+
+	xTaskNotifyWait(0, UINT32_MAX, nullptr, 0);
+	if (ESP_OK != atSubmit(request, request.timeout))
+		return AtResult::Error;
+
+	// engine always completes request (timer), response lives on our stack - wait for it
+	uint32_t result = static_cast<uint32_t>(AtResult::Timeout);
+	xTaskNotifyWait(0, UINT32_MAX, &result, portMAX_DELAY);
+	return static_cast<AtResult>(result);
+}
+
+bool atParseLine(std::string_view line) noexcept {
+	xSemaphoreTake(atLock, portMAX_DELAY);
+	if (!atIsActive) {
+		xSemaphoreGive(atLock);
+		return false;
+	}
+
+	// echo
+	if (line == atActive.command) {
+		atIsEchoed = true;
+		xSemaphoreGive(atLock);
+		return true;
+	}
+
+	AtResult result = AtResult::Ok;
+	int code = 0;
+	bool isFinal = (nullptr != atActive.data && atDataFinal(line, result)) || atFinal(line, result, code);
+	if (!isFinal && "CLOSE OK" == atUnlink(line)) {
+		result = AtResult::Ok;	// AT+CIPCLOSE=<n>
+		isFinal = true;
+	}
+	if (!isFinal) {
+		if (nullptr != atActive.onLine)
+			atActive.onLine(line, atActive.arg);
+		else if (nullptr != atActive.response)
+			atCollect(*atActive.response, line);
+		if (!atActive.isLineResult) {
+			xSemaphoreGive(atLock);
+			return true;
+		}
+	}
+
+	const AtRequest request = atActive;
+	atIsActive = false;
+	statsRecord(StatsHistogram::AtCommand, esp_timer_get_time() - atStartedUs);
+	xTimerStop(atTimer, 0);
+	xSemaphoreGive(atLock);
+
+	atComplete(request, result, code);
+	atKick();
+	return true;
+}
+
+bool atPrompt(size_t &echo) noexcept {
+	xSemaphoreTake(atLock, portMAX_DELAY);
+	if (!atIsActive || nullptr == atActive.data || atIsPrompted) {
+		xSemaphoreGive(atLock);
+		return false;
+	}
+
+	atIsPrompted = true;
+	echo = atIsEchoed ? atActive.dataLength : 0;
+	atOutput = static_cast<const char *>(atActive.data);
+	atOutputLength = atActive.dataLength;
+	atOutputSent = 0;
+	atIsOutputData = true;
+	atPump();
+	xSemaphoreGive(atLock);
+	return true;
+}
+
+bool atIsResponse(std::string_view line) noexcept {
+	xSemaphoreTake(atLock, portMAX_DELAY);
+	AtResult result;
+	if (atIsActive && ((nullptr != atActive.data && atDataFinal(line, result)) || "CLOSE OK" == atUnlink(line))) {
+		xSemaphoreGive(atLock);
+		return true;
+	}
+
+	std::string_view name = atIsActive ? std::string_view(atActive.command) : std::string_view();
+	bool isResponse = false;
+	if (2 < name.length()) {
+		name.remove_prefix(2);	// AT
+		name = name.substr(0, name.find_first_of("=?"));
+		isResponse = line.length() > name.length() && ':' == line[name.length()] &&
+					 0 == line.compare(0, name.length(), name);
+	}
+	xSemaphoreGive(atLock);
+	return isResponse;
+}
+
+const char *atResultName(AtResult result) noexcept {
+	switch (result) {
+		case AtResult::Ok:
+			return "OK";
+		case AtResult::Connect:
+			return "CONNECT";
+		case AtResult::Error:
+			return "ERROR";
+		case AtResult::CmeError:
+			return "CME ERROR";
+		case AtResult::CmsError:
+			return "CMS ERROR";
+		case AtResult::NoCarrier:
+			return "NO CARRIER";
+		case AtResult::Busy:
+			return "BUSY";
+		case AtResult::NoAnswer:
+			return "NO ANSWER";
+		case AtResult::NoDialtone:
+			return "NO DIALTONE";
+		case AtResult::Timeout:
+			return "TIMEOUT";
+	}
+	return "?";
+}
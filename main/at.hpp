@@ -0,0 +1,95 @@
+// vim: tabstop=4 shiftwidth=4 noexpandtab colorcolumn=120 :
+// This file is part of the Sim800 (https://github.com/beranat/sim800).
+// Copyright (c) 2021 Anatoly L. Berenblit.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 3.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+
+#include <string_view>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <esp_err.h>
+
+// AT transaction engine: commands are queued and sent one at a time, every response line up to the final result
+// belongs to the active command.
+
+constexpr size_t atCommandMax = 128;
+constexpr size_t atResponseMax = 256;
+constexpr size_t atQueueLength = 16;	// sockets: send window and a read per connection
+constexpr TickType_t atDefaultTimeout = pdMS_TO_TICKS(1000);
+
+enum class AtResult : uint32_t {
+	Ok,
+	Connect,
+	Error,
+	CmeError,
+	CmsError,
+	NoCarrier,
+	Busy,
+	NoAnswer,
+	NoDialtone,
+	Timeout,
+};
+
+// Intermediate lines collected up to atResponseMax ('\n' separated, zero terminated)
+struct AtResponse {
+	AtResult result = AtResult::Timeout;
+	int code = 0;	// +CME/+CMS error code
+	unsigned lines = 0;
+	size_t length = 0;
+	char text[atResponseMax] = {};
+};
+
+// Callbacks are called on the receiver (timer for timeout) task, they must not block. The timer task stack is
+// CONFIG_FREERTOS_TIMER_TASK_STACK_DEPTH (raised to 4096, see sdkconfig.defaults).
+// Line callback must not submit commands, done callback may.
+typedef void (*AtLineCallback)(std::string_view line, void *arg);
+typedef void (*AtDoneCallback)(AtResult result, int code, void *arg);
+
+struct AtRequest {
+	char command[atCommandMax] = {};	// full command w/o CR, e.g. "AT+CSQ"
+	TickType_t timeout = atDefaultTimeout;
+	AtLineCallback onLine = nullptr;	// intermediate lines, otherwise collected into response
+	AtDoneCallback onDone = nullptr;
+	void *arg = nullptr;
+	AtResponse *response = nullptr;	// must stay valid till completion
+	TaskHandle_t notify = nullptr;	// notified with AtResult value on completion
+	const void *data = nullptr;		// sent on `> ' prompt (AT+CIPSEND, AT+CMGS), must stay valid till completion
+	size_t dataLength = 0;
+	bool isLineResult = false;		// the first response line is the result (AT+CIFSR has no OK)
+	bool isQuiet = false;			// failure is expected (probe), logged at debug level
+};
+
+esp_err_t atInit() noexcept;
+
+// Queue request, waits up to `wait' for free slot
+esp_err_t atSubmit(const AtRequest &request, TickType_t wait = 0) noexcept;
+esp_err_t atSubmit(const char *command, AtDoneCallback onDone = nullptr, void *arg = nullptr,
+				   TickType_t timeout = atDefaultTimeout) noexcept;
+
+// Queue and wait for the final result (calling task notification is used)
+AtResult atCommand(const char *command, AtResponse *response = nullptr, TickType_t timeout = atDefaultTimeout) noexcept;
+AtResult atCommand(AtRequest request) noexcept;	// onDone/notify are replaced
+
+// Receiver hook, returns true if the line belongs to the active command
+bool atParseLine(std::string_view line) noexcept;
+
+// Receiver hook: `> ' prompt, data of the active command is sent (w/o waiting for the modem flow, the rest goes
+// by a timer). echo - length of the echoed data to skip
+bool atPrompt(size_t &echo) noexcept;
+
+// Line is information response of the active command (e.g. "+CREG: ..." for AT+CREG?), not an URC
+bool atIsResponse(std::string_view line) noexcept;
+
+const char *atResultName(AtResult result) noexcept;
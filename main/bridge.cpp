@@ -0,0 +1,136 @@
+// vim: tabstop=4 shiftwidth=4 noexpandtab colorcolumn=120 :
+// This file is part of the Sim800 (https://github.com/beranat/sim800).
+// Copyright (c) 2021 Anatoly L. Berenblit.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 3.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <esp_timer.h>
+#include <driver/uart.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include "sdkconfig.h"
+
+#include "console.hpp"
+#include "sim.hpp"
+#include "bridge.hpp"
+
+constexpr const char *MODULE = "bridge";
+
+constexpr uart_port_t consolePort = CONFIG_ESP_CONSOLE_UART_NUM;
+
+// Console to modem chunk, modem to console goes straight from the receiver ring (up to its size)
+constexpr size_t bridgeChunk = 1024;
+constexpr TickType_t bridgePoll = pdMS_TO_TICKS(20);
+constexpr TickType_t bridgeDrain = pdMS_TO_TICKS(500);
+
+// Escape: Ctrl-] x3 after a guard time, an incomplete sequence is passed to the modem
+constexpr uint8_t escapeChar = 0x1d;
+constexpr unsigned int escapeLength = 3;
+constexpr int64_t escapeGuardUs = 1000000;
+static const uint8_t escapeChars[escapeLength] = {escapeChar, escapeChar, escapeChar};
+
+static uint8_t bridgeBuffer[bridgeChunk];
+
+static void bridgeOutput(const uint8_t *data, size_t length, void *) noexcept {
+	uart_write_bytes(consolePort, reinterpret_cast<const char *>(data), length);
+}
+
+// Forward console input until the escape sequence, false on console error
+static bool bridgeInput() noexcept {
+	unsigned int escapes = 0;
+	int64_t last = esp_timer_get_time();
+
+	for (;;) {
+		const int length = uart_read_bytes(consolePort, bridgeBuffer, sizeof(bridgeBuffer), bridgePoll);
+		const int64_t now = esp_timer_get_time();
+		if (length < 0)
+			return false;
+
+		if (0 == length) {
+			if (0 != escapes && now - last >= escapeGuardUs) {
+				simWrite(escapeChars, escapes);
+				escapes = 0;
+			}
+			continue;
+		}
+
+		size_t from = 0;
+		for (size_t i = 0; i < static_cast<size_t>(length); ++i) {
+			if (escapeChar == bridgeBuffer[i] && (0 != escapes || (0 == i && now - last >= escapeGuardUs))) {
+				if (i > from)
+					simWrite(bridgeBuffer + from, i - from);
+				from = i + 1;
+				if (escapeLength == ++escapes)
+					return true;
+				continue;
+			}
+
+			if (0 != escapes) {
+				simWrite(escapeChars, escapes);
+				escapes = 0;
+			}
+		}
+
+		if (from < static_cast<size_t>(length))
+			simWrite(bridgeBuffer + from, length - from);
+		last = now;
+	}
+}
+
+// bridge [baud|max] - console rate for the session, max is the modem link rate
+static int bridgeCommand(int argc, char **argv) {
+	if (2 < argc)
+		return ESP_ERR_INVALID_ARG;
+
+	uint32_t consoleBaud = 0;
+	if (ESP_OK != uart_get_baudrate(consolePort, &consoleBaud))
+		return ESP_FAIL;
+
+	uint32_t bridgeBaud = consoleBaud;
+	if (2 == argc) {
+		char *end = nullptr;
+		bridgeBaud = (0 == strcmp(argv[1], "max")) ? simBaudRate() : strtoul(argv[1], &end, 10);
+		if ((nullptr != end && '\0' != *end) || 0 == bridgeBaud)
+			return ESP_ERR_INVALID_ARG;
+	}
+
+	if (!simRaw(&bridgeOutput)) {
+		printf("%s: modem UART is busy (multiplexer?)\n", MODULE);
+		return ESP_ERR_INVALID_STATE;
+	}
+
+	printf("%s: SIM800 %d baud, console %" PRIu32 " baud, Ctrl-] x3 after a pause to exit\n", MODULE,
+		   simBaudRate(), bridgeBaud);
+	fflush(stdout);
+	uart_wait_tx_done(consolePort, bridgeDrain);
+	if (bridgeBaud != consoleBaud)
+		uart_set_baudrate(consolePort, bridgeBaud);
+	const bool isOk = bridgeInput();
+	simRaw(nullptr);
+
+	uart_wait_tx_done(consolePort, bridgeDrain);
+	if (bridgeBaud != consoleBaud)
+		uart_set_baudrate(consolePort, consoleBaud);
+	printf("\n%s: closed\n", MODULE);
+	return isOk ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t bridgeInit() noexcept {
+	return consoleAdd("bridge", "Connect console to the modem UART, Ctrl-] x3 to exit [baud|max]", &bridgeCommand);
+}
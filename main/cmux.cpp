@@ -0,0 +1,668 @@
+// vim: tabstop=4 shiftwidth=4 noexpandtab colorcolumn=120 :
+// This file is part of the Sim800 (https://github.com/beranat/sim800).
+// Copyright (c) 2021 Anatoly L. Berenblit.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 3.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <esp_log.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+
+#include "console.hpp"
+#include "hal.hpp"
+#include "at.hpp"
+#include "sim.hpp"
+#include "dlog.hpp"
+#include "stats.hpp"
+#include "cmux.hpp"
+
+constexpr const char *MODULE = "cmux";
+
+// Basic option, UIH frames, default N1 (127) and timers
+constexpr const char *cmuxCommand = "AT+CMUX=0";
+
+constexpr uint8_t frameFlag = 0xF9;
+constexpr uint8_t addressEa = 0x01;
+constexpr uint8_t addressCr = 0x02;
+constexpr uint8_t controlPf = 0x10;
+
+enum Control : uint8_t {
+	Sabm = 0x2F,
+	Ua = 0x63,
+	Dm = 0x0F,
+	Disc = 0x43,
+	Uih = 0xEF,
+	Ui = 0x03,
+};
+
+// Control channel message types w/o C/R bit
+constexpr uint8_t messageCr = 0x02;
+enum Message : uint8_t {
+	Cld = 0xC1,
+	Test = 0x21,
+	Msc = 0xE1,
+	Fcon = 0xA1,
+	Fcoff = 0x61,
+	Psc = 0x41,
+	Nsc = 0x11,
+};
+
+// MSC V.24 signals octet
+constexpr uint8_t signalFc = 0x02;
+constexpr uint8_t signalRtc = 0x04;
+constexpr uint8_t signalRtr = 0x08;
+constexpr uint8_t signalDv = 0x80;
+constexpr uint8_t signalsDefault = addressEa | signalRtc | signalRtr | signalDv;
+
+constexpr unsigned int startTries = 3;
+constexpr TickType_t stoppedPoll = pdMS_TO_TICKS(10);
+constexpr TickType_t cmuxSendWait = pdMS_TO_TICKS(300);
+
+// FCS - reversed CRC-8 (x^8 + x^2 + x + 1), check over the header and FCS is 0xCF
+struct FcsTable {
+	uint8_t crc[256];
+
+	constexpr FcsTable() : crc() {
+		for (unsigned int i = 0; i < 256; ++i) {
+			uint8_t value = i;
+			for (unsigned int bit = 0; bit < 8; ++bit)
+				value = (value & 1) ? (value >> 1) ^ 0xE0 : (value >> 1);
+			crc[i] = value;
+		}
+	}
+};
+static constexpr FcsTable fcsTable;
+constexpr uint8_t fcsCheck = 0xCF;
+
+static uint8_t fcsUpdate(uint8_t crc, const uint8_t *data, size_t length) noexcept {
+	while (0 != length--)
+		crc = fcsTable.crc[crc ^ *data++];
+	return crc;
+}
+
+enum class MuxState : uint8_t {
+	Off,		// receiver bytes are AT lines
+	Starting,	// deframer runs, AT channel is not ready
+	On,
+};
+
+enum class ChannelState : uint8_t {
+	Closed,
+	Open,
+};
+
+struct Channel {
+	std::atomic<ChannelState> state = ChannelState::Closed;
+	CmuxReceiveCallback callback = nullptr;
+	void *arg = nullptr;
+	std::atomic<bool> isStopped = false;	// modem flow control
+	std::atomic<bool> isThrottled = false;	// ours, buffer is full
+	// single producer (receiver) ring
+	std::atomic<size_t> head = 0;
+	std::atomic<size_t> tail = 0;
+	SemaphoreHandle_t readable = nullptr;
+	uint8_t ring[cmuxChannelBuffer];
+};
+
+static std::atomic<MuxState> muxState = MuxState::Off;
+static std::atomic<bool> muxIsStopped = false;	// FCoff - all channels
+static Channel channels[cmuxDlciMax];
+
+static SemaphoreHandle_t muxLock = nullptr;		// start/stop/open/close
+static SemaphoreHandle_t txLock = nullptr;		// frame writes
+
+// Awaited response of the control procedure (SABM/DISC/CLD), under muxLock
+constexpr int awaitCld = 0x100;
+static std::atomic<int> awaited = -1;
+static std::atomic<bool> awaitedOk = false;
+static SemaphoreHandle_t awaitedDone = nullptr;
+
+// Deframer, receiver task only
+enum class RxState : uint8_t {
+	Flag,
+	Address,
+	Control,
+	Length,
+	Length2,
+	Data,
+	Fcs,
+	End,
+};
+
+static struct {
+	RxState state = RxState::Flag;
+	uint8_t address = 0;
+	uint8_t control = 0;
+	uint8_t crc = 0;
+	size_t length = 0;
+	size_t received = 0;
+	uint8_t data[cmuxFrameMax];
+} rx;
+
+static Channel *channelOf(uint8_t dlci) noexcept {
+	return (0 != dlci && dlci <= cmuxDlciMax) ? &channels[dlci - 1] : nullptr;
+}
+
+static esp_err_t frameSend(uint8_t dlci, uint8_t control, bool isCommand, const void *data = nullptr,
+						   size_t length = 0) noexcept {
+	if (length > cmuxFrameMax)
+		return ESP_ERR_INVALID_SIZE;
+
+	uint8_t frame[cmuxFrameMax + 6];
+	frame[0] = frameFlag;
+	frame[1] = static_cast<uint8_t>((dlci << 2) | (isCommand ? addressCr : 0) | addressEa);
+	frame[2] = control;
+	frame[3] = static_cast<uint8_t>((length << 1) | addressEa);
+	if (0 != length)
+		memcpy(frame + 4, data, length);
+	frame[4 + length] = 0xFF - fcsUpdate(0xFF, frame + 1, 3);
+	frame[5 + length] = frameFlag;
+
+	const size_t size = length + 6;
+	xSemaphoreTake(txLock, portMAX_DELAY);
+	const bool isSent = (halUartWrite(frame, size) == static_cast<int>(size));
+	xSemaphoreGive(txLock);
+	if (!isSent)
+		return ESP_FAIL;
+	statsAdd(StatsCounter::SendBytes, size);
+	return ESP_OK;
+}
+
+// Control channel message, value length < 128
+static esp_err_t messageSend(uint8_t type, bool isCommand, const uint8_t *values, size_t length) noexcept {
+	uint8_t message[2 + 8];
+	if (length > sizeof(message) - 2)
+		return ESP_ERR_INVALID_SIZE;
+	message[0] = type | (isCommand ? messageCr : 0) | addressEa;
+	message[1] = static_cast<uint8_t>((length << 1) | addressEa);
+	memcpy(message + 2, values, length);
+	return frameSend(0, Uih, true, message, length + 2);
+}
+
+static esp_err_t mscSend(uint8_t dlci, bool isFlowStop) noexcept {
+	const uint8_t values[] = {
+		static_cast<uint8_t>((dlci << 2) | 0x02 | addressEa),
+		static_cast<uint8_t>(signalsDefault | (isFlowStop ? signalFc : 0)),
+	};
+	return messageSend(Msc, true, values, sizeof(values));
+}
+
+// Sends the command and waits for its response, caller holds muxLock
+static bool procedure(int await, uint8_t dlci, uint8_t control, const void *data = nullptr,
+					  size_t length = 0) noexcept {
+	xSemaphoreTake(awaitedDone, 0);
+	awaitedOk = false;
+	awaited = await;
+	bool isOk = (ESP_OK == frameSend(dlci, control, true, data, length)) &&
+				pdTRUE == xSemaphoreTake(awaitedDone, cmuxResponseTimeout) && awaitedOk;
+	awaited = -1;
+	return isOk;
+}
+
+static void awaitedResponse(int response, bool isOk) noexcept {
+	if (response != awaited.load())
+		return;
+	awaitedOk = isOk;
+	xSemaphoreGive(awaitedDone);
+}
+
+static void channelReset(Channel &channel) noexcept {
+	channel.state = ChannelState::Closed;
+	channel.isStopped = false;
+	channel.isThrottled = false;
+	channel.head = 0;
+	channel.tail = 0;
+	xSemaphoreGive(channel.readable);	// wake the reader up
+}
+
+static void channelInput(uint8_t dlci, const uint8_t *data, size_t length) noexcept {
+	Channel *channel = channelOf(dlci);
+	if (nullptr == channel || ChannelState::Open != channel->state) {
+		DLOG(Warn, MODULE, "Data for closed DLCI %u", dlci);
+		return;
+	}
+
+	if (nullptr != channel->callback) {
+		channel->callback(dlci, data, length, channel->arg);
+		return;
+	}
+
+	const size_t head = channel->head.load(std::memory_order_relaxed);
+	const size_t free = cmuxChannelBuffer - (head - channel->tail.load(std::memory_order_acquire));
+	if (length > free) {
+		statsAdd(StatsCounter::MuxErrors);
+		DLOG(Warn, MODULE, "DLCI %u buffer overflow, %zu bytes lost", dlci, length - free);
+		length = free;
+	}
+	for (size_t i = 0; i < length; ++i)
+		channel->ring[(head + i) % cmuxChannelBuffer] = data[i];
+	channel->head.store(head + length, std::memory_order_release);
+
+	if (free - length < 2 * cmuxFrameMax && !channel->isThrottled.exchange(true))
+		mscSend(dlci, true);
+	xSemaphoreGive(channel->readable);
+}
+
+static void messageReceived(const uint8_t *data, size_t length) noexcept {
+	if (length < 2)
+		return;
+	const uint8_t type = data[0] & ~messageCr;
+	const bool isCommand = 0 != (data[0] & messageCr);
+	size_t valuesLength = data[1] >> 1;
+	const uint8_t *values = data + 2;
+	if (valuesLength > length - 2)
+		valuesLength = length - 2;
+
+	if (!isCommand) {
+		if (Cld == type)
+			awaitedResponse(awaitCld, true);
+		return;
+	}
+
+	switch (type) {
+		case Msc:
+			if (valuesLength >= 2) {
+				Channel *channel = channelOf(values[0] >> 2);
+				if (nullptr != channel)
+					channel->isStopped = 0 != (values[1] & signalFc);
+			}
+			break;
+		case Fcon:
+		case Fcoff:
+			muxIsStopped = (Fcoff == type);
+			break;
+		case Cld:
+			muxState = MuxState::Off;
+			break;
+		case Test:
+		case Psc:
+			break;
+		default: {
+			const uint8_t unknown = data[0];
+			messageSend(Nsc, false, &unknown, 1);
+			return;
+		}
+	}
+	messageSend(type, false, values, valuesLength);
+}
+
+static void frameReceived() noexcept {
+	statsAdd(StatsCounter::MuxFrames);
+	const uint8_t dlci = rx.address >> 2;
+	switch (rx.control & ~controlPf) {
+		case Ua:
+		case Dm:
+			awaitedResponse(dlci, Ua == (rx.control & ~controlPf));
+			break;
+		case Disc: {
+			frameSend(dlci, Ua | controlPf, false);
+			Channel *channel = channelOf(dlci);
+			if (nullptr != channel)
+				channelReset(*channel);
+			else if (0 == dlci) {
+				ESP_LOGW(MODULE, "Closed by modem");
+				muxState = MuxState::Off;
+			}
+			break;
+		}
+		case Sabm:
+			frameSend(dlci, Dm | controlPf, false);
+			break;
+		case Uih:
+		case Ui:
+			if (0 == dlci)
+				messageReceived(rx.data, rx.length);
+			else if (0 != rx.length)
+				channelInput(dlci, rx.data, rx.length);
+			break;
+		default:
+			DLOG(Debug, MODULE, "Frame %02x on DLCI %u ignored", rx.control, dlci);
+			break;
+	}
+}
+
+// Receiver raw callback: frames while the multiplexer runs, AT lines when it is off (modem closed it)
+static void cmuxInput(const uint8_t *data, size_t length, void *) noexcept {
+	if (MuxState::Off == muxState.load()) {
+		simFeed(data, length);
+		return;
+	}
+
+	for (size_t i = 0; i < length; ++i) {
+		const uint8_t byte = data[i];
+		switch (rx.state) {
+			case RxState::Flag:
+				if (frameFlag == byte)
+					rx.state = RxState::Address;
+				break;
+			case RxState::Address:
+				if (frameFlag == byte)
+					break;	// flags between frames
+				rx.address = byte;
+				rx.crc = fcsUpdate(0xFF, &byte, 1);
+				rx.state = RxState::Control;
+				break;
+			case RxState::Control:
+				rx.control = byte;
+				rx.crc = fcsUpdate(rx.crc, &byte, 1);
+				rx.state = RxState::Length;
+				break;
+			case RxState::Length:
+				rx.crc = fcsUpdate(rx.crc, &byte, 1);
+				rx.length = byte >> 1;
+				rx.received = 0;
+				if (0 == (byte & addressEa))
+					rx.state = RxState::Length2;
+				else
+					rx.state = (0 != rx.length) ? RxState::Data : RxState::Fcs;
+				break;
+			case RxState::Length2:
+				rx.crc = fcsUpdate(rx.crc, &byte, 1);
+				rx.length |= static_cast<size_t>(byte) << 7;
+				if (rx.length > cmuxFrameMax) {
+					statsAdd(StatsCounter::MuxErrors);
+					rx.state = RxState::Flag;
+				} else
+					rx.state = (0 != rx.length) ? RxState::Data : RxState::Fcs;
+				break;
+			case RxState::Data:
+				rx.data[rx.received++] = byte;
+				if (rx.received == rx.length)
+					rx.state = RxState::Fcs;
+				break;
+			case RxState::Fcs:
+				if (fcsCheck == fcsUpdate(rx.crc, &byte, 1))
+					rx.state = RxState::End;
+				else {
+					statsAdd(StatsCounter::MuxErrors);
+					DLOG(Warn, MODULE, "FCS error, DLCI %u", rx.address >> 2);
+					rx.state = RxState::Flag;
+				}
+				break;
+			case RxState::End:
+				if (frameFlag == byte)
+					frameReceived();
+				else
+					statsAdd(StatsCounter::MuxErrors);
+				// closing flag opens the next frame
+				rx.state = (frameFlag == byte) ? RxState::Address : RxState::Flag;
+				break;
+		}
+	}
+}
+
+static void atInput(uint8_t, const uint8_t *data, size_t length, void *) noexcept {
+	simFeed(data, length);
+}
+
+// Caller holds muxLock
+static esp_err_t channelOpen(uint8_t dlci, CmuxReceiveCallback callback, void *arg) noexcept {
+	Channel *channel = channelOf(dlci);
+	if (nullptr == channel)
+		return ESP_ERR_INVALID_ARG;
+	if (ChannelState::Closed != channel->state)
+		return ESP_ERR_INVALID_STATE;
+
+	channel->callback = callback;
+	channel->arg = arg;
+	channelReset(*channel);
+	xSemaphoreTake(channel->readable, 0);
+	channel->state = ChannelState::Open;	// data may follow UA at once
+	if (!procedure(dlci, dlci, Sabm | controlPf)) {
+		channel->state = ChannelState::Closed;
+		ESP_LOGW(MODULE, "DLCI %u open failed", dlci);
+		return ESP_ERR_TIMEOUT;
+	}
+	mscSend(dlci, false);
+	return ESP_OK;
+}
+
+static void channelClose(uint8_t dlci) noexcept {
+	Channel *channel = channelOf(dlci);
+	if (nullptr == channel || ChannelState::Closed == channel->state)
+		return;
+	if (!procedure(dlci, dlci, Disc | controlPf))
+		ESP_LOGW(MODULE, "DLCI %u close is not confirmed", dlci);
+	channelReset(*channel);
+}
+
+class MuxGuard final {
+	public:
+		MuxGuard() noexcept {
+			xSemaphoreTake(muxLock, portMAX_DELAY);
+		}
+		~MuxGuard() {
+			xSemaphoreGive(muxLock);
+		}
+};
+
+bool cmuxIsActive() noexcept {
+	return MuxState::On == muxState.load();
+}
+
+esp_err_t cmuxStart() noexcept {
+	const MuxGuard guard;
+	if (MuxState::Off != muxState.load())
+		return ESP_ERR_INVALID_STATE;
+
+	if (AtResult::Ok != atCommand(cmuxCommand)) {
+		ESP_LOGW(MODULE, "%s is not accepted", cmuxCommand);
+		return ESP_FAIL;
+	}
+
+	rx.state = RxState::Flag;
+	muxIsStopped = false;
+	muxState = MuxState::Starting;
+	if (!simRaw(&cmuxInput)) {
+		muxState = MuxState::Off;
+		ESP_LOGE(MODULE, "Receiver is busy");
+		return ESP_ERR_INVALID_STATE;
+	}
+
+	bool isOk = false;
+	for (unsigned int i = 0; i < startTries && !isOk; ++i)
+		isOk = procedure(0, 0, Sabm | controlPf);
+	esp_err_t result = isOk ? channelOpen(cmuxDlciAt, &atInput, nullptr) : ESP_ERR_TIMEOUT;
+	if (ESP_OK != result) {
+		ESP_LOGE(MODULE, "Start error %s (%d)", esp_err_to_name(result), static_cast<int>(result));
+		muxState = MuxState::Off;
+		simRaw(nullptr);
+		return result;
+	}
+
+	muxState = MuxState::On;
+	ESP_LOGI(MODULE, "Started, AT on DLCI %u", cmuxDlciAt);
+	return ESP_OK;
+}
+
+esp_err_t cmuxStop() noexcept {
+	const MuxGuard guard;
+	if (MuxState::Off == muxState.load()) {
+		simRaw(nullptr);
+		return ESP_OK;
+	}
+
+	for (uint8_t dlci = cmuxDlciMax; dlci > 0; --dlci) {
+		if (cmuxDlciAt != dlci)
+			channelClose(dlci);
+	}
+
+	// AT goes to the channel till the close down
+	const uint8_t cld[] = { Cld | messageCr | addressEa, addressEa };
+	const bool isOk = procedure(awaitCld, 0, Uih, cld, sizeof(cld));
+	muxState = MuxState::Off;
+	simRaw(nullptr);
+	for (Channel &channel : channels)
+		channelReset(channel);
+
+	if (!isOk)
+		ESP_LOGW(MODULE, "Close down is not confirmed");
+	ESP_LOGI(MODULE, "Stopped");
+	return isOk ? ESP_OK : ESP_ERR_TIMEOUT;
+}
+
+esp_err_t cmuxOpen(uint8_t dlci, CmuxReceiveCallback callback, void *arg) noexcept {
+	const MuxGuard guard;
+	if (MuxState::On != muxState.load())
+		return ESP_ERR_INVALID_STATE;
+	if (cmuxDlciAt == dlci)
+		return ESP_ERR_INVALID_ARG;
+	return channelOpen(dlci, callback, arg);
+}
+
+esp_err_t cmuxClose(uint8_t dlci) noexcept {
+	const MuxGuard guard;
+	if (cmuxDlciAt == dlci || nullptr == channelOf(dlci))
+		return ESP_ERR_INVALID_ARG;
+	if (MuxState::On == muxState.load())
+		channelClose(dlci);
+	return ESP_OK;
+}
+
+int cmuxRead(uint8_t dlci, void *data, size_t length, TickType_t wait) noexcept {
+	Channel *channel = channelOf(dlci);
+	if (nullptr == channel || nullptr != channel->callback)
+		return -1;
+
+	size_t tail = channel->tail.load(std::memory_order_relaxed);
+	size_t available = channel->head.load(std::memory_order_acquire) - tail;
+	while (0 == available) {
+		if (ChannelState::Open != channel->state)
+			return -1;
+		if (pdTRUE != xSemaphoreTake(channel->readable, wait))
+			return 0;
+		available = channel->head.load(std::memory_order_acquire) - tail;
+	}
+
+	if (length > available)
+		length = available;
+	uint8_t *bytes = reinterpret_cast<uint8_t *>(data);
+	for (size_t i = 0; i < length; ++i)
+		bytes[i] = channel->ring[(tail + i) % cmuxChannelBuffer];
+	channel->tail.store(tail + length, std::memory_order_release);
+
+	if (available - length <= cmuxChannelBuffer / 2 && channel->isThrottled.exchange(false))
+		mscSend(dlci, false);
+	return static_cast<int>(length);
+}
+
+esp_err_t cmuxWrite(uint8_t dlci, const void *data, size_t length, TickType_t wait, size_t *written) noexcept {
+	if (nullptr != written)
+		*written = 0;
+	Channel *channel = channelOf(dlci);
+	if (nullptr == channel)
+		return ESP_ERR_INVALID_ARG;
+
+	const uint8_t *bytes = reinterpret_cast<const uint8_t *>(data);
+	const TickType_t start = xTaskGetTickCount();
+	while (0 != length) {
+		if (ChannelState::Open != channel->state)
+			return ESP_ERR_INVALID_STATE;
+		if (channel->isStopped || muxIsStopped) {
+			if (portMAX_DELAY != wait && xTaskGetTickCount() - start >= wait)
+				return ESP_ERR_TIMEOUT;
+			vTaskDelay(stoppedPoll);
+			continue;
+		}
+
+		const size_t chunk = (length < cmuxFrameMax) ? length : cmuxFrameMax;
+		const esp_err_t result = frameSend(dlci, Uih, true, bytes, chunk);
+		if (ESP_OK != result)
+			return result;
+		bytes += chunk;
+		length -= chunk;
+		if (nullptr != written)
+			*written += chunk;
+	}
+	return ESP_OK;
+}
+
+static const char *muxStateName(MuxState state) noexcept {
+	switch (state) {
+		case MuxState::Off:
+			return "off";
+		case MuxState::Starting:
+			return "starting";
+		case MuxState::On:
+			return "on";
+	}
+	return "unknown";
+}
+
+// Line to the buffered channel and what it answers in a while
+static int cmuxCommandSend(uint8_t dlci, const char *text) {
+	char buffer[128];
+	snprintf(buffer, sizeof(buffer), "%s\r", text);
+	const esp_err_t result = cmuxWrite(dlci, buffer, strlen(buffer), cmuxResponseTimeout);
+	if (ESP_OK != result)
+		return result;
+
+	int length;
+	while (0 < (length = cmuxRead(dlci, buffer, sizeof(buffer), cmuxSendWait)))
+		fwrite(buffer, 1, length, stdout);
+	printf("\n");
+	return (0 == length) ? ESP_OK : ESP_FAIL;
+}
+
+// cmux [start|stop] | [open|close <dlci>] | [send <dlci> <line>]
+static int cmuxCommandRun(int argc, char **argv) {
+	if (2 == argc) {
+		if (0 == strcmp(argv[1], "start"))
+			return cmuxStart();
+		if (0 == strcmp(argv[1], "stop"))
+			return cmuxStop();
+		return ESP_ERR_INVALID_ARG;
+	}
+	if (3 <= argc) {
+		const uint8_t dlci = static_cast<uint8_t>(atoi(argv[2]));
+		if (3 == argc && 0 == strcmp(argv[1], "open"))
+			return cmuxOpen(dlci);
+		if (3 == argc && 0 == strcmp(argv[1], "close"))
+			return cmuxClose(dlci);
+		if (4 == argc && 0 == strcmp(argv[1], "send"))
+			return cmuxCommandSend(dlci, argv[3]);
+		return ESP_ERR_INVALID_ARG;
+	}
+
+	printf("%s: %s%s\n", MODULE, muxStateName(muxState.load()), muxIsStopped ? ", flow stopped" : "");
+	for (uint8_t dlci = 1; dlci <= cmuxDlciMax; ++dlci) {
+		const Channel &channel = channels[dlci - 1];
+		if (ChannelState::Open != channel.state)
+			continue;
+		printf("  DLCI %u%s%s%s, %zu buffered\n", dlci, (cmuxDlciAt == dlci) ? " AT" : "",
+			   channel.isStopped ? " stopped" : "", channel.isThrottled ? " throttled" : "",
+			   channel.head.load() - channel.tail.load());
+	}
+	return ESP_OK;
+}
+
+esp_err_t cmuxInit() noexcept {
+	muxLock = xSemaphoreCreateMutex();
+	txLock = xSemaphoreCreateMutex();
+	awaitedDone = xSemaphoreCreateBinary();
+	if (nullptr == muxLock || nullptr == txLock || nullptr == awaitedDone)
+		return ESP_ERR_NO_MEM;
+
+	for (Channel &channel : channels) {
+		channel.readable = xSemaphoreCreateBinary();
+		if (nullptr == channel.readable)
+			return ESP_ERR_NO_MEM;
+	}
+	return consoleAdd("cmux", "GSM 07.10 multiplexer [start|stop] [open|close <dlci>] [send <dlci> <line>]", &cmuxCommandRun);
+}
@@ -0,0 +1,54 @@
+// vim: tabstop=4 shiftwidth=4 noexpandtab colorcolumn=120 :
+// This file is part of the Sim800 (https://github.com/beranat/sim800).
+// Copyright (c) 2021 Anatoly L. Berenblit.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 3.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <freertos/FreeRTOS.h>
+#include <esp_err.h>
+
+// GSM 07.10 multiplexer (basic option) below the sim/at layers: the receiver hands modem bytes to the deframer
+// (simRaw), DLCI cmuxDlciAt carries AT commands and URCs (simSend/simFeed), other DLCIs are virtual channels
+// of their users (data). DLCI 0 is the control channel.
+
+constexpr uint8_t cmuxDlciAt = 1;
+constexpr uint8_t cmuxDlciMax = 3;			// SIM800 channels 1..3
+constexpr size_t cmuxFrameMax = 127;		// N1, one byte length field
+constexpr size_t cmuxChannelBuffer = 1024;	// receive buffer of a channel w/o callback
+constexpr TickType_t cmuxResponseTimeout = pdMS_TO_TICKS(1000);	// T2
+
+// Channel data on the receiver task, must not block
+typedef void (*CmuxReceiveCallback)(uint8_t dlci, const uint8_t *data, size_t length, void *arg);
+
+// AT+CMUX and control/AT channels setup, modem stays in AT mode on error
+esp_err_t cmuxStart() noexcept;
+// Close down, the modem is back to AT mode
+esp_err_t cmuxStop() noexcept;
+bool cmuxIsActive() noexcept;
+
+// Callback gets the data, otherwise it is buffered for cmuxRead() (flow control stops the modem when full)
+esp_err_t cmuxOpen(uint8_t dlci, CmuxReceiveCallback callback = nullptr, void *arg = nullptr) noexcept;
+esp_err_t cmuxClose(uint8_t dlci) noexcept;
+
+// Returns received length (0 on timeout) or -1 if the channel is closed
+int cmuxRead(uint8_t dlci, void *data, size_t length, TickType_t wait) noexcept;
+// Splits data into frames, waits while the modem stops the channel (flow control). written - length sent in frames,
+// less than length on error
+esp_err_t cmuxWrite(uint8_t dlci, const void *data, size_t length, TickType_t wait = portMAX_DELAY,
+					size_t *written = nullptr) noexcept;
+
+esp_err_t cmuxInit() noexcept;
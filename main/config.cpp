@@ -0,0 +1,95 @@
+// vim: tabstop=4 shiftwidth=4 noexpandtab colorcolumn=120 :
+// This file is part of the Sim800 (https://github.com/beranat/sim800).
+// Copyright (c) 2021 Anatoly L. Berenblit.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 3.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+#include <cstddef>
+#include <cstring>
+
+#include <esp_log.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+
+#include "storage.hpp"
+#include "config.hpp"
+
+constexpr const char *MODULE = "config";
+
+constexpr uint16_t configVersion = 1;
+
+static bool configMigrate(uint16_t version, const void *payload, size_t length, void *data) noexcept;
+
+constexpr StorageField configLegacy[] = {
+	{ "sim-baud", StorageField::Type::I32, offsetof(Config, simBaudRate), sizeof(Config::simBaudRate) },
+};
+
+static const StorageSchema configSchema = {
+	"config",
+	configVersion,
+	sizeof(Config),
+	&configMigrate,
+	configLegacy,
+	sizeof(configLegacy) / sizeof(*configLegacy),
+};
+
+static Config config;
+static SemaphoreHandle_t configLock = nullptr;
+
+// Older payload into the current Config (defaults on input), layouts of the previous versions live here
+bool configMigrate(uint16_t version, const void *payload, size_t length, void *data) noexcept {
+	switch (version) {
+		default:
+			ESP_LOGW(MODULE, "No migration from version %u (%zu bytes)", version, length);
+			return false;
+	}
+}
+
+esp_err_t configInit() noexcept {
+	if (nullptr != configLock)
+		return ESP_ERR_INVALID_STATE;
+
+	configLock = xSemaphoreCreateMutex();
+	if (nullptr == configLock)
+		return ESP_ERR_NO_MEM;
+
+	xSemaphoreTake(configLock, portMAX_DELAY);
+	if (!Storage::getInstance().load(configSchema, &config))
+		ESP_LOGI(MODULE, "Snapshot v%u created", configVersion);
+	xSemaphoreGive(configLock);
+	return ESP_OK;
+}
+
+Config configGet() noexcept {
+	if (nullptr == configLock)
+		return Config();
+
+	xSemaphoreTake(configLock, portMAX_DELAY);
+	const Config result = config;
+	xSemaphoreGive(configLock);
+	return result;
+}
+
+bool configSet(const Config &value) noexcept {
+	if (nullptr == configLock)
+		return false;
+
+	xSemaphoreTake(configLock, portMAX_DELAY);
+	bool isOk = true;
+	if (0 != memcmp(&config, &value, sizeof(config))) {
+		config = value;
+		isOk = Storage::getInstance().save(configSchema, &config);
+	}
+	xSemaphoreGive(configLock);
+	return isOk;
+}
@@ -0,0 +1,32 @@
+// vim: tabstop=4 shiftwidth=4 noexpandtab colorcolumn=120 :
+// This file is part of the Sim800 (https://github.com/beranat/sim800).
+// Copyright (c) 2021 Anatoly L. Berenblit.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 3.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+
+#include <cstdint>
+
+#include <esp_err.h>
+
+// Device configuration, one versioned Storage snapshot ("config") loaded by configInit() at boot.
+// Values of the firmware before the snapshot (per-key NVS) are picked up once and saved into it.
+// Changing the layout: bump configVersion and convert the old payload in configMigrate() (config.cpp).
+
+struct Config {
+	int32_t simBaudRate = 0;	// last negotiated modem link rate, 0 - unknown
+};
+
+esp_err_t configInit() noexcept;
+Config configGet() noexcept;	// defaults before configInit()
+bool configSet(const Config &config) noexcept;
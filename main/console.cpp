@@ -14,11 +14,13 @@
 // You should have received a copy of the GNU General Public License
 // along with this program. If not, see <http://www.gnu.org/licenses/>.
 #include <esp_log.h>
+#include <esp_timer.h>
 #include <esp_console.h>
 #include <esp_vfs_dev.h>
 #include <driver/uart.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
 
 #include <linenoise/linenoise.h>
 
@@ -28,12 +30,16 @@
 #include "main.hpp"
 #include "sdkconfig.h"
 
+#include "stats.hpp"
 #include "console.hpp"
 
 static constexpr const char *MODULE = "console";
 
 static constexpr unsigned int CONSOLE_UART_BAUDRATE = 115200;
 static constexpr unsigned int CONSOLE_UART_BUFFER_RX = 256;
+// driver buffers hold the bridge bursts
+static constexpr unsigned int CONSOLE_UART_DRIVER_RX = 2048;
+static constexpr unsigned int CONSOLE_UART_DRIVER_TX = 2048;
 static constexpr unsigned int CONSOLE_COMMANDLINE_ARGS = 8;
 static constexpr unsigned int CONSOLE_COMMANDLINE_HISTORY = 32;
 static constexpr unsigned int CONSOLE_COMMANDLINE_LENGTH = CONSOLE_UART_BUFFER_RX - 8;
@@ -70,7 +76,7 @@ esp_err_t consoleInit(void) noexcept {
 		.source_clk = UART_SCLK_REF_TICK
 	};
 
-	ESP_ERROR_CHECK(uart_driver_install(CONFIG_ESP_CONSOLE_UART_NUM, CONSOLE_UART_BUFFER_RX, 0, 0, NULL, 0));
+	ESP_ERROR_CHECK(uart_driver_install(CONFIG_ESP_CONSOLE_UART_NUM, CONSOLE_UART_DRIVER_RX, CONSOLE_UART_DRIVER_TX, 0, NULL, 0));
 	ESP_ERROR_CHECK(uart_param_config(CONFIG_ESP_CONSOLE_UART_NUM, &uart_config));
 
 	esp_vfs_dev_uart_use_driver(CONFIG_ESP_CONSOLE_UART_NUM);
@@ -128,7 +134,9 @@ void consoleLoop() noexcept {
 		linenoiseHistoryAdd(line);
 
 		int ret = 0;
+		const int64_t started = esp_timer_get_time();
 		const esp_err_t err = esp_console_run(line, &ret);
+		statsRecord(StatsHistogram::Console, esp_timer_get_time() - started);
 		switch (err) {
 			case ESP_ERR_NOT_FOUND:
 				printf("Unrecognized command\n");
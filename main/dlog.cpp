@@ -0,0 +1,331 @@
+// vim: tabstop=4 shiftwidth=4 noexpandtab colorcolumn=120 :
+// This file is part of the Sim800 (https://github.com/beranat/sim800).
+// Copyright (c) 2021 Anatoly L. Berenblit.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 3.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string_view>
+
+#include <strings.h>
+
+#include <esp_log.h>
+#include <esp_system.h>
+#include <esp_timer.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+
+#include "sdkconfig.h"
+
+#include "console.hpp"
+#include "dlog.hpp"
+
+constexpr const char *MODULE = "dlog";
+
+// Bounded MPSC ring (D. Vyukov): slot sequence equals position when free, position + 1 when filled
+constexpr size_t slotsCount = 32;	// power of 2
+static_assert(0 == (slotsCount & (slotsCount - 1)));
+
+constexpr unsigned int formatterStackSize = 3072;
+constexpr UBaseType_t formatterPriority = tskIDLE_PRIORITY;
+constexpr size_t messageMax = 256;
+
+struct Slot {
+	std::atomic<size_t> sequence;
+	const DlogFormat *format;
+	uint32_t time;	// ms
+	uint8_t length;
+	uint8_t data[dlogArgsMax];
+};
+
+static Slot slots[slotsCount];
+static std::atomic<size_t> head = 0;
+static size_t tail = 0;	// consumer, under formatterLock
+static std::atomic<uint32_t> dropped = 0;
+static SemaphoreHandle_t formatterLock = nullptr;
+static SemaphoreHandle_t formatterWakeup = nullptr;	// given when the ring is no more empty
+static std::atomic<bool> formatterIsIdle = false;
+
+std::atomic<DlogLevel> dlogLevel = static_cast<DlogLevel>(CONFIG_LOG_DEFAULT_LEVEL);
+
+void dlogPush(const DlogFormat &format, const DlogArgs &args) noexcept {
+	size_t position = head.load(std::memory_order_relaxed);
+	Slot *slot;
+	for (;;) {
+		slot = &slots[position & (slotsCount - 1)];
+		const size_t sequence = slot->sequence.load(std::memory_order_acquire);
+		const intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position);
+		if (0 == diff) {
+			if (head.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+				break;
+		} else if (diff < 0) {
+			dropped.fetch_add(1, std::memory_order_relaxed);
+			return;
+		} else
+			position = head.load(std::memory_order_relaxed);
+	}
+
+	slot->format = &format;
+	slot->time = static_cast<uint32_t>(esp_timer_get_time() / 1000);
+	slot->length = static_cast<uint8_t>(args.length);
+	memcpy(slot->data, args.data, args.length);
+	slot->sequence.store(position + 1, std::memory_order_release);
+
+	std::atomic_thread_fence(std::memory_order_seq_cst);	// pairs with the formatter: entry, then idle check
+	if (formatterIsIdle.exchange(false, std::memory_order_relaxed) && nullptr != formatterWakeup)
+		xSemaphoreGive(formatterWakeup);
+}
+
+namespace {
+
+// printf-like expansion of the recorded arguments
+class Formatter {
+	public:
+		Formatter(char *buffer, size_t size) noexcept : buffer_(buffer), size_(size) {
+			buffer_[0] = '\0';
+		}
+
+		size_t length() const noexcept {
+			return length_;
+		}
+
+		void format(const char *format, const uint8_t *data, size_t length) noexcept;
+
+		void append(const char *data, size_t length) noexcept {
+			const size_t free = size_ - 1 - length_;
+			if (length > free)
+				length = free;
+			memcpy(buffer_ + length_, data, length);
+			length_ += length;
+			buffer_[length_] = '\0';
+		}
+
+	private:
+		template <class... Args> void print(const char *spec, Args... args) noexcept {
+			const int result = snprintf(buffer_ + length_, size_ - length_, spec, args...);
+			if (result > 0)
+				length_ = (static_cast<size_t>(result) < size_ - length_) ? length_ + result : size_ - 1;
+		}
+
+		char *buffer_;
+		size_t size_;
+		size_t length_ = 0;
+};
+
+void Formatter::format(const char *format, const uint8_t *data, size_t length) noexcept {
+	size_t offset = 0;
+	for (const char *p = format; '\0' != *p;) {
+		const char *percent = strchr(p, '%');
+		if (nullptr == percent) {
+			append(p, strlen(p));
+			break;
+		}
+		append(p, percent - p);
+		p = percent + 1;
+		if ('%' == *p) {
+			append(p++, 1);
+			continue;
+		}
+
+		// flags, width and precision are kept, length modifiers are replaced by the recorded type
+		char spec[16] = "%";
+		size_t specLength = 1;
+		while (nullptr != strchr("-+ #0123456789.", *p) && '\0' != *p) {
+			if (specLength < sizeof(spec) - 4)
+				spec[specLength++] = *p;
+			++p;
+		}
+		while (nullptr != strchr("hlLqjzt", *p) && '\0' != *p)
+			++p;
+		const char conversion = *p;
+		if ('\0' == conversion)
+			break;
+		++p;
+
+		if (offset >= length) {
+			append("?", 1);
+			continue;
+		}
+		const auto type = static_cast<DlogArgs::Type>(data[offset++]);
+		const auto read = [&](auto &value) noexcept {
+			memcpy(&value, data + offset, sizeof(value));
+			offset += sizeof(value);
+		};
+
+		switch (type) {
+			case DlogArgs::String: {
+				const uint8_t size = data[offset++];
+				if ('s' == conversion) {
+					memcpy(spec + specLength, ".*s", 4);
+					print(spec, static_cast<int>(size), reinterpret_cast<const char *>(data + offset));
+				} else
+					append("?", 1);
+				offset += size;
+				break;
+			}
+			case DlogArgs::Double: {
+				double value;
+				read(value);
+				spec[specLength] = conversion;
+				print(spec, value);
+				break;
+			}
+			case DlogArgs::Pointer: {
+				const void *value;
+				read(value);
+				print("%p", value);
+				break;
+			}
+			default: {
+				long long value = 0;
+				if (DlogArgs::I32 == type) {
+					int32_t v;
+					read(v);
+					value = v;
+				} else if (DlogArgs::U32 == type) {
+					uint32_t v;
+					read(v);
+					value = v;
+				} else if (DlogArgs::I64 == type) {
+					int64_t v;
+					read(v);
+					value = v;
+				} else {
+					uint64_t v;
+					read(v);
+					value = static_cast<long long>(v);
+				}
+				if (nullptr == strchr("diouxXc", conversion)) {
+					append("?", 1);
+					break;
+				}
+				if ('c' != conversion) {
+					spec[specLength++] = 'l';
+					spec[specLength++] = 'l';
+				}
+				spec[specLength] = conversion;
+				if ('c' == conversion)
+					print(spec, static_cast<int>(value));
+				else
+					print(spec, value);
+				break;
+			}
+		}
+	}
+}
+
+} // namespace
+
+// Consumer side, caller holds formatterLock
+static bool formatNext() noexcept {
+	Slot &slot = slots[tail & (slotsCount - 1)];
+	if (slot.sequence.load(std::memory_order_acquire) != tail + 1)
+		return false;
+
+	static constexpr char letters[] = "NEWIDV";
+	const DlogFormat &format = *slot.format;
+	char message[messageMax];
+	Formatter formatter(message, sizeof(message));
+	formatter.format(format.format, slot.data, slot.length);
+	const uint32_t time = slot.time;
+	slot.sequence.store(tail + slotsCount, std::memory_order_release);
+	++tail;
+
+	printf("%c (%" PRIu32 ") %s: %s\n", letters[static_cast<size_t>(format.level)], time, format.tag, message);
+	return true;
+}
+
+static void formatDropped() noexcept {
+	const uint32_t count = dropped.exchange(0, std::memory_order_relaxed);
+	if (0 != count)
+		ESP_LOGW(MODULE, "%" PRIu32 " entries dropped", count);
+}
+
+void dlogFlush() noexcept {
+	if (nullptr == formatterLock || pdTRUE != xSemaphoreTake(formatterLock, portMAX_DELAY))
+		return;
+	while (formatNext())
+		;
+	formatDropped();
+	xSemaphoreGive(formatterLock);
+	fflush(stdout);
+}
+
+// Sleeps while the ring is empty: idle is raised before the last drain, so an entry pushed after it wakes us
+static void formatterTask(void *) {
+	for (;;) {
+		formatterIsIdle.store(true, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		dlogFlush();
+		xSemaphoreTake(formatterWakeup, portMAX_DELAY);
+	}
+}
+
+static const char *const levelNames[] = {"none", "error", "warn", "info", "debug", "verbose"};
+
+static bool parseLevel(const char *name, DlogLevel &level) noexcept {
+	for (size_t i = 0; i < sizeof(levelNames) / sizeof(levelNames[0]); ++i) {
+		if (0 == strcasecmp(name, levelNames[i])) {
+			level = static_cast<DlogLevel>(i);
+			return true;
+		}
+	}
+	return false;
+}
+
+static int logCommand(int argc, char **argv) {
+	DlogLevel level;
+	switch (argc) {
+		case 1:
+			printf("%s: level %s, %" PRIu32 " dropped\n", MODULE,
+				   levelNames[static_cast<size_t>(dlogLevel.load())], dropped.load());
+			return ESP_OK;
+		case 2:
+			if (!parseLevel(argv[1], level))
+				break;
+			dlogLevel = level;
+			esp_log_level_set("*", static_cast<esp_log_level_t>(level));
+			return ESP_OK;
+		case 3:
+			// deferred entries have the global level only
+			if (!parseLevel(argv[2], level))
+				break;
+			esp_log_level_set(argv[1], static_cast<esp_log_level_t>(level));
+			return ESP_OK;
+		default:
+			break;
+	}
+	printf("Usage: %s [tag] none|error|warn|info|debug|verbose\n", argv[0]);
+	return ESP_ERR_INVALID_ARG;
+}
+
+esp_err_t dlogInit() noexcept {
+	for (size_t i = 0; i < slotsCount; ++i)
+		slots[i].sequence.store(i, std::memory_order_relaxed);
+
+	formatterLock = xSemaphoreCreateMutex();
+	formatterWakeup = xSemaphoreCreateBinary();
+	if (nullptr == formatterLock || nullptr == formatterWakeup)
+		return ESP_ERR_NO_MEM;
+
+	if (pdPASS != xTaskCreate(formatterTask, "dlog", formatterStackSize, nullptr, formatterPriority, nullptr)) {
+		ESP_LOGE(MODULE, "Task create error");
+		return ESP_ERR_NO_MEM;
+	}
+	esp_register_shutdown_handler(&dlogFlush);
+	return consoleAdd("log", "Show or set log level [tag] none|error|warn|info|debug|verbose", &logCommand);
+}
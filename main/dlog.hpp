@@ -0,0 +1,142 @@
+// vim: tabstop=4 shiftwidth=4 noexpandtab colorcolumn=120 :
+// This file is part of the Sim800 (https://github.com/beranat/sim800).
+// Copyright (c) 2021 Anatoly L. Berenblit.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 3.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include <type_traits>
+
+#include <esp_err.h>
+
+// Deferred log for hot paths (receiver, AT engine): DLOG() stores the address of the static format descriptor
+// (format ID) and the binary arguments into a lock-free ring, a low priority task formats and prints them later.
+// Strings are copied (truncated to the entry), "%s" takes const char * and std::string_view, integer length
+// modifiers of the format are ignored (argument type is recorded). Full ring drops the entry.
+//
+//   DLOG(Debug, MODULE, ">> %s", line);
+
+enum class DlogLevel : uint8_t {
+	None,
+	Error,
+	Warn,
+	Info,
+	Debug,
+	Verbose,
+};
+
+struct DlogFormat {
+	const char *tag;
+	const char *format;
+	DlogLevel level;
+};
+
+// Entry: format ID, time and the arguments as {type, value} pairs
+constexpr size_t dlogArgsMax = 112;
+
+struct DlogArgs {
+	uint8_t data[dlogArgsMax];
+	size_t length = 0;
+
+	enum Type : uint8_t {
+		I32,
+		U32,
+		I64,
+		U64,
+		Double,
+		Pointer,
+		String,	// length byte + bytes
+	};
+
+	bool put(Type type, const void *value, size_t size) noexcept {
+		if (length + 1 + size > sizeof(data))
+			return false;
+		data[length++] = type;
+		memcpy(data + length, value, size);
+		length += size;
+		return true;
+	}
+
+	void add(std::string_view value) noexcept {
+		if (length + 2 > sizeof(data))
+			return;
+		const size_t size = (value.length() < sizeof(data) - length - 2) ? value.length() : sizeof(data) - length - 2;
+		const uint8_t size8 = static_cast<uint8_t>((size < UINT8_MAX) ? size : UINT8_MAX);
+		data[length++] = String;
+		data[length++] = size8;
+		memcpy(data + length, value.data(), size8);
+		length += size8;
+	}
+
+	void add(const char *value) noexcept {
+		add(std::string_view((nullptr != value) ? value : "(null)"));
+	}
+
+	void add(char *value) noexcept {
+		add(static_cast<const char *>(value));
+	}
+
+	template <class T> void add(T value) noexcept {
+		if constexpr(std::is_enum_v<T>)
+			add(static_cast<std::underlying_type_t<T>>(value));
+		else if constexpr(std::is_pointer_v<T>)
+			put(Pointer, &value, sizeof(value));
+		else if constexpr(std::is_floating_point_v<T>) {
+			const double v = value;
+			put(Double, &v, sizeof(v));
+		} else if constexpr(sizeof(T) <= sizeof(int32_t)) {
+			if constexpr(std::is_signed_v<T>) {
+				const int32_t v = value;
+				put(I32, &v, sizeof(v));
+			} else {
+				const uint32_t v = value;
+				put(U32, &v, sizeof(v));
+			}
+		} else {
+			if constexpr(std::is_signed_v<T>) {
+				const int64_t v = value;
+				put(I64, &v, sizeof(v));
+			} else {
+				const uint64_t v = value;
+				put(U64, &v, sizeof(v));
+			}
+		}
+	}
+};
+
+extern std::atomic<DlogLevel> dlogLevel;
+
+esp_err_t dlogInit() noexcept;
+void dlogPush(const DlogFormat &format, const DlogArgs &args) noexcept;
+void dlogFlush() noexcept;	// format pending entries on the calling task
+
+inline bool dlogIsEnabled(DlogLevel level) noexcept {
+	return level <= dlogLevel.load(std::memory_order_relaxed);
+}
+
+template <class... Args> void dlogWrite(const DlogFormat &format, const Args &... args) noexcept {
+	DlogArgs packed;
+	(packed.add(args), ...);
+	dlogPush(format, packed);
+}
+
+#define DLOG(level, tag, format, ...) do { \
+		static constexpr DlogFormat dlogFormat_ { tag, format, DlogLevel::level }; \
+		if (dlogIsEnabled(DlogLevel::level)) \
+			dlogWrite(dlogFormat_, ##__VA_ARGS__); \
+	} while (false)
@@ -0,0 +1,200 @@
+// vim: tabstop=4 shiftwidth=4 noexpandtab colorcolumn=120 :
+// This file is part of the Sim800 (https://github.com/beranat/sim800).
+// Copyright (c) 2021 Anatoly L. Berenblit.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 3.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+#include <string_view>
+#include <utility>
+
+// What to do with a line longer than LineMax
+enum class FramerOversize {
+	Truncate,	// hand out first LineMax bytes (isTruncated = true), skip the rest up to the line end
+	Discard,	// drop whole line
+};
+
+// Line framer on top of a fixed-capacity ring buffer (no platform dependencies).
+//
+// Producer writes directly into the ring: writable() returns the contiguous free span, commit() publishes it.
+// parse() hands every complete CR/LF terminated line as a string_view into the ring, nothing is copied except a
+// line wrapped over the ring end - its head (at most LineMax bytes) is mirrored right behind the storage once.
+// Binary data after a header line (expect()) is handed out as it arrives, in contiguous spans of the ring.
+template <size_t Capacity, size_t LineMax = Capacity / 2, FramerOversize Policy = FramerOversize::Truncate>
+class LineFramer final {
+	static_assert(0 != Capacity && 0 == (Capacity & (Capacity - 1)), "Capacity must be power of 2");
+	static_assert(0 != LineMax && LineMax <= Capacity / 2, "LineMax must fit half of the ring");
+
+	static constexpr size_t mask = Capacity - 1;
+
+	// positions are free running counters, ring index is (position & mask)
+	size_t head_ = 0;	// start of the current line
+	size_t scan_ = 0;	// first byte not checked for terminator
+	size_t tail_ = 0;	// first free byte
+	bool isSkipping_ = false;	// rest of oversize line is dropped
+	size_t oversized_ = 0;
+	size_t block_ = 0;			// data bytes still expected
+	bool isBlockLf_ = false;	// header ended with CR, LF before the data is skipped
+
+	char data_[Capacity + LineMax];
+
+	std::string_view view(size_t position, size_t length) noexcept {
+		const size_t index = position & mask;
+		if (index + length > Capacity)
+			memcpy(data_ + Capacity, data_, index + length - Capacity);
+		return std::string_view(data_ + index, length);
+	}
+
+public:
+	LineFramer() noexcept = default;
+	LineFramer(const LineFramer &) = delete;
+	LineFramer &operator=(const LineFramer &) = delete;
+
+	static constexpr size_t capacity() noexcept {
+		return Capacity;
+	}
+
+	static constexpr size_t lineMax() noexcept {
+		return LineMax;
+	}
+
+	size_t size() const noexcept {
+		return tail_ - head_;
+	}
+
+	// Number of lines hit by oversize policy since reset
+	size_t oversized() const noexcept {
+		return oversized_;
+	}
+
+	void reset() noexcept {
+		head_ = scan_ = tail_ = 0;
+		isSkipping_ = false;
+		oversized_ = 0;
+		block_ = 0;
+		isBlockLf_ = false;
+	}
+
+	// Contiguous free span to receive into, never empty after parse()
+	std::pair<char *, size_t> writable() noexcept {
+		const size_t index = tail_ & mask;
+		const size_t free = Capacity - size();
+		return { data_ + index, (free < Capacity - index) ? free : Capacity - index };
+	}
+
+	void commit(size_t length) noexcept {
+		tail_ += length;
+	}
+
+	// Unterminated text after the last line (e.g. `> ' prompt), valid till the next parse()
+	std::string_view pending() noexcept {
+		if (0 != block_ || isBlockLf_ || isSkipping_)
+			return std::string_view();
+		const size_t length = tail_ - head_;
+		return view(head_, (length < LineMax) ? length : LineMax);
+	}
+
+	// Next length bytes are data: called from the line callback - after that line, otherwise after the pending text
+	// (it is dropped)
+	void expect(size_t length) noexcept {
+		if (head_ > scan_)
+			isBlockLf_ = ('\r' == data_[scan_ & mask]);
+		else {
+			head_ = scan_;
+			isBlockLf_ = false;
+		}
+		isSkipping_ = false;
+		block_ = length;
+	}
+
+	// Calls fn(std::string_view line, bool isTruncated) -> bool for each complete non-empty line and
+	// block(std::string_view data, bool isLast) -> bool for expect()ed data, stops and returns false as soon as
+	// a callback fails. Views are valid only inside the call.
+	template <class Fn, class BlockFn> bool parse(Fn &&fn, BlockFn &&block) {
+		for (; scan_ != tail_; ++scan_) {
+			if (isBlockLf_) {
+				isBlockLf_ = false;
+				if ('\n' == data_[scan_ & mask]) {
+					head_ = scan_ + 1;
+					continue;
+				}
+			}
+
+			if (0 != block_) {
+				const size_t index = scan_ & mask;
+				size_t length = tail_ - scan_;
+				length = (length < block_) ? length : block_;
+				length = (length < Capacity - index) ? length : Capacity - index;
+				block_ -= length;
+				scan_ += length - 1;
+				head_ = scan_ + 1;
+				if (!block(std::string_view(data_ + index, length), 0 == block_)) {
+					++scan_;
+					return false;
+				}
+				continue;
+			}
+
+			const char c = data_[scan_ & mask];
+			if ('\r' != c && '\n' != c) {
+				if (isSkipping_ || scan_ - head_ < LineMax)
+					continue;
+
+				// unterminated line reached the limit
+				const size_t begin = head_;
+				head_ = scan_ + 1;
+				isSkipping_ = true;
+				if (!oversize(fn, begin)) {
+					++scan_;
+					return false;
+				}
+				continue;
+			}
+
+			const size_t begin = head_;
+			const size_t length = scan_ - head_;
+			head_ = scan_ + 1;
+
+			if (isSkipping_) {
+				isSkipping_ = false;
+				continue;
+			}
+
+			if (0 != length && !fn(view(begin, length), false)) {
+				++scan_;
+				return false;
+			}
+		}
+
+		if (isSkipping_)
+			head_ = scan_;
+		return true;
+	}
+
+	template <class Fn> bool parse(Fn &&fn) {
+		return parse(std::forward<Fn>(fn), [](std::string_view, bool) noexcept {
+			return true;
+		});
+	}
+
+private:
+	template <class Fn> bool oversize(Fn &&fn, size_t begin) {
+		++oversized_;
+		if constexpr(FramerOversize::Truncate == Policy)
+			return fn(view(begin, LineMax), true);
+		else
+			return true;
+	}
+};
@@ -0,0 +1,159 @@
+// vim: tabstop=4 shiftwidth=4 noexpandtab colorcolumn=120 :
+// This file is part of the Sim800 (https://github.com/beranat/sim800).
+// Copyright (c) 2021 Anatoly L. Berenblit.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 3.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+#include <esp_log.h>
+#include <driver/gpio.h>
+#include <driver/uart.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+
+#include "sdkconfig.h"
+
+#include "hal.hpp"
+
+constexpr const char *MODULE = "hal";
+
+constexpr uart_port_t port = CONFIG_SIM800_UART_PORT;
+
+// Driver events: line end (pattern) or RX FIFO threshold/timeout
+constexpr unsigned int eventsLength = 16;
+constexpr unsigned int patternsLength = 16;
+constexpr int fifoThreshold = 64;
+static QueueHandle_t events = nullptr;
+
+// RTS is raised when RX FIFO holds that many bytes (FIFO is 128 bytes)
+constexpr uint8_t flowThreshold = 100;
+
+#if CONFIG_SIM800_FLOWCONTROL
+constexpr int rtsPin = CONFIG_SIM800_RTS_GPIO;
+constexpr int ctsPin = CONFIG_SIM800_CTS_GPIO;
+#else
+constexpr int rtsPin = UART_PIN_NO_CHANGE;
+constexpr int ctsPin = UART_PIN_NO_CHANGE;
+#endif
+
+esp_err_t halUartInit(const HalUartConfig &config) noexcept {
+	const uart_config_t uartConfig = {
+		.baud_rate = config.baudRate,
+		.data_bits = UART_DATA_8_BITS,
+		.parity = UART_PARITY_DISABLE,
+		.stop_bits = UART_STOP_BITS_1,
+		.flow_ctrl = UART_HW_FLOWCTRL_DISABLE,
+		.rx_flow_ctrl_thresh = flowThreshold,
+		.source_clk = UART_SCLK_APB,
+	};
+
+	esp_err_t result = uart_driver_install(port, config.rxBuffer, config.txBuffer,
+										   config.isEvents ? eventsLength : 0, config.isEvents ? &events : nullptr, 0);
+	if (ESP_OK == result)
+		result = uart_param_config(port, &uartConfig);
+
+	if (ESP_OK == result && config.isEvents) {
+		result = uart_enable_pattern_det_baud_intr(port, '\n', 1, 9, 0, 0);
+		if (ESP_OK == result)
+			result = uart_pattern_queue_reset(port, patternsLength);
+		if (ESP_OK == result)
+			result = uart_set_rx_full_threshold(port, fifoThreshold);
+	}
+
+	if (ESP_OK == result)
+		result = uart_set_pin(port, CONFIG_SIM800_TX_GPIO, CONFIG_SIM800_RX_GPIO, rtsPin, ctsPin);
+
+	if (ESP_OK != result)
+		ESP_LOGE(MODULE, "UART init error %s (%d)", esp_err_to_name(result), static_cast<int>(result));
+	return result;
+}
+
+esp_err_t halUartBaud(int baudRate) noexcept {
+	return uart_set_baudrate(port, baudRate);
+}
+
+esp_err_t halUartFlowControl(bool isEnabled) noexcept {
+	if (isEnabled && (UART_PIN_NO_CHANGE == rtsPin || UART_PIN_NO_CHANGE == ctsPin))
+		return ESP_ERR_NOT_SUPPORTED;
+	return uart_set_hw_flow_ctrl(port, isEnabled ? UART_HW_FLOWCTRL_CTS_RTS : UART_HW_FLOWCTRL_DISABLE, flowThreshold);
+}
+
+int halUartRead(void *data, size_t length, TickType_t wait) noexcept {
+	return uart_read_bytes(port, reinterpret_cast<uint8_t *>(data), length, wait);
+}
+
+int halUartWrite(const void *data, size_t length) noexcept {
+	return uart_write_bytes(port, reinterpret_cast<const char *>(data), length);
+}
+
+esp_err_t halUartWaitTx(TickType_t wait) noexcept {
+	return uart_wait_tx_done(port, wait);
+}
+
+size_t halUartBuffered() noexcept {
+	size_t length = 0;
+	return (ESP_OK == uart_get_buffered_data_len(port, &length)) ? length : 0;
+}
+
+void halUartFlush() noexcept {
+	uart_flush_input(port);
+	if (nullptr != events) {
+		uart_pattern_queue_reset(port, patternsLength);
+		xQueueReset(events);
+	}
+}
+
+bool halUartWait(HalUartEvent &event, TickType_t wait) noexcept {
+	while (nullptr != events) {
+		uart_event_t uartEvent;
+		if (pdTRUE != xQueueReceive(events, &uartEvent, wait))
+			return false;
+
+		switch (uartEvent.type) {
+			case UART_PATTERN_DET:
+				// receiver finds line ends itself, positions are useless
+				while (-1 != uart_pattern_pop_pos(port))
+					;
+				event = HalUartEvent::Line;
+				return true;
+			case UART_DATA:
+				event = HalUartEvent::Data;
+				return true;
+			case UART_FIFO_OVF:
+			case UART_BUFFER_FULL:
+				event = HalUartEvent::Overflow;
+				return true;
+			case UART_FRAME_ERR:
+			case UART_PARITY_ERR:
+				event = HalUartEvent::Error;
+				return true;
+			default:
+				break;
+		}
+	}
+	return false;
+}
+
+esp_err_t halGpioOutput(uint64_t mask) noexcept {
+	const gpio_config_t config = {
+		.pin_bit_mask = mask,
+		.mode = GPIO_MODE_OUTPUT,
+		.pull_up_en = GPIO_PULLUP_DISABLE,
+		.pull_down_en = GPIO_PULLDOWN_DISABLE,
+		.intr_type = GPIO_INTR_DISABLE
+	};
+	return gpio_config(&config);
+}
+
+void halGpioSet(int pin, bool level) noexcept {
+	gpio_set_level(static_cast<gpio_num_t>(pin), level ? 1 : 0);
+}
@@ -0,0 +1,54 @@
+// vim: tabstop=4 shiftwidth=4 noexpandtab colorcolumn=120 :
+// This file is part of the Sim800 (https://github.com/beranat/sim800).
+// Copyright (c) 2021 Anatoly L. Berenblit.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 3.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <freertos/FreeRTOS.h>
+#include <esp_err.h>
+
+// Modem link seam: UART and control GPIOs of the SIM800.
+// main/hal.cpp is ESP32 driver implementation, host/hal.cpp connects the modem layer to the emulator.
+
+enum class HalUartEvent : uint8_t {
+	Data,		// RX FIFO threshold or RX timeout
+	Line,		// '\n' received
+	Overflow,	// data lost, receiver must be flushed
+	Error,		// frame/parity error
+};
+
+struct HalUartConfig {
+	int baudRate = 57600;
+	size_t rxBuffer = 256;
+	size_t txBuffer = 0;
+	bool isEvents = false;	// halUartWait() is available
+};
+
+esp_err_t halUartInit(const HalUartConfig &config) noexcept;
+esp_err_t halUartBaud(int baudRate) noexcept;
+esp_err_t halUartFlowControl(bool isEnabled) noexcept;	// RTS/CTS, pins are configured if supported
+
+// Blocks until length bytes received or wait expired, returns received length or -1
+int halUartRead(void *data, size_t length, TickType_t wait) noexcept;
+int halUartWrite(const void *data, size_t length) noexcept;
+esp_err_t halUartWaitTx(TickType_t wait) noexcept;
+size_t halUartBuffered() noexcept;
+void halUartFlush() noexcept;
+bool halUartWait(HalUartEvent &event, TickType_t wait) noexcept;
+
+esp_err_t halGpioOutput(uint64_t mask) noexcept;
+void halGpioSet(int pin, bool level) noexcept;
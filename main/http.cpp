@@ -0,0 +1,387 @@
+// vim: tabstop=4 shiftwidth=4 noexpandtab colorcolumn=120 :
+// This file is part of the Sim800 (https://github.com/beranat/sim800).
+// Copyright (c) 2021 Anatoly L. Berenblit.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 3.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+#include <atomic>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string_view>
+
+#include <esp_log.h>
+#include <esp_timer.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+
+#include "sdkconfig.h"
+
+#include "console.hpp"
+#include "dlog.hpp"
+#include "at.hpp"
+#include "urc.hpp"
+#include "sim.hpp"
+#include "http.hpp"
+
+constexpr const char *MODULE = "http";
+
+constexpr TickType_t httpCommandTimeout = pdMS_TO_TICKS(5000);
+constexpr TickType_t httpBearerTimeout = pdMS_TO_TICKS(85000);	// AT+SAPBR=1,1
+constexpr TickType_t httpActionTimeout = pdMS_TO_TICKS(125000);	// +HTTPACTION, the modem gives up in 120 s
+constexpr TickType_t httpReadTimeout = pdMS_TO_TICKS(10000);
+constexpr unsigned int httpUploadSlackMs = 10000;				// AT+HTTPDATA <time> over the link time
+constexpr unsigned int httpUploadMaxMs = 120000;
+constexpr int httpNetworkError = 600;
+
+static SemaphoreHandle_t httpLock = nullptr;		// one request at a time
+static SemaphoreHandle_t httpAction = nullptr;		// +HTTPACTION arrived
+static SemaphoreHandle_t httpDownload = nullptr;	// AT+HTTPDATA prompts
+static SemaphoreHandle_t httpUploaded = nullptr;
+static std::atomic<AtResult> httpUploadResult = AtResult::Timeout;
+static std::atomic<int> httpStatus = 0;
+static std::atomic<size_t> httpLength = 0;
+
+// AT+HTTPREAD in progress, data goes straight from the receive ring
+static HttpBodyCallback httpBody = nullptr;
+static void *httpArg = nullptr;
+static size_t httpOffset = 0;
+static size_t httpBlock = 0;	// +HTTPREAD: <length>
+
+static uint8_t httpBuffer[httpChunk];	// POST chunk of the producer
+
+class HttpGuard final {
+	SemaphoreHandle_t lock_;
+	public:
+		explicit HttpGuard(SemaphoreHandle_t lock) noexcept : lock_(lock) {
+			xSemaphoreTake(lock_, portMAX_DELAY);
+		}
+		~HttpGuard() {
+			xSemaphoreGive(lock_);
+		}
+};
+
+// Comma separated numbers of a response, returns the number parsed
+static size_t httpNumbers(std::string_view args, unsigned int *values, size_t count) noexcept {
+	size_t parsed = 0;
+	while (parsed < count && !args.empty()) {
+		while (!args.empty() && ' ' == args.front())
+			args.remove_prefix(1);
+		if (args.empty() || args.front() < '0' || '9' < args.front())
+			break;
+
+		unsigned int value = 0;
+		while (!args.empty() && '0' <= args.front() && args.front() <= '9') {
+			value = value * 10 + (args.front() - '0');
+			args.remove_prefix(1);
+		}
+		values[parsed++] = value;
+		if (!args.empty() && ',' == args.front())
+			args.remove_prefix(1);
+	}
+	return parsed;
+}
+
+// +HTTPACTION: <method>,<status>,<length>
+static void httpOnUrc(Urc, std::string_view, std::string_view args, void *) noexcept {
+	unsigned int values[3];
+	if (3 != httpNumbers(args, values, 3))
+		return;
+	httpStatus = static_cast<int>(values[1]);
+	httpLength = values[2];
+	xSemaphoreGive(httpAction);
+}
+
+// Bearer profile 1 is shared with the other users of the modem, it is opened once
+static bool httpBearer() noexcept {
+	AtResponse response;
+	if (AtResult::Ok == atCommand("AT+SAPBR=2,1", &response, httpCommandTimeout)) {
+		// +SAPBR: <cid>,<status>,<address>, 1 - connected
+		unsigned int values[2];
+		const char *colon = strchr(response.text, ':');
+		if (nullptr != colon && 2 == httpNumbers(colon + 1, values, 2) && 1 == values[1])
+			return true;
+	}
+
+	char apn[atCommandMax];
+	snprintf(apn, sizeof(apn), "AT+SAPBR=3,1,\"APN\",\"%s\"", CONFIG_SIM800_APN);
+	const struct {
+		const char *command;
+		TickType_t timeout;
+	} steps[] = {
+		{ "AT+SAPBR=3,1,\"Contype\",\"GPRS\"", httpCommandTimeout },
+		{ apn, httpCommandTimeout },
+		{ "AT+SAPBR=1,1", httpBearerTimeout },
+	};
+	for (const auto &step : steps) {
+		if (AtResult::Ok != atCommand(step.command, nullptr, step.timeout)) {
+			ESP_LOGE(MODULE, "Bearer %s failed", step.command);
+			return false;
+		}
+	}
+	ESP_LOGI(MODULE, "Bearer is up");
+	return true;
+}
+
+static bool httpParameter(const char *name, const char *value) noexcept {
+	char command[atCommandMax];
+	const int length = snprintf(command, sizeof(command), "AT+HTTPPARA=\"%s\",\"%s\"", name, value);
+	if (length < 0 || sizeof(command) <= static_cast<size_t>(length)) {
+		ESP_LOGE(MODULE, "%s is too long", name);
+		return false;
+	}
+	return AtResult::Ok == atCommand(command, nullptr, httpCommandTimeout);
+}
+
+// Service of the previous request is terminated if it was left
+static bool httpStart(const HttpRequest &request) noexcept {
+	if (AtResult::Ok != atCommand("AT+HTTPINIT", nullptr, httpCommandTimeout)) {
+		atCommand("AT+HTTPTERM", nullptr, httpCommandTimeout);
+		if (AtResult::Ok != atCommand("AT+HTTPINIT", nullptr, httpCommandTimeout))
+			return false;
+	}
+
+	const bool isSecure = (0 == strncmp(request.url, "https://", 8));
+	return httpParameter("CID", "1") && httpParameter("URL", request.url) &&
+		   AtResult::Ok == atCommand(isSecure ? "AT+HTTPSSL=1" : "AT+HTTPSSL=0", nullptr, httpCommandTimeout) &&
+		   (HttpMethod::Post != request.method ||
+			httpParameter("CONTENT", (nullptr != request.contentType) ? request.contentType : "text/plain"));
+}
+
+static void httpDownloadLine(std::string_view line, void *) noexcept {
+	if ("DOWNLOAD" == line)
+		xSemaphoreGive(httpDownload);
+}
+
+static void httpUploadDone(AtResult result, int, void *) noexcept {
+	httpUploadResult = result;
+	xSemaphoreGive(httpUploaded);
+}
+
+// AT+HTTPDATA=<length>,<time> answers DOWNLOAD, the body follows in producer chunks and the modem says OK
+static esp_err_t httpUpload(const HttpRequest &request) noexcept {
+	const int baudRate = (0 < simBaudRate()) ? simBaudRate() : 9600;
+	const uint64_t linkMs = static_cast<uint64_t>(request.length) * 10 * 1000 / baudRate;
+	const unsigned int timeMs = (linkMs + httpUploadSlackMs < httpUploadMaxMs) ?
+								static_cast<unsigned int>(linkMs) + httpUploadSlackMs : httpUploadMaxMs;
+
+	AtRequest command;
+	snprintf(command.command, sizeof(command.command), "AT+HTTPDATA=%zu,%u", request.length, timeMs);
+	command.timeout = pdMS_TO_TICKS(timeMs) + httpCommandTimeout;
+	command.onLine = &httpDownloadLine;
+	command.onDone = &httpUploadDone;
+	xSemaphoreTake(httpDownload, 0);
+	xSemaphoreTake(httpUploaded, 0);
+	if (ESP_OK != atSubmit(command, httpCommandTimeout))
+		return ESP_ERR_TIMEOUT;
+
+	esp_err_t result = (pdTRUE == xSemaphoreTake(httpDownload, httpCommandTimeout)) ? ESP_OK : ESP_FAIL;
+	for (size_t offset = 0; ESP_OK == result && offset < request.length;) {
+		const size_t left = request.length - offset;
+		const size_t size = (left < sizeof(httpBuffer)) ? left : sizeof(httpBuffer);
+		const size_t length = request.producer(offset, httpBuffer, size, request.producerArg);
+		if (0 == length || size < length) {
+			ESP_LOGW(MODULE, "Body is aborted at %zu", offset);
+			result = ESP_FAIL;	// the modem waits the time out
+			break;
+		}
+		result = simSend(httpBuffer, length);
+		offset += length;
+	}
+
+	// done comes anyway, by the time out at least
+	xSemaphoreTake(httpUploaded, portMAX_DELAY);
+	return (ESP_OK == result && AtResult::Ok != httpUploadResult) ? ESP_FAIL : result;
+}
+
+static void httpData(const uint8_t *data, size_t length, void *) noexcept {
+	if (nullptr != httpBody)
+		httpBody(httpOffset, data, length, httpArg);
+	httpOffset += length;
+}
+
+// +HTTPREAD: <length> and the data
+static void httpReadLine(std::string_view line, void *) noexcept {
+	constexpr std::string_view prefix = "+HTTPREAD:";
+	unsigned int length;
+	if (0 != line.compare(0, prefix.length(), prefix) || 1 != httpNumbers(line.substr(prefix.length()), &length, 1))
+		return;
+	httpBlock = length;
+	if (!simExpect(length, &httpData))
+		DLOG(Error, MODULE, "Body block is not expected");
+}
+
+static esp_err_t httpRead(const HttpRequest &request, size_t length, size_t &received) noexcept {
+	httpBody = request.onBody;
+	httpArg = request.arg;
+	httpOffset = 0;
+	while (httpOffset < length) {
+		const size_t left = length - httpOffset;
+		const size_t size = (left < httpChunk) ? left : httpChunk;
+		if (nullptr != request.onReady && !request.onReady(httpOffset, size, length, request.arg)) {
+			ESP_LOGW(MODULE, "Read is aborted at %zu", httpOffset);
+			break;
+		}
+
+		AtRequest command;
+		snprintf(command.command, sizeof(command.command), "AT+HTTPREAD=%zu,%zu", httpOffset, size);
+		command.timeout = httpReadTimeout;
+		command.onLine = &httpReadLine;
+		httpBlock = 0;
+		const AtResult result = atCommand(command);
+		if (AtResult::Ok != result || 0 == httpBlock) {
+			ESP_LOGW(MODULE, "Read at %zu: %s", httpOffset, atResultName(result));
+			break;
+		}
+	}
+	received = httpOffset;
+	httpBody = nullptr;
+	return (httpOffset == length) ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t httpRequest(const HttpRequest &request, HttpResponse *response) noexcept {
+	if (nullptr == request.url || (HttpMethod::Post == request.method &&
+			((0 != request.length && nullptr == request.producer) || httpUploadMax < request.length)))
+		return ESP_ERR_INVALID_ARG;
+
+	const HttpGuard guard(httpLock);
+	if (!httpBearer())
+		return ESP_FAIL;
+	if (!httpStart(request)) {
+		atCommand("AT+HTTPTERM", nullptr, httpCommandTimeout);
+		return ESP_FAIL;
+	}
+
+	esp_err_t result = (HttpMethod::Post == request.method) ? httpUpload(request) : ESP_OK;
+	if (ESP_OK == result) {
+		char command[atCommandMax];
+		snprintf(command, sizeof(command), "AT+HTTPACTION=%d", static_cast<int>(request.method));
+		xSemaphoreTake(httpAction, 0);
+		if (AtResult::Ok != atCommand(command, nullptr, httpCommandTimeout))
+			result = ESP_FAIL;
+		else if (pdTRUE != xSemaphoreTake(httpAction, httpActionTimeout))
+			result = ESP_ERR_TIMEOUT;
+	}
+
+	HttpResponse answer;
+	if (ESP_OK == result) {
+		answer.status = httpStatus;
+		answer.length = httpLength;
+		DLOG(Info, MODULE, "%s %d, %zu bytes", request.url, answer.status, answer.length);
+		if (httpNetworkError <= answer.status)
+			result = ESP_FAIL;
+		else if (nullptr != request.onBody && 0 != answer.length)
+			result = httpRead(request, answer.length, answer.received);
+	}
+
+	atCommand("AT+HTTPTERM", nullptr, httpCommandTimeout);
+	if (nullptr != response)
+		*response = answer;
+	return result;
+}
+
+static void httpPrint(size_t, const uint8_t *data, size_t length, void *) noexcept {
+	fwrite(data, 1, length, stdout);
+}
+
+static size_t httpText(size_t offset, uint8_t *buffer, size_t size, void *arg) noexcept {
+	memcpy(buffer, reinterpret_cast<const char *>(arg) + offset, size);
+	return size;
+}
+
+// http bench: the server echoes the POST body back
+struct Bench {
+	size_t mismatches;
+};
+
+static uint8_t benchByte(size_t offset) noexcept {
+	return static_cast<uint8_t>(offset % 251);
+}
+
+static size_t benchProduce(size_t offset, uint8_t *buffer, size_t size, void *) noexcept {
+	for (size_t i = 0; i < size; ++i)
+		buffer[i] = benchByte(offset + i);
+	return size;
+}
+
+static void benchCheck(size_t offset, const uint8_t *data, size_t length, void *arg) noexcept {
+	Bench &bench = *reinterpret_cast<Bench *>(arg);
+	for (size_t i = 0; i < length; ++i) {
+		if (data[i] != benchByte(offset + i))
+			++bench.mismatches;
+	}
+}
+
+static int httpBench(const char *url, size_t length) {
+	if (0 == length || httpUploadMax < length)
+		return ESP_ERR_INVALID_ARG;
+
+	Bench bench { 0 };
+	HttpRequest request;
+	request.method = HttpMethod::Post;
+	request.url = url;
+	request.contentType = "application/octet-stream";
+	request.length = length;
+	request.producer = &benchProduce;
+	request.onBody = &benchCheck;
+	request.arg = &bench;
+	HttpResponse response;
+	const int64_t start = esp_timer_get_time();
+	const esp_err_t result = httpRequest(request, &response);
+	const int64_t us = esp_timer_get_time() - start;
+
+	printf("%s: %d, %zu bytes up, %zu down in %" PRId64 " ms, %" PRId64 " B/s, %zu mismatches, %s\n", MODULE,
+		   response.status, length, response.received, us / 1000,
+		   (0 < us) ? static_cast<int64_t>(length + response.received) * 1000000 / us : 0, bench.mismatches,
+		   esp_err_to_name(result));
+	return (ESP_OK == result && response.received != length) ? ESP_FAIL : result;
+}
+
+// http get <url> | post <url> <text> | bench <url> <bytes>
+static int httpCommand(int argc, char **argv) {
+	HttpRequest request;
+	if (3 == argc && 0 == strcmp(argv[1], "get")) {
+		request.url = argv[2];
+	} else if (4 == argc && 0 == strcmp(argv[1], "post")) {
+		request.method = HttpMethod::Post;
+		request.url = argv[2];
+		request.length = strlen(argv[3]);
+		request.producer = &httpText;
+		request.producerArg = argv[3];
+	} else if (4 == argc && 0 == strcmp(argv[1], "bench"))
+		return httpBench(argv[2], strtoul(argv[3], nullptr, 0));
+	else
+		return ESP_ERR_INVALID_ARG;
+
+	request.onBody = &httpPrint;
+	HttpResponse response;
+	const esp_err_t result = httpRequest(request, &response);
+	printf("\n%s: %d, %zu/%zu bytes\n", MODULE, response.status, response.received, response.length);
+	return result;
+}
+
+esp_err_t httpInit() noexcept {
+	httpLock = xSemaphoreCreateMutex();
+	httpAction = xSemaphoreCreateBinary();
+	httpDownload = xSemaphoreCreateBinary();
+	httpUploaded = xSemaphoreCreateBinary();
+	if (nullptr == httpLock || nullptr == httpAction || nullptr == httpDownload || nullptr == httpUploaded)
+		return ESP_ERR_NO_MEM;
+
+	const esp_err_t result = urcRegister(Urc::HttpAction, &httpOnUrc);
+	if (ESP_OK != result)
+		return result;
+	return consoleAdd("http", "HTTP over the modem [get <url>] [post <url> <text>] [bench <url> <bytes>]",
+					  &httpCommand);
+}
@@ -0,0 +1,67 @@
+// vim: tabstop=4 shiftwidth=4 noexpandtab colorcolumn=120 :
+// This file is part of the Sim800 (https://github.com/beranat/sim800).
+// Copyright (c) 2021 Anatoly L. Berenblit.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 3.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <esp_err.h>
+
+#include "sim.hpp"
+
+// HTTP client of the modem (AT+HTTPINIT, AT+HTTPPARA, AT+HTTPACTION) on the bearer profile 1 (AT+SAPBR). The
+// response body is read in httpChunk pieces (AT+HTTPREAD=<offset>,<size>) and handed out as it arrives, the POST
+// body is streamed from the producer into AT+HTTPDATA. Memory use does not depend on the body size.
+
+constexpr size_t httpChunk = simRingSize;	// AT+HTTPREAD block, the modem sends it at once
+constexpr size_t httpUploadMax = 319488;	// AT+HTTPDATA
+
+enum class HttpMethod : uint8_t {
+	Get,	// AT+HTTPACTION=0
+	Post,
+	Head,
+};
+
+// Body data at the offset on the receiver task, must not block
+typedef void (*HttpBodyCallback)(size_t offset, const uint8_t *data, size_t length, void *arg);
+// POST body from the offset on the calling task, returns the length written (0 - abort)
+typedef size_t (*HttpProducer)(size_t offset, uint8_t *buffer, size_t size, void *arg);
+// Before a body block of size at the offset (of length) is read, on the calling task: may wait till the consumer
+// has room for it, false - abort
+typedef bool (*HttpReadyCallback)(size_t offset, size_t size, size_t length, void *arg);
+
+struct HttpRequest {
+	HttpMethod method = HttpMethod::Get;
+	const char *url = nullptr;			// http:// or https://
+	const char *contentType = nullptr;	// POST, text/plain by default
+	size_t length = 0;					// POST body
+	HttpProducer producer = nullptr;
+	void *producerArg = nullptr;
+	HttpBodyCallback onBody = nullptr;	// nullptr - the body is not read
+	HttpReadyCallback onReady = nullptr;
+	void *arg = nullptr;				// of onBody and onReady
+};
+
+struct HttpResponse {
+	int status = 0;			// 6xx - modem network errors
+	size_t length = 0;		// body length of +HTTPACTION
+	size_t received = 0;
+};
+
+// Blocks till the body is read, ESP_OK if the server answered (any HTTP status)
+esp_err_t httpRequest(const HttpRequest &request, HttpResponse *response = nullptr) noexcept;
+
+esp_err_t httpInit() noexcept;
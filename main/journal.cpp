@@ -0,0 +1,396 @@
+// vim: tabstop=4 shiftwidth=4 noexpandtab colorcolumn=120 :
+// This file is part of the Sim800 (https://github.com/beranat/sim800).
+// Copyright (c) 2021 Anatoly L. Berenblit.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 3.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+#include <algorithm>
+#include <cinttypes>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+
+#include <esp_log.h>
+#include <esp_partition.h>
+#include <esp_system.h>
+#include <esp_timer.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
+
+#include "console.hpp"
+#include "journal.hpp"
+
+constexpr const char *MODULE = "journal";
+constexpr const char *journalLabel = "journal";
+
+constexpr size_t sectorSize = 4096;	// SPI flash erase unit
+constexpr size_t pageSize = 256;	// SPI flash program unit
+constexpr uint32_t sectorMagic = 0x4c4e524a;	// "JRNL"
+
+// Sector: header, records back to back, erased (0xff) tail. Records never cross sectors.
+struct SectorHeader {
+	uint32_t magic;
+	uint32_t sequence;
+};
+
+struct RecordHeader {
+	uint8_t kind;
+	uint8_t check;	// CRC-8 of the record (check is zero), torn page writes do not match
+	uint16_t length;	// payload
+	uint32_t time;	// ms since boot
+};
+static_assert(sizeof(RecordHeader) + journalPayloadMax <= pageSize, "Record must fit a page");
+
+constexpr size_t recordMax = sizeof(RecordHeader) + journalPayloadMax;
+
+// Staging ring: appenders copy records in under the spinlock, the writer takes them out
+constexpr size_t stagingSize = 4096;
+static_assert(0 == (stagingSize & (stagingSize - 1)), "Staging size must be power of 2");
+static uint8_t staging[stagingSize];
+static size_t stagingHead = 0;	// free running
+static size_t stagingTail = 0;
+static uint32_t stagingDropped = 0;
+static portMUX_TYPE stagingMux = portMUX_INITIALIZER_UNLOCKED;
+
+// Flash side, flashLock owner only.
+// Flash operations stall the other tasks anyway (cache is off), the writer keeps them short: page writes and a
+// single sector erase when the journal moves on.
+static const esp_partition_t *partition = nullptr;
+static size_t sectors = 0;
+static SemaphoreHandle_t flashLock = nullptr;
+static size_t sector = 0;
+static uint32_t sequence = 0;
+static size_t writeOffset = 0;	// partition offset of pending[0]
+static uint8_t pending[pageSize];
+static size_t pendingLength = 0;
+
+static void writerTask(void *ptr) noexcept;
+constexpr size_t writerStackSize = configMINIMAL_STACK_SIZE + 1024*2;
+constexpr UBaseType_t writerPriority = tskIDLE_PRIORITY;
+constexpr TickType_t writerIdle = pdMS_TO_TICKS(1000);	// partial page is written after
+static TaskHandle_t writerHandle = nullptr;
+
+const char *journalKindName(JournalKind kind) noexcept {
+	switch (kind) {
+		case JournalKind::Boot:
+			return "boot";
+		case JournalKind::Tx:
+			return "tx";
+		case JournalKind::Rx:
+			return "rx";
+		case JournalKind::Urc:
+			return "urc";
+		case JournalKind::Result:
+			return "result";
+		case JournalKind::Fatal:
+			return "fatal";
+		case JournalKind::Count:
+			break;
+	}
+	return "unknown";
+}
+
+static uint8_t crc8(uint8_t crc, const void *data, size_t length) noexcept {
+	const uint8_t *bytes = reinterpret_cast<const uint8_t *>(data);
+	for (size_t i = 0; i < length; ++i) {
+		crc ^= bytes[i];
+		for (unsigned int bit = 0; bit < 8; ++bit)
+			crc = (crc & 0x80) ? static_cast<uint8_t>((crc << 1) ^ 0x07) : static_cast<uint8_t>(crc << 1);
+	}
+	return crc;
+}
+
+static uint8_t recordCheck(RecordHeader header, const void *payload) noexcept {
+	header.check = 0;
+	return crc8(crc8(0, &header, sizeof(header)), payload, header.length);
+}
+
+static void stagingPut(size_t offset, const void *data, size_t length) noexcept {
+	const size_t index = offset & (stagingSize - 1);
+	const size_t first = (length < stagingSize - index) ? length : stagingSize - index;
+	memcpy(staging + index, data, first);
+	memcpy(staging, reinterpret_cast<const uint8_t *>(data) + first, length - first);
+}
+
+static void stagingGet(size_t offset, void *data, size_t length) noexcept {
+	const size_t index = offset & (stagingSize - 1);
+	const size_t first = (length < stagingSize - index) ? length : stagingSize - index;
+	memcpy(data, staging + index, first);
+	memcpy(reinterpret_cast<uint8_t *>(data) + first, staging, length - first);
+}
+
+bool journalAppend(JournalKind kind, std::string_view payload) noexcept {
+	if (nullptr == writerHandle)
+		return false;
+
+	if (payload.length() > journalPayloadMax)
+		payload = payload.substr(0, journalPayloadMax);
+
+	RecordHeader header = {
+		static_cast<uint8_t>(kind),
+		0,
+		static_cast<uint16_t>(payload.length()),
+		static_cast<uint32_t>(esp_timer_get_time() / 1000),
+	};
+	header.check = recordCheck(header, payload.data());
+	const size_t length = sizeof(header) + payload.length();
+
+	portENTER_CRITICAL(&stagingMux);
+	const size_t used = stagingHead - stagingTail;
+	const bool isFit = length <= stagingSize - used;
+	if (isFit) {
+		stagingPut(stagingHead, &header, sizeof(header));
+		stagingPut(stagingHead + sizeof(header), payload.data(), payload.length());
+		stagingHead += length;
+	} else
+		++stagingDropped;
+	portEXIT_CRITICAL(&stagingMux);
+
+	// wake the writer once per staged page
+	if (isFit && used < pageSize && used + length >= pageSize)
+		xTaskNotifyGive(writerHandle);
+	return isFit;
+}
+
+bool journalAppendf(JournalKind kind, const char *format, ...) noexcept {
+	char payload[journalPayloadMax + 1];
+	va_list args;
+	va_start(args, format);
+	const int length = vsnprintf(payload, sizeof(payload), format, args);
+	va_end(args);
+	if (length < 0)
+		return false;
+	return journalAppend(kind, std::string_view(payload, (static_cast<size_t>(length) < sizeof(payload)) ?
+						 length : journalPayloadMax));
+}
+
+static size_t stagingTake(uint8_t *record) noexcept {
+	size_t length = 0;
+	portENTER_CRITICAL(&stagingMux);
+	if (stagingHead != stagingTail) {
+		RecordHeader header;
+		stagingGet(stagingTail, &header, sizeof(header));
+		length = sizeof(header) + header.length;
+		stagingGet(stagingTail, record, length);
+		stagingTail += length;
+	}
+	portEXIT_CRITICAL(&stagingMux);
+	return length;
+}
+
+static void flashPending() noexcept {
+	if (0 == pendingLength)
+		return;
+
+	const esp_err_t result = esp_partition_write(partition, writeOffset, pending, pendingLength);
+	if (ESP_OK != result)
+		ESP_LOGW(MODULE, "Write %zu error %s (%d)", writeOffset, esp_err_to_name(result), static_cast<int>(result));
+	writeOffset += pendingLength;
+	pendingLength = 0;
+}
+
+static bool sectorStart(size_t index, uint32_t number) noexcept {
+	const size_t offset = index * sectorSize;
+	esp_err_t result = esp_partition_erase_range(partition, offset, sectorSize);
+	const SectorHeader header = { sectorMagic, number };
+	if (ESP_OK == result)
+		result = esp_partition_write(partition, offset, &header, sizeof(header));
+
+	sector = index;
+	sequence = number;
+	writeOffset = offset + sizeof(header);
+	pendingLength = 0;
+
+	if (ESP_OK != result)
+		ESP_LOGW(MODULE, "Sector %zu error %s (%d)", index, esp_err_to_name(result), static_cast<int>(result));
+	return ESP_OK == result;
+}
+
+static void journalWrite(const uint8_t *record, size_t length) noexcept {
+	if (writeOffset + pendingLength + length > (sector + 1) * sectorSize) {
+		flashPending();
+		sectorStart((sector + 1) % sectors, sequence + 1);
+	}
+
+	// pending never crosses a page, the page is written as soon as it is complete
+	while (0 != length) {
+		const size_t pageRoom = pageSize - writeOffset % pageSize;
+		const size_t chunk = (length < pageRoom - pendingLength) ? length : pageRoom - pendingLength;
+		memcpy(pending + pendingLength, record, chunk);
+		pendingLength += chunk;
+		record += chunk;
+		length -= chunk;
+		if (pendingLength == pageRoom)
+			flashPending();
+	}
+}
+
+static void journalDrain(bool isIdle) noexcept {
+	uint8_t record[recordMax];
+
+	xSemaphoreTake(flashLock, portMAX_DELAY);
+	for (size_t length; 0 != (length = stagingTake(record));)
+		journalWrite(record, length);
+	if (isIdle)
+		flashPending();
+	xSemaphoreGive(flashLock);
+}
+
+void journalSync() noexcept {
+	if (nullptr != writerHandle)
+		journalDrain(true);
+}
+
+void writerTask(void *ptr) noexcept {
+	while (true) {
+		const bool isIdle = (0 == ulTaskNotifyTake(pdTRUE, writerIdle));
+		journalDrain(isIdle);
+	}
+}
+
+// Record at offset (flashLock), false at the end of the sector data (erased or torn)
+static bool recordRead(size_t offset, size_t end, RecordHeader &header, uint8_t *payload) noexcept {
+	if (offset + sizeof(header) > end || ESP_OK != esp_partition_read(partition, offset, &header, sizeof(header)))
+		return false;
+
+	if (header.kind >= static_cast<uint8_t>(JournalKind::Count) || header.length > journalPayloadMax ||
+			offset + sizeof(header) + header.length > end)
+		return false;
+
+	return ESP_OK == esp_partition_read(partition, offset + sizeof(header), payload, header.length) &&
+		   recordCheck(header, payload) == header.check;
+}
+
+static bool sectorRead(size_t index, SectorHeader &header) noexcept {
+	return ESP_OK == esp_partition_read(partition, index * sectorSize, &header, sizeof(header)) &&
+		   sectorMagic == header.magic;
+}
+
+static void printPayload(const uint8_t *payload, size_t length) noexcept {
+	for (size_t i = 0; i < length; ++i) {
+		if (payload[i] >= ' ' && payload[i] < 0x7f && '\\' != payload[i])
+			putchar(payload[i]);
+		else
+			printf("\\x%02x", payload[i]);
+	}
+	putchar('\n');
+}
+
+// journal [clear] - stream records oldest first
+static int journalCommand(int argc, char **argv) {
+	if (2 < argc || (2 == argc && 0 != strcmp(argv[1], "clear")))
+		return ESP_ERR_INVALID_ARG;
+
+	journalSync();
+
+	if (2 == argc) {
+		xSemaphoreTake(flashLock, portMAX_DELAY);
+		const esp_err_t result = esp_partition_erase_range(partition, 0, sectors * sectorSize);
+		sectorStart(0, 1);
+		xSemaphoreGive(flashLock);
+		return result;
+	}
+
+	unsigned int records = 0;
+	uint8_t payload[journalPayloadMax];
+	for (size_t i = 1; i <= sectors; ++i) {
+		const size_t index = (sector + i) % sectors;
+
+		xSemaphoreTake(flashLock, portMAX_DELAY);
+		SectorHeader sectorHeader;
+		const bool isValid = sectorRead(index, sectorHeader);
+		xSemaphoreGive(flashLock);
+		if (!isValid)
+			continue;
+
+		const size_t end = (index + 1) * sectorSize;
+		for (size_t offset = index * sectorSize + sizeof(SectorHeader); offset < end;) {
+			RecordHeader header;
+			xSemaphoreTake(flashLock, portMAX_DELAY);
+			const bool isRecord = recordRead(offset, end, header, payload);
+			xSemaphoreGive(flashLock);
+			if (!isRecord)
+				break;
+
+			printf("%08" PRIx32 " %6" PRIu32 ".%03" PRIu32 " %-6s ", sectorHeader.sequence, header.time / 1000,
+				   header.time % 1000, journalKindName(static_cast<JournalKind>(header.kind)));
+			printPayload(payload, header.length);
+			offset += sizeof(header) + header.length;
+			++records;
+		}
+	}
+
+	portENTER_CRITICAL(&stagingMux);
+	const uint32_t dropped = stagingDropped;
+	portEXIT_CRITICAL(&stagingMux);
+	printf("%s: %u records, %zu sectors, %" PRIu32 " dropped\n", MODULE, records, sectors, dropped);
+	return ESP_OK;
+}
+
+esp_err_t journalInit() noexcept {
+	partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, journalLabel);
+	if (nullptr == partition || partition->size < 2 * sectorSize) {
+		ESP_LOGW(MODULE, "No `%s' partition", journalLabel);
+		return ESP_ERR_NOT_FOUND;
+	}
+	sectors = partition->size / sectorSize;
+
+	flashLock = xSemaphoreCreateMutex();
+	if (nullptr == flashLock)
+		return ESP_ERR_NO_MEM;
+
+	// newest sector continues, a broken tail (power loss) starts the next one
+	bool isFound = false;
+	for (size_t i = 0; i < sectors; ++i) {
+		SectorHeader header;
+		if (sectorRead(i, header) && (!isFound || static_cast<int32_t>(header.sequence - sequence) > 0)) {
+			isFound = true;
+			sector = i;
+			sequence = header.sequence;
+		}
+	}
+
+	if (isFound) {
+		const size_t end = (sector + 1) * sectorSize;
+		size_t offset = sector * sectorSize + sizeof(SectorHeader);
+		RecordHeader header;
+		uint8_t payload[journalPayloadMax];
+		while (recordRead(offset, end, header, payload))
+			offset += sizeof(header) + header.length;
+
+		uint8_t tail[sizeof(RecordHeader)];
+		const bool isErased = (offset + sizeof(tail) > end) ||
+							  (ESP_OK == esp_partition_read(partition, offset, tail, sizeof(tail)) &&
+							   std::all_of(tail, tail + sizeof(tail), [](uint8_t b) {
+								   return 0xff == b;
+							   }));
+		if (isErased)
+			writeOffset = offset;
+		else
+			sectorStart((sector + 1) % sectors, sequence + 1);
+	} else
+		sectorStart(0, 1);
+
+	ESP_LOGI(MODULE, "%zu sectors, sequence %" PRIu32 " at %zu", sectors, sequence, writeOffset);
+
+	const BaseType_t result = xTaskCreate(writerTask, "journal", writerStackSize, nullptr, writerPriority, &writerHandle);
+	if (pdPASS != result) {
+		ESP_LOGE(MODULE, "Writer Task create error");
+		return ESP_FAIL;
+	}
+
+	esp_register_shutdown_handler(&journalSync);
+	journalAppendf(JournalKind::Boot, "reset %d", static_cast<int>(esp_reset_reason()));
+	return consoleAdd("journal", "Stream modem journal, oldest first [clear]", &journalCommand);
+}
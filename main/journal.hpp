@@ -0,0 +1,50 @@
+// vim: tabstop=4 shiftwidth=4 noexpandtab colorcolumn=120 :
+// This file is part of the Sim800 (https://github.com/beranat/sim800).
+// Copyright (c) 2021 Anatoly L. Berenblit.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 3.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+#include <esp_err.h>
+
+// Append-only journal of the modem traffic in the "journal" data partition (partitions.csv), it survives reboots.
+// Sectors are used round robin with a sequence number, the oldest one is erased when the journal wraps around.
+// journalAppend() only copies the record into the RAM staging ring (constant time, dropped when the ring is full),
+// the writer task packs records into flash page writes and erases sectors.
+
+enum class JournalKind : uint8_t {
+	Boot,
+	Tx,		// command to the modem
+	Rx,		// modem line
+	Urc,
+	Result,	// final result of a command
+	Fatal,
+	Count,
+};
+
+constexpr size_t journalPayloadMax = 248;	// longer payload is truncated
+
+esp_err_t journalInit() noexcept;
+
+// Any task, never blocks
+bool journalAppend(JournalKind kind, std::string_view payload) noexcept;
+bool journalAppendf(JournalKind kind, const char *format, ...) noexcept __attribute__((format(printf, 2, 3)));
+
+// Write staged records on the calling task (fatal error path)
+void journalSync() noexcept;
+
+const char *journalKindName(JournalKind kind) noexcept;
@@ -0,0 +1,316 @@
+// vim: tabstop=4 shiftwidth=4 noexpandtab colorcolumn=120 :
+// This file is part of the Sim800 (https://github.com/beranat/sim800).
+// Copyright (c) 2021 Anatoly L. Berenblit.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 3.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string_view>
+
+#include <esp_log.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+
+#include "console.hpp"
+#include "at.hpp"
+#include "pdu.hpp"
+#include "listing.hpp"
+
+constexpr const char *MODULE = "listing";
+
+constexpr TickType_t listingCommandTimeout = pdMS_TO_TICKS(5000);
+// Hundreds of PDU lines at the link rate
+constexpr TickType_t listingTimeout = pdMS_TO_TICKS(60000);
+constexpr size_t listingNumberMax = 40;	// AT+CPBR=? <nlength>
+constexpr size_t listingIndexMax = 256;	// console
+constexpr int listingPrintMax = 60;		// console, text bytes of a record
+
+// Listing in progress (listingLock), its lines are parsed on the receiver task
+struct Listing {
+	ListingKind kind = ListingKind::Sms;
+	ListingCallback callback = nullptr;
+	void *arg = nullptr;
+	ListingIndex *index = nullptr;
+	bool isHeader = false;		// +CMGL: line, the PDU is next
+	uint16_t location = 0;
+	uint8_t status = 0;
+	size_t records = 0;
+	size_t undecoded = 0;
+	bool isOverflow = false;	// of the index
+};
+
+static SemaphoreHandle_t listingLock = nullptr;
+static Listing listing;
+static PduDeliver listingMessage;
+static char listingNumber[listingNumberMax + 1];
+static char listingName[listingNameMax + 1];
+
+static ListingEntry listingEntries[listingIndexMax];
+static ListingIndex listingConsole(listingEntries, listingIndexMax);
+
+class ListingGuard final {
+	SemaphoreHandle_t lock_;
+	public:
+		explicit ListingGuard(SemaphoreHandle_t lock) noexcept : lock_(lock) {
+			xSemaphoreTake(lock_, portMAX_DELAY);
+		}
+		~ListingGuard() {
+			xSemaphoreGive(lock_);
+		}
+};
+
+// FNV-1a
+uint32_t listingKey(const char *number) noexcept {
+	uint32_t key = 2166136261u;
+	for (; 0 != *number; ++number)
+		key = (key ^ static_cast<uint8_t>(*number)) * 16777619u;
+	return key;
+}
+
+void ListingIndex::clear(ListingKind kind) noexcept {
+	size_t kept = 0;
+	for (size_t i = 0; i < count_; ++i) {
+		if (kind != entries_[i].kind)
+			entries_[kept++] = entries_[i];
+	}
+	count_ = kept;
+}
+
+bool ListingIndex::add(const ListingRecord &record) noexcept {
+	if (capacity_ <= count_)
+		return false;
+	entries_[count_++] = ListingEntry { listingKey(record.number), record.index, record.status, record.kind };
+	return true;
+}
+
+void ListingIndex::remove(ListingKind kind, uint16_t index) noexcept {
+	for (size_t i = 0; i < count_; ++i) {
+		if (kind == entries_[i].kind && index == entries_[i].index) {
+			entries_[i] = entries_[--count_];
+			return;
+		}
+	}
+}
+
+size_t ListingIndex::find(const char *number, ListingEntry *found, size_t max) const noexcept {
+	const uint32_t key = listingKey(number);
+	size_t total = 0;
+	for (size_t i = 0; i < count_; ++i) {
+		if (key != entries_[i].key)
+			continue;
+		if (total < max)
+			found[total] = entries_[i];
+		++total;
+	}
+	return total;
+}
+
+// Next comma separated field of a response, quotes are stripped (a quoted one may have commas)
+static std::string_view listingField(std::string_view &args) noexcept {
+	while (!args.empty() && ' ' == args.front())
+		args.remove_prefix(1);
+
+	std::string_view field;
+	if (!args.empty() && '"' == args.front()) {
+		const size_t end = args.find('"', 1);
+		field = args.substr(1, (std::string_view::npos != end) ? end - 1 : std::string_view::npos);
+		args.remove_prefix((std::string_view::npos != end) ? end + 1 : args.length());
+	} else {
+		field = args.substr(0, args.find(','));
+		args.remove_prefix(field.length());
+	}
+	if (!args.empty() && ',' == args.front())
+		args.remove_prefix(1);
+	return field;
+}
+
+static unsigned int listingValue(std::string_view field) noexcept {
+	unsigned int value = 0;
+	for (const char c : field) {
+		if (c < '0' || '9' < c)
+			break;
+		value = value * 10 + (c - '0');
+	}
+	return value;
+}
+
+static void listingCopy(std::string_view field, char *text, size_t size) noexcept {
+	const size_t length = (field.length() < size) ? field.length() : size - 1;
+	memcpy(text, field.data(), length);
+	text[length] = 0;
+}
+
+static void listingRecord(const ListingRecord &record) noexcept {
+	++listing.records;
+	if (nullptr != listing.index && !listing.index->add(record))
+		listing.isOverflow = true;
+	if (nullptr != listing.callback)
+		listing.callback(record, listing.arg);
+}
+
+// +CMGL: <index>,<stat>,[<alpha>],<length> and the PDU; +CPBR: <index>,<number>,<type>,<text>
+static void listingLine(std::string_view line, void *) noexcept {
+	constexpr std::string_view sms = "+CMGL:";
+	constexpr std::string_view phonebook = "+CPBR:";
+	if (ListingKind::Sms == listing.kind) {
+		if (0 == line.compare(0, sms.length(), sms)) {
+			line.remove_prefix(sms.length());
+			listing.location = static_cast<uint16_t>(listingValue(listingField(line)));
+			listing.status = static_cast<uint8_t>(listingValue(listingField(line)));
+			listing.isHeader = true;
+			return;
+		}
+		if (!listing.isHeader)
+			return;
+
+		listing.isHeader = false;
+		if (pduDeliver(line, listingMessage)) {
+			listingRecord(ListingRecord { ListingKind::Sms, listing.location, listing.status, listingMessage.sender,
+										  listingMessage.text, listingMessage.length, &listingMessage });
+		} else {
+			++listing.undecoded;
+			listingRecord(ListingRecord { ListingKind::Sms, listing.location, listing.status, "", "", 0, nullptr });
+		}
+		return;
+	}
+
+	if (0 != line.compare(0, phonebook.length(), phonebook))
+		return;
+	line.remove_prefix(phonebook.length());
+	const uint16_t location = static_cast<uint16_t>(listingValue(listingField(line)));
+	listingCopy(listingField(line), listingNumber, sizeof(listingNumber));
+	const uint8_t type = static_cast<uint8_t>(listingValue(listingField(line)));
+	const std::string_view name = listingField(line);
+	listingCopy(name, listingName, sizeof(listingName));
+	listingRecord(ListingRecord { ListingKind::Phonebook, location, type, listingNumber, listingName,
+								  strlen(listingName), nullptr });
+}
+
+// AT+CPBR=? - +CPBR: (<first>-<last>),<nlength>,<tlength>
+static bool listingRange(unsigned int &first, unsigned int &last) noexcept {
+	AtResponse response;
+	if (AtResult::Ok != atCommand("AT+CPBR=?", &response, listingCommandTimeout))
+		return false;
+
+	const char *range = strchr(response.text, '(');
+	const char *dash = (nullptr != range) ? strchr(range, '-') : nullptr;
+	if (nullptr == dash)
+		return false;
+	first = strtoul(range + 1, nullptr, 10);
+	last = strtoul(dash + 1, nullptr, 10);
+	return 0 != first && first <= last;
+}
+
+esp_err_t listingRead(ListingKind kind, ListingCallback callback, void *arg, ListingIndex *index) noexcept {
+	const ListingGuard guard(listingLock);
+	AtRequest request;
+	if (ListingKind::Sms == kind) {
+		// every status, unread ones stay unread
+		if (AtResult::Ok != atCommand("AT+CMGF=0", nullptr, listingCommandTimeout))
+			return ESP_FAIL;
+		snprintf(request.command, sizeof(request.command), "AT+CMGL=4,1");
+	} else {
+		unsigned int first, last;
+		if (!listingRange(first, last))
+			return ESP_FAIL;
+		snprintf(request.command, sizeof(request.command), "AT+CPBR=%u,%u", first, last);
+	}
+
+	if (nullptr != index)
+		index->clear(kind);
+	listing = Listing();
+	listing.kind = kind;
+	listing.callback = callback;
+	listing.arg = arg;
+	listing.index = index;
+
+	request.timeout = listingTimeout;
+	request.onLine = &listingLine;
+	const AtResult result = atCommand(request);
+	ESP_LOGI(MODULE, "%s %s, %zu records, %zu undecoded", request.command, atResultName(result), listing.records,
+			 listing.undecoded);
+	switch (result) {
+		case AtResult::Ok:
+			return listing.isOverflow ? ESP_ERR_NO_MEM : ESP_OK;
+		case AtResult::Timeout:
+			return ESP_ERR_TIMEOUT;
+		default:
+			return ESP_FAIL;
+	}
+}
+
+esp_err_t listingDelete(ListingIndex &index, const char *number) noexcept {
+	size_t deleted = 0;
+	ListingEntry entry;
+	while (0 != index.find(number, &entry, 1)) {
+		char command[atCommandMax];
+		snprintf(command, sizeof(command), (ListingKind::Sms == entry.kind) ? "AT+CMGD=%u" : "AT+CPBW=%u",
+				 entry.index);
+		if (AtResult::Ok != atCommand(command, nullptr, listingCommandTimeout))
+			return ESP_FAIL;
+		index.remove(entry.kind, entry.index);
+		++deleted;
+	}
+	return (0 != deleted) ? ESP_OK : ESP_ERR_NOT_FOUND;
+}
+
+static const char *listingStatusName(const ListingRecord &record) noexcept {
+	if (ListingKind::Phonebook == record.kind)
+		return (145 == record.status) ? "intl" : "local";
+
+	constexpr const char *names[] = { "unread", "read", "unsent", "sent" };
+	return (record.status < sizeof(names) / sizeof(*names)) ? names[record.status] : "unknown";
+}
+
+static void listingPrint(const ListingRecord &record, void *) noexcept {
+	const int length = (record.length < listingPrintMax) ? static_cast<int>(record.length) : listingPrintMax;
+	printf("  %u %s %s %s%s%.*s%s\n", record.index, listingStatusName(record), record.number,
+		   (nullptr != record.message) ? record.message->timestamp : "",
+		   (nullptr != record.message && 0 != record.message->timestamp[0]) ? " " : "", length, record.text,
+		   (record.length > static_cast<size_t>(length)) ? "..." : "");
+}
+
+// listing [sms|phonebook] | [find <number>] | [delete <number>]
+static int listingCommand(int argc, char **argv) {
+	if (2 == argc && (0 == strcmp(argv[1], "sms") || 0 == strcmp(argv[1], "phonebook")))
+		return listingRead(('s' == argv[1][0]) ? ListingKind::Sms : ListingKind::Phonebook, &listingPrint, nullptr,
+						   &listingConsole);
+	if (3 == argc && 0 == strcmp(argv[1], "find")) {
+		ListingEntry found[16];
+		const size_t total = listingConsole.find(argv[2], found, sizeof(found) / sizeof(*found));
+		for (size_t i = 0; i < total && i < sizeof(found) / sizeof(*found); ++i)
+			printf("  %s %u\n", (ListingKind::Sms == found[i].kind) ? "sms" : "phonebook", found[i].index);
+		return (0 != total) ? ESP_OK : ESP_ERR_NOT_FOUND;
+	}
+	if (3 == argc && 0 == strcmp(argv[1], "delete"))
+		return listingDelete(listingConsole, argv[2]);
+	if (1 != argc)
+		return ESP_ERR_INVALID_ARG;
+
+	size_t sms = 0;
+	for (size_t i = 0; i < listingConsole.size(); ++i)
+		sms += (ListingKind::Sms == listingConsole[i].kind) ? 1 : 0;
+	printf("%s: index %zu/%zu, %zu sms, %zu phonebook\n", MODULE, listingConsole.size(), listingIndexMax, sms,
+		   listingConsole.size() - sms);
+	return ESP_OK;
+}
+
+esp_err_t listingInit() noexcept {
+	listingLock = xSemaphoreCreateMutex();
+	if (nullptr == listingLock)
+		return ESP_ERR_NO_MEM;
+	return consoleAdd("listing", "SIM storage listing and its index [sms|phonebook] [find <number>] "
+					  "[delete <number>]", &listingCommand);
+}
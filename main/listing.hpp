@@ -0,0 +1,88 @@
+// vim: tabstop=4 shiftwidth=4 noexpandtab colorcolumn=120 :
+// This file is part of the Sim800 (https://github.com/beranat/sim800).
+// Copyright (c) 2021 Anatoly L. Berenblit.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 3.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <esp_err.h>
+
+#include "pdu.hpp"
+
+// Bulk readers of the SIM storage: AT+CMGL (SMS, PDU mode) and AT+CPBR (phonebook). Records are parsed as the lines
+// arrive and handed out one by one, the listing itself is never kept. A ListingIndex (8 bytes a record) remembers
+// where the records of a number are, so they are found and deleted without another listing.
+
+constexpr size_t listingNameMax = 40;	// AT+CPBR=? <tlength>
+
+enum class ListingKind : uint8_t {
+	Sms,
+	Phonebook,
+};
+
+struct ListingRecord {
+	ListingKind kind;
+	uint16_t index;				// storage location
+	uint8_t status;				// SMS: 0 unread, 1 read, 2 unsent, 3 sent; phonebook: number type (129, 145)
+	const char *number;			// sender (recipient of stored SMS-SUBMIT) or phonebook number
+	const char *text;			// SMS text (UTF-8) or the name
+	size_t length;
+	const PduDeliver *message;	// SMS details, nullptr for the phonebook and undecoded PDU
+};
+
+// Record on the receiver task, valid only inside the call, must not block or submit AT commands
+typedef void (*ListingCallback)(const ListingRecord &record, void *arg);
+
+struct ListingEntry {
+	uint32_t key;	// listingKey() of the number
+	uint16_t index;
+	uint8_t status;
+	ListingKind kind;
+};
+
+// Storage locations by the number hash, entries are caller provided
+class ListingIndex final {
+	ListingEntry *entries_;
+	size_t capacity_;
+	size_t count_ = 0;
+	public:
+		ListingIndex(ListingEntry *entries, size_t capacity) noexcept : entries_(entries), capacity_(capacity) {}
+		ListingIndex(const ListingIndex &) = delete;
+		ListingIndex &operator=(const ListingIndex &) = delete;
+
+		size_t size() const noexcept {
+			return count_;
+		}
+		const ListingEntry &operator[](size_t i) const noexcept {
+			return entries_[i];
+		}
+
+		void clear(ListingKind kind) noexcept;
+		bool add(const ListingRecord &record) noexcept;
+		void remove(ListingKind kind, uint16_t index) noexcept;
+		// Entries of the number are copied (hash collision is not resolved, 2^-32 a pair), returns the total
+		size_t find(const char *number, ListingEntry *found, size_t max) const noexcept;
+};
+
+uint32_t listingKey(const char *number) noexcept;
+
+// Reads the whole storage, the index (optional) loses entries of the kind and gets the new ones.
+// Index overflow is ESP_ERR_NO_MEM after the listing.
+esp_err_t listingRead(ListingKind kind, ListingCallback callback, void *arg, ListingIndex *index = nullptr) noexcept;
+// Deletes the records of the number found in the index (AT+CMGD, AT+CPBW), ESP_ERR_NOT_FOUND - none
+esp_err_t listingDelete(ListingIndex &index, const char *number) noexcept;
+
+esp_err_t listingInit() noexcept;
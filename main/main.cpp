@@ -23,6 +23,7 @@
 #include <esp_log.h>
 #include <esp_system.h>
 #include <esp_sleep.h>
+#include <esp_timer.h>
 #include <driver/i2c.h>
 
 #include <freertos/FreeRTOS.h>
@@ -33,6 +34,13 @@
 #include "sdkconfig.h"
 
 #include "storage.hpp"
+#include "config.hpp"
+#include "journal.hpp"
+#include "dlog.hpp"
+#include "stats.hpp"
+#include "bridge.hpp"
+#include "outbox.hpp"
+#include "ppp.hpp"
 #include "main.hpp"
 
 constexpr const char *APP = "app";
@@ -42,7 +50,12 @@ void fatalError(const char *message, const char *tag) noexcept {
 		message = "Internal";
 
 	ESP_LOGE((nullptr != tag)?tag:APP, "%s", message);
+	journalAppendf(JournalKind::Fatal, "%s: %s", (nullptr != tag)?tag:APP, message);
+	journalSync();
 
+	// deep sleep skips shutdown handlers
+	dlogFlush();
+	Storage::getInstance().flush();
 	while (true)
 		esp_deep_sleep_start();
 }
@@ -55,6 +68,11 @@ void fatalError(esp_err_t code, const char *message, const char *tag) noexcept {
 			message = "Internal";
 
 		ESP_LOGE((nullptr != tag)?tag:APP, "%s error %s (%d)", message, esp_err_to_name(code), static_cast<int>(code));
+		journalAppendf(JournalKind::Fatal, "%s: %s error %s (%d)", (nullptr != tag)?tag:APP, message,
+					   esp_err_to_name(code), static_cast<int>(code));
+		journalSync();
+		dlogFlush();
+		Storage::getInstance().flush();
 		while (true)
 			esp_deep_sleep_start();
 	}
@@ -233,8 +251,24 @@ extern "C" void app_main(void) {
 		ESP_LOGW(APP, "LED not available");
 
 	ESP_ERROR_CHECK(consoleInit());
+	ESP_ERROR_CHECK(dlogInit());
+	ESP_ERROR_CHECK(statsInit());
+
+	if (ESP_OK != journalInit())
+		ESP_LOGW(APP, "Journal is not available");
+	ESP_ERROR_CHECK(configInit());
+
+	// SIM800 power-up goes on in background
+	ESP_ERROR_CHECK(simInit());
+	ESP_ERROR_CHECK(bridgeInit());
+	ESP_ERROR_CHECK(pppInit());
+	if (ESP_OK != outboxInit())
+		ESP_LOGW(APP, "Outbox is not available");
 
 	ESP_ERROR_CHECK(consoleAdd("reboot", "Software reset of the chip", [](int, char **) -> int { esp_restart(); return ESP_FAIL; }));
+	ESP_ERROR_CHECK(consoleAdd("flush", "Commit storage changes", [](int, char **) -> int {
+		return Storage::getInstance().flush() ? ESP_OK : ESP_FAIL;
+	}));
 	ESP_ERROR_CHECK(consoleAdd("pinout", "Configure Pin as Output", &pinOutput));
 	ESP_ERROR_CHECK(consoleAdd("pinin", "Configure pin as Input", &pinInput));
 	ESP_ERROR_CHECK(consoleAdd("pinoff", "Deconfigure pin", &pinDisable));
@@ -242,8 +276,7 @@ extern "C" void app_main(void) {
 	ESP_LOGI(APP, "IP5306 init");
 	ESP_ERROR_CHECK(setPowerBoostKeepOn(true));
 
-	// SIM800 configuration
-	ESP_ERROR_CHECK(simInit());
+	ESP_LOGI(APP, "Initialized in %lld ms", static_cast<long long>(esp_timer_get_time() / 1000));
 
 	consoleLoop();
 	fatalError("System halted", APP);
@@ -0,0 +1,744 @@
+// vim: tabstop=4 shiftwidth=4 noexpandtab colorcolumn=120 :
+// This file is part of the Sim800 (https://github.com/beranat/sim800).
+// Copyright (c) 2021 Anatoly L. Berenblit.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 3.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+#include <atomic>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+#include <esp_log.h>
+#include <esp_timer.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+
+#include "console.hpp"
+#include "socket.hpp"
+#include "mqtt.hpp"
+
+constexpr const char *MODULE = "mqtt";
+
+constexpr TickType_t mqttAnswerTimeout = pdMS_TO_TICKS(30000);	// CONNACK, SUBACK
+constexpr TickType_t mqttSendTimeout = pdMS_TO_TICKS(30000);
+constexpr uint32_t mqttTaskStack = 4096;
+constexpr UBaseType_t mqttTaskPriority = 5;
+
+enum class MqttType : uint8_t {
+	Connect = 1,
+	Connack,
+	Publish,
+	Puback,
+	Pubrec,
+	Pubrel,
+	Pubcomp,
+	Subscribe,
+	Suback,
+	Unsubscribe,
+	Unsuback,
+	Pingreq,
+	Pingresp,
+	Disconnect,
+};
+
+enum class MqttState : uint8_t {
+	Closed,
+	Connecting,	// CONNECT is sent
+	Connected,
+	Closing,	// DISCONNECT is queued
+};
+
+enum class MqttRx : uint8_t {
+	Header,
+	Length,
+	Body,
+};
+
+struct MqttSlot {
+	uint16_t id;	// 0 - free
+	int64_t queuedUs;
+};
+
+struct Mqtt {
+	std::atomic<MqttState> state { MqttState::Closed };
+	int socket = -1;
+	MqttCallback callback = nullptr;
+	void *arg = nullptr;
+	TickType_t pingInterval = 0;	// 0 - no keepalive
+	std::atomic<TickType_t> lastSent { 0 };
+	std::atomic<bool> isPingPending { false };
+	SemaphoreHandle_t wakeup = nullptr;	// something to send, not task notifications - the task waits for AT commands
+
+	// packets are queued into tx[fill] under txLock while the task sends the other buffer
+	SemaphoreHandle_t txLock = nullptr;
+	SemaphoreHandle_t txRoom = nullptr;		// buffers were swapped or the connection is gone
+	uint8_t tx[2][mqttPacketMax];
+	int fill = 0;
+	size_t fillLength = 0;
+
+	// QoS 1 publishes w/o PUBACK (slots and ids under txLock)
+	SemaphoreHandle_t window = nullptr;		// free slots
+	SemaphoreHandle_t drained = nullptr;	// nothing is in flight
+	MqttSlot slots[mqttWindowMax];
+	std::atomic<unsigned int> inFlight { 0 };
+	uint16_t nextId = 0;
+
+	// CONNACK/SUBACK return code, -1 - the connection is gone
+	SemaphoreHandle_t answered = nullptr;
+	std::atomic<int> answer { 0 };
+
+	// packet being received, on the receiver task
+	MqttRx rxState = MqttRx::Header;
+	uint8_t rxHeader = 0;
+	size_t rxRemaining = 0;
+	unsigned int rxShift = 0;
+	size_t rxLength = 0;
+	uint8_t rx[mqttPacketMax];
+
+	MqttStats stats = {};	// sends/bytes on the task, the rest under txLock
+};
+
+static Mqtt mqtt;
+static SemaphoreHandle_t mqttLock = nullptr;	// connect/subscribe/disconnect
+
+class MqttGuard final {
+	SemaphoreHandle_t lock_;
+	public:
+		explicit MqttGuard(SemaphoreHandle_t lock) noexcept : lock_(lock) {
+			xSemaphoreTake(lock_, portMAX_DELAY);
+		}
+		~MqttGuard() {
+			xSemaphoreGive(lock_);
+		}
+};
+
+static constexpr uint8_t mqttFixed(MqttType type, uint8_t flags = 0) noexcept {
+	return static_cast<uint8_t>(static_cast<uint8_t>(type) << 4 | flags);
+}
+
+// Whole packet of the remaining length
+static size_t mqttSize(size_t remaining) noexcept {
+	size_t size = 2 + remaining;
+	for (size_t length = remaining; 0x80 <= length; length >>= 7)
+		++size;
+	return size;
+}
+
+static uint8_t *mqttHeader(uint8_t *p, uint8_t fixed, size_t remaining) noexcept {
+	*p++ = fixed;
+	do {
+		*p++ = static_cast<uint8_t>((remaining & 0x7F) | ((0x80 <= remaining) ? 0x80 : 0));
+		remaining >>= 7;
+	} while (0 != remaining);
+	return p;
+}
+
+static uint8_t *mqttWord(uint8_t *p, uint16_t value) noexcept {
+	*p++ = static_cast<uint8_t>(value >> 8);
+	*p++ = static_cast<uint8_t>(value & 0xFF);
+	return p;
+}
+
+static uint8_t *mqttString(uint8_t *p, const char *text, size_t length) noexcept {
+	p = mqttWord(p, static_cast<uint16_t>(length));
+	memcpy(p, text, length);
+	return p + length;
+}
+
+static TickType_t mqttLeft(TickType_t start, TickType_t wait) noexcept {
+	if (portMAX_DELAY == wait)
+		return portMAX_DELAY;
+	const TickType_t elapsed = xTaskGetTickCount() - start;
+	return (elapsed < wait) ? wait - elapsed : 0;
+}
+
+// Room for the packet in the fill buffer, txLock is held till mqttQueued(). nullptr - no connection or no room in
+// `wait'.
+static uint8_t *mqttReserve(size_t size, TickType_t wait) noexcept {
+	const TickType_t start = xTaskGetTickCount();
+	while (true) {
+		xSemaphoreTake(mqtt.txLock, portMAX_DELAY);
+		if (MqttState::Closed == mqtt.state.load()) {
+			xSemaphoreGive(mqtt.txLock);
+			xSemaphoreGive(mqtt.txRoom);	// the next waiter sees it too
+			return nullptr;
+		}
+		if (mqtt.fillLength + size <= mqttPacketMax)
+			return mqtt.tx[mqtt.fill] + mqtt.fillLength;
+		xSemaphoreGive(mqtt.txLock);
+
+		xSemaphoreGive(mqtt.wakeup);
+		const TickType_t left = mqttLeft(start, wait);
+		if (0 == left || pdTRUE != xSemaphoreTake(mqtt.txRoom, left))
+			return nullptr;
+	}
+}
+
+static void mqttQueued(size_t size) noexcept {
+	mqtt.fillLength += size;
+	xSemaphoreGive(mqtt.txLock);
+	xSemaphoreGive(mqtt.wakeup);
+}
+
+static bool mqttQueue(const uint8_t *packet, size_t size, TickType_t wait) noexcept {
+	uint8_t *p = mqttReserve(size, wait);
+	if (nullptr == p)
+		return false;
+	memcpy(p, packet, size);
+	mqttQueued(size);
+	return true;
+}
+
+// Connection is closed (socket callback): waiters are released, in flight publishes are lost
+static void mqttLost() noexcept {
+	const MqttState state = mqtt.state.exchange(MqttState::Closed);
+	if (MqttState::Closed == state)
+		return;
+
+	unsigned int lost = 0;
+	{
+		const MqttGuard guard(mqtt.txLock);
+		for (MqttSlot &slot : mqtt.slots) {
+			if (0 != slot.id)
+				++lost;
+			slot.id = 0;
+		}
+		mqtt.fillLength = 0;
+		mqtt.stats.lost += lost;
+	}
+	mqtt.inFlight = 0;
+	if (MqttState::Closing != state || 0 != lost)
+		ESP_LOGW(MODULE, "Connection lost, %u publishes unacknowledged", lost);
+	else
+		ESP_LOGI(MODULE, "Disconnected");
+
+	mqtt.answer = -1;
+	xSemaphoreGive(mqtt.answered);
+	xSemaphoreGive(mqtt.window);
+	xSemaphoreGive(mqtt.txRoom);
+	xSemaphoreGive(mqtt.drained);
+}
+
+static void mqttAcked(uint16_t id) noexcept {
+	bool isFound = false;
+	{
+		const MqttGuard guard(mqtt.txLock);
+		for (MqttSlot &slot : mqtt.slots) {
+			if (id != slot.id)
+				continue;
+			const int64_t us = esp_timer_get_time() - slot.queuedUs;
+			MqttStats &stats = mqtt.stats;
+			stats.ackMinUs = (0 == stats.acked || us < stats.ackMinUs) ? us : stats.ackMinUs;
+			stats.ackMaxUs = (us > stats.ackMaxUs) ? us : stats.ackMaxUs;
+			stats.ackTotalUs += us;
+			++stats.acked;
+			slot.id = 0;
+			isFound = true;
+			break;
+		}
+	}
+	if (!isFound) {
+		ESP_LOGW(MODULE, "PUBACK of unknown %u", id);
+		return;
+	}
+
+	xSemaphoreGive(mqtt.window);
+	if (1 == mqtt.inFlight.fetch_sub(1))
+		xSemaphoreGive(mqtt.drained);
+}
+
+static void mqttReceived(uint8_t fixed, const uint8_t *body, size_t length) noexcept {
+	const unsigned int qos = (fixed >> 1) & 3;
+	const size_t topicLength = (2 <= length) ? (body[0] << 8 | body[1]) : length;
+	size_t pos = 2 + topicLength;
+	if (length < pos + ((0 != qos) ? 2 : 0)) {
+		ESP_LOGW(MODULE, "Malformed PUBLISH");
+		return;
+	}
+	const uint16_t id = (0 != qos) ? static_cast<uint16_t>(body[pos] << 8 | body[pos + 1]) : 0;
+	if (0 != qos)
+		pos += 2;
+
+	{
+		const MqttGuard guard(mqtt.txLock);
+		++mqtt.stats.received;
+	}
+	if (nullptr != mqtt.callback)
+		mqtt.callback(std::string_view(reinterpret_cast<const char *>(body + 2), topicLength), body + pos,
+					  length - pos, mqtt.arg);
+
+	if (1 == qos) {
+		uint8_t ack[4] = { mqttFixed(MqttType::Puback), 2 };
+		mqttWord(ack + 2, id);
+		if (!mqttQueue(ack, sizeof(ack), 0))
+			ESP_LOGW(MODULE, "PUBACK %u is dropped", id);
+	} else if (2 == qos)
+		ESP_LOGW(MODULE, "QoS 2 PUBLISH %u is not acknowledged", id);
+}
+
+static void mqttPacket(uint8_t fixed, const uint8_t *body, size_t length) noexcept {
+	switch (static_cast<MqttType>(fixed >> 4)) {
+		case MqttType::Connack:
+			if (2 <= length) {
+				MqttState connecting = MqttState::Connecting;
+				if (0 == body[1] && mqtt.state.compare_exchange_strong(connecting, MqttState::Connected))
+					xSemaphoreGive(mqtt.wakeup);	// keepalive starts
+				mqtt.answer = body[1];
+				xSemaphoreGive(mqtt.answered);
+			}
+			break;
+		case MqttType::Puback:
+			if (2 <= length)
+				mqttAcked(static_cast<uint16_t>(body[0] << 8 | body[1]));
+			break;
+		case MqttType::Suback:
+			if (3 <= length) {
+				mqtt.answer = body[2];
+				xSemaphoreGive(mqtt.answered);
+			}
+			break;
+		case MqttType::Pingresp:
+			mqtt.isPingPending = false;
+			break;
+		case MqttType::Publish:
+			mqttReceived(fixed, body, length);
+			break;
+		default:
+			ESP_LOGD(MODULE, "Packet %02x ignored", fixed);
+			break;
+	}
+}
+
+// Broker data on the receiver task: packets are put together in rx, the ones over it are skipped
+static void mqttData(int, const uint8_t *data, size_t length, void *) noexcept {
+	if (nullptr == data) {
+		mqttLost();
+		return;
+	}
+
+	while (0 != length) {
+		if (MqttRx::Header == mqtt.rxState) {
+			mqtt.rxHeader = *data++;
+			--length;
+			mqtt.rxRemaining = 0;
+			mqtt.rxShift = 0;
+			mqtt.rxState = MqttRx::Length;
+			continue;
+		}
+
+		if (MqttRx::Length == mqtt.rxState) {
+			const uint8_t byte = *data++;
+			--length;
+			mqtt.rxRemaining |= static_cast<size_t>(byte & 0x7F) << mqtt.rxShift;
+			mqtt.rxShift += 7;
+			if (0 != (byte & 0x80) && mqtt.rxShift < 28)
+				continue;
+			mqtt.rxLength = 0;
+			mqtt.rxState = MqttRx::Body;
+			if (0 != mqtt.rxRemaining)
+				continue;
+		} else {
+			const size_t size = (length < mqtt.rxRemaining - mqtt.rxLength) ? length : mqtt.rxRemaining - mqtt.rxLength;
+			if (mqtt.rxLength < sizeof(mqtt.rx))
+				memcpy(mqtt.rx + mqtt.rxLength, data,
+					   (size < sizeof(mqtt.rx) - mqtt.rxLength) ? size : sizeof(mqtt.rx) - mqtt.rxLength);
+			mqtt.rxLength += size;
+			data += size;
+			length -= size;
+			if (mqtt.rxLength < mqtt.rxRemaining)
+				continue;
+		}
+
+		mqtt.rxState = MqttRx::Header;
+		if (mqtt.rxRemaining <= sizeof(mqtt.rx))
+			mqttPacket(mqtt.rxHeader, mqtt.rx, mqtt.rxRemaining);
+		else
+			ESP_LOGW(MODULE, "Packet %02x of %zu bytes skipped", mqtt.rxHeader, mqtt.rxRemaining);
+	}
+}
+
+// Queued packets go out, one socketSend per buffer; the connection is closed after DISCONNECT or a send error
+static void mqttSend() noexcept {
+	while (true) {
+		int sending = 0;
+		size_t length = 0;
+		bool isClosing = false;
+		{
+			const MqttGuard guard(mqtt.txLock);
+			sending = mqtt.fill;
+			length = mqtt.fillLength;
+			isClosing = (0 == length && MqttState::Closing == mqtt.state.load());
+			if (0 != length) {
+				mqtt.fill ^= 1;
+				mqtt.fillLength = 0;
+			}
+		}
+		if (isClosing)
+			socketClose(mqtt.socket);
+		if (0 == length)
+			return;
+
+		xSemaphoreGive(mqtt.txRoom);
+		const esp_err_t result = socketSend(mqtt.socket, mqtt.tx[sending], length, mqttSendTimeout);
+		mqtt.lastSent = xTaskGetTickCount();
+		++mqtt.stats.sends;
+		mqtt.stats.bytes += length;
+		if (ESP_OK != result) {
+			ESP_LOGW(MODULE, "Send error %s", esp_err_to_name(result));
+			socketClose(mqtt.socket);
+			return;
+		}
+	}
+}
+
+// Sleeps till there is something to send or the keepalive is due
+static void mqttTask(void *) noexcept {
+	while (true) {
+		TickType_t wait = portMAX_DELAY;
+		const bool isKeepAlive = (MqttState::Connected == mqtt.state.load() && 0 != mqtt.pingInterval);
+		if (isKeepAlive) {
+			const TickType_t idle = xTaskGetTickCount() - mqtt.lastSent.load();
+			wait = (idle < mqtt.pingInterval) ? mqtt.pingInterval - idle : 0;
+		}
+		xSemaphoreTake(mqtt.wakeup, wait);
+		if (MqttState::Closed == mqtt.state.load())
+			continue;
+
+		if (isKeepAlive && mqtt.pingInterval <= xTaskGetTickCount() - mqtt.lastSent.load()) {
+			// PINGRESP did not come in the interval
+			if (mqtt.isPingPending.exchange(true)) {
+				ESP_LOGW(MODULE, "Broker does not answer");
+				socketClose(mqtt.socket);
+				continue;
+			}
+			static const uint8_t ping[] = { mqttFixed(MqttType::Pingreq), 0 };
+			mqttQueue(ping, sizeof(ping), 0);
+		}
+		mqttSend();
+	}
+}
+
+esp_err_t mqttConnect(const MqttConfig &config) noexcept {
+	if (nullptr == config.host || nullptr == config.clientId || 0 == config.window || mqttWindowMax < config.window ||
+			(nullptr != config.password && nullptr == config.user))
+		return ESP_ERR_INVALID_ARG;
+
+	const size_t remaining = 10 + 2 + strlen(config.clientId) +
+							 ((nullptr != config.user) ? 2 + strlen(config.user) : 0) +
+							 ((nullptr != config.password) ? 2 + strlen(config.password) : 0);
+	if (mqttPacketMax < mqttSize(remaining))
+		return ESP_ERR_INVALID_SIZE;
+
+	const MqttGuard guard(mqttLock);
+	if (MqttState::Closed != mqtt.state.load())
+		return ESP_ERR_INVALID_STATE;
+
+	// clean session
+	{
+		const MqttGuard tx(mqtt.txLock);
+		mqtt.fill = 0;
+		mqtt.fillLength = 0;
+		for (MqttSlot &slot : mqtt.slots)
+			slot.id = 0;
+		mqtt.stats = MqttStats {};
+	}
+	mqtt.inFlight = 0;
+	while (pdTRUE == xSemaphoreTake(mqtt.window, 0))
+		;
+	for (unsigned int i = 0; i < config.window; ++i)
+		xSemaphoreGive(mqtt.window);
+	xSemaphoreTake(mqtt.answered, 0);
+	xSemaphoreTake(mqtt.drained, 0);
+	xSemaphoreTake(mqtt.txRoom, 0);
+	mqtt.callback = config.callback;
+	mqtt.arg = config.arg;
+	mqtt.pingInterval = pdMS_TO_TICKS(config.keepAlive * 750);
+	mqtt.isPingPending = false;
+	mqtt.rxState = MqttRx::Header;
+
+	esp_err_t result = socketConnect(SocketType::Tcp, config.host, config.port, &mqttData, nullptr, &mqtt.socket);
+	if (ESP_OK != result)
+		return result;
+	mqtt.lastSent = xTaskGetTickCount();
+	mqtt.state = MqttState::Connecting;
+
+	uint8_t *p = mqttReserve(mqttSize(remaining), 0);
+	if (nullptr == p) {
+		socketClose(mqtt.socket);
+		return ESP_FAIL;
+	}
+	const uint8_t flags = 0x02 | ((nullptr != config.user) ? 0x80 : 0) | ((nullptr != config.password) ? 0x40 : 0);
+	p = mqttHeader(p, mqttFixed(MqttType::Connect), remaining);
+	p = mqttString(p, "MQTT", 4);
+	*p++ = 4;	// 3.1.1
+	*p++ = flags;
+	p = mqttWord(p, config.keepAlive);
+	p = mqttString(p, config.clientId, strlen(config.clientId));
+	if (nullptr != config.user)
+		p = mqttString(p, config.user, strlen(config.user));
+	if (nullptr != config.password)
+		p = mqttString(p, config.password, strlen(config.password));
+	mqttQueued(mqttSize(remaining));
+
+	if (pdTRUE != xSemaphoreTake(mqtt.answered, mqttAnswerTimeout))
+		result = ESP_ERR_TIMEOUT;
+	else if (0 > mqtt.answer)
+		result = ESP_FAIL;
+	else if (0 != mqtt.answer)
+		result = ESP_ERR_INVALID_RESPONSE;
+	if (ESP_OK != result) {
+		ESP_LOGW(MODULE, "%s:%u refused %d, %s", config.host, config.port, mqtt.answer.load(),
+				 esp_err_to_name(result));
+		socketClose(mqtt.socket);
+		return result;
+	}
+
+	ESP_LOGI(MODULE, "Connected to %s:%u as %s, window %u, keepalive %u s", config.host, config.port,
+			 config.clientId, config.window, config.keepAlive);
+	return ESP_OK;
+}
+
+esp_err_t mqttPublish(const char *topic, const void *payload, size_t length, int qos, bool isRetain,
+					  TickType_t wait) noexcept {
+	if (nullptr == topic || '\0' == *topic || (nullptr == payload && 0 != length) || qos < 0 || 1 < qos)
+		return ESP_ERR_INVALID_ARG;
+
+	const size_t topicLength = strlen(topic);
+	const size_t remaining = 2 + topicLength + ((0 != qos) ? 2 : 0) + length;
+	if (mqttPacketMax < mqttSize(remaining))
+		return ESP_ERR_INVALID_SIZE;
+	if (MqttState::Connected != mqtt.state.load())
+		return ESP_ERR_INVALID_STATE;
+
+	const TickType_t start = xTaskGetTickCount();
+	if (0 != qos) {
+		if (pdTRUE != xSemaphoreTake(mqtt.window, wait))
+			return ESP_ERR_TIMEOUT;
+		if (MqttState::Connected != mqtt.state.load()) {
+			xSemaphoreGive(mqtt.window);	// the next waiter sees it too
+			return ESP_ERR_INVALID_STATE;
+		}
+	}
+
+	uint8_t *p = mqttReserve(mqttSize(remaining), mqttLeft(start, wait));
+	MqttSlot *slot = nullptr;
+	if (nullptr != p && 0 != qos) {
+		for (MqttSlot &free : mqtt.slots) {
+			if (0 == free.id) {
+				slot = &free;
+				break;
+			}
+		}
+		if (nullptr == slot) {
+			xSemaphoreGive(mqtt.txLock);
+			p = nullptr;
+		}
+	}
+	if (nullptr == p) {
+		if (0 != qos)
+			xSemaphoreGive(mqtt.window);
+		return (MqttState::Connected == mqtt.state.load()) ? ESP_ERR_TIMEOUT : ESP_ERR_INVALID_STATE;
+	}
+
+	p = mqttHeader(p, mqttFixed(MqttType::Publish, static_cast<uint8_t>(qos << 1 | (isRetain ? 1 : 0))), remaining);
+	p = mqttString(p, topic, topicLength);
+	if (nullptr != slot) {
+		if (0 == ++mqtt.nextId)
+			++mqtt.nextId;
+		slot->id = mqtt.nextId;
+		slot->queuedUs = esp_timer_get_time();
+		++mqtt.inFlight;
+		p = mqttWord(p, slot->id);
+	}
+	if (0 != length)
+		memcpy(p, payload, length);
+	++mqtt.stats.published;
+	mqttQueued(mqttSize(remaining));
+	return ESP_OK;
+}
+
+esp_err_t mqttSubscribe(const char *topic, int qos) noexcept {
+	if (nullptr == topic || '\0' == *topic || qos < 0 || 1 < qos)
+		return ESP_ERR_INVALID_ARG;
+
+	const size_t topicLength = strlen(topic);
+	const size_t remaining = 2 + 2 + topicLength + 1;
+	if (mqttPacketMax < mqttSize(remaining))
+		return ESP_ERR_INVALID_SIZE;
+
+	const MqttGuard guard(mqttLock);
+	if (MqttState::Connected != mqtt.state.load())
+		return ESP_ERR_INVALID_STATE;
+
+	xSemaphoreTake(mqtt.answered, 0);
+	uint8_t *p = mqttReserve(mqttSize(remaining), mqttSendTimeout);
+	if (nullptr == p)
+		return ESP_ERR_INVALID_STATE;
+	if (0 == ++mqtt.nextId)
+		++mqtt.nextId;
+	p = mqttHeader(p, mqttFixed(MqttType::Subscribe, 0x02), remaining);
+	p = mqttWord(p, mqtt.nextId);
+	p = mqttString(p, topic, topicLength);
+	*p = static_cast<uint8_t>(qos);
+	mqttQueued(mqttSize(remaining));
+
+	if (pdTRUE != xSemaphoreTake(mqtt.answered, mqttAnswerTimeout))
+		return ESP_ERR_TIMEOUT;
+	if (0 > mqtt.answer || 0x80 == mqtt.answer) {
+		ESP_LOGW(MODULE, "%s is not subscribed", topic);
+		return ESP_FAIL;
+	}
+	ESP_LOGI(MODULE, "%s subscribed, QoS %d", topic, mqtt.answer.load());
+	return ESP_OK;
+}
+
+esp_err_t mqttFlush(TickType_t wait) noexcept {
+	const TickType_t start = xTaskGetTickCount();
+	while (0 != mqtt.inFlight.load()) {
+		if (pdTRUE != xSemaphoreTake(mqtt.drained, mqttLeft(start, wait)))
+			return ESP_ERR_TIMEOUT;
+	}
+	return (MqttState::Closed != mqtt.state.load()) ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t mqttDisconnect() noexcept {
+	const MqttGuard guard(mqttLock);
+	if (MqttState::Closed == mqtt.state.load())
+		return ESP_OK;
+
+	// the task closes the connection after it is sent
+	xSemaphoreTake(mqtt.answered, 0);
+	uint8_t *p = mqttReserve(2, mqttSendTimeout);
+	if (nullptr != p) {
+		mqttHeader(p, mqttFixed(MqttType::Disconnect), 0);
+		mqtt.state = MqttState::Closing;
+		mqttQueued(2);
+		xSemaphoreTake(mqtt.answered, mqttSendTimeout);
+	}
+	if (MqttState::Closed != mqtt.state.load())
+		socketClose(mqtt.socket);
+	return ESP_OK;
+}
+
+bool mqttIsConnected() noexcept {
+	return MqttState::Connected == mqtt.state.load();
+}
+
+MqttStats mqttStats() noexcept {
+	const MqttGuard guard(mqtt.txLock);
+	return mqtt.stats;
+}
+
+static void mqttPrint(std::string_view topic, const uint8_t *payload, size_t length, void *) noexcept {
+	printf("%s: %.*s %.*s\n", MODULE, static_cast<int>(topic.length()), topic.data(), static_cast<int>(length),
+		   reinterpret_cast<const char *>(payload));
+}
+
+static void mqttPrintStats(const MqttStats &stats) noexcept {
+	printf("  published %" PRIu32 ", acked %" PRIu32 ", lost %" PRIu32 ", received %" PRIu32 ", %" PRIu32
+		   " sends of %" PRIu32 " bytes", stats.published, stats.acked, stats.lost, stats.received, stats.sends,
+		   stats.bytes);
+	if (0 != stats.acked)
+		printf(", ack min %" PRId64 " avg %" PRId64 " max %" PRId64 " ms", stats.ackMinUs / 1000,
+			   stats.ackTotalUs / stats.acked / 1000, stats.ackMaxUs / 1000);
+	printf("\n");
+}
+
+// mqtt bench <host> <port> <messages> <bytes> [<window>]: QoS 1 publishes as fast as the window allows
+static int mqttBench(const char *host, uint16_t port, unsigned int messages, size_t size, unsigned int window) {
+	if (0 == messages)
+		return ESP_ERR_INVALID_ARG;
+	uint8_t *payload = new (std::nothrow) uint8_t[size + 1];
+	if (nullptr == payload)
+		return ESP_ERR_NO_MEM;
+	for (size_t i = 0; i < size; ++i)
+		payload[i] = static_cast<uint8_t>('a' + i % 26);
+
+	MqttConfig config;
+	config.host = host;
+	config.port = port;
+	config.clientId = "sim800-bench";
+	config.window = window;
+	esp_err_t result = mqttConnect(config);
+	if (ESP_OK != result) {
+		delete[] payload;
+		return result;
+	}
+
+	const int64_t start = esp_timer_get_time();
+	for (unsigned int i = 0; ESP_OK == result && i < messages; ++i)
+		result = mqttPublish("sim800/bench", payload, size);
+	if (ESP_OK == result)
+		result = mqttFlush(pdMS_TO_TICKS(60000));
+	const int64_t us = esp_timer_get_time() - start;
+	const MqttStats stats = mqttStats();
+	mqttDisconnect();
+	delete[] payload;
+
+	printf("%s: %" PRIu32 " messages of %zu bytes, window %u in %" PRId64 " ms, %" PRId64 " msg/s\n", MODULE,
+		   stats.acked, size, window, us / 1000, (0 < us) ? static_cast<int64_t>(stats.acked) * 1000000 / us : 0);
+	mqttPrintStats(stats);
+	return result;
+}
+
+// mqtt [connect <host> [<port>]] | [publish <topic> <text> [<qos>]] | [subscribe <topic>] | [disconnect] |
+//      [bench <host> <port> <messages> <bytes> [<window>]]
+static int mqttCommand(int argc, char **argv) {
+	if ((3 == argc || 4 == argc) && 0 == strcmp(argv[1], "connect")) {
+		MqttConfig config;
+		config.host = argv[2];
+		config.port = (4 == argc) ? static_cast<uint16_t>(atoi(argv[3])) : mqttPort;
+		config.callback = &mqttPrint;
+		return mqttConnect(config);
+	}
+	if ((4 == argc || 5 == argc) && 0 == strcmp(argv[1], "publish")) {
+		const esp_err_t result = mqttPublish(argv[2], argv[3], strlen(argv[3]), (5 == argc) ? atoi(argv[4]) : 1);
+		return (ESP_OK == result) ? mqttFlush(mqttAnswerTimeout) : result;
+	}
+	if (3 == argc && 0 == strcmp(argv[1], "subscribe"))
+		return mqttSubscribe(argv[2]);
+	if (2 == argc && 0 == strcmp(argv[1], "disconnect"))
+		return mqttDisconnect();
+	if ((6 == argc || 7 == argc) && 0 == strcmp(argv[1], "bench"))
+		return mqttBench(argv[2], static_cast<uint16_t>(atoi(argv[3])), strtoul(argv[4], nullptr, 0),
+						 strtoul(argv[5], nullptr, 0), (7 == argc) ? atoi(argv[6]) : CONFIG_SIM800_MQTT_WINDOW);
+	if (1 != argc)
+		return ESP_ERR_INVALID_ARG;
+
+	printf("%s: %s, %u in flight\n", MODULE, mqttIsConnected() ? "connected" : "disconnected", mqtt.inFlight.load());
+	mqttPrintStats(mqttStats());
+	return ESP_OK;
+}
+
+esp_err_t mqttInit() noexcept {
+	mqttLock = xSemaphoreCreateMutex();
+	mqtt.txLock = xSemaphoreCreateMutex();
+	mqtt.txRoom = xSemaphoreCreateBinary();
+	mqtt.window = xSemaphoreCreateCounting(mqttWindowMax, 0);
+	mqtt.drained = xSemaphoreCreateBinary();
+	mqtt.answered = xSemaphoreCreateBinary();
+	mqtt.wakeup = xSemaphoreCreateBinary();
+	if (nullptr == mqttLock || nullptr == mqtt.txLock || nullptr == mqtt.txRoom || nullptr == mqtt.window ||
+			nullptr == mqtt.drained || nullptr == mqtt.answered || nullptr == mqtt.wakeup)
+		return ESP_ERR_NO_MEM;
+	if (pdPASS != xTaskCreate(&mqttTask, "mqtt", mqttTaskStack, nullptr, mqttTaskPriority, nullptr))
+		return ESP_ERR_NO_MEM;
+
+	return consoleAdd("mqtt", "MQTT over the modem [connect <host> [<port>]] [publish <topic> <text> [<qos>]] "
+					  "[subscribe <topic>] [disconnect] [bench <host> <port> <messages> <bytes> [<window>]]",
+					  &mqttCommand);
+}
@@ -0,0 +1,81 @@
+// vim: tabstop=4 shiftwidth=4 noexpandtab colorcolumn=120 :
+// This file is part of the Sim800 (https://github.com/beranat/sim800).
+// Copyright (c) 2021 Anatoly L. Berenblit.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 3.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+#include <freertos/FreeRTOS.h>
+#include <esp_err.h>
+
+#include "sdkconfig.h"
+
+#include "socket.hpp"
+
+// MQTT 3.1.1 client on a modem TCP connection (socket.hpp). QoS 1 publishes go out without waiting for the PUBACK of
+// the previous ones, up to the window of them are unacknowledged. Packets are coalesced: they are queued into one of
+// two socketMss buffers and the client task sends it with one AT+CIPSEND, what is queued meanwhile goes with the next
+// one. The task wakes only to send and for the keepalive (PINGREQ after 3/4 of it without anything sent). Clean
+// session only, unacknowledged publishes of a lost connection are not resent.
+
+constexpr size_t mqttPacketMax = socketMss;	// whole packet, a publish has the topic, its id and the payload in it
+constexpr unsigned int mqttWindowMax = 32;
+constexpr uint16_t mqttPort = 1883;
+
+// Publish of a subscribed topic on the receiver task, must not block. QoS 1 ones are acknowledged after the call.
+typedef void (*MqttCallback)(std::string_view topic, const uint8_t *payload, size_t length, void *arg);
+
+struct MqttConfig {
+	const char *host = nullptr;
+	uint16_t port = mqttPort;
+	const char *clientId = "sim800";
+	const char *user = nullptr;			// nullptr - none
+	const char *password = nullptr;
+	uint16_t keepAlive = CONFIG_SIM800_MQTT_KEEPALIVE;	// s, 0 - off
+	unsigned int window = CONFIG_SIM800_MQTT_WINDOW;	// QoS 1 publishes w/o PUBACK, 1 - stop and wait
+	MqttCallback callback = nullptr;
+	void *arg = nullptr;
+};
+
+struct MqttStats {
+	uint32_t published;
+	uint32_t acked;		// PUBACK
+	uint32_t lost;		// in flight when the connection closed
+	uint32_t received;
+	uint32_t sends;		// socketSend of the coalesced packets
+	uint32_t bytes;
+	int64_t ackMinUs;	// queued to PUBACK
+	int64_t ackMaxUs;
+	int64_t ackTotalUs;
+};
+
+// Blocks till CONNACK
+esp_err_t mqttConnect(const MqttConfig &config) noexcept;
+// Queues the publish, QoS 1 ones wait for a window slot first (ESP_ERR_TIMEOUT)
+esp_err_t mqttPublish(const char *topic, const void *payload, size_t length, int qos = 1, bool isRetain = false,
+					  TickType_t wait = portMAX_DELAY) noexcept;
+// Blocks till SUBACK, QoS 0 or 1
+esp_err_t mqttSubscribe(const char *topic, int qos = 1) noexcept;
+// Waits till all the QoS 1 publishes are acknowledged
+esp_err_t mqttFlush(TickType_t wait = portMAX_DELAY) noexcept;
+// DISCONNECT after the queued packets, closes the connection
+esp_err_t mqttDisconnect() noexcept;
+bool mqttIsConnected() noexcept;
+// Since the connect
+MqttStats mqttStats() noexcept;
+
+esp_err_t mqttInit() noexcept;
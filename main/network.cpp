@@ -0,0 +1,489 @@
+// vim: tabstop=4 shiftwidth=4 noexpandtab colorcolumn=120 :
+// This file is part of the Sim800 (https://github.com/beranat/sim800).
+// Copyright (c) 2021 Anatoly L. Berenblit.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 3.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+#include <atomic>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <string_view>
+
+#include <esp_log.h>
+#include <esp_timer.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
+
+#include "console.hpp"
+#include "at.hpp"
+#include "urc.hpp"
+#include "sim.hpp"
+#include "network.hpp"
+
+constexpr const char *MODULE = "network";
+
+constexpr unsigned int networkTickMs = 15000;	// ages are checked that often
+constexpr unsigned int networkRetryMs = 1000;	// modem is not ready for the pending setup/poll
+constexpr uint32_t networkStack = 3072;
+constexpr UBaseType_t networkPriority = tskIDLE_PRIORITY + 1;
+
+// Event bits, not task notifications - the task waits for AT commands on them
+constexpr uint32_t networkSetup = 1;	// modem is up: URCs are enabled, then everything is polled
+constexpr uint32_t networkAll = 2;		// poll everything
+constexpr uint32_t networkOperator = 4;	// registration changed
+
+// URCs are off after a power-up, AT+CLTS=1 takes effect on the next network time update
+constexpr const char *networkSetupCommands[] = { "AT+CREG=2", "AT+CGREG=2", "AT+EXUNSOL=\"SQ\",1", "AT+CLTS=1" };
+
+struct NetworkState {
+	NetworkStatus status;	// w/o ages
+	int64_t simUs = 0;		// update time, 0 - never
+	int64_t registrationUs = 0;
+	int64_t gprsUs = 0;
+	int64_t signalUs = 0;
+	int64_t operatorUs = 0;
+	int64_t timeUs = 0;
+};
+
+// Writers (receiver task, the poll answers) fill the spare copy and publish it by the version, readers copy the
+// current one and retry only if an update was published meanwhile
+static NetworkState states[2];
+static std::atomic<uint32_t> version { 0 };
+static portMUX_TYPE writerMux = portMUX_INITIALIZER_UNLOCKED;
+
+static std::atomic<uint32_t> networkEvents { 0 };
+static SemaphoreHandle_t networkWakeup = nullptr;
+
+template <typename Update>
+static void networkUpdate(Update update) noexcept {
+	portENTER_CRITICAL(&writerMux);
+	const uint32_t current = version.load(std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);	// the previous publish is seen before these writes
+	NetworkState &next = states[(current + 1) & 1];
+	next = states[current & 1];
+	update(next, esp_timer_get_time());
+	version.store(current + 1, std::memory_order_release);
+	portEXIT_CRITICAL(&writerMux);
+}
+
+static uint32_t networkAge(int64_t now, int64_t us) noexcept {
+	if (0 == us)
+		return networkNever;
+	const int64_t ms = (now - us) / 1000;
+	return (ms < networkNever) ? static_cast<uint32_t>(ms) : networkNever - 1;
+}
+
+NetworkStatus networkStatus() noexcept {
+	NetworkState state;
+	uint32_t current = version.load(std::memory_order_acquire);
+	while (true) {
+		state = states[current & 1];
+		std::atomic_thread_fence(std::memory_order_acquire);
+		const uint32_t after = version.load(std::memory_order_relaxed);
+		if (after == current)
+			break;
+		current = version.load(std::memory_order_acquire);
+	}
+
+	const int64_t now = esp_timer_get_time();
+	NetworkStatus &status = state.status;
+	status.simAgeMs = networkAge(now, state.simUs);
+	status.registrationAgeMs = networkAge(now, state.registrationUs);
+	status.gprsAgeMs = networkAge(now, state.gprsUs);
+	status.signalAgeMs = networkAge(now, state.signalUs);
+	status.operatorAgeMs = networkAge(now, state.operatorUs);
+	status.timeAgeMs = networkAge(now, state.timeUs);
+	return status;
+}
+
+static bool networkIsRegistered(NetworkRegistration registration) noexcept {
+	return NetworkRegistration::Home == registration || NetworkRegistration::Roaming == registration;
+}
+
+bool networkIsRegistered() noexcept {
+	return networkIsRegistered(networkStatus().registration);
+}
+
+static void networkWake(uint32_t events) noexcept {
+	networkEvents.fetch_or(events);
+	if (nullptr != networkWakeup)
+		xSemaphoreGive(networkWakeup);
+}
+
+void networkRefresh() noexcept {
+	networkWake(networkAll);
+}
+
+// Comma separated fields, quotes are stripped (commas inside them stay), returns the number of them
+static size_t networkFields(std::string_view args, std::string_view *fields, size_t count) noexcept {
+	size_t parsed = 0;
+	while (parsed < count) {
+		while (!args.empty() && ' ' == args.front())
+			args.remove_prefix(1);
+
+		size_t end = std::string_view::npos;
+		if (!args.empty() && '"' == args.front()) {
+			const size_t quote = args.find('"', 1);
+			fields[parsed++] = args.substr(1, (std::string_view::npos != quote) ? quote - 1 : quote);
+			if (std::string_view::npos != quote)
+				end = args.find(',', quote);
+		} else {
+			end = args.find(',');
+			fields[parsed++] = args.substr(0, end);
+		}
+		if (std::string_view::npos == end)
+			break;
+		args.remove_prefix(end + 1);
+	}
+	return parsed;
+}
+
+// Whole field as a number, fallback if it is not one
+static long networkNumber(std::string_view field, long fallback, int base = 10) noexcept {
+	char text[16];
+	if (field.empty() || sizeof(text) <= field.length())
+		return fallback;
+	memcpy(text, field.data(), field.length());
+	text[field.length()] = '\0';
+
+	char *end = nullptr;
+	const long value = strtol(text, &end, base);
+	return ('\0' == *end) ? value : fallback;
+}
+
+// Days since 1970-01-01 of a Gregorian date
+static int64_t networkDays(int year, int month, int day) noexcept {
+	year -= (month <= 2) ? 1 : 0;
+	const int era = ((0 <= year) ? year : year - 399) / 400;
+	const int yearOfEra = year - era * 400;
+	const int dayOfYear = (153 * (month + ((2 < month) ? -3 : 9)) + 2) / 5 + day - 1;
+	const int dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+	return static_cast<int64_t>(era) * 146097 + dayOfEra - 719468;
+}
+
+// [<n>,]<stat>[,"<lac>","<ci>"]: query answers have <n> first (even number of fields), URCs do not
+static void networkRegistration(Urc urc, std::string_view args) noexcept {
+	std::string_view fields[4];
+	const size_t count = networkFields(args, fields, 4);
+	const size_t first = (0 == count % 2) ? 1 : 0;
+	const long stat = networkNumber(fields[first], -1);
+	if (stat < 0 || 5 < stat)
+		return;
+
+	const NetworkRegistration registration = static_cast<NetworkRegistration>(stat);
+	const bool isLocation = first + 3 <= count;
+	const long lac = isLocation ? networkNumber(fields[first + 1], 0, 16) : 0;
+	const long cellId = isLocation ? networkNumber(fields[first + 2], 0, 16) : 0;
+
+	bool isChanged = false;
+	networkUpdate([&](NetworkState &state, int64_t now) noexcept {
+		NetworkStatus &status = state.status;
+		if (Urc::Cgreg == urc) {
+			status.gprs = registration;
+			state.gprsUs = now;
+			return;
+		}
+
+		isChanged = (registration != status.registration);
+		status.registration = registration;
+		if (isLocation || !networkIsRegistered(registration)) {
+			status.lac = static_cast<uint16_t>(lac);
+			status.cellId = static_cast<uint32_t>(cellId);
+		}
+		state.registrationUs = now;
+	});
+	if (isChanged)
+		networkWake(networkOperator);
+}
+
+// <rssi>,<ber> of +CSQN and +CSQ
+static void networkSignal(std::string_view args) noexcept {
+	std::string_view fields[2];
+	if (2 != networkFields(args, fields, 2))
+		return;
+	const long rssi = networkNumber(fields[0], -1);
+	const long ber = networkNumber(fields[1], -1);
+	if (rssi < 0 || 99 < rssi || ber < 0 || 99 < ber)
+		return;
+
+	networkUpdate([&](NetworkState &state, int64_t now) noexcept {
+		state.status.rssi = static_cast<uint8_t>(rssi);
+		state.status.ber = static_cast<uint8_t>(ber);
+		state.signalUs = now;
+	});
+}
+
+static void networkSim(std::string_view args) noexcept {
+	NetworkSim sim = NetworkSim::Error;
+	if ("READY" == args)
+		sim = NetworkSim::Ready;
+	else if ("SIM PIN" == args || "PH_SIM PIN" == args)
+		sim = NetworkSim::Pin;
+	else if ("SIM PUK" == args || "PH_SIM PUK" == args)
+		sim = NetworkSim::Puk;
+	else if ("NOT INSERTED" == args)
+		sim = NetworkSim::Absent;
+
+	networkUpdate([&](NetworkState &state, int64_t now) noexcept {
+		state.status.sim = sim;
+		state.simUs = now;
+	});
+}
+
+// <mode>[,<format>,"<oper>"], no operator w/o registration
+static void networkOperatorName(std::string_view args) noexcept {
+	std::string_view fields[3];
+	const size_t count = networkFields(args, fields, 3);
+	const std::string_view name = (3 == count) ? fields[2].substr(0, networkOperatorMax - 1) : std::string_view();
+
+	networkUpdate([&](NetworkState &state, int64_t now) noexcept {
+		memset(state.status.operatorName, 0, sizeof(state.status.operatorName));
+		memcpy(state.status.operatorName, name.data(), name.length());
+		state.operatorUs = now;
+	});
+}
+
+// <year>,<month>,<day>,<hour>,<min>,<sec>,"<zone, quarters of hour>",<dst>, the time is UTC
+static void networkTime(std::string_view args) noexcept {
+	std::string_view fields[8];
+	if (8 != networkFields(args, fields, 8))
+		return;
+	long values[7];
+	for (size_t i = 0; i < 7; ++i) {
+		values[i] = networkNumber(fields[i], -1000);
+		if (-1000 == values[i])
+			return;
+	}
+	const long year = (values[0] < 100) ? values[0] + 2000 : values[0];
+	if (values[1] < 1 || 12 < values[1] || values[2] < 1 || 31 < values[2])
+		return;
+
+	const int64_t time = networkDays(year, values[1], values[2]) * 86400 + values[3] * 3600 + values[4] * 60 +
+						 values[5];
+	networkUpdate([&](NetworkState &state, int64_t now) noexcept {
+		state.status.time = time;
+		state.status.zoneMinutes = static_cast<int16_t>(values[6] * 15);
+		state.timeUs = now;
+	});
+}
+
+// URCs and the same lines of the poll answers, receiver task
+static void networkOnUrc(Urc urc, std::string_view, std::string_view args, void *) noexcept {
+	switch (urc) {
+		case Urc::CallReady:
+			networkWake(networkSetup);
+			break;
+		case Urc::Cpin:
+			networkSim(args);
+			break;
+		case Urc::Creg:
+		case Urc::Cgreg:
+			networkRegistration(urc, args);
+			break;
+		case Urc::Csqn:
+			networkSignal(args);
+			break;
+		case Urc::Psuttz:
+			networkTime(args);
+			break;
+		default:
+			break;
+	}
+}
+
+static void networkOnLine(std::string_view line, void *) noexcept {
+	constexpr std::string_view csq = "+CSQ:";
+	constexpr std::string_view cops = "+COPS:";
+
+	size_t prefix = 0;
+	const Urc urc = urcClassify(line, &prefix);
+	if (Urc::None == urc) {
+		if (0 == line.compare(0, csq.length(), csq))
+			prefix = csq.length();
+		else if (0 == line.compare(0, cops.length(), cops))
+			prefix = cops.length();
+		else
+			return;
+	}
+
+	std::string_view args = line.substr(prefix);
+	while (!args.empty() && ' ' == args.front())
+		args.remove_prefix(1);
+	if (Urc::None != urc)
+		networkOnUrc(urc, line, args, nullptr);
+	else if (csq.length() == prefix)
+		networkSignal(args);
+	else
+		networkOperatorName(args);
+}
+
+static AtResult networkQuery(const char *command) noexcept {
+	AtRequest request;
+	strncpy(request.command, command, sizeof(request.command) - 1);
+	request.onLine = &networkOnLine;
+	const AtResult result = atCommand(request);
+	if (AtResult::Ok != result)
+		ESP_LOGD(MODULE, "%s - %s", command, atResultName(result));
+	return result;
+}
+
+// Enables the URCs after a power-up and polls what is old
+static void networkTaskRun(void *) noexcept {
+	uint32_t pending = 0;
+	while (true) {
+		xSemaphoreTake(networkWakeup, pdMS_TO_TICKS((0 != pending) ? networkRetryMs : networkTickMs));
+		pending |= networkEvents.exchange(0);
+		if (!simIsReady())
+			continue;
+
+		if (0 != (pending & networkSetup)) {
+			for (const char *command : networkSetupCommands) {
+				if (AtResult::Ok != atCommand(command))
+					ESP_LOGW(MODULE, "%s failed", command);
+			}
+			pending |= networkAll;
+		}
+
+		const NetworkStatus status = networkStatus();
+		const bool isAll = (0 != (pending & networkAll));
+		if (isAll)
+			networkQuery("AT+CPIN?");
+		if (isAll || networkSignalPollMs <= status.signalAgeMs)
+			networkQuery("AT+CSQ");
+		if (isAll || networkRegistrationPollMs <= status.registrationAgeMs) {
+			networkQuery("AT+CREG?");
+			networkQuery("AT+CGREG?");
+		}
+		if (isAll || 0 != (pending & networkOperator) || networkRegistrationPollMs <= status.operatorAgeMs)
+			networkQuery("AT+COPS?");
+		pending = 0;
+	}
+}
+
+static const char *networkRegistrationName(NetworkRegistration registration) noexcept {
+	switch (registration) {
+		case NetworkRegistration::NotSearching:
+			return "not searching";
+		case NetworkRegistration::Home:
+			return "home";
+		case NetworkRegistration::Searching:
+			return "searching";
+		case NetworkRegistration::Denied:
+			return "denied";
+		case NetworkRegistration::Unknown:
+			return "unknown";
+		case NetworkRegistration::Roaming:
+			return "roaming";
+	}
+	return "unknown";
+}
+
+static const char *networkSimName(NetworkSim sim) noexcept {
+	switch (sim) {
+		case NetworkSim::Unknown:
+			return "unknown";
+		case NetworkSim::Ready:
+			return "ready";
+		case NetworkSim::Pin:
+			return "PIN";
+		case NetworkSim::Puk:
+			return "PUK";
+		case NetworkSim::Absent:
+			return "absent";
+		case NetworkSim::Error:
+			return "error";
+	}
+	return "unknown";
+}
+
+// " (<age> ms)" or " (never)"
+static const char *networkAgeText(char *text, size_t size, uint32_t ageMs) noexcept {
+	if (networkNever == ageMs)
+		snprintf(text, size, " (never)");
+	else
+		snprintf(text, size, " (%" PRIu32 " ms)", ageMs);
+	return text;
+}
+
+// network [refresh] | [bench [count]]
+static int networkCommand(int argc, char **argv) {
+	if (2 == argc && 0 == strcmp(argv[1], "refresh")) {
+		networkRefresh();
+		return ESP_OK;
+	}
+	if ((2 == argc || 3 == argc) && 0 == strcmp(argv[1], "bench")) {
+		const int count = (3 == argc) ? atoi(argv[2]) : 10000;
+		if (count <= 0)
+			return ESP_ERR_INVALID_ARG;
+
+		int64_t start = esp_timer_get_time();
+		for (int i = 0; i < count; ++i)
+			networkStatus();
+		const int64_t cachedNs = (esp_timer_get_time() - start) * 1000 / count;
+
+		start = esp_timer_get_time();
+		const AtResult result = networkQuery("AT+CSQ");
+		const int64_t queryUs = esp_timer_get_time() - start;
+		printf("%s: cached status %" PRId64 " ns (%d reads), AT+CSQ %s in %" PRId64 " us\n", MODULE, cachedNs, count,
+			   atResultName(result), queryUs);
+		return ESP_OK;
+	}
+	if (1 != argc)
+		return ESP_ERR_INVALID_ARG;
+
+	const NetworkStatus s = networkStatus();
+	char age[24];
+	printf("%s: SIM %s%s, registration %s", MODULE, networkSimName(s.sim), networkAgeText(age, sizeof(age), s.simAgeMs),
+		   networkRegistrationName(s.registration));
+	if (0 != s.lac || 0 != s.cellId)
+		printf(" LAC %04X cell %04" PRIX32, s.lac, s.cellId);
+	printf("%s, GPRS %s", networkAgeText(age, sizeof(age), s.registrationAgeMs), networkRegistrationName(s.gprs));
+	printf("%s\n", networkAgeText(age, sizeof(age), s.gprsAgeMs));
+
+	printf("  signal ");
+	if (99 != s.rssi)
+		printf("%u (%d dBm)", s.rssi, -113 + 2 * s.rssi);
+	else
+		printf("unknown");
+	printf(" ber %u%s, operator `%s'", s.ber, networkAgeText(age, sizeof(age), s.signalAgeMs), s.operatorName);
+	printf("%s\n", networkAgeText(age, sizeof(age), s.operatorAgeMs));
+
+	if (networkNever != s.timeAgeMs) {
+		const time_t now = static_cast<time_t>(s.time + s.timeAgeMs / 1000);
+		struct tm utc;
+		gmtime_r(&now, &utc);
+		char text[32];
+		strftime(text, sizeof(text), "%Y-%m-%d %H:%M:%S", &utc);
+		printf("  time %s UTC, zone %+03d:%02d%s\n", text, s.zoneMinutes / 60, abs(s.zoneMinutes % 60),
+			   networkAgeText(age, sizeof(age), s.timeAgeMs));
+	}
+	return ESP_OK;
+}
+
+esp_err_t networkInit() noexcept {
+	networkWakeup = xSemaphoreCreateBinary();
+	if (nullptr == networkWakeup ||
+			pdPASS != xTaskCreate(&networkTaskRun, "network", networkStack, nullptr, networkPriority, nullptr))
+		return ESP_ERR_NO_MEM;
+
+	for (const Urc urc : { Urc::CallReady, Urc::Cpin, Urc::Creg, Urc::Cgreg, Urc::Csqn, Urc::Psuttz }) {
+		const esp_err_t result = urcRegister(urc, &networkOnUrc);
+		if (ESP_OK != result)
+			return result;
+	}
+	return consoleAdd("network", "Cached network status [refresh] [bench [count]]", &networkCommand);
+}
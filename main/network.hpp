@@ -0,0 +1,79 @@
+// vim: tabstop=4 shiftwidth=4 noexpandtab colorcolumn=120 :
+// This file is part of the Sim800 (https://github.com/beranat/sim800).
+// Copyright (c) 2021 Anatoly L. Berenblit.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 3.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <esp_err.h>
+
+// Network status cache. SIM state (+CPIN), registration with the serving cell (AT+CREG=2), GPRS attach (AT+CGREG=2),
+// signal (+CSQN, AT+EXUNSOL="SQ",1) and network time (*PSUTTZ, AT+CLTS=1) come with URCs on the receiver task, the
+// operator (AT+COPS?) and what has not been pushed for a while are polled at a low rate in background. Reads copy a
+// double-buffered snapshot, lock-free from any task, each value reports its age.
+
+constexpr uint32_t networkNever = UINT32_MAX;				// age of a value not received yet
+constexpr unsigned int networkSignalPollMs = 60000;			// AT+CSQ if +CSQN is silent that long
+constexpr unsigned int networkRegistrationPollMs = 300000;	// AT+CREG?/AT+CGREG?/AT+COPS?
+constexpr size_t networkOperatorMax = 24;
+
+enum class NetworkSim : uint8_t {
+	Unknown,
+	Ready,
+	Pin,	// SIM PIN, PH_SIM PIN
+	Puk,
+	Absent,	// NOT INSERTED
+	Error,
+};
+
+// 27.007 <stat>
+enum class NetworkRegistration : uint8_t {
+	NotSearching = 0,
+	Home = 1,
+	Searching = 2,
+	Denied = 3,
+	Unknown = 4,
+	Roaming = 5,
+};
+
+struct NetworkStatus {
+	NetworkSim sim = NetworkSim::Unknown;
+	NetworkRegistration registration = NetworkRegistration::Unknown;
+	NetworkRegistration gprs = NetworkRegistration::Unknown;
+	uint16_t lac = 0;		// location area and cell of the registration, 0 - unknown
+	uint32_t cellId = 0;
+	uint8_t rssi = 99;		// 0..31 is -113..-51 dBm, 99 - unknown
+	uint8_t ber = 99;
+	char operatorName[networkOperatorMax] = {};
+	int64_t time = 0;		// network UTC (seconds since the epoch) when it was received
+	int16_t zoneMinutes = 0;
+
+	// ms since the value was received or confirmed, networkNever - not yet
+	uint32_t simAgeMs = networkNever;
+	uint32_t registrationAgeMs = networkNever;
+	uint32_t gprsAgeMs = networkNever;
+	uint32_t signalAgeMs = networkNever;
+	uint32_t operatorAgeMs = networkNever;
+	uint32_t timeAgeMs = networkNever;
+};
+
+// Snapshot, never blocks (retried only if the cache is updated twice during the copy)
+NetworkStatus networkStatus() noexcept;
+bool networkIsRegistered() noexcept;	// home or roaming
+// Polls everything now (in background)
+void networkRefresh() noexcept;
+
+esp_err_t networkInit() noexcept;
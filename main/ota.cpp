@@ -0,0 +1,270 @@
+// vim: tabstop=4 shiftwidth=4 noexpandtab colorcolumn=120 :
+// This file is part of the Sim800 (https://github.com/beranat/sim800).
+// Copyright (c) 2021 Anatoly L. Berenblit.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 3.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+#include <atomic>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <new>
+
+#include <esp_log.h>
+#include <esp_ota_ops.h>
+#include <esp_partition.h>
+#include <esp_timer.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+
+#include "console.hpp"
+#include "http.hpp"
+#include "ota.hpp"
+
+constexpr const char *MODULE = "ota";
+
+constexpr uint32_t otaWriterStack = 4096;
+constexpr UBaseType_t otaWriterPriority = 5;
+// image header, the first segment header and the app description in it
+constexpr size_t otaHeaderMin = sizeof(esp_image_header_t) + sizeof(esp_image_segment_header_t) +
+								sizeof(esp_app_desc_t);
+
+struct OtaBlock {
+	int buffer;
+	size_t length;	// 0 - the end
+};
+
+// Update in progress: the download fills buffers[fill] on the receiver task, the writer task gets full ones
+struct Ota {
+	const esp_partition_t *partition = nullptr;
+	uint8_t *buffers[2] = {};
+	int fill = 0;
+	size_t fillLength = 0;
+	QueueHandle_t blocks = nullptr;
+	SemaphoreHandle_t free = nullptr;		// buffers not in the writer
+	SemaphoreHandle_t finished = nullptr;	// writer is gone
+	std::atomic<esp_err_t> result { ESP_OK };
+	esp_ota_handle_t handle = 0;
+	bool isBegun = false;
+	OtaStats stats = {};
+};
+
+static SemaphoreHandle_t otaLock = nullptr;
+
+class OtaGuard final {
+	SemaphoreHandle_t lock_;
+	public:
+		explicit OtaGuard(SemaphoreHandle_t lock) noexcept : lock_(lock) {
+			xSemaphoreTake(lock_, portMAX_DELAY);
+		}
+		~OtaGuard() {
+			xSemaphoreGive(lock_);
+		}
+};
+
+// The image is an app of this project, nothing is written otherwise
+static esp_err_t otaCheck(const uint8_t *image, size_t length) noexcept {
+	if (length < otaHeaderMin || ESP_IMAGE_HEADER_MAGIC != image[0]) {
+		ESP_LOGE(MODULE, "Not an app image");
+		return ESP_ERR_INVALID_SIZE;
+	}
+
+	esp_app_desc_t description;
+	memcpy(&description, image + sizeof(esp_image_header_t) + sizeof(esp_image_segment_header_t),
+		   sizeof(description));
+	const esp_app_desc_t *running = esp_ota_get_app_description();
+	if (ESP_APP_DESC_MAGIC_WORD != description.magic_word ||
+			0 != strncmp(description.project_name, running->project_name, sizeof(description.project_name))) {
+		ESP_LOGE(MODULE, "Image is not of %s", running->project_name);
+		return ESP_ERR_INVALID_VERSION;
+	}
+	ESP_LOGI(MODULE, "Image version %.32s, running %.32s", description.version, running->version);
+	return ESP_OK;
+}
+
+static void otaWriter(void *arg) noexcept {
+	Ota &ota = *reinterpret_cast<Ota *>(arg);
+	OtaBlock block;
+	while (pdTRUE == xQueueReceive(ota.blocks, &block, portMAX_DELAY) && 0 != block.length) {
+		const uint8_t *data = ota.buffers[block.buffer];
+		if (ESP_OK == ota.result && !ota.isBegun) {
+			// sectors are erased as they are written, not the whole partition ahead
+			esp_err_t result = otaCheck(data, block.length);
+			if (ESP_OK == result)
+				result = esp_ota_begin(ota.partition, OTA_WITH_SEQUENTIAL_WRITES, &ota.handle);
+			ota.isBegun = (ESP_OK == result);
+			ota.result = result;
+		}
+		if (ESP_OK == ota.result) {
+			const int64_t start = esp_timer_get_time();
+			ota.result = esp_ota_write(ota.handle, data, block.length);
+			ota.stats.writeUs += esp_timer_get_time() - start;
+		}
+		xSemaphoreGive(ota.free);
+	}
+	xSemaphoreGive(ota.finished);
+	vTaskDelete(nullptr);
+}
+
+// Filled buffer goes to the writer, the download continues in the other one as soon as it is written
+static void otaHand(Ota &ota) noexcept {
+	if (0 == ota.fillLength)
+		return;
+
+	const OtaBlock block { ota.fill, ota.fillLength };
+	xQueueSend(ota.blocks, &block, portMAX_DELAY);
+	const int64_t start = esp_timer_get_time();
+	xSemaphoreTake(ota.free, portMAX_DELAY);
+	ota.stats.stallUs += esp_timer_get_time() - start;
+	ota.fill ^= 1;
+	ota.fillLength = 0;
+}
+
+static bool otaReady(size_t offset, size_t size, size_t length, void *arg) noexcept {
+	Ota &ota = *reinterpret_cast<Ota *>(arg);
+	if (0 == offset) {
+		if (ota.partition->size < length) {
+			ESP_LOGE(MODULE, "Image %zu is over %s", length, ota.partition->label);
+			ota.result = ESP_ERR_INVALID_SIZE;
+			return false;
+		}
+		ota.stats.length = length;
+	}
+	if (otaBuffer < ota.fillLength + size)
+		otaHand(ota);
+	return ESP_OK == ota.result;
+}
+
+static void otaBody(size_t, const uint8_t *data, size_t length, void *arg) noexcept {
+	Ota &ota = *reinterpret_cast<Ota *>(arg);
+	const size_t room = otaBuffer - ota.fillLength;
+	const size_t size = (length < room) ? length : room;
+	memcpy(ota.buffers[ota.fill] + ota.fillLength, data, size);
+	ota.fillLength += size;
+}
+
+static void otaFree(Ota *ota) noexcept {
+	if (nullptr != ota->blocks)
+		vQueueDelete(ota->blocks);
+	if (nullptr != ota->free)
+		vSemaphoreDelete(ota->free);
+	if (nullptr != ota->finished)
+		vSemaphoreDelete(ota->finished);
+	delete[] ota->buffers[0];
+	delete[] ota->buffers[1];
+	delete ota;
+}
+
+esp_err_t otaUpdate(const char *url, OtaStats *stats) noexcept {
+	if (nullptr == url)
+		return ESP_ERR_INVALID_ARG;
+
+	const OtaGuard guard(otaLock);
+	const esp_partition_t *partition = esp_ota_get_next_update_partition(nullptr);
+	if (nullptr == partition)
+		return ESP_ERR_NOT_FOUND;
+
+	Ota *ota = new (std::nothrow) Ota;
+	if (nullptr == ota)
+		return ESP_ERR_NO_MEM;
+	ota->partition = partition;
+	ota->buffers[0] = new (std::nothrow) uint8_t[otaBuffer];
+	ota->buffers[1] = new (std::nothrow) uint8_t[otaBuffer];
+	ota->blocks = xQueueCreate(2, sizeof(OtaBlock));
+	ota->free = xSemaphoreCreateCounting(2, 2);
+	ota->finished = xSemaphoreCreateBinary();
+	if (nullptr == ota->buffers[0] || nullptr == ota->buffers[1] || nullptr == ota->blocks || nullptr == ota->free ||
+			nullptr == ota->finished) {
+		otaFree(ota);
+		return ESP_ERR_NO_MEM;
+	}
+	xSemaphoreTake(ota->free, 0);	// the first one is filled
+	if (pdPASS != xTaskCreate(&otaWriter, "ota-writer", otaWriterStack, ota, otaWriterPriority, nullptr)) {
+		otaFree(ota);
+		return ESP_ERR_NO_MEM;
+	}
+
+	ESP_LOGI(MODULE, "%s to %s", url, partition->label);
+	const int64_t start = esp_timer_get_time();
+	HttpRequest request;
+	request.url = url;
+	request.onBody = &otaBody;
+	request.onReady = &otaReady;
+	request.arg = ota;
+	HttpResponse response;
+	esp_err_t result = httpRequest(request, &response);
+	ota->stats.downloadUs = esp_timer_get_time() - start;
+	if (ESP_OK == result && 200 != response.status) {
+		ESP_LOGE(MODULE, "HTTP status %d", response.status);
+		result = ESP_ERR_INVALID_RESPONSE;
+	}
+	if (ESP_OK == result)
+		otaHand(*ota);
+
+	const OtaBlock end { 0, 0 };
+	xQueueSend(ota->blocks, &end, portMAX_DELAY);
+	xSemaphoreTake(ota->finished, portMAX_DELAY);
+	if (ESP_OK != ota->result)
+		result = ota->result;	// the reason of the aborted download
+	else if (ESP_OK == result && !ota->isBegun)
+		result = ESP_ERR_INVALID_SIZE;
+
+	// image verification, the boot partition is switched only to a valid one
+	if (ota->isBegun)
+		result = (ESP_OK == result) ? esp_ota_end(ota->handle) : (esp_ota_abort(ota->handle), result);
+	if (ESP_OK == result)
+		result = esp_ota_set_boot_partition(partition);
+	ota->stats.totalUs = esp_timer_get_time() - start;
+
+	if (ESP_OK == result)
+		ESP_LOGI(MODULE, "%zu bytes to %s in %" PRId64 " ms, reboot to run it", ota->stats.length, partition->label,
+				 ota->stats.totalUs / 1000);
+	else
+		ESP_LOGE(MODULE, "Update failed: %s", esp_err_to_name(result));
+	if (nullptr != stats)
+		*stats = ota->stats;
+	otaFree(ota);
+	return result;
+}
+
+// ota [<url>]
+static int otaCommand(int argc, char **argv) {
+	if (2 == argc) {
+		OtaStats stats;
+		const esp_err_t result = otaUpdate(argv[1], &stats);
+		const int64_t us = (0 < stats.downloadUs) ? stats.downloadUs : 1;
+		printf("%s: %zu bytes, download %" PRId64 " ms (%" PRId64 " B/s), flash %" PRId64 " ms, stalled %" PRId64
+			   " ms, total %" PRId64 " ms\n", MODULE, stats.length, stats.downloadUs / 1000,
+			   static_cast<int64_t>(stats.length) * 1000000 / us, stats.writeUs / 1000, stats.stallUs / 1000,
+			   stats.totalUs / 1000);
+		return result;
+	}
+	if (1 != argc)
+		return ESP_ERR_INVALID_ARG;
+
+	const esp_app_desc_t *description = esp_ota_get_app_description();
+	const esp_partition_t *running = esp_ota_get_running_partition();
+	const esp_partition_t *boot = esp_ota_get_boot_partition();
+	printf("%s: %.32s %.32s on %s, boot %s\n", MODULE, description->project_name, description->version,
+		   (nullptr != running) ? running->label : "-", (nullptr != boot) ? boot->label : "-");
+	return ESP_OK;
+}
+
+esp_err_t otaInit() noexcept {
+	otaLock = xSemaphoreCreateMutex();
+	if (nullptr == otaLock)
+		return ESP_ERR_NO_MEM;
+	return consoleAdd("ota", "Firmware update over the modem [<url>]", &otaCommand);
+}
@@ -0,0 +1,40 @@
+// vim: tabstop=4 shiftwidth=4 noexpandtab colorcolumn=120 :
+// This file is part of the Sim800 (https://github.com/beranat/sim800).
+// Copyright (c) 2021 Anatoly L. Berenblit.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 3.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <esp_err.h>
+
+// Firmware update over the modem HTTP client into the next OTA partition. The download fills one of two sector
+// buffers while the writer task puts the other one into flash (esp_ota_write), a block is read only when a buffer
+// has room for it. The first block is checked (image header, project name) before anything is written, the whole
+// image is verified by esp_ota_end() before the boot partition is switched; the new firmware runs after a reboot.
+
+constexpr size_t otaBuffer = 4096;	// flash sector, two of them
+
+struct OtaStats {
+	size_t length;
+	int64_t downloadUs;		// request to the last block
+	int64_t writeUs;		// esp_ota_write, overlapped with the download
+	int64_t stallUs;		// download waited for the writer
+	int64_t totalUs;		// boot partition is set
+};
+
+esp_err_t otaUpdate(const char *url, OtaStats *stats = nullptr) noexcept;
+
+esp_err_t otaInit() noexcept;
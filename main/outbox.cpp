@@ -0,0 +1,495 @@
+// vim: tabstop=4 shiftwidth=4 noexpandtab colorcolumn=120 :
+// This file is part of the Sim800 (https://github.com/beranat/sim800).
+// Copyright (c) 2021 Anatoly L. Berenblit.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 3.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+#include <algorithm>
+#include <atomic>
+#include <cinttypes>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string_view>
+
+#include <esp_log.h>
+#include <esp_partition.h>
+#include <esp_timer.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+
+#include "sdkconfig.h"
+
+#include "console.hpp"
+#include "urc.hpp"
+#include "mqtt.hpp"
+#include "network.hpp"
+#include "outbox.hpp"
+
+constexpr const char *MODULE = "outbox";
+constexpr const char *outboxLabel = "outbox";
+
+constexpr size_t sectorSize = 4096;	// SPI flash erase unit
+constexpr uint32_t outboxPerSector = sectorSize / outboxRecord;
+constexpr uint32_t outboxErased = 0xffffffff;
+constexpr uint8_t outboxSent = 0x00;	// programmed over the erased byte
+constexpr TickType_t outboxAckTimeout = pdMS_TO_TICKS(60000);
+constexpr uint32_t outboxStack = 4096;
+constexpr UBaseType_t outboxPriority = 4;
+
+// Event bits, not task notifications - the drain waits for AT commands on them
+constexpr uint32_t outboxPushed = 1;	// drain after the linger time
+constexpr uint32_t outboxNow = 2;		// drain now, backoff is reset
+
+struct OutboxHeader {
+	uint32_t sequence;	// erased - free slot
+	uint16_t length;
+	uint8_t check;		// CRC-8 of the header (check is zero, sent is erased) and the payload
+	uint8_t sent;		// outboxSent on the last record of a delivered batch
+};
+static_assert(sizeof(OutboxHeader) + outboxPayloadMax == outboxRecord, "Record is a flash page");
+
+// Flash side, outboxLock owner only
+static const esp_partition_t *partition = nullptr;
+static SemaphoreHandle_t outboxLock = nullptr;
+static uint32_t slots = 0;
+static uint32_t head = 0;	// first unsent
+static uint32_t tail = 0;	// next pushed
+static OutboxStatus status = {};
+static OutboxSender outboxSender = nullptr;
+static void *outboxSenderArg = nullptr;
+static char outboxBroker[64] = CONFIG_SIM800_OUTBOX_BROKER;
+static uint16_t outboxPort = mqttPort;
+
+// Drain side, the task only: a batch of records and their messages
+static uint8_t batch[outboxBatch][outboxRecord];
+static OutboxMessage messages[outboxBatch];
+static bool outboxIsConnection = false;	// the default sender connected MQTT itself
+static int64_t drainUs = 0;
+static uint32_t drainMessages = 0;
+
+static std::atomic<bool> outboxWasRegistered { false };	// +CREG of the last URC, the drain is due when it is back
+static std::atomic<uint32_t> outboxEvents { 0 };
+static SemaphoreHandle_t outboxWakeup = nullptr;
+
+// Registration of the network cache: it turns +CREG/+CGREG on and its handlers run before ours (registered earlier
+// by simInit). Unknown does not hold the queue back
+static bool outboxIsOffline() noexcept {
+	const NetworkStatus network = networkStatus();
+	return networkNever != network.registrationAgeMs && NetworkRegistration::Home != network.registration &&
+		   NetworkRegistration::Roaming != network.registration;
+}
+
+class OutboxGuard final {
+	SemaphoreHandle_t lock_;
+	public:
+		explicit OutboxGuard(SemaphoreHandle_t lock) noexcept : lock_(lock) {
+			xSemaphoreTake(lock_, portMAX_DELAY);
+		}
+		~OutboxGuard() {
+			xSemaphoreGive(lock_);
+		}
+};
+
+// Comma separated numbers of a response, returns the number parsed
+static size_t outboxNumbers(std::string_view args, unsigned int *values, size_t count) noexcept {
+	size_t parsed = 0;
+	while (parsed < count && !args.empty()) {
+		while (!args.empty() && ' ' == args.front())
+			args.remove_prefix(1);
+		if (args.empty() || args.front() < '0' || '9' < args.front())
+			break;
+
+		unsigned int value = 0;
+		while (!args.empty() && '0' <= args.front() && args.front() <= '9') {
+			value = value * 10 + (args.front() - '0');
+			args.remove_prefix(1);
+		}
+		values[parsed++] = value;
+		if (!args.empty() && ',' == args.front())
+			args.remove_prefix(1);
+	}
+	return parsed;
+}
+
+static uint8_t crc8(uint8_t crc, const void *data, size_t length) noexcept {
+	const uint8_t *bytes = reinterpret_cast<const uint8_t *>(data);
+	for (size_t i = 0; i < length; ++i) {
+		crc ^= bytes[i];
+		for (unsigned int bit = 0; bit < 8; ++bit)
+			crc = (crc & 0x80) ? static_cast<uint8_t>((crc << 1) ^ 0x07) : static_cast<uint8_t>(crc << 1);
+	}
+	return crc;
+}
+
+static uint8_t outboxCheck(OutboxHeader header, const void *payload) noexcept {
+	header.check = 0;
+	header.sent = 0xff;
+	return crc8(crc8(0, &header, sizeof(header)), payload, header.length);
+}
+
+static size_t outboxOffset(uint32_t sequence) noexcept {
+	return (sequence % slots) * outboxRecord;
+}
+
+// Record of the sequence into record[outboxRecord] (outboxLock), false - torn, overwritten or never written
+static bool outboxRead(uint32_t sequence, uint8_t *record) noexcept {
+	if (ESP_OK != esp_partition_read(partition, outboxOffset(sequence), record, outboxRecord))
+		return false;
+	OutboxHeader header;
+	memcpy(&header, record, sizeof(header));
+	return sequence == header.sequence && header.length <= outboxPayloadMax &&
+		   outboxCheck(header, record + sizeof(header)) == header.check;
+}
+
+static void outboxWake(uint32_t events) noexcept {
+	outboxEvents.fetch_or(events);
+	if (nullptr != outboxWakeup)
+		xSemaphoreGive(outboxWakeup);
+}
+
+esp_err_t outboxPush(const void *data, size_t length) noexcept {
+	if (nullptr == data && 0 != length)
+		return ESP_ERR_INVALID_ARG;
+	if (outboxPayloadMax < length)
+		return ESP_ERR_INVALID_SIZE;
+	if (nullptr == partition)
+		return ESP_ERR_INVALID_STATE;
+
+	uint8_t record[outboxRecord];
+	{
+		const OutboxGuard guard(outboxLock);
+		OutboxHeader header = { tail, static_cast<uint16_t>(length), 0, 0xff };
+		header.check = outboxCheck(header, data);
+		memcpy(record, &header, sizeof(header));
+		memcpy(record + sizeof(header), data, length);
+
+		// the sector is used again, its unsent messages of `slots' ago are lost
+		const size_t offset = outboxOffset(tail);
+		if (0 == offset % sectorSize) {
+			const uint32_t kept = tail - slots + outboxPerSector;
+			if (slots <= tail && static_cast<int32_t>(kept - head) > 0) {
+				ESP_LOGW(MODULE, "Full, %" PRIu32 " oldest dropped", kept - head);
+				status.dropped += kept - head;
+				head = kept;
+			}
+			const esp_err_t result = esp_partition_erase_range(partition, offset, sectorSize);
+			if (ESP_OK != result) {
+				ESP_LOGW(MODULE, "Erase %zu error %s", offset, esp_err_to_name(result));
+				return result;
+			}
+		}
+
+		const esp_err_t result = esp_partition_write(partition, offset, record, sizeof(header) + length);
+		if (ESP_OK != result) {
+			ESP_LOGW(MODULE, "Write %zu error %s", offset, esp_err_to_name(result));
+			return result;
+		}
+		++tail;
+		++status.pushed;
+	}
+
+	if (!outboxIsOffline())
+		outboxWake(outboxPushed);
+	return ESP_OK;
+}
+
+void outboxSetSender(OutboxSender sender, void *arg) noexcept {
+	const OutboxGuard guard(outboxLock);
+	outboxSender = sender;
+	outboxSenderArg = arg;
+}
+
+void outboxDrain() noexcept {
+	outboxWake(outboxNow);
+}
+
+OutboxStatus outboxStatus() noexcept {
+	const OutboxGuard guard(outboxLock);
+	OutboxStatus result = status;
+	result.queued = tail - head;
+	result.capacity = slots;
+	result.isRegistered = networkIsRegistered();
+	return result;
+}
+
+// Default sender: QoS 1 publishes in the MQTT window, the connection is kept for the whole drain
+static size_t outboxMqtt(const OutboxMessage *batch, size_t count, void *) noexcept {
+	if (0 == count) {
+		if (outboxIsConnection)
+			mqttDisconnect();
+		outboxIsConnection = false;
+		return 0;
+	}
+
+	if (!mqttIsConnected()) {
+		char broker[sizeof(outboxBroker)];
+		MqttConfig config;
+		{
+			const OutboxGuard guard(outboxLock);
+			memcpy(broker, outboxBroker, sizeof(broker));
+			config.port = outboxPort;
+		}
+		if ('\0' == broker[0]) {
+			ESP_LOGW(MODULE, "No broker");
+			return 0;
+		}
+		config.host = broker;
+		config.clientId = "sim800-outbox";
+		if (ESP_OK != mqttConnect(config))
+			return 0;
+		outboxIsConnection = true;
+	}
+
+	size_t published = 0;
+	while (published < count && ESP_OK == mqttPublish(CONFIG_SIM800_OUTBOX_TOPIC, batch[published].data,
+													  batch[published].length))
+		++published;
+	return (ESP_OK == mqttFlush(outboxAckTimeout)) ? published : 0;
+}
+
+// Batches from the head till the queue is empty or the sender fails, false - it failed
+static bool outboxRun() noexcept {
+	OutboxSender sender = nullptr;
+	void *arg = nullptr;
+	{
+		const OutboxGuard guard(outboxLock);
+		sender = (nullptr != outboxSender) ? outboxSender : &outboxMqtt;
+		arg = outboxSenderArg;
+		++status.drains;
+	}
+
+	const int64_t start = esp_timer_get_time();
+	uint32_t delivered = 0;
+	bool isOk = true;
+	while (isOk) {
+		// records are copied out, pushes go on while the batch is sent
+		size_t count = 0;
+		uint32_t end = 0;
+		{
+			const OutboxGuard guard(outboxLock);
+			for (end = head; end != tail && count < outboxBatch; ++end) {
+				if (!outboxRead(end, batch[count])) {
+					ESP_LOGW(MODULE, "Record %" PRIu32 " is broken, skipped", end);
+					continue;
+				}
+				OutboxHeader header;
+				memcpy(&header, batch[count], sizeof(header));
+				messages[count] = OutboxMessage { end, batch[count] + sizeof(header), header.length };
+				++count;
+			}
+			if (0 == count)
+				head = end;
+		}
+		if (0 == count)
+			break;
+
+		const size_t sent = std::min(sender(messages, count, arg), count);
+		isOk = (sent == count);
+		if (0 == sent)
+			break;
+
+		// the last delivered one is marked unless the full queue has overwritten it already
+		const OutboxGuard guard(outboxLock);
+		const uint32_t last = messages[sent - 1].sequence;
+		if (static_cast<int32_t>(last - (tail - slots)) >= 0) {
+			const esp_err_t result = esp_partition_write(partition, outboxOffset(last) + offsetof(OutboxHeader, sent),
+														 &outboxSent, sizeof(outboxSent));
+			if (ESP_OK != result)
+				ESP_LOGW(MODULE, "Mark %" PRIu32 " error %s", last, esp_err_to_name(result));
+		}
+		const uint32_t next = isOk ? end : last + 1;
+		if (static_cast<int32_t>(next - head) > 0)
+			head = next;
+		status.sent += sent;
+		++status.batches;
+		delivered += sent;
+	}
+	sender(nullptr, 0, arg);
+
+	drainUs = esp_timer_get_time() - start;
+	drainMessages = delivered;
+	if (0 != delivered)
+		ESP_LOGI(MODULE, "%" PRIu32 " sent in %" PRId64 " ms%s", delivered, drainUs / 1000, isOk ? "" : ", failed");
+	return isOk;
+}
+
+// Sleeps till a push, registration or the retry is due
+static void outboxTaskRun(void *) noexcept {
+	bool isDue = false;
+	TickType_t due = 0;
+	TickType_t retry = pdMS_TO_TICKS(outboxRetryMs);
+	while (true) {
+		TickType_t wait = portMAX_DELAY;
+		if (isDue) {
+			const TickType_t now = xTaskGetTickCount();
+			wait = (static_cast<int32_t>(due - now) > 0) ? due - now : 0;
+		}
+		xSemaphoreTake(outboxWakeup, wait);
+		const uint32_t events = outboxEvents.exchange(0);
+
+		const TickType_t now = xTaskGetTickCount();
+		if (0 != (events & outboxNow)) {
+			isDue = true;
+			due = now;
+			retry = pdMS_TO_TICKS(outboxRetryMs);
+		} else if (0 != (events & outboxPushed) &&
+				   (!isDue || static_cast<int32_t>(due - now) > static_cast<int32_t>(pdMS_TO_TICKS(outboxLingerMs)))) {
+			isDue = true;
+			due = now + pdMS_TO_TICKS(outboxLingerMs);
+		}
+		if (!isDue || static_cast<int32_t>(due - now) > 0)
+			continue;
+
+		// registration coming back wakes it again
+		isDue = false;
+		if (outboxIsOffline() || 0 == outboxStatus().queued)
+			continue;
+		if (outboxRun()) {
+			retry = pdMS_TO_TICKS(outboxRetryMs);
+			continue;
+		}
+		ESP_LOGW(MODULE, "Drain failed, retry in %u s", static_cast<unsigned int>(retry * portTICK_PERIOD_MS / 1000));
+		isDue = true;
+		due = xTaskGetTickCount() + retry;
+		retry = std::min<TickType_t>(2 * retry, pdMS_TO_TICKS(outboxRetryMaxMs));
+	}
+}
+
+// +CREG: <stat>[,<lac>,<ci>], +CGREG: <stat>[,...]: 1 home, 5 roaming
+static void outboxOnUrc(Urc urc, std::string_view, std::string_view args, void *) noexcept {
+	unsigned int stat = 0;
+	if (1 != outboxNumbers(args, &stat, 1))
+		return;
+
+	const bool isRegistered = (1 == stat || 5 == stat);
+	if (Urc::Creg == urc) {
+		if (!outboxWasRegistered.exchange(isRegistered) && isRegistered)
+			outboxWake(outboxNow);
+	} else if (isRegistered && !outboxIsOffline())
+		outboxWake(outboxNow);	// GPRS is attached again
+}
+
+// outbox [push <text>] | [fill <count> <bytes>] | [drain] | [broker <host> [<port>]]
+static int outboxCommand(int argc, char **argv) {
+	if (3 == argc && 0 == strcmp(argv[1], "push"))
+		return outboxPush(argv[2], strlen(argv[2]));
+	if (4 == argc && 0 == strcmp(argv[1], "fill")) {
+		const unsigned long count = strtoul(argv[2], nullptr, 0);
+		const size_t length = std::min<size_t>(strtoul(argv[3], nullptr, 0), outboxPayloadMax);
+		char payload[outboxPayloadMax];
+		esp_err_t result = ESP_OK;
+		const int64_t start = esp_timer_get_time();
+		unsigned long i = 0;
+		for (; ESP_OK == result && i < count; ++i) {
+			const int prefix = snprintf(payload, sizeof(payload), "%lu:", i);
+			for (size_t j = prefix; j < length; ++j)
+				payload[j] = static_cast<char>('a' + j % 26);
+			result = outboxPush(payload, std::max<size_t>(length, static_cast<size_t>(prefix)));
+		}
+		const int64_t us = esp_timer_get_time() - start;
+		printf("%s: %lu pushed in %" PRId64 " ms, %" PRId64 " us each\n", MODULE, i, us / 1000,
+			   (0 != i) ? us / static_cast<int64_t>(i) : 0);
+		return result;
+	}
+	if (2 == argc && 0 == strcmp(argv[1], "drain")) {
+		outboxDrain();
+		return ESP_OK;
+	}
+	if ((3 == argc || 4 == argc) && 0 == strcmp(argv[1], "broker")) {
+		if (sizeof(outboxBroker) <= strlen(argv[2]))
+			return ESP_ERR_INVALID_SIZE;
+		const OutboxGuard guard(outboxLock);
+		strcpy(outboxBroker, argv[2]);
+		outboxPort = (4 == argc) ? static_cast<uint16_t>(atoi(argv[3])) : mqttPort;
+		return ESP_OK;
+	}
+	if (1 != argc)
+		return ESP_ERR_INVALID_ARG;
+
+	const OutboxStatus s = outboxStatus();
+	printf("%s: %" PRIu32 " queued of %" PRIu32 ", network %s\n", MODULE, s.queued, s.capacity,
+		   s.isRegistered ? "registered" : outboxIsOffline() ? "not registered" : "unknown");
+	printf("  pushed %" PRIu32 ", sent %" PRIu32 ", dropped %" PRIu32 ", %" PRIu32 " drains, %" PRIu32
+		   " batches, the last one %" PRIu32 " in %" PRId64 " ms\n", s.pushed, s.sent, s.dropped, s.drains,
+		   s.batches, drainMessages, drainUs / 1000);
+	return ESP_OK;
+}
+
+esp_err_t outboxInit() noexcept {
+	partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, outboxLabel);
+	if (nullptr == partition || partition->size < 2 * sectorSize) {
+		ESP_LOGW(MODULE, "No `%s' partition", outboxLabel);
+		partition = nullptr;
+		return ESP_ERR_NOT_FOUND;
+	}
+	slots = partition->size / sectorSize * outboxPerSector;
+
+	outboxLock = xSemaphoreCreateMutex();
+	if (nullptr == outboxLock)
+		return ESP_ERR_NO_MEM;
+
+	// oldest and newest valid records, the last delivered one
+	bool isAny = false;
+	bool isSent = false;
+	uint32_t first = 0;
+	uint32_t last = 0;
+	uint32_t sent = 0;
+	for (uint32_t slot = 0; slot < slots; ++slot) {
+		OutboxHeader header;
+		if (ESP_OK != esp_partition_read(partition, slot * outboxRecord, &header, sizeof(header)) ||
+				outboxErased == header.sequence || slot != header.sequence % slots ||
+				!outboxRead(header.sequence, batch[0]))
+			continue;
+
+		if (!isAny || static_cast<int32_t>(header.sequence - first) < 0)
+			first = header.sequence;
+		if (!isAny || static_cast<int32_t>(header.sequence - last) > 0)
+			last = header.sequence;
+		if (outboxSent == header.sent && (!isSent || static_cast<int32_t>(header.sequence - sent) > 0))
+			sent = header.sequence;
+		isSent = isSent || outboxSent == header.sent;
+		isAny = true;
+	}
+	if (isAny) {
+		head = (isSent && static_cast<int32_t>(sent + 1 - first) > 0) ? sent + 1 : first;
+		tail = last + 1;
+	}
+
+	// a torn write (power loss) left the next slot dirty, the sector start is erased anyway
+	while (0 != outboxOffset(tail) % sectorSize) {
+		const bool isErased = ESP_OK == esp_partition_read(partition, outboxOffset(tail), batch[0], outboxRecord) &&
+							  std::all_of(batch[0], batch[0] + outboxRecord, [](uint8_t b) {
+								  return 0xff == b;
+							  });
+		if (isErased)
+			break;
+		++tail;
+	}
+	ESP_LOGI(MODULE, "%" PRIu32 " slots, %" PRIu32 " queued (%" PRIu32 "..%" PRIu32 ")", slots, tail - head, head,
+			 tail);
+
+	outboxWakeup = xSemaphoreCreateBinary();
+	if (nullptr == outboxWakeup ||
+			pdPASS != xTaskCreate(&outboxTaskRun, "outbox", outboxStack, nullptr, outboxPriority, nullptr))
+		return ESP_ERR_NO_MEM;
+	for (const Urc urc : { Urc::Creg, Urc::Cgreg }) {
+		const esp_err_t result = urcRegister(urc, &outboxOnUrc);
+		if (ESP_OK != result)
+			return result;
+	}
+	return consoleAdd("outbox", "Store-and-forward queue [push <text>] [fill <count> <bytes>] [drain] "
+					  "[broker <host> [<port>]]", &outboxCommand);
+}
@@ -0,0 +1,67 @@
+// vim: tabstop=4 shiftwidth=4 noexpandtab colorcolumn=120 :
+// This file is part of the Sim800 (https://github.com/beranat/sim800).
+// Copyright (c) 2021 Anatoly L. Berenblit.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 3.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <esp_err.h>
+
+// Store-and-forward queue of outbound messages in the "outbox" data partition (partitions.csv), it survives reboots.
+// Records are fixed size slots (outboxRecord), message n always goes to slot n % slots; a sector is erased when the
+// queue gets to it again, unsent messages in it are dropped (the queue is full). Delivered messages are not erased:
+// the last record of a delivered batch gets its `sent' byte programmed, the queue starts after it on boot.
+// Drains go while the modem is registered (network cache, it enables +CREG/+CGREG): at once when registration comes
+// back, outboxLingerMs after a push so pushes go together, then with growing backoff when the send fails. A drain
+// sends batches of up to outboxBatch messages (one sender call each) till the queue is empty.
+
+constexpr size_t outboxRecord = 256;		// flash page
+constexpr size_t outboxPayloadMax = 248;
+constexpr size_t outboxBatch = 16;			// a sector of records, RAM of the drain
+constexpr unsigned int outboxLingerMs = 2000;
+constexpr unsigned int outboxRetryMs = 30000;		// doubles up to outboxRetryMaxMs
+constexpr unsigned int outboxRetryMaxMs = 600000;
+
+struct OutboxMessage {
+	uint32_t sequence;
+	const uint8_t *data;
+	size_t length;
+};
+
+// Sends the batch (oldest first) on the outbox task, returns how many from the first one are delivered, the rest is
+// sent again by the next drain. count 0 - the drain is over (the connection may be closed).
+typedef size_t (*OutboxSender)(const OutboxMessage *messages, size_t count, void *arg);
+
+struct OutboxStatus {
+	uint32_t queued;	// slots between the first unsent and the next one (torn records are skipped by the drain)
+	uint32_t capacity;
+	uint32_t pushed;	// since boot
+	uint32_t sent;
+	uint32_t dropped;	// overwritten by the full queue
+	uint32_t drains;
+	uint32_t batches;
+	bool isRegistered;
+};
+
+// Any task, blocks for the flash write
+esp_err_t outboxPush(const void *data, size_t length) noexcept;
+// nullptr - MQTT publishes (QoS 1) to CONFIG_SIM800_OUTBOX_TOPIC at CONFIG_SIM800_OUTBOX_BROKER
+void outboxSetSender(OutboxSender sender, void *arg) noexcept;
+// Drain now if the modem is not known to be unregistered
+void outboxDrain() noexcept;
+OutboxStatus outboxStatus() noexcept;
+
+esp_err_t outboxInit() noexcept;
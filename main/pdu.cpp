@@ -0,0 +1,513 @@
+// vim: tabstop=4 shiftwidth=4 noexpandtab colorcolumn=120 :
+// This file is part of the Sim800 (https://github.com/beranat/sim800).
+// Copyright (c) 2021 Anatoly L. Berenblit.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 3.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+#include <cstdio>
+#include <cstring>
+
+#include "pdu.hpp"
+
+constexpr uint8_t gsmEscape = 0x1B;
+constexpr uint16_t gsmNone = 0xFFFF;
+constexpr uint16_t gsmExtended = 0x100;	// septet after the escape
+
+// GSM 03.38 default alphabet
+constexpr uint16_t gsmBasic[128] = {
+	'@', 0x00A3, '$', 0x00A5, 0x00E8, 0x00E9, 0x00F9, 0x00EC, 0x00F2, 0x00C7, '\n', 0x00D8, 0x00F8, '\r', 0x00C5, 0x00E5,
+	0x0394, '_', 0x03A6, 0x0393, 0x039B, 0x03A9, 0x03A0, 0x03A8, 0x03A3, 0x0398, 0x039E, gsmNone, 0x00C6, 0x00E6, 0x00DF,
+	0x00C9, ' ', '!', '"', '#', 0x00A4, '%', '&', '\'', '(', ')', '*', '+', ',', '-', '.', '/', '0', '1', '2', '3', '4',
+	'5', '6', '7', '8', '9', ':', ';', '<', '=', '>', '?', 0x00A1, 'A', 'B', 'C', 'D', 'E', 'F', 'G', 'H', 'I', 'J', 'K',
+	'L', 'M', 'N', 'O', 'P', 'Q', 'R', 'S', 'T', 'U', 'V', 'W', 'X', 'Y', 'Z', 0x00C4, 0x00D6, 0x00D1, 0x00DC, 0x00A7,
+	0x00BF, 'a', 'b', 'c', 'd', 'e', 'f', 'g', 'h', 'i', 'j', 'k', 'l', 'm', 'n', 'o', 'p', 'q', 'r', 's', 't', 'u', 'v',
+	'w', 'x', 'y', 'z', 0x00E4, 0x00F6, 0x00F1, 0x00FC, 0x00E0,
+};
+
+// Extension table (after the escape)
+constexpr struct {
+	uint8_t septet;
+	uint16_t code;
+} gsmExtension[] = {
+	{ 0x0A, 0x000C }, { 0x14, '^' }, { 0x28, '{' }, { 0x29, '}' }, { 0x2F, '\\' }, { 0x3C, '[' }, { 0x3D, '~' },
+	{ 0x3E, ']' }, { 0x40, '|' }, { 0x65, 0x20AC },
+};
+
+// Latin-1 code point to septet (gsmExtended - escaped), Greek and the euro sign are searched
+struct GsmReverse {
+	uint16_t septet[256];
+
+	constexpr GsmReverse() : septet() {
+		for (uint16_t &value : septet)
+			value = gsmNone;
+		for (unsigned int i = 0; i < 128; ++i) {
+			if (gsmBasic[i] < 256)
+				septet[gsmBasic[i]] = i;
+		}
+		for (const auto &extension : gsmExtension) {
+			if (extension.code < 256)
+				septet[extension.code] = gsmExtended | extension.septet;
+		}
+	}
+};
+static constexpr GsmReverse gsmReverse;
+
+static uint16_t gsmSeptet(uint32_t code) noexcept {
+	if (code < 256)
+		return gsmReverse.septet[code];
+	for (unsigned int i = 0; i < 128; ++i) {
+		if (gsmBasic[i] == code && gsmEscape != i)
+			return i;
+	}
+	for (const auto &extension : gsmExtension) {
+		if (extension.code == code)
+			return gsmExtended | extension.septet;
+	}
+	return gsmNone;
+}
+
+static uint32_t gsmCode(uint8_t septet, bool isEscaped) noexcept {
+	if (isEscaped) {
+		for (const auto &extension : gsmExtension) {
+			if (extension.septet == septet)
+				return extension.code;
+		}
+	}
+	// unknown extension is shown as the basic character, a lone escape as a space
+	const uint16_t code = gsmBasic[septet & 0x7F];
+	return (gsmNone != code) ? code : 0x00A0;
+}
+
+// Next code point, U+FFFD for a malformed sequence
+static uint32_t utf8Next(std::string_view text, size_t &pos) noexcept {
+	const uint8_t c = text[pos++];
+	if (c < 0x80)
+		return c;
+
+	unsigned int extra = (0xF0 <= c) ? 3 : (0xE0 <= c) ? 2 : (0xC0 <= c) ? 1 : 0;
+	if (0 == extra || 0xF8 <= c)
+		return 0xFFFD;
+	uint32_t code = c & (0x3F >> extra);
+	for (; 0 != extra; --extra) {
+		if (text.length() <= pos || 0x80 != (text[pos] & 0xC0))
+			return 0xFFFD;
+		code = (code << 6) | (text[pos++] & 0x3F);
+	}
+	return code;
+}
+
+// Appends the code point if it fits
+static void utf8Put(uint32_t code, char *text, size_t &length, size_t max) noexcept {
+	char bytes[4];
+	size_t count = 0;
+	if (code < 0x80)
+		bytes[count++] = static_cast<char>(code);
+	else if (code < 0x800) {
+		bytes[count++] = static_cast<char>(0xC0 | (code >> 6));
+		bytes[count++] = static_cast<char>(0x80 | (code & 0x3F));
+	} else if (code < 0x10000) {
+		bytes[count++] = static_cast<char>(0xE0 | (code >> 12));
+		bytes[count++] = static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+		bytes[count++] = static_cast<char>(0x80 | (code & 0x3F));
+	} else {
+		bytes[count++] = static_cast<char>(0xF0 | (code >> 18));
+		bytes[count++] = static_cast<char>(0x80 | ((code >> 12) & 0x3F));
+		bytes[count++] = static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+		bytes[count++] = static_cast<char>(0x80 | (code & 0x3F));
+	}
+	if (length + count > max)
+		return;
+	memcpy(text + length, bytes, count);
+	length += count;
+}
+
+size_t pduPack(const uint8_t *septets, size_t count, uint8_t *octets, unsigned int fill) noexcept {
+	// 8 septets are 7 octets: whole blocks go through a 64-bit word, the pending bits (< 8) stay in it
+	uint8_t *out = octets;
+	uint64_t pending = 0;
+	unsigned int bits = fill & 7;
+	for (; 8 <= count; count -= 8, septets += 8) {
+		uint64_t block = 0;
+		for (unsigned int i = 0; i < 8; ++i)
+			block |= static_cast<uint64_t>(septets[i] & 0x7F) << (7 * i);
+		pending |= block << bits;
+		for (unsigned int i = 0; i < 7; ++i)
+			*out++ = static_cast<uint8_t>(pending >> (8 * i));
+		pending >>= 56;
+	}
+
+	for (; 0 != count; --count) {
+		pending |= static_cast<uint64_t>(*septets++ & 0x7F) << bits;
+		bits += 7;
+		if (8 <= bits) {
+			*out++ = static_cast<uint8_t>(pending);
+			pending >>= 8;
+			bits -= 8;
+		}
+	}
+	if (0 != bits)
+		*out++ = static_cast<uint8_t>(pending);
+	return out - octets;
+}
+
+size_t pduUnpack(const uint8_t *octets, size_t count, uint8_t *septets, unsigned int fill) noexcept {
+	fill &= 7;
+	const size_t length = (fill + 7 * count + 7) / 8;
+	size_t bit = fill;
+	size_t i = 0;
+
+	// 8 septets of a 64-bit load while it stays in the data
+	for (; i + 8 <= count && bit / 8 + 8 <= length; i += 8, bit += 56) {
+		uint64_t word = 0;
+		for (unsigned int j = 0; j < 8; ++j)
+			word |= static_cast<uint64_t>(octets[bit / 8 + j]) << (8 * j);
+		word >>= bit & 7;
+		for (unsigned int j = 0; j < 8; ++j)
+			septets[i + j] = static_cast<uint8_t>(word >> (7 * j)) & 0x7F;
+	}
+
+	for (; i < count; ++i, bit += 7) {
+		unsigned int value = octets[bit / 8] >> (bit & 7);
+		if (1 < (bit & 7))
+			value |= octets[bit / 8 + 1] << (8 - (bit & 7));
+		septets[i] = value & 0x7F;
+	}
+	return count;
+}
+
+static void pduHex(const uint8_t *data, size_t length, char *hex) noexcept {
+	constexpr const char *digits = "0123456789ABCDEF";
+	for (size_t i = 0; i < length; ++i) {
+		*hex++ = digits[data[i] >> 4];
+		*hex++ = digits[data[i] & 0x0F];
+	}
+	*hex = 0;
+}
+
+static int pduNibble(char c) noexcept {
+	if ('0' <= c && c <= '9')
+		return c - '0';
+	if ('A' <= c && c <= 'F')
+		return c - 'A' + 10;
+	if ('a' <= c && c <= 'f')
+		return c - 'a' + 10;
+	return -1;
+}
+
+// Address field: digit count, type (international/unknown) and swapped semi-octets, F padded
+static size_t pduAddress(const char *number, uint8_t *address) noexcept {
+	if (nullptr == number)
+		return 0;
+	const bool isInternational = ('+' == *number);
+	if (isInternational)
+		++number;
+
+	const size_t digits = strlen(number);
+	if (0 == digits || pduNumberMax < digits)
+		return 0;
+	address[0] = static_cast<uint8_t>(digits);
+	address[1] = isInternational ? 0x91 : 0x81;
+	for (size_t i = 0; i < digits; ++i) {
+		if (number[i] < '0' || '9' < number[i])
+			return 0;
+		const uint8_t digit = number[i] - '0';
+		uint8_t &octet = address[2 + i / 2];
+		octet = (0 == i % 2) ? (0xF0 | digit) : ((octet & 0x0F) | (digit << 4));
+	}
+	return 2 + (digits + 1) / 2;
+}
+
+static void pduAddressText(uint8_t type, const uint8_t *octets, size_t digits, char *text, size_t max) noexcept {
+	size_t length = 0;
+	if (0x50 == (type & 0x70)) {
+		// alphanumeric, GSM 7-bit in the semi-octets
+		uint8_t septets[pduNumberMax * 4 / 7];
+		const size_t count = pduUnpack(octets, digits * 4 / 7, septets);
+		for (size_t i = 0; i < count; ++i) {
+			const bool isEscaped = (gsmEscape == septets[i] && i + 1 < count);
+			utf8Put(gsmCode(isEscaped ? septets[++i] : septets[i], isEscaped), text, length, max);
+		}
+	} else {
+		constexpr const char *symbols = "0123456789*#abc";
+		if (0x10 == (type & 0x70))
+			text[length++] = '+';
+		for (size_t i = 0; i < digits && length < max; ++i) {
+			const uint8_t digit = (0 == i % 2) ? (octets[i / 2] & 0x0F) : (octets[i / 2] >> 4);
+			if (digit < 15)
+				text[length++] = symbols[digit];
+		}
+	}
+	text[length] = 0;
+}
+
+// Units of the text in the GSM alphabet (escapes included) or UTF-16, false - over the parts limit
+struct PduText {
+	bool isGsm = true;
+	size_t count = 0;
+	uint8_t septets[pduPartsMax * pduSeptetsMax];
+	uint16_t units[pduPartsMax * pduUserDataMax / 2];
+
+	bool encode(std::string_view text) noexcept {
+		for (size_t pos = 0; pos < text.length();) {
+			const uint16_t septet = gsmSeptet(utf8Next(text, pos));
+			if (gsmNone == septet) {
+				isGsm = false;
+				break;
+			}
+			if (0 != (septet & gsmExtended)) {
+				if (sizeof(septets) < count + 2)
+					return false;
+				septets[count++] = gsmEscape;
+			} else if (sizeof(septets) < count + 1)
+				return false;
+			septets[count++] = septet & 0x7F;
+		}
+		if (isGsm)
+			return true;
+
+		count = 0;
+		constexpr size_t unitsMax = sizeof(units) / sizeof(*units);
+		for (size_t pos = 0; pos < text.length();) {
+			uint32_t code = utf8Next(text, pos);
+			if (0x10000 <= code) {
+				if (unitsMax < count + 2)
+					return false;
+				code -= 0x10000;
+				units[count++] = 0xD800 | (code >> 10);
+				code = 0xDC00 | (code & 0x3FF);
+			} else if (unitsMax < count + 1)
+				return false;
+			units[count++] = static_cast<uint16_t>(code);
+		}
+		return true;
+	}
+
+	// escape and high surrogate stay with what they modify
+	bool isLead(size_t index) const noexcept {
+		return isGsm ? (gsmEscape == septets[index]) : (0xD800 <= units[index] && units[index] < 0xDC00);
+	}
+};
+
+constexpr size_t pduUdhLength = 6;	// UDHL, IEI 00 (8-bit reference), IEDL, reference, parts, part
+
+size_t pduSubmit(const char *number, std::string_view text, uint8_t reference, PduSubmit *parts, size_t max) noexcept {
+	uint8_t address[2 + pduNumberMax / 2];
+	const size_t addressLength = pduAddress(number, address);
+	if (0 == addressLength || nullptr == parts || 0 == max)
+		return 0;
+
+	static_assert(sizeof(PduText) < 4096, "Text units are on the stack");
+	PduText units;
+	if (!units.encode(text))
+		return 0;
+
+	// concatenated parts lose the UDH: 153 septets or 67 UCS-2 units
+	const size_t single = units.isGsm ? pduSeptetsMax : pduUserDataMax / 2;
+	const size_t each = units.isGsm ? (pduUserDataMax - pduUdhLength) * 8 / 7 : (pduUserDataMax - pduUdhLength) / 2;
+	size_t starts[pduPartsMax + 1];
+	size_t count = 0;
+	if (units.count <= single)
+		starts[count++] = 0;
+	else {
+		for (size_t pos = 0; pos < units.count;) {
+			if (max <= count || pduPartsMax <= count)
+				return 0;
+			size_t end = (units.count - pos < each) ? units.count : pos + each;
+			if (end < units.count && units.isLead(end - 1))
+				--end;
+			starts[count++] = pos;
+			pos = end;
+		}
+	}
+	starts[count] = units.count;
+
+	const bool isConcatenated = (1 < count);
+	for (size_t i = 0; i < count; ++i) {
+		uint8_t tpdu[pduOctetsMax];
+		size_t length = 0;
+		tpdu[length++] = isConcatenated ? 0x41 : 0x01;	// SMS-SUBMIT, TP-UDHI
+		tpdu[length++] = 0x00;	// TP-MR is set by the modem
+		memcpy(tpdu + length, address, addressLength);
+		length += addressLength;
+		tpdu[length++] = 0x00;	// TP-PID
+		tpdu[length++] = units.isGsm ? 0x00 : 0x08;
+		uint8_t &udl = tpdu[length++];
+
+		if (isConcatenated) {
+			const uint8_t udh[pduUdhLength] = { pduUdhLength - 1, 0x00, 3, reference, static_cast<uint8_t>(count),
+												static_cast<uint8_t>(i + 1) };
+			memcpy(tpdu + length, udh, sizeof(udh));
+			length += sizeof(udh);
+		}
+
+		const size_t begin = starts[i];
+		const size_t size = starts[i + 1] - begin;
+		if (units.isGsm) {
+			// UDH with the fill bit is 7 septets
+			length += pduPack(units.septets + begin, size, tpdu + length, isConcatenated ? 1 : 0);
+			udl = static_cast<uint8_t>(size + (isConcatenated ? 7 : 0));
+		} else {
+			for (size_t j = 0; j < size; ++j) {
+				tpdu[length++] = static_cast<uint8_t>(units.units[begin + j] >> 8);
+				tpdu[length++] = static_cast<uint8_t>(units.units[begin + j]);
+			}
+			udl = static_cast<uint8_t>(2 * size + (isConcatenated ? pduUdhLength : 0));
+		}
+
+		// empty SMSC - the one stored on the SIM
+		parts[i].length = static_cast<uint8_t>(length);
+		parts[i].hex[0] = parts[i].hex[1] = '0';
+		pduHex(tpdu, length, parts[i].hex + 2);
+	}
+	return count;
+}
+
+static PduCoding pduCodingOf(uint8_t dcs) noexcept {
+	if (0x00 == (dcs & 0xC0) || 0x40 == (dcs & 0xC0)) {
+		// general data coding, automatic deletion group
+		switch ((dcs >> 2) & 0x03) {
+			case 1:
+				return PduCoding::Data8;
+			case 2:
+				return PduCoding::Ucs2;
+			default:
+				return PduCoding::Gsm7;
+		}
+	}
+	if (0xE0 == (dcs & 0xF0))
+		return PduCoding::Ucs2;	// message waiting, store, UCS-2
+	if (0xF0 == (dcs & 0xF0))
+		return (0 != (dcs & 0x04)) ? PduCoding::Data8 : PduCoding::Gsm7;
+	return PduCoding::Gsm7;
+}
+
+static unsigned int pduSemiOctets(uint8_t octet) noexcept {
+	return (octet & 0x0F) * 10 + (octet >> 4);
+}
+
+bool pduDeliver(std::string_view hex, PduDeliver &message) noexcept {
+	uint8_t pdu[pduOctetsMax];
+	const size_t length = hex.length() / 2;
+	if (0 != hex.length() % 2 || sizeof(pdu) < length)
+		return false;
+	for (size_t i = 0; i < length; ++i) {
+		const int high = pduNibble(hex[2 * i]);
+		const int low = pduNibble(hex[2 * i + 1]);
+		if (high < 0 || low < 0)
+			return false;
+		pdu[i] = static_cast<uint8_t>((high << 4) | low);
+	}
+
+	// SMSC, first octet, originating address (TP-MR and the destination one of SMS-SUBMIT)
+	size_t pos = 0;
+	if (length < 1 || length < static_cast<size_t>(pdu[0]) + 5)
+		return false;
+	pos += 1 + pdu[0];
+	const uint8_t first = pdu[pos++];
+	message.isSubmit = (0x01 == (first & 0x03));
+	if (0x00 != (first & 0x03) && !message.isSubmit)
+		return false;
+	if (message.isSubmit)
+		++pos;
+
+	// TP-SCTS or TP-VP (none, relative, enhanced/absolute)
+	const size_t digits = pdu[pos];
+	const size_t addressLength = 2 + (digits + 1) / 2;
+	const unsigned int validityFormat = (first >> 3) & 0x03;
+	const size_t stamp = !message.isSubmit ? 7 : (0 == validityFormat) ? 0 : (2 == validityFormat) ? 1 : 7;
+	if (pduNumberMax < digits || length < pos + addressLength + 2 + stamp + 1)
+		return false;
+	pduAddressText(pdu[pos + 1], pdu + pos + 2, digits, message.sender, sizeof(message.sender) - 1);
+	pos += addressLength;
+
+	++pos;	// TP-PID
+	message.coding = pduCodingOf(pdu[pos++]);
+	message.timestamp[0] = 0;
+	if (!message.isSubmit) {
+		const uint8_t *scts = pdu + pos;
+		const uint8_t zone = scts[6];
+		snprintf(message.timestamp, sizeof(message.timestamp), "%02u/%02u/%02u,%02u:%02u:%02u%c%02u",
+				 pduSemiOctets(scts[0]) % 100, pduSemiOctets(scts[1]) % 100, pduSemiOctets(scts[2]) % 100,
+				 pduSemiOctets(scts[3]) % 100, pduSemiOctets(scts[4]) % 100, pduSemiOctets(scts[5]) % 100,
+				 (0 != (zone & 0x08)) ? '-' : '+', pduSemiOctets(zone & 0xF7) % 100);
+	}
+	pos += stamp;
+
+	const size_t udl = pdu[pos++];
+	const size_t udLength = (PduCoding::Gsm7 == message.coding) ? (7 * udl + 7) / 8 : udl;
+	if (pduUserDataMax < udLength || length < pos + udLength)
+		return false;
+	const uint8_t *ud = pdu + pos;
+
+	// concatenation reference of the UDH, other elements are skipped
+	size_t header = 0;
+	message.reference = 0;
+	message.parts = message.part = 0;
+	if (0 != (first & 0x40)) {
+		header = 1 + ud[0];
+		if (udLength < header)
+			return false;
+		for (size_t i = 1; i + 2 <= header && i + 2 + ud[i + 1] <= header; i += 2 + ud[i + 1]) {
+			const uint8_t *element = ud + i + 2;
+			if (0x00 == ud[i] && 3 == ud[i + 1]) {
+				message.reference = element[0];
+				message.parts = element[1];
+				message.part = element[2];
+			} else if (0x08 == ud[i] && 4 == ud[i + 1]) {
+				message.reference = (element[0] << 8) | element[1];
+				message.parts = element[2];
+				message.part = element[3];
+			}
+		}
+		if (0 == message.part || message.parts < message.part)
+			message.parts = message.part = 0;
+	}
+
+	constexpr size_t max = sizeof(message.text) - 1;
+	message.length = 0;
+	switch (message.coding) {
+		case PduCoding::Gsm7: {
+			// text starts at the septet boundary after the header
+			const size_t skip = (8 * header + 6) / 7;
+			if (udl < skip)
+				return false;
+			uint8_t septets[pduSeptetsMax];
+			const size_t count = pduUnpack(ud + header, udl - skip, septets, 7 * skip - 8 * header);
+			for (size_t i = 0; i < count; ++i) {
+				const bool isEscaped = (gsmEscape == septets[i] && i + 1 < count);
+				utf8Put(gsmCode(isEscaped ? septets[++i] : septets[i], isEscaped), message.text, message.length, max);
+			}
+			break;
+		}
+		case PduCoding::Ucs2:
+			for (size_t i = header; i + 1 < udLength; i += 2) {
+				uint32_t code = (ud[i] << 8) | ud[i + 1];
+				if (0xD800 <= code && code < 0xDC00 && i + 3 < udLength) {
+					const uint32_t low = (ud[i + 2] << 8) | ud[i + 3];
+					if (0xDC00 <= low && low < 0xE000) {
+						code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+						i += 2;
+					}
+				}
+				if (0xD800 <= code && code < 0xE000)
+					code = 0xFFFD;
+				utf8Put(code, message.text, message.length, max);
+			}
+			break;
+		case PduCoding::Data8:
+			message.length = udLength - header;
+			memcpy(message.text, ud + header, message.length);
+			break;
+	}
+	message.text[message.length] = 0;
+	return true;
+}
@@ -0,0 +1,68 @@
+// vim: tabstop=4 shiftwidth=4 noexpandtab colorcolumn=120 :
+// This file is part of the Sim800 (https://github.com/beranat/sim800).
+// Copyright (c) 2021 Anatoly L. Berenblit.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 3.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+// SMS PDU (GSM 03.40) codec: SMS-SUBMIT of UTF-8 text and SMS-DELIVER back to UTF-8. Text goes in GSM 03.38
+// default alphabet (with the extension table) if every character has a septet, UCS-2 otherwise. Longer text is
+// split into concatenated parts with an 8-bit reference UDH, escapes and surrogate pairs are never split.
+
+constexpr size_t pduUserDataMax = 140;	// TP-UD octets
+constexpr size_t pduSeptetsMax = 160;
+constexpr size_t pduPartsMax = 8;
+constexpr size_t pduNumberMax = 20;		// address digits
+// SMSC, SMS-DELIVER header with the longest address and the user data
+constexpr size_t pduOctetsMax = 12 + 1 + 12 + 2 + 7 + 1 + pduUserDataMax;
+constexpr size_t pduHexMax = 2 * pduOctetsMax;
+// septet is up to 2 UTF-8 bytes (Greek, escaped are 3 per 2), UCS-2 unit - 3 (70 units is less)
+constexpr size_t pduTextMax = 2 * pduSeptetsMax;
+
+enum class PduCoding : uint8_t {
+	Gsm7,
+	Data8,
+	Ucs2,
+};
+
+// AT+CMGS=<length> and the PDU hex (empty SMSC - the one on SIM)
+struct PduSubmit {
+	uint8_t length;	// TPDU octets, w/o the SMSC
+	char hex[pduHexMax + 1];
+};
+
+struct PduDeliver {
+	bool isSubmit;					// SMS-SUBMIT stored on the SIM: sender is the recipient, no timestamp
+	char sender[pduNumberMax + 2];	// `+' and digits or alphanumeric
+	char timestamp[21];				// yy/MM/dd,hh:mm:ss+zz (AT+CCLK), empty of SMS-SUBMIT
+	PduCoding coding;
+	uint16_t reference;				// concatenated: parts != 0
+	uint8_t parts;
+	uint8_t part;					// 1..parts
+	size_t length;
+	char text[pduTextMax + 1];		// UTF-8 (raw octets of Data8)
+};
+
+// Septets are packed LSB first after `fill' zero bits; return octets/septets written
+size_t pduPack(const uint8_t *septets, size_t count, uint8_t *octets, unsigned int fill = 0) noexcept;
+size_t pduUnpack(const uint8_t *octets, size_t count, uint8_t *septets, unsigned int fill = 0) noexcept;
+
+// Parts written, 0 - bad number or text too long for pduPartsMax parts
+size_t pduSubmit(const char *number, std::string_view text, uint8_t reference, PduSubmit *parts,
+				 size_t max = pduPartsMax) noexcept;
+// PDU hex of AT+CMGR/AT+CMGL (with SMSC), SMS-DELIVER or a stored SMS-SUBMIT
+bool pduDeliver(std::string_view hex, PduDeliver &message) noexcept;
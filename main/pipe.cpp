@@ -0,0 +1,369 @@
+// vim: tabstop=4 shiftwidth=4 noexpandtab colorcolumn=120 :
+// This file is part of the Sim800 (https://github.com/beranat/sim800).
+// Copyright (c) 2021 Anatoly L. Berenblit.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 3.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+#include <algorithm>
+#include <atomic>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string_view>
+
+#include <esp_log.h>
+#include <esp_timer.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+
+#include "hal.hpp"
+#include "sim.hpp"
+#include "cmux.hpp"
+#include "dlog.hpp"
+#include "socket.hpp"
+#include "console.hpp"
+#include "pipe.hpp"
+
+constexpr const char *MODULE = "pipe";
+
+constexpr TickType_t dialTimeout = pdMS_TO_TICKS(30000);
+constexpr TickType_t hangupTimeout = pdMS_TO_TICKS(5000);
+// Escape guard time before and after `+++' (S12, 1 s by default)
+constexpr unsigned int guardMs = 1000;
+constexpr TickType_t escapeTimeout = pdMS_TO_TICKS(guardMs + 1000);
+constexpr const char *escape = "+++";
+constexpr const char *hangup = "ATH";
+constexpr size_t scanLineMax = 64;
+constexpr std::string_view noCarrier = "\r\nNO CARRIER\r\n";
+
+// pipebench: TCP segment of an 1500 bytes IP packet, both paths carry it
+constexpr size_t benchSegment = 1460;
+constexpr size_t benchHeaders = 40;
+constexpr size_t benchDefault = 64 * 1024;
+
+enum class PipeState : uint8_t {
+	Closed,
+	Dialing,	// command mode: result lines are scanned
+	Open,		// data
+	Lost,		// NO CARRIER in data mode
+	Escaping,
+	Hangup,
+};
+
+static std::atomic<PipeState> pipeState = PipeState::Closed;
+static PipeCallback pipeCallback = nullptr;
+static void *pipeArg = nullptr;
+static uint8_t pipeChannel = 0;	// DLCI, 0 - modem UART
+static SemaphoreHandle_t pipeLock = nullptr;
+static SemaphoreHandle_t pipeDone = nullptr;
+static std::atomic<bool> pipeIsOk = false;
+
+// Receiver task only
+static char scanLine[scanLineMax];
+static size_t scanLength = 0;
+static size_t carrierMatched = 0;
+
+static void pipeResult(PipeState next, bool isOk) noexcept {
+	pipeState = next;
+	pipeIsOk = isOk;
+	xSemaphoreGive(pipeDone);
+}
+
+static void pipeScan(std::string_view line) noexcept {
+	static constexpr std::string_view failures[] = {
+		"NO CARRIER", "ERROR", "BUSY", "NO DIALTONE", "NO ANSWER", "+CME ERROR",
+	};
+
+	DLOG(Debug, MODULE, ">> %s", line);
+	switch (pipeState.load()) {
+		case PipeState::Dialing:
+			if (0 == line.compare(0, 7, "CONNECT")) {
+				carrierMatched = 0;
+				pipeResult(PipeState::Open, true);
+				return;
+			}
+			for (const std::string_view failure : failures) {
+				if (0 == line.compare(0, failure.length(), failure)) {
+					pipeResult(PipeState::Dialing, false);
+					return;
+				}
+			}
+			break;
+		case PipeState::Escaping:
+			if ("OK" == line)
+				pipeResult(PipeState::Hangup, true);
+			break;
+		case PipeState::Hangup:
+			if ("OK" == line || "NO CARRIER" == line || "ERROR" == line)
+				pipeResult(PipeState::Hangup, true);
+			break;
+		default:
+			break;
+	}
+}
+
+static void pipeInput(const uint8_t *data, size_t length) noexcept {
+	for (size_t i = 0; i < length; ++i) {
+		if (PipeState::Open == pipeState.load()) {
+			// the rest is data, modem hang-up is text in it
+			const size_t from = i;
+			for (; i < length && carrierMatched != noCarrier.length(); ++i) {
+				if (noCarrier[carrierMatched] == static_cast<char>(data[i]))
+					++carrierMatched;
+				else
+					carrierMatched = (noCarrier[0] == static_cast<char>(data[i])) ? 1 : 0;
+			}
+			pipeCallback(data + from, length - from, pipeArg);
+			if (carrierMatched == noCarrier.length()) {
+				ESP_LOGW(MODULE, "Carrier lost");
+				pipeState = PipeState::Lost;
+				pipeCallback(nullptr, 0, pipeArg);
+			}
+			return;
+		}
+
+		const char c = static_cast<char>(data[i]);
+		if ('\r' == c || '\n' == c) {
+			if (0 != scanLength)
+				pipeScan(std::string_view(scanLine, scanLength));
+			scanLength = 0;
+		} else if (scanLength < sizeof(scanLine))
+			scanLine[scanLength++] = c;
+	}
+}
+
+static void pipeRawInput(const uint8_t *data, size_t length, void *) noexcept {
+	pipeInput(data, length);
+}
+
+static void pipeChannelInput(uint8_t, const uint8_t *data, size_t length, void *) noexcept {
+	pipeInput(data, length);
+}
+
+static esp_err_t pipeSend(const void *data, size_t length) noexcept {
+	return (0 != pipeChannel) ? cmuxWrite(pipeChannel, data, length) : simWrite(data, length);
+}
+
+// Command mode request, waits for pipeResult()
+static bool pipeCommand(PipeState state, const char *command, bool isLine, TickType_t timeout) noexcept {
+	xSemaphoreTake(pipeDone, 0);
+	pipeIsOk = false;
+	pipeState = state;
+	esp_err_t result = pipeSend(command, strlen(command));
+	if (ESP_OK == result && isLine)
+		result = pipeSend("\r", 1);
+	return ESP_OK == result && pdTRUE == xSemaphoreTake(pipeDone, timeout) && pipeIsOk;
+}
+
+// Takes pipeDlci of the multiplexer or the modem UART (raw mode)
+static esp_err_t pipeAttach(PipeCallback callback, void *arg) noexcept {
+	pipeCallback = callback;
+	pipeArg = arg;
+	scanLength = 0;
+	pipeState = PipeState::Dialing;
+	if (cmuxIsActive()) {
+		pipeChannel = pipeDlci;
+		const esp_err_t result = cmuxOpen(pipeChannel, &pipeChannelInput);
+		if (ESP_OK != result)
+			pipeState = PipeState::Closed;
+		return result;
+	}
+
+	pipeChannel = 0;
+	if (!simRaw(&pipeRawInput)) {
+		pipeState = PipeState::Closed;
+		ESP_LOGE(MODULE, "Modem UART is busy");
+		return ESP_ERR_INVALID_STATE;
+	}
+	return ESP_OK;
+}
+
+static void pipeDetach() noexcept {
+	if (0 != pipeChannel)
+		cmuxClose(pipeChannel);
+	else
+		simRaw(nullptr);
+	pipeState = PipeState::Closed;
+}
+
+class PipeGuard final {
+	public:
+		PipeGuard() noexcept {
+			xSemaphoreTake(pipeLock, portMAX_DELAY);
+		}
+		~PipeGuard() {
+			xSemaphoreGive(pipeLock);
+		}
+};
+
+bool pipeIsOpen() noexcept {
+	return PipeState::Open == pipeState.load();
+}
+
+esp_err_t pipeOpen(const char *dial, PipeCallback callback, void *arg) noexcept {
+	if (nullptr == callback)
+		return ESP_ERR_INVALID_ARG;
+
+	const PipeGuard guard;
+	if (PipeState::Closed != pipeState.load())
+		return ESP_ERR_INVALID_STATE;
+
+	const esp_err_t result = pipeAttach(callback, arg);
+	if (ESP_OK != result)
+		return result;
+
+	if (!pipeCommand(PipeState::Dialing, (nullptr != dial) ? dial : pipeDialDefault, true, dialTimeout)) {
+		ESP_LOGW(MODULE, "%s failed", (nullptr != dial) ? dial : pipeDialDefault);
+		pipeDetach();
+		return ESP_FAIL;
+	}
+	ESP_LOGI(MODULE, "Connected on %s %u", (0 != pipeChannel) ? "DLCI" : "UART", pipeChannel);
+	return ESP_OK;
+}
+
+esp_err_t pipeWrite(const void *data, size_t length) noexcept {
+	if (PipeState::Open != pipeState.load())
+		return ESP_ERR_INVALID_STATE;
+	return pipeSend(data, length);
+}
+
+esp_err_t pipeClose() noexcept {
+	const PipeGuard guard;
+	const PipeState state = pipeState.load();
+	if (PipeState::Closed == state)
+		return ESP_OK;
+
+	bool isOk = true;
+	if (PipeState::Open == state) {
+		// no data for the guard time on both sides of the escape
+		vTaskDelay(pdMS_TO_TICKS(guardMs));
+		isOk = pipeCommand(PipeState::Escaping, escape, false, escapeTimeout);
+		if (!isOk)
+			ESP_LOGW(MODULE, "Escape is not answered");
+	}
+	if (PipeState::Lost != state && isOk && !pipeCommand(PipeState::Hangup, hangup, true, hangupTimeout))
+		ESP_LOGW(MODULE, "Hang-up is not answered");
+
+	pipeDetach();
+	ESP_LOGI(MODULE, "Closed");
+	return isOk ? ESP_OK : ESP_ERR_TIMEOUT;
+}
+
+// Async-HDLC (RFC 1662) as PPP sends an IP packet with the default ACCM, FCS is not computed
+static size_t benchFrame(uint8_t *frame, const uint8_t *packet, size_t length) noexcept {
+	size_t size = 0;
+	frame[size++] = 0x7E;
+	for (size_t i = 0; i < length + 2; ++i) {
+		const uint8_t c = (i < length) ? packet[i] : 0xFF;
+		if (0x7E == c || 0x7D == c || c < 0x20) {
+			frame[size++] = 0x7D;
+			frame[size++] = c ^ 0x20;
+		} else
+			frame[size++] = c;
+	}
+	frame[size++] = 0x7E;
+	return size;
+}
+
+static void benchSink(const uint8_t *, size_t, void *) noexcept {
+}
+
+static void benchSocketSink(int, const uint8_t *, size_t, void *) noexcept {
+}
+
+static void benchPrint(const char *path, size_t payload, size_t wire, int64_t us) noexcept {
+	const int baudRate = simBaudRate();
+	const uint64_t rate = (0 < us) ? payload * UINT64_C(1000000) / us : 0;
+	printf("%s: %-8s %zu bytes (%zu on the wire) in %" PRId64 " ms, %" PRIu64 " B/s, %" PRIu64 "%% of %d baud\n",
+		   MODULE, path, payload, wire, us / 1000, rate, (0 < baudRate) ? rate * 1000 / baudRate : 0, baudRate);
+}
+
+// pipebench <host> <port> [bytes] - uplink throughput of the data mode (PPP framed packets) and of the modem
+// TCP connection (AT+CIPSEND segments) to host:port
+static int pipeBench(int argc, char **argv) {
+	const long total = (3 < argc) ? atol(argv[3]) : static_cast<long>(benchDefault);
+	if (argc < 3 || 4 < argc || total <= 0)
+		return ESP_ERR_INVALID_ARG;
+
+	// socket path gets the whole window of segments per call
+	static_assert(benchHeaders + benchSegment <= socketWindow * socketMss, "Packet must fit the window");
+	uint8_t *packet = new (std::nothrow) uint8_t[socketWindow * socketMss];
+	uint8_t *frame = new (std::nothrow) uint8_t[2 * (benchHeaders + benchSegment) + 8];
+	if (nullptr == packet || nullptr == frame) {
+		delete[] packet;
+		delete[] frame;
+		return ESP_ERR_NO_MEM;
+	}
+	uint32_t seed = 0x2545F491;
+	for (size_t i = 0; i < socketWindow * socketMss; ++i) {
+		seed ^= seed << 13;
+		seed ^= seed >> 17;
+		seed ^= seed << 5;
+		packet[i] = static_cast<uint8_t>(seed);
+	}
+
+	esp_err_t result = pipeOpen(nullptr, &benchSink);
+	if (ESP_OK == result) {
+		size_t payload = 0, wire = 0;
+		const int64_t start = esp_timer_get_time();
+		while (ESP_OK == result && payload < static_cast<size_t>(total)) {
+			const size_t length = std::min(benchSegment, static_cast<size_t>(total) - payload);
+			const size_t size = benchFrame(frame, packet, benchHeaders + length);
+			result = pipeWrite(frame, size);
+			payload += length;
+			wire += size;
+		}
+		if (ESP_OK == result)
+			result = halUartWaitTx(portMAX_DELAY);
+		const int64_t us = esp_timer_get_time() - start;
+		if (ESP_OK == pipeClose() && ESP_OK == result)
+			benchPrint("ppp", payload, wire, us);
+	}
+
+	int id = -1;
+	if (ESP_OK == result)
+		result = socketConnect(SocketType::Tcp, argv[1], static_cast<uint16_t>(atoi(argv[2])), &benchSocketSink,
+							   nullptr, &id);
+	if (ESP_OK == result) {
+		size_t payload = 0, wire = 0;
+		const int64_t start = esp_timer_get_time();
+		while (ESP_OK == result && payload < static_cast<size_t>(total)) {
+			const size_t length = std::min(socketWindow * socketMss, static_cast<size_t>(total) - payload);
+			result = socketSend(id, packet, length);
+			for (size_t segment = 0; segment < length; segment += socketMss) {
+				const size_t size = std::min(socketMss, length - segment);
+				wire += snprintf(nullptr, 0, "AT+CIPSEND=%zu\r", size) + size;
+			}
+			payload += length;
+		}
+		const int64_t us = esp_timer_get_time() - start;
+		socketClose(id);
+		if (ESP_OK == result)
+			benchPrint("cipsend", payload, wire, us);
+	}
+
+	delete[] packet;
+	delete[] frame;
+	return result;
+}
+
+esp_err_t pipeInit() noexcept {
+	pipeLock = xSemaphoreCreateMutex();
+	pipeDone = xSemaphoreCreateBinary();
+	if (nullptr == pipeLock || nullptr == pipeDone)
+		return ESP_ERR_NO_MEM;
+	return consoleAdd("pipebench", "Uplink throughput of data mode and TCP socket <host> <port> [bytes]", &pipeBench);
+}
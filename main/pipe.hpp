@@ -0,0 +1,40 @@
+// vim: tabstop=4 shiftwidth=4 noexpandtab colorcolumn=120 :
+// This file is part of the Sim800 (https://github.com/beranat/sim800).
+// Copyright (c) 2021 Anatoly L. Berenblit.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 3.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <freertos/FreeRTOS.h>
+#include <esp_err.h>
+
+// Modem data mode (PPPoS pipe): dials on the modem UART, or on pipeDlci when the multiplexer runs (AT channel
+// stays available), data bytes bypass the AT layers. Closing escapes with `+++' and hangs up.
+
+constexpr uint8_t pipeDlci = 2;
+constexpr const char *pipeDialDefault = "ATD*99#";
+
+// Data on the receiver task, must not block. nullptr/0 - carrier is lost (NO CARRIER), pipe must be closed
+typedef void (*PipeCallback)(const uint8_t *data, size_t length, void *arg);
+
+// Sends dial command (w/o CR) and waits for CONNECT
+esp_err_t pipeOpen(const char *dial, PipeCallback callback, void *arg = nullptr) noexcept;
+esp_err_t pipeWrite(const void *data, size_t length) noexcept;
+// Escape (guard time, +++, guard time) and ATH, the UART or channel is back to AT
+esp_err_t pipeClose() noexcept;
+bool pipeIsOpen() noexcept;
+
+esp_err_t pipeInit() noexcept;
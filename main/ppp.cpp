@@ -0,0 +1,192 @@
+// vim: tabstop=4 shiftwidth=4 noexpandtab colorcolumn=120 :
+// This file is part of the Sim800 (https://github.com/beranat/sim800).
+// Copyright (c) 2021 Anatoly L. Berenblit.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 3.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+
+#include <esp_log.h>
+#include <esp_event.h>
+#include <esp_netif.h>
+#include <esp_netif_ppp.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+
+#include "sdkconfig.h"
+
+#include "console.hpp"
+#include "at.hpp"
+#include "pipe.hpp"
+#include "ppp.hpp"
+
+constexpr const char *MODULE = "ppp";
+
+constexpr TickType_t pdpTimeout = pdMS_TO_TICKS(5000);
+
+// esp_netif I/O driver: transmit goes to the pipe, pipe data is esp_netif_receive()d
+struct PppDriver {
+	esp_netif_driver_base_t base;
+};
+
+static PppDriver pppDriver = {};
+static esp_netif_t *pppNetif = nullptr;
+static SemaphoreHandle_t pppLock = nullptr;
+static std::atomic<bool> pppIsStarted = false;
+static std::atomic<bool> pppHasIp = false;
+
+static esp_err_t pppTransmit(void *, void *buffer, size_t length) {
+	return pipeWrite(buffer, length);
+}
+
+static esp_err_t pppPostAttach(esp_netif_t *netif, void *args) {
+	PppDriver *driver = reinterpret_cast<PppDriver *>(args);
+	driver->base.netif = netif;
+
+	const esp_netif_driver_ifconfig_t config = {
+		.handle = driver,
+		.transmit = &pppTransmit,
+	};
+	return esp_netif_set_driver_config(netif, &config);
+}
+
+static void pppInput(const uint8_t *data, size_t length, void *) noexcept {
+	if (nullptr == data) {
+		// NO CARRIER: PPP is dead, the pipe is closed by pppStop()
+		esp_netif_action_disconnected(pppNetif, nullptr, 0, nullptr);
+		return;
+	}
+	esp_netif_receive(pppNetif, const_cast<uint8_t *>(data), length, nullptr);
+}
+
+static void pppOnIpEvent(void *, esp_event_base_t, int32_t id, void *data) {
+	switch (id) {
+		case IP_EVENT_PPP_GOT_IP: {
+			const ip_event_got_ip_t *event = reinterpret_cast<const ip_event_got_ip_t *>(data);
+			ESP_LOGI(MODULE, "IP " IPSTR ", gateway " IPSTR, IP2STR(&event->ip_info.ip), IP2STR(&event->ip_info.gw));
+			pppHasIp = true;
+			break;
+		}
+		case IP_EVENT_PPP_LOST_IP:
+			ESP_LOGW(MODULE, "IP lost");
+			pppHasIp = false;
+			break;
+		default:
+			break;
+	}
+}
+
+static void pppOnStatus(void *, esp_event_base_t, int32_t id, void *) {
+	if (NETIF_PPP_ERRORNONE != id)
+		ESP_LOGW(MODULE, "Status %d", static_cast<int>(id));
+}
+
+class PppGuard final {
+	public:
+		PppGuard() noexcept {
+			xSemaphoreTake(pppLock, portMAX_DELAY);
+		}
+		~PppGuard() {
+			xSemaphoreGive(pppLock);
+		}
+};
+
+bool pppIsUp() noexcept {
+	return pppHasIp.load();
+}
+
+esp_err_t pppStart(const char *apn) noexcept {
+	const PppGuard guard;
+	if (pppIsStarted)
+		return ESP_ERR_INVALID_STATE;
+
+	char command[atCommandMax];
+	snprintf(command, sizeof(command), "AT+CGDCONT=1,\"IP\",\"%s\"", (nullptr != apn) ? apn : CONFIG_SIM800_APN);
+	if (AtResult::Ok != atCommand(command, nullptr, pdpTimeout))
+		return ESP_FAIL;
+
+	const esp_err_t result = pipeOpen(pipeDialDefault, &pppInput);
+	if (ESP_OK != result)
+		return result;
+
+	pppIsStarted = true;
+	esp_netif_action_start(pppNetif, nullptr, 0, nullptr);
+	return ESP_OK;
+}
+
+esp_err_t pppStop() noexcept {
+	const PppGuard guard;
+	if (!pppIsStarted)
+		return ESP_OK;
+
+	// LCP terminate goes out while the pipe is still open
+	esp_netif_action_stop(pppNetif, nullptr, 0, nullptr);
+	pppHasIp = false;
+	pppIsStarted = false;
+	return pipeClose();
+}
+
+// ppp [start [apn]|stop]
+static int pppCommand(int argc, char **argv) {
+	if (1 == argc) {
+		esp_netif_ip_info_t info = {};
+		esp_netif_get_ip_info(pppNetif, &info);
+		printf("%s: %s, IP " IPSTR "\n", MODULE, pppHasIp ? "up" : (pppIsStarted ? "negotiating" : "down"),
+			   IP2STR(&info.ip));
+		return ESP_OK;
+	}
+	if (0 == strcmp(argv[1], "start") && argc <= 3)
+		return pppStart((3 == argc) ? argv[2] : nullptr);
+	if (0 == strcmp(argv[1], "stop") && 2 == argc)
+		return pppStop();
+	return ESP_ERR_INVALID_ARG;
+}
+
+esp_err_t pppInit() noexcept {
+	pppLock = xSemaphoreCreateMutex();
+	if (nullptr == pppLock)
+		return ESP_ERR_NO_MEM;
+
+	esp_err_t result = esp_netif_init();
+	if (ESP_OK == result) {
+		result = esp_event_loop_create_default();
+		if (ESP_ERR_INVALID_STATE == result)
+			result = ESP_OK;	// already created
+	}
+	if (ESP_OK == result)
+		result = esp_event_handler_register(IP_EVENT, ESP_EVENT_ANY_ID, &pppOnIpEvent, nullptr);
+	if (ESP_OK == result)
+		result = esp_event_handler_register(NETIF_PPP_STATUS, ESP_EVENT_ANY_ID, &pppOnStatus, nullptr);
+	if (ESP_OK != result) {
+		ESP_LOGE(MODULE, "Init error %s (%d)", esp_err_to_name(result), static_cast<int>(result));
+		return result;
+	}
+
+	const esp_netif_config_t config = ESP_NETIF_DEFAULT_PPP();
+	pppNetif = esp_netif_new(&config);
+	if (nullptr == pppNetif)
+		return ESP_ERR_NO_MEM;
+
+	pppDriver.base.post_attach = &pppPostAttach;
+	result = esp_netif_attach(pppNetif, &pppDriver);
+	if (ESP_OK != result)
+		return result;
+
+#if CONFIG_LWIP_PPP_PAP_SUPPORT
+	if (0 != *CONFIG_SIM800_PPP_USER)
+		esp_netif_ppp_set_auth(pppNetif, NETIF_PPP_AUTHTYPE_PAP, CONFIG_SIM800_PPP_USER, CONFIG_SIM800_PPP_PASSWORD);
+#endif
+	return consoleAdd("ppp", "PPP over GPRS state [start [apn]|stop]", &pppCommand);
+}
@@ -0,0 +1,28 @@
+// vim: tabstop=4 shiftwidth=4 noexpandtab colorcolumn=120 :
+// This file is part of the Sim800 (https://github.com/beranat/sim800).
+// Copyright (c) 2021 Anatoly L. Berenblit.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 3.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+
+#include <esp_err.h>
+
+// PPPoS over the modem data pipe attached to esp_netif: lwIP sockets work over GPRS while it is up.
+// With the multiplexer the AT channel stays available, otherwise AT commands are rejected till pppStop().
+
+// Sets PDP context APN (CONFIG_SIM800_APN if nullptr), dials and starts PPP negotiation
+esp_err_t pppStart(const char *apn = nullptr) noexcept;
+esp_err_t pppStop() noexcept;
+bool pppIsUp() noexcept;	// IP address is assigned
+
+esp_err_t pppInit() noexcept;
@@ -13,164 +13,529 @@
 //
 // You should have received a copy of the GNU General Public License
 // along with this program. If not, see <http://www.gnu.org/licenses/>.
+#include <cinttypes>
 #include <cstring>
 #include <string>
+#include <string_view>
+#include <tuple>
+#include <atomic>
 #include <exception>
 #include <system_error>
 
 #include <esp_log.h>
 #include <esp_system.h>
 #include <esp_sleep.h>
-#include <driver/uart.h>
+#include <esp_timer.h>
+#include <esp_bit_defs.h>
 
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
+#include <freertos/semphr.h>
 
 #include "main.hpp"
 #include "console.hpp"
 #include "sdkconfig.h"
 
+#include "config.hpp"
+#include "dlog.hpp"
+#include "stats.hpp"
+#include "journal.hpp"
+#include "framer.hpp"
+#include "hal.hpp"
+#include "at.hpp"
+#include "urc.hpp"
+#include "cmux.hpp"
+#include "pipe.hpp"
+#include "socket.hpp"
+#include "sms.hpp"
+#include "listing.hpp"
+#include "http.hpp"
+#include "ota.hpp"
+#include "mqtt.hpp"
+#include "network.hpp"
 #include "sim.hpp"
 
 constexpr const char *MODULE = "sim";
-constexpr const bool verbose = true;
 
 constexpr unsigned int resetDelayEnableMs = 500;
 // Pull down PWRKEY for more than 1 second according to manual requirements
 constexpr unsigned int powerKeyDelayEnableMs = 1250;
-constexpr unsigned int powerKeyDelayDisableMs = 2000;
-static_assert(powerKeyDelayEnableMs + powerKeyDelayDisableMs > 2900, ""); // UART will be ready in 2.9 seconds
-
-constexpr unsigned int SIM800_UART_BUFFER_RX = 256;
-constexpr unsigned int SIM800_UART_BUFFER_TX = 0;
+// UART is ready in ~2.9 seconds after the key, modem is ready on RDY (fixed rate only) or the first answered AT
+constexpr unsigned int powerProbeMs = 250;
+constexpr unsigned int powerReadyTimeoutMs = 10000;
+
+// Power-up runs on its own task, app_main continues with the console, IP5306 and storage
+enum class PowerState : uint8_t {
+	Reset,
+	Key,
+	Boot,
+	Link,
+	Ready,
+	Failed,	// no answer at any rate
+};
+
+static void powerTask(void *ptr) noexcept;
+constexpr size_t powerStackSize = configMINIMAL_STACK_SIZE + 1024*2;
+constexpr UBaseType_t powerPriority = tskIDLE_PRIORITY + 1;
+static SemaphoreHandle_t powerRdy = nullptr;
+static std::atomic<PowerState> powerState = PowerState::Reset;
+static int64_t powerReadyUs = 0;	// since boot
+
+// Driver buffer holds ~45ms of data at 460800 baud, receiver is not the bottleneck any more.
+// AT+CIPSEND data is written by the receiver task on the prompt, TX ring takes a whole segment without blocking.
+constexpr unsigned int SIM800_UART_BUFFER_RX = 2048;
+constexpr unsigned int SIM800_UART_BUFFER_TX = 2048;
+
+// Link rate: modem autobauds (or keeps AT+IPR rate from the previous run, it is stored by modem),
+// after sync it is switched to the fastest rate passed the check.
+constexpr int linkBaudRateDefault = 57600;
+constexpr int linkBaudRates[] = { 460800, 230400, 115200, 57600, 38400, 19200, 9600 };	// fastest first
+constexpr unsigned int linkSyncTries = 3;
+constexpr TickType_t linkSyncTimeout = pdMS_TO_TICKS(250);
+constexpr TickType_t linkSettleDelay = pdMS_TO_TICKS(20);
+static int linkBaudRate = linkBaudRateDefault;
+static bool linkIsFlowControl = false;
 
 static void recvReceiver(void *ptr) noexcept;
 constexpr size_t recvStackSize = configMINIMAL_STACK_SIZE + 1024*2;
 constexpr UBaseType_t recvPriority = tskIDLE_PRIORITY + 1;
 TaskHandle_t recvHandle = nullptr;
 
+#if CONFIG_SIM800_RECV_EVENTS
+// Receiver sleeps on the driver events: line end or RX FIFO threshold/timeout
+constexpr bool recvIsEvents = true;
+constexpr const char *recvMode = "event";
+#else
+constexpr bool recvIsEvents = false;
+constexpr const char *recvMode = "polling";
+#endif
+
+// +CMGL/+HTTPREAD lines are long, keep whole PDU (up to 2*(164+12)) in a single line
+constexpr size_t recvRingSize = simRingSize;
+constexpr size_t recvLineMax = 512;
+static LineFramer<recvRingSize, recvLineMax> recvFramer;
+
+// Raw mode (bridge, multiplexer): modem bytes bypass the framer into own buffer - raw user may feed lines back
+// (simFeed), busy while the receiver is inside the callback
+static std::atomic<SimRawCallback> recvRaw = nullptr;
+static void *recvRawArg = nullptr;
+static std::atomic<bool> recvRawBusy = false;
+static bool recvWasRaw = false;
+static uint8_t recvRawBuffer[recvRingSize];
+
+// Data block after a response line (simExpect), receiver task only
+static SimRawCallback recvBlock = nullptr;
+static void *recvBlockArg = nullptr;
+
+// Console splits the line by spaces, join them back by single ones: `AT +CMGS="+123" ; +CSQ' is `AT+CMGS="+123" ; +CSQ'
 static int sendCommand(int argc, char **argv) {
 	std::string command = "AT";
 	for (int i = 1; i < argc; ++i) {
 		if (1 != i)
-			command.append(",");
+			command.append(" ");
 		command.append(argv[i]);
 	}
-	command.append("\r\n");
-	return simSend(command.c_str(), command.length());
+
+	AtResponse response;
+	const AtResult result = atCommand(command.c_str(), &response);
+	if (0 != response.length)
+		printf("%s\n", response.text);
+
+	switch (result) {
+		case AtResult::Ok:
+		case AtResult::Connect:
+			return ESP_OK;
+		case AtResult::Timeout:
+			return ESP_ERR_TIMEOUT;
+		default:
+			printf("%s %s (%d)\n", MODULE, atResultName(result), response.code);
+			return ESP_FAIL;
+	}
 }
 
-bool recvParseLine(const char *line, ptrdiff_t length) noexcept {
-	if (verbose)
-		printf("%s >> %s\n", MODULE, line);
+bool recvParseLine(std::string_view line) noexcept {
+	statsAdd(StatsCounter::Lines);
+	DLOG(Debug, MODULE, ">> %s", line);
 
+	size_t prefix = 0;
+	const Urc urc = urcClassify(line, &prefix);
+	journalAppend((Urc::None != urc) ? JournalKind::Urc : JournalKind::Rx, line);
+	if (Urc::None != urc && !atIsResponse(line)) {
+		urcDispatch(urc, line, prefix);
+		return true;
+	}
+
+	if (!atParseLine(line) && Urc::None == urc)
+		DLOG(Debug, MODULE, "Unexpected line `%s'", line);
 	return true;
 }
 
-void recvReceiver(void *ptr) noexcept {
-	uart_flush_input(CONFIG_SIM800_UART_PORT);
+static void recvFlush() noexcept {
+	statsAdd(StatsCounter::RecvFlushes);
+	halUartFlush();
+	recvFramer.reset();
+}
 
-	constexpr TickType_t poolPeriod = pdMS_TO_TICKS(250);
+static bool recvParse() noexcept {
+	const bool isParsed = recvFramer.parse([](std::string_view line, bool isTruncated) noexcept {
+		if (isTruncated) {
+			statsAdd(StatsCounter::LinesTruncated);
+			DLOG(Warn, MODULE, "Line over %zu bytes truncated", recvFramer.lineMax());
+		}
+		return recvParseLine(line);
+	}, [](std::string_view data, bool isLast) noexcept {
+		const SimRawCallback block = recvBlock;
+		if (isLast)
+			recvBlock = nullptr;
+		if (nullptr != block)
+			block(reinterpret_cast<const uint8_t *>(data.data()), data.length(), recvBlockArg);
+		return true;
+	});
+
+	// prompt has no line end, the echo of the data sent on it is skipped
+	size_t echo = 0;
+	if (isParsed && "> " == recvFramer.pending() && atPrompt(echo)) {
+		recvBlock = nullptr;
+		recvFramer.expect(echo);
+	}
 
-	char buffer[128], *bufPtr = nullptr;
-	size_t bufLength = 0;
+	if (!isParsed) {
+		statsAdd(StatsCounter::ParseErrors);
+		ESP_LOGE(MODULE, "Receiver parse error, flush data");
+	}
+	return isParsed;
+}
 
+// Receive up to length bytes (whole free span if zero) into framer and operate line(s)
+static bool recvRead(size_t length, TickType_t wait) noexcept {
 	do {
-		if (nullptr == bufPtr) {
-			ESP_LOGI(MODULE, "Flush receiver");
-			uart_flush_input(CONFIG_SIM800_UART_PORT);
-			bufPtr = buffer;
-			bufLength = sizeof(buffer);
+		recvRawBusy = true;
+		const SimRawCallback raw = recvRaw;
+		if ((nullptr != raw) != recvWasRaw) {
+			recvWasRaw = (nullptr != raw);
+			recvFramer.reset();	// partial line of the other mode
 		}
 
+		char *bufPtr = reinterpret_cast<char *>(recvRawBuffer);
+		size_t bufLength = sizeof(recvRawBuffer);
+		if (nullptr == raw)
+			std::tie(bufPtr, bufLength) = recvFramer.writable();
 
-		const int recvLen = uart_read_bytes(CONFIG_SIM800_UART_PORT, reinterpret_cast<uint8_t *>(bufPtr), bufLength-1,
-											poolPeriod);
+		const size_t readLength = (0 != length && length < bufLength) ? length : bufLength;
+		const int recvLen = halUartRead(bufPtr, readLength, wait);
 		if (recvLen <= 0) {
+			recvRawBusy = false;
 			if (recvLen < 0) {
 				ESP_LOGE(MODULE, "Receiver error, flush data");
-				bufPtr = nullptr;
+				return false;
 			}
-			continue;
+			return true;
 		}
-		bufPtr[recvLen] = 0;
-
-		// OPERATE LINE(s)
-		for (char *line = buffer; nullptr != line;) {
-			char *end = strpbrk(line, "\r\n");
-			if (nullptr == end) {
-				const size_t length = strlen(line);
-				memmove(buffer, line, sizeof(*buffer)*length);
-				bufPtr = buffer + length;
-				bufLength = sizeof(buffer) - length;
-				line = nullptr;
-			} else {
-				*end++ = 0;
-				if (0 != *line && !recvParseLine(line, line - end)) {
-					ESP_LOGE(MODULE, "Receiver parse error, flush data");
-					bufPtr = nullptr;
-				}
-				line = end;
+		statsAdd(StatsCounter::RecvBytes, recvLen);
+
+		if (nullptr != raw) {
+			raw(recvRawBuffer, recvLen, recvRawArg);
+			recvRawBusy = false;
+		} else {
+			recvRawBusy = false;
+			recvFramer.commit(recvLen);
+			if (!recvParse())
+				return false;
+		}
+
+		if (0 == length)
+			return true;
+		length -= (static_cast<size_t>(recvLen) < length) ? recvLen : length;
+	} while (0 != length);
+
+	return true;
+}
+
+void recvReceiver(void *ptr) noexcept {
+	recvFlush();
+
+#if CONFIG_SIM800_RECV_EVENTS
+	do {
+		HalUartEvent event;
+		if (!halUartWait(event, portMAX_DELAY))
+			continue;
+
+		bool isOk = true;
+		switch (event) {
+			case HalUartEvent::Line:
+			case HalUartEvent::Data: {
+				const size_t length = halUartBuffered();
+				if (0 != length)
+					isOk = recvRead(length, 0);
 			}
+			break;
+			case HalUartEvent::Overflow:
+				statsAdd(StatsCounter::UartOverflows);
+				ESP_LOGW(MODULE, "Receiver overflow, flush data");
+				isOk = false;
+				break;
+			case HalUartEvent::Error:
+				statsAdd(StatsCounter::UartErrors);
+				ESP_LOGW(MODULE, "Receiver line error");
+				break;
 		}
 
+		if (!isOk)
+			recvFlush();
+	} while (true);
+#else
+	constexpr TickType_t poolPeriod = pdMS_TO_TICKS(250);
+
+	do {
+		if (!recvRead(0, poolPeriod))
+			recvFlush();
 	} while (true);
+#endif
 
 	fatalError(ESP_FAIL, "Receiver stopped", MODULE);
 }
 
-esp_err_t simInit() noexcept try {
-	{
-		gpio_config_t config = {
-			.pin_bit_mask = BIT64(CONFIG_SIM800_POWER_GPIO) | BIT64(CONFIG_SIM800_RESET_GPIO) | BIT64(CONFIG_SIM800_POWERKEY_GPIO),
-			.mode = GPIO_MODE_OUTPUT,
-			.pull_up_en = GPIO_PULLUP_DISABLE,
-			.pull_down_en = GPIO_PULLDOWN_DISABLE,
-			.intr_type = GPIO_INTR_DISABLE
-		};
-		ESP_ERROR_CHECK(gpio_config(&config));
+// simbench [count] - AT/OK round trip latency (send to line parsed)
+static int simBench(int argc, char **argv) {
+	const int count = (1 < argc) ? atoi(argv[1]) : 10;
+	if (2 < argc || count <= 0)
+		return ESP_ERR_INVALID_ARG;
+
+	int64_t total = 0, min = INT64_MAX, max = 0;
+	int received = 0;
+	for (int i = 0; i < count; ++i) {
+		const int64_t start = esp_timer_get_time();
+		if (AtResult::Ok != atCommand("AT"))
+			continue;
+
+		const int64_t latency = esp_timer_get_time() - start;
+		total += latency;
+		min = (latency < min) ? latency : min;
+		max = (latency > max) ? latency : max;
+		++received;
 	}
 
-	ESP_LOGI(MODULE, "Chip init");
-	gpio_set_level(static_cast<gpio_num_t>(CONFIG_SIM800_POWER_GPIO), 1);
-	gpio_set_level(static_cast<gpio_num_t>(CONFIG_SIM800_RESET_GPIO), 0);
-	gpio_set_level(static_cast<gpio_num_t>(CONFIG_SIM800_POWERKEY_GPIO), 1);
+	printf("%s: %s receiver, %d/%d answered", MODULE, recvMode, received, count);
+	if (0 != received)
+		printf(", latency min %" PRId64 " avg %" PRId64 " max %" PRId64 " us", min, total / received, max);
+	printf("\n");
+	return (0 != received) ? ESP_OK : ESP_ERR_TIMEOUT;
+}
+
+// Host and modem understand each other at baudRate (autobauding modem locks on "AT")
+static bool linkSync(int baudRate) noexcept {
+	if (ESP_OK != halUartBaud(baudRate))
+		return false;
+	vTaskDelay(linkSettleDelay);
+
+	for (unsigned int i = 0; i < linkSyncTries; ++i) {
+		if (AtResult::Ok == atCommand("AT", nullptr, linkSyncTimeout)) {
+			linkBaudRate = baudRate;
+			return true;
+		}
+	}
+	return false;
+}
+
+// Modem acks AT+IPR at the old rate and switches, an unstable rate is reverted blindly
+static bool linkSwitch(int baudRate) noexcept {
+	char command[atCommandMax];
+	snprintf(command, sizeof(command), "AT+IPR=%d", baudRate);
+	if (AtResult::Ok != atCommand(command))
+		return false;
+
+	const int previous = linkBaudRate;
+	if (linkSync(baudRate))
+		return true;
+
+	ESP_LOGW(MODULE, "Link check at %d failed, back to %d", baudRate, previous);
+	snprintf(command, sizeof(command), "AT+IPR=%d\r", previous);
+	simSend(command, strlen(command), linkSyncTimeout);
+	vTaskDelay(linkSettleDelay);
+	if (!linkSync(previous))
+		ESP_LOGE(MODULE, "Link lost at %d", previous);
+	return false;
+}
+
+static bool linkInit() noexcept {
+	Config config = configGet();
+	const int stored = (0 != config.simBaudRate) ? config.simBaudRate : linkBaudRateDefault;
+
+	bool isSynced = linkSync(stored) || (stored != linkBaudRateDefault && linkSync(linkBaudRateDefault));
+	for (size_t i = 0; !isSynced && i < sizeof(linkBaudRates) / sizeof(*linkBaudRates); ++i) {
+		if (stored != linkBaudRates[i] && linkBaudRateDefault != linkBaudRates[i])
+			isSynced = linkSync(linkBaudRates[i]);
+	}
+
+	if (!isSynced) {
+		ESP_LOGE(MODULE, "Link sync failed");
+		halUartBaud(linkBaudRateDefault);
+		return false;
+	}
+
+#if CONFIG_SIM800_FLOWCONTROL
+	if (AtResult::Ok == atCommand("AT+IFC=2,2")) {
+		linkIsFlowControl = (ESP_OK == halUartFlowControl(true));
+		if (!linkIsFlowControl)
+			atCommand("AT+IFC=0,0");
+	}
+#endif
+
+	// fastest allowed first, the stored rate over the limit goes down as well
+	for (const int baudRate : linkBaudRates) {
+		if (baudRate > CONFIG_SIM800_BAUDRATE_MAX)
+			continue;
+		if (baudRate == linkBaudRate || linkSwitch(baudRate))
+			break;
+	}
 
+	config.simBaudRate = linkBaudRate;
+	configSet(config);
+	ESP_LOGI(MODULE, "Link %d baud, flow control %s", linkBaudRate, linkIsFlowControl ? "on" : "off");
+	return true;
+}
+
+// simlink [command] - link rate and the throughput measured on a long response (AT+CLAC by default)
+static int simLink(int argc, char **argv) {
+	if (2 < argc)
+		return ESP_ERR_INVALID_ARG;
+
+	const uint32_t bytes = statsGet(StatsCounter::RecvBytes);
+	const int64_t start = esp_timer_get_time();
+	const AtResult result = atCommand((1 < argc) ? argv[1] : "AT+CLAC", nullptr, pdMS_TO_TICKS(5000));
+	const int64_t elapsed = esp_timer_get_time() - start;
+	const uint32_t received = statsGet(StatsCounter::RecvBytes) - bytes;
+
+	printf("%s: link %d baud (%d B/s), flow control %s\n", MODULE, linkBaudRate, linkBaudRate / 10,
+		   linkIsFlowControl ? "on" : "off");
+	printf("%s: %s, %" PRIu32 " bytes in %" PRId64 " us, %" PRId64 " B/s\n", MODULE, atResultName(result), received,
+		   elapsed, (0 != elapsed) ? static_cast<int64_t>(received) * 1000000 / elapsed : 0);
+	return (AtResult::Ok == result) ? ESP_OK : ESP_FAIL;
+}
+
+static const char *powerStateName(PowerState state) noexcept {
+	switch (state) {
+		case PowerState::Reset:
+			return "reset";
+		case PowerState::Key:
+			return "key";
+		case PowerState::Boot:
+			return "boot";
+		case PowerState::Link:
+			return "link";
+		case PowerState::Ready:
+			return "ready";
+		case PowerState::Failed:
+			return "failed";
+	}
+	return "unknown";
+}
+
+static void powerRdyHandler(Urc, std::string_view, std::string_view, void *) noexcept {
+	xSemaphoreGive(powerRdy);
+}
+
+// Modem answers: RDY arrived or AT is answered at the stored rate, silence is expected while it boots
+static bool powerProbe() noexcept {
+	if (pdTRUE == xSemaphoreTake(powerRdy, pdMS_TO_TICKS(powerProbeMs)))
+		return true;
+
+	AtRequest request;
+	strcpy(request.command, "AT");
+	request.timeout = pdMS_TO_TICKS(powerProbeMs);
+	request.isQuiet = true;
+	return AtResult::Ok == atCommand(request);
+}
+
+void powerTask(void *ptr) noexcept {
+	const int64_t start = esp_timer_get_time();
+
+	powerState.store(PowerState::Reset);
+	halGpioSet(CONFIG_SIM800_POWER_GPIO, true);
+	halGpioSet(CONFIG_SIM800_RESET_GPIO, false);
+	halGpioSet(CONFIG_SIM800_POWERKEY_GPIO, true);
 	vTaskDelay(pdMS_TO_TICKS(resetDelayEnableMs));
-	gpio_set_level(static_cast<gpio_num_t>(CONFIG_SIM800_RESET_GPIO), 1);
-	gpio_set_level(static_cast<gpio_num_t>(CONFIG_SIM800_POWERKEY_GPIO), 0);
+
+	powerState.store(PowerState::Key);
+	halGpioSet(CONFIG_SIM800_RESET_GPIO, true);
+	halGpioSet(CONFIG_SIM800_POWERKEY_GPIO, false);
 	vTaskDelay(pdMS_TO_TICKS(powerKeyDelayEnableMs));
-	gpio_set_level(static_cast<gpio_num_t>(CONFIG_SIM800_POWERKEY_GPIO), 1);
-	vTaskDelay(pdMS_TO_TICKS(powerKeyDelayDisableMs));
+	halGpioSet(CONFIG_SIM800_POWERKEY_GPIO, true);
+
+	powerState.store(PowerState::Boot);
+	const int64_t keyUp = esp_timer_get_time();
+	const int stored = configGet().simBaudRate;
+	halUartBaud((0 != stored) ? stored : linkBaudRateDefault);
+
+	bool isAnswered = false;
+	while (!isAnswered && esp_timer_get_time() - keyUp < powerReadyTimeoutMs * 1000LL)
+		isAnswered = powerProbe();
+	const int64_t answered = esp_timer_get_time();
+	if (!isAnswered)
+		ESP_LOGW(MODULE, "Modem is silent for %u ms", powerReadyTimeoutMs);
+
+	// silent modem may be at another rate (autobaud does not send RDY), link tries them all
+	powerState.store(PowerState::Link);
+	const bool isLinked = linkInit();
+
+#if CONFIG_SIM800_CMUX
+	if (isLinked && ESP_OK != cmuxStart())
+		ESP_LOGW(MODULE, "Multiplexer is not started, single AT channel");
+#endif
+
+	powerReadyUs = esp_timer_get_time();
+	powerState.store(isLinked ? PowerState::Ready : PowerState::Failed);
+	ESP_LOGI(MODULE, "Modem %s in %" PRId64 " ms since boot (power-up %" PRId64 ", boot %" PRId64 ", link %" PRId64
+			 " ms)", powerStateName(powerState.load()), powerReadyUs / 1000, (powerReadyUs - start) / 1000,
+			 (answered - keyUp) / 1000, (powerReadyUs - answered) / 1000);
+
+	urcUnregister(Urc::Rdy, &powerRdyHandler, nullptr);
+	vTaskDelete(nullptr);
+}
 
+esp_err_t simInit() noexcept try {
+	ESP_ERROR_CHECK(halGpioOutput(BIT64(CONFIG_SIM800_POWER_GPIO) | BIT64(CONFIG_SIM800_RESET_GPIO) |
+								  BIT64(CONFIG_SIM800_POWERKEY_GPIO)));
+
+	// Receiver is running before the modem is powered to catch RDY
 	ESP_LOGI(MODULE, "UART init");
-	uart_config_t config = {
-		.baud_rate = 57600,
-		.data_bits = UART_DATA_8_BITS,
-		.parity = UART_PARITY_DISABLE,
-		.stop_bits = UART_STOP_BITS_1,
-		.flow_ctrl = UART_HW_FLOWCTRL_DISABLE,
-		.rx_flow_ctrl_thresh = 122,
-		.source_clk = UART_SCLK_APB,
-	};
-
-	ESP_LOGI(MODULE, "Driver Init");
-	ESP_ERROR_CHECK(uart_driver_install(CONFIG_SIM800_UART_PORT, SIM800_UART_BUFFER_RX, SIM800_UART_BUFFER_TX, 0, NULL, 0));
-	ESP_ERROR_CHECK(uart_param_config(CONFIG_SIM800_UART_PORT, &config));
-
-	ESP_LOGI(MODULE, "PINs init");
-	ESP_ERROR_CHECK(uart_set_pin(CONFIG_SIM800_UART_PORT, CONFIG_SIM800_TX_GPIO, CONFIG_SIM800_RX_GPIO, UART_PIN_NO_CHANGE,
-								 UART_PIN_NO_CHANGE));
-
-	ESP_LOGI(MODULE, "Modem init");
-	vTaskDelay(pdMS_TO_TICKS(1000));
+	HalUartConfig config;
+	config.baudRate = linkBaudRateDefault;
+	config.rxBuffer = SIM800_UART_BUFFER_RX;
+	config.txBuffer = SIM800_UART_BUFFER_TX;
+	config.isEvents = recvIsEvents;
+	ESP_ERROR_CHECK(halUartInit(config));
+
+	ESP_ERROR_CHECK(atInit());
+	ESP_ERROR_CHECK(cmuxInit());
+	ESP_ERROR_CHECK(pipeInit());
+	ESP_ERROR_CHECK(socketInit());
+	ESP_ERROR_CHECK(smsInit());
+	ESP_ERROR_CHECK(listingInit());
+	ESP_ERROR_CHECK(httpInit());
+	ESP_ERROR_CHECK(otaInit());
+	ESP_ERROR_CHECK(mqttInit());
+	ESP_ERROR_CHECK(networkInit());
 	BaseType_t result = xTaskCreate(recvReceiver, "sim800-recv", recvStackSize, nullptr, recvPriority, &recvHandle);
 	if (result != pdPASS) {
 		ESP_LOGE(MODULE, "Recv Task create error");
 		return ESP_FAIL;
 	}
 
+	ESP_LOGI(MODULE, "Chip init");
+	powerRdy = xSemaphoreCreateBinary();
+	if (nullptr == powerRdy)
+		return ESP_ERR_NO_MEM;
+	ESP_ERROR_CHECK(urcRegister(Urc::Rdy, &powerRdyHandler, nullptr));
+	result = xTaskCreate(powerTask, "sim800-power", powerStackSize, nullptr, powerPriority, nullptr);
+	if (result != pdPASS) {
+		ESP_LOGE(MODULE, "Power Task create error");
+		return ESP_FAIL;
+	}
+
 	ESP_ERROR_CHECK(consoleAdd("AT", "Send AT-command to modem", &sendCommand));
+	ESP_ERROR_CHECK(consoleAdd("simbench", "Measure AT round trip latency [count]", &simBench));
+	ESP_ERROR_CHECK(consoleAdd("simlink", "Link rate and measured throughput [command]", &simLink));
 	return ESP_OK;
 } catch (const std::system_error &e) {
 	ESP_LOGE(MODULE, "Init esp error %s", e.what());
@@ -180,20 +545,93 @@ esp_err_t simInit() noexcept try {
 	return ESP_FAIL;
 }
 
+int simBaudRate() noexcept {
+	return linkBaudRate;
+}
+
+bool simRaw(SimRawCallback callback, void *arg) noexcept {
+	if (nullptr != callback) {
+		SimRawCallback expected = nullptr;
+		if (nullptr != recvRaw.load())
+			return false;
+		recvRawArg = arg;
+		return recvRaw.compare_exchange_strong(expected, callback);
+	}
+
+	recvRaw = nullptr;
+	while (recvRawBusy)
+		vTaskDelay(1);
+	return true;
+}
+
+bool simExpect(size_t length, SimRawCallback callback, void *arg) noexcept {
+	if (nullptr != recvBlock)
+		return false;
+	if (0 != length) {
+		recvBlock = callback;
+		recvBlockArg = arg;
+	}
+	recvFramer.expect(length);
+	return true;
+}
+
+bool simFeed(const void *data, size_t length) noexcept {
+	const char *bytes = reinterpret_cast<const char *>(data);
+	while (0 != length) {
+		const auto [bufPtr, bufLength] = recvFramer.writable();
+		const size_t chunk = (length < bufLength) ? length : bufLength;
+		memcpy(bufPtr, bytes, chunk);
+		recvFramer.commit(chunk);
+		if (!recvParse()) {
+			recvFramer.reset();
+			return false;
+		}
+		bytes += chunk;
+		length -= chunk;
+	}
+	return true;
+}
+
 esp_err_t simSend(const void *message, size_t length, TickType_t wait) noexcept {
-	if (uart_write_bytes(CONFIG_SIM800_UART_PORT, reinterpret_cast<const char *>(message), length) != length) {
+	if (cmuxIsActive())
+		return cmuxWrite(cmuxDlciAt, message, length, (0 != wait) ? wait : cmuxResponseTimeout);
+
+	// data mode or bridge owns the UART
+	if (nullptr != recvRaw.load()) {
+		DLOG(Warn, MODULE, "send %zu rejected, UART is raw", length);
+		return ESP_ERR_INVALID_STATE;
+	}
+
+	const esp_err_t result = simWrite(message, length);
+	return (ESP_OK != result || 0 == wait) ? result : halUartWaitTx(wait);
+}
+
+esp_err_t simWrite(const void *data, size_t length) noexcept {
+	if (halUartWrite(data, length) != static_cast<int>(length)) {
 		ESP_LOGE(MODULE, "send %zu error", length);
 		return ESP_FAIL;
 	}
-
-	return (0 == wait)?ESP_OK:uart_wait_tx_done(CONFIG_SIM800_UART_PORT, wait);
+	statsAdd(StatsCounter::SendBytes, length);
+	return ESP_OK;
 }
 
 esp_err_t simSend(const char *message) noexcept {
 	return simSend(reinterpret_cast<const void *>(message), strlen(message), 0);
 }
 
-int simRecv(uint8_t *data, size_t maxlen) noexcept {
-	return -1;
+esp_err_t simTrySend(const void *message, size_t length, size_t &sent) noexcept {
+	sent = 0;
+	if (cmuxIsActive())
+		return cmuxWrite(cmuxDlciAt, message, length, 0, &sent);
+
+	const esp_err_t result = simSend(message, length);
+	if (ESP_OK == result)
+		sent = length;
+	return result;
+}
+
+bool simIsReady() noexcept {
+	return PowerState::Ready == powerState.load();
 }
 
+
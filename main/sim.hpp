@@ -15,10 +15,36 @@
 // along with this program. If not, see <http://www.gnu.org/licenses/>.
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
+
 #include <freertos/FreeRTOS.h>
 #include <esp_err.h>
 
+constexpr size_t simRingSize = 1024;	// receive ring of the modem lines and data blocks
+
+// Starts the modem power-up in background, simIsReady() when it answers
 esp_err_t simInit() noexcept;
+bool simIsReady() noexcept;
+int simBaudRate() noexcept;	// negotiated link rate
 esp_err_t simSend(const void *message, size_t length, TickType_t sendTimeout = 0) noexcept;
 esp_err_t simSend(const char *message) noexcept;
-int simRecv(uint8_t *data, size_t maxlen) noexcept;
+// Never waits for the modem flow (receiver, timer tasks): ESP_ERR_TIMEOUT while the modem stops the AT channel,
+// sent - length gone out, the rest is for the next try
+esp_err_t simTrySend(const void *message, size_t length, size_t &sent) noexcept;
+
+// Raw receive (bridge, multiplexer): modem bytes go to the callback on the receiver task instead of the line
+// framer, false if another one is set. nullptr restores line mode and returns when the receiver has left the
+// previous callback.
+typedef void (*SimRawCallback)(const uint8_t *data, size_t length, void *arg);
+bool simRaw(SimRawCallback callback, void *arg = nullptr) noexcept;
+
+// Raw write of the UART owner (bridge, data mode), simSend() is for the AT layer
+esp_err_t simWrite(const void *data, size_t length) noexcept;
+
+// Called from a line callback on the receiver task (socket, AT+CIPRXGET=2 response): next length bytes after the line
+// are data, handed to the callback straight from the receive ring. false if a block is already expected.
+bool simExpect(size_t length, SimRawCallback callback, void *arg = nullptr) noexcept;
+
+// Line input of the raw user (multiplexer AT channel) on the receiver task, false on parse error
+bool simFeed(const void *data, size_t length) noexcept;
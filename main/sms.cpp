@@ -0,0 +1,507 @@
+// vim: tabstop=4 shiftwidth=4 noexpandtab colorcolumn=120 :
+// This file is part of the Sim800 (https://github.com/beranat/sim800).
+// Copyright (c) 2021 Anatoly L. Berenblit.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 3.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+#include <atomic>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+#include <string_view>
+
+#include <esp_log.h>
+#include <esp_timer.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+
+#include "console.hpp"
+#include "dlog.hpp"
+#include "at.hpp"
+#include "urc.hpp"
+#include "pdu.hpp"
+#include "sms.hpp"
+
+constexpr const char *MODULE = "sms";
+
+constexpr TickType_t smsCommandTimeout = pdMS_TO_TICKS(5000);
+constexpr TickType_t smsSendTimeout = pdMS_TO_TICKS(60000);	// AT+CMGS, network dependent
+
+// AT+CMGS data: the PDU hex and Ctrl-Z
+constexpr char smsSubmitEnd = 0x1A;
+
+struct SmsSlot {
+	std::atomic<bool> isBusy { false };
+	unsigned int reference = 0;	// TP-MR of +CMGS
+	char data[pduHexMax + 2];
+};
+
+// Parts of a concatenated message received so far
+struct SmsAssembly {
+	bool isUsed = false;
+	char sender[pduNumberMax + 2];
+	char timestamp[21];
+	PduCoding coding;
+	uint16_t reference;
+	uint8_t parts;
+	uint32_t received;	// bit per part
+	int64_t updatedUs;
+	uint16_t lengths[pduPartsMax];
+	uint16_t indexes[pduPartsMax];	// SIM storage, parts are deleted once the message is delivered
+	char texts[pduPartsMax][pduTextMax];
+};
+
+static SemaphoreHandle_t smsLock = nullptr;		// one batch at a time
+static SemaphoreHandle_t smsFree = nullptr;		// free slots
+static SmsSlot smsSlots[smsWindow];
+static std::atomic<bool> smsIsFailed = false;	// part of the batch
+static std::atomic<bool> smsIsPdu = false;		// AT+CMGF=0 is set
+static std::atomic<uint8_t> smsReference = 0;	// concatenated messages sent
+static SmsCallback smsCallback = nullptr;
+static void *smsArg = nullptr;
+
+static std::atomic<uint32_t> smsSent = 0;		// parts
+static std::atomic<uint32_t> smsFailed = 0;
+static std::atomic<uint32_t> smsReceived = 0;	// messages
+static std::atomic<uint32_t> smsPartsReceived = 0;
+
+// Receiver task only: AT+CMGR response and the reassembly
+static bool smsIsHeader = false;
+static size_t smsHexLength = 0;
+static char smsHex[pduHexMax + 1];
+static PduDeliver smsPart;
+static SmsAssembly smsAssembly[smsAssemblies];
+static char smsJoined[smsTextMax + 1];
+
+class SmsGuard final {
+	SemaphoreHandle_t lock_;
+	public:
+		explicit SmsGuard(SemaphoreHandle_t lock) noexcept : lock_(lock) {
+			xSemaphoreTake(lock_, portMAX_DELAY);
+		}
+		~SmsGuard() {
+			xSemaphoreGive(lock_);
+		}
+};
+
+static void smsModeDone(AtResult result, int, void *) noexcept {
+	smsIsPdu = (AtResult::Ok == result);
+}
+
+// Queued ahead of a command that needs the PDU mode, false - the queue is full
+static bool smsMode() noexcept {
+	return smsIsPdu || ESP_OK == atSubmit("AT+CMGF=0", &smsModeDone, nullptr, smsCommandTimeout);
+}
+
+static void smsSentLine(std::string_view line, void *arg) noexcept {
+	constexpr std::string_view prefix = "+CMGS:";
+	if (0 == line.compare(0, prefix.length(), prefix))
+		reinterpret_cast<SmsSlot *>(arg)->reference = strtoul(line.data() + prefix.length(), nullptr, 10);
+}
+
+static void smsSentDone(AtResult result, int code, void *arg) noexcept {
+	SmsSlot &slot = *reinterpret_cast<SmsSlot *>(arg);
+	if (AtResult::Ok == result) {
+		++smsSent;
+		DLOG(Debug, MODULE, "Part is sent, reference %u", slot.reference);
+	} else {
+		smsIsFailed = true;
+		++smsFailed;
+		ESP_LOGW(MODULE, "Part is not sent: %s (%d)", atResultName(result), code);
+	}
+	slot.isBusy = false;
+	xSemaphoreGive(smsFree);
+}
+
+// Part is copied to a free slot, so the next message is encoded while it is sent
+static esp_err_t smsQueue(const PduSubmit &part, TickType_t wait) noexcept {
+	if (pdTRUE != xSemaphoreTake(smsFree, wait))
+		return ESP_ERR_TIMEOUT;
+
+	SmsSlot *slot = smsSlots;
+	while (slot->isBusy.exchange(true))
+		++slot;	// semaphore counts the free ones
+
+	const size_t length = strlen(part.hex);
+	memcpy(slot->data, part.hex, length);
+	slot->data[length] = smsSubmitEnd;
+	slot->reference = 0;
+
+	AtRequest request;
+	snprintf(request.command, sizeof(request.command), "AT+CMGS=%u", part.length);
+	request.timeout = smsSendTimeout;
+	request.data = slot->data;
+	request.dataLength = length + 1;
+	request.onLine = &smsSentLine;
+	request.onDone = &smsSentDone;
+	request.arg = slot;
+	const esp_err_t result = atSubmit(request, wait);
+	if (ESP_OK != result) {
+		slot->isBusy = false;
+		xSemaphoreGive(smsFree);
+	}
+	return result;
+}
+
+esp_err_t smsSend(const SmsOutgoing *messages, size_t count, TickType_t wait) noexcept {
+	if (nullptr == messages || 0 == count)
+		return ESP_ERR_INVALID_ARG;
+
+	const SmsGuard guard(smsLock);
+	if (!smsIsPdu && AtResult::Ok != atCommand("AT+CMGF=0", nullptr, smsCommandTimeout))
+		return ESP_FAIL;
+	smsIsPdu = true;
+
+	PduSubmit *parts = new (std::nothrow) PduSubmit[pduPartsMax];
+	if (nullptr == parts)
+		return ESP_ERR_NO_MEM;
+
+	smsIsFailed = false;
+	esp_err_t result = ESP_OK;
+	for (size_t i = 0; ESP_OK == result && i < count; ++i) {
+		const size_t total = pduSubmit(messages[i].number, messages[i].text, smsReference++, parts);
+		if (0 == total) {
+			ESP_LOGW(MODULE, "Message to %s is not encoded", messages[i].number);
+			result = ESP_ERR_INVALID_ARG;
+		}
+		for (size_t j = 0; ESP_OK == result && j < total; ++j)
+			result = smsIsFailed ? ESP_FAIL : smsQueue(parts[j], wait);
+	}
+
+	// all the slots are back when the queued parts are completed
+	for (unsigned int i = 0; i < smsWindow; ++i)
+		xSemaphoreTake(smsFree, portMAX_DELAY);
+	for (unsigned int i = 0; i < smsWindow; ++i)
+		xSemaphoreGive(smsFree);
+
+	delete[] parts;
+	return (ESP_OK == result && smsIsFailed) ? ESP_FAIL : result;
+}
+
+esp_err_t smsSend(const char *number, const char *text, TickType_t wait) noexcept {
+	const SmsOutgoing message { number, text };
+	return smsSend(&message, 1, wait);
+}
+
+esp_err_t smsRegister(SmsCallback callback, void *arg) noexcept {
+	smsArg = arg;
+	smsCallback = callback;
+	return ESP_OK;
+}
+
+static void smsDeliver(const SmsMessage &message) noexcept {
+	++smsReceived;
+	if (nullptr != smsCallback)
+		smsCallback(message, smsArg);
+	else
+		printf("%s: %s %s << %.*s\n", MODULE, message.sender, message.timestamp, static_cast<int>(message.length),
+			   message.text);
+}
+
+static void smsDelete(unsigned int index) noexcept {
+	char command[atCommandMax];
+	snprintf(command, sizeof(command), "AT+CMGD=%u", index);
+	if (ESP_OK != atSubmit(command, nullptr, nullptr, smsCommandTimeout))
+		ESP_LOGW(MODULE, "Message %u is not deleted", index);
+}
+
+static SmsAssembly &smsAssemblyOf(const PduDeliver &part) noexcept {
+	SmsAssembly *oldest = nullptr;
+	for (SmsAssembly &assembly : smsAssembly) {
+		if (!assembly.isUsed) {
+			if (nullptr == oldest || oldest->isUsed)
+				oldest = &assembly;
+			continue;
+		}
+		if (assembly.reference == part.reference && assembly.parts == part.parts &&
+				0 == strcmp(assembly.sender, part.sender))
+			return assembly;
+		if (nullptr == oldest || (oldest->isUsed && assembly.updatedUs < oldest->updatedUs))
+			oldest = &assembly;
+	}
+
+	if (oldest->isUsed) {
+		// nothing reads them again, they would fill up the SIM storage
+		ESP_LOGW(MODULE, "Incomplete message from %s is dropped", oldest->sender);
+		for (unsigned int i = 0; i < oldest->parts; ++i) {
+			if (0 != (oldest->received & (1u << i)))
+				smsDelete(oldest->indexes[i]);
+		}
+	}
+	oldest->isUsed = true;
+	strcpy(oldest->sender, part.sender);
+	strcpy(oldest->timestamp, part.timestamp);
+	oldest->coding = part.coding;
+	oldest->reference = part.reference;
+	oldest->parts = part.parts;
+	oldest->received = 0;
+	return *oldest;
+}
+
+// Part of a concatenated message is kept (in RAM and on the SIM at index) till the others arrive in any order
+static void smsOnPart(const PduDeliver &part, unsigned int index) noexcept {
+	++smsPartsReceived;
+	if (0 == part.parts || pduPartsMax < part.parts || 0 == part.part || part.parts < part.part) {
+		if (0 != part.parts)
+			ESP_LOGW(MODULE, "Part %u of %u is delivered alone", part.part, part.parts);
+		smsDeliver(SmsMessage { part.sender, part.timestamp, part.coding, part.length, part.text });
+		smsDelete(index);
+		return;
+	}
+
+	SmsAssembly &assembly = smsAssemblyOf(part);
+	const unsigned int number = part.part - 1;
+	if (0 != (assembly.received & (1u << number))) {
+		DLOG(Debug, MODULE, "Message %u is a duplicate part", index);
+		smsDelete(index);
+		return;
+	}
+	memcpy(assembly.texts[number], part.text, part.length);
+	assembly.lengths[number] = static_cast<uint16_t>(part.length);
+	assembly.indexes[number] = static_cast<uint16_t>(index);
+	assembly.received |= 1u << number;
+	assembly.updatedUs = esp_timer_get_time();
+	if (1 == part.part)
+		strcpy(assembly.timestamp, part.timestamp);
+	DLOG(Debug, MODULE, "%s part %u/%u of %u", assembly.sender, part.part, part.parts, part.reference);
+	if ((1u << assembly.parts) - 1 != assembly.received)
+		return;
+
+	size_t length = 0;
+	for (unsigned int i = 0; i < assembly.parts; ++i) {
+		memcpy(smsJoined + length, assembly.texts[i], assembly.lengths[i]);
+		length += assembly.lengths[i];
+	}
+	smsJoined[length] = 0;
+	assembly.isUsed = false;
+	smsDeliver(SmsMessage { assembly.sender, assembly.timestamp, assembly.coding, length, smsJoined });
+	for (unsigned int i = 0; i < assembly.parts; ++i)
+		smsDelete(assembly.indexes[i]);
+}
+
+// +CMGR: <stat>,[<alpha>],<length> and the PDU
+static void smsReadLine(std::string_view line, void *) noexcept {
+	constexpr std::string_view prefix = "+CMGR:";
+	if (0 == line.compare(0, prefix.length(), prefix)) {
+		smsIsHeader = true;
+		return;
+	}
+	if (smsIsHeader && line.length() <= pduHexMax) {
+		memcpy(smsHex, line.data(), line.length());
+		smsHexLength = line.length();
+	}
+	smsIsHeader = false;
+}
+
+// Message is deleted once delivered, so the SIM storage does not fill up. Undecoded ones are kept
+static void smsReadDone(AtResult result, int code, void *arg) noexcept {
+	const unsigned int index = static_cast<unsigned int>(reinterpret_cast<uintptr_t>(arg));
+	const size_t length = smsHexLength;
+	smsHexLength = 0;
+	smsIsHeader = false;
+	if (AtResult::Ok != result) {
+		ESP_LOGW(MODULE, "Message %u is not read: %s (%d)", index, atResultName(result), code);
+		return;
+	}
+	if (0 == length) {
+		DLOG(Debug, MODULE, "Message %u is empty", index);
+		return;
+	}
+
+	if (pduDeliver(std::string_view(smsHex, length), smsPart))
+		smsOnPart(smsPart, index);
+	else
+		ESP_LOGW(MODULE, "Message %u is not decoded, kept on the SIM", index);
+}
+
+static esp_err_t smsRead(unsigned int index) noexcept {
+	if (!smsMode())
+		return ESP_ERR_TIMEOUT;
+
+	AtRequest request;
+	snprintf(request.command, sizeof(request.command), "AT+CMGR=%u", index);
+	request.timeout = smsCommandTimeout;
+	request.onLine = &smsReadLine;
+	request.onDone = &smsReadDone;
+	request.arg = reinterpret_cast<void *>(static_cast<uintptr_t>(index));
+	return atSubmit(request, 0);
+}
+
+static void smsOnUrc(Urc urc, std::string_view, std::string_view args, void *) noexcept {
+	switch (urc) {
+		case Urc::SmsReady:
+			// new message indication is +CMTI: <mem>,<index>, the message stays on the SIM
+			smsIsPdu = false;
+			if (!smsMode() || ESP_OK != atSubmit("AT+CNMI=2,1,0,0,0", nullptr, nullptr, smsCommandTimeout))
+				ESP_LOGW(MODULE, "Indications are not set");
+			break;
+		case Urc::Cmti: {
+			const size_t comma = args.rfind(',');
+			if (std::string_view::npos == comma)
+				break;
+			const unsigned int index = strtoul(args.data() + comma + 1, nullptr, 10);
+			if (ESP_OK != smsRead(index))
+				ESP_LOGW(MODULE, "Message %u is not read, AT queue is full", index);
+			break;
+		}
+		default:
+			break;
+	}
+}
+
+// sms [send <number> <text>] | [read <index>]
+static int smsCommand(int argc, char **argv) {
+	if (4 <= argc && 0 == strcmp(argv[1], "send")) {
+		// console splits the text by spaces
+		std::string text = argv[3];
+		for (int i = 4; i < argc; ++i)
+			text.append(" ").append(argv[i]);
+		return smsSend(argv[2], text.c_str());
+	}
+	if (3 == argc && 0 == strcmp(argv[1], "read"))
+		return smsRead(strtoul(argv[2], nullptr, 10));
+	if (1 != argc)
+		return ESP_ERR_INVALID_ARG;
+
+	printf("%s: PDU mode %s, sent %" PRIu32 " parts, failed %" PRIu32 ", received %" PRIu32 " messages of %" PRIu32
+		   " parts\n", MODULE, smsIsPdu ? "on" : "off", smsSent.load(), smsFailed.load(), smsReceived.load(),
+		   smsPartsReceived.load());
+	return ESP_OK;
+}
+
+// Reference packer: a bit at a time
+static size_t benchPack(const uint8_t *septets, size_t count, uint8_t *octets) noexcept {
+	const size_t length = (count * 7 + 7) / 8;
+	memset(octets, 0, length);
+	for (size_t bit = 0; bit < count * 7; ++bit) {
+		if (0 != (septets[bit / 7] & (1u << (bit % 7))))
+			octets[bit / 8] |= 1u << (bit % 8);
+	}
+	return length;
+}
+
+// SMS-SUBMIT as the network delivers it: SMSC, first octet, the originating address, PID, DCS, timestamp and UD
+static size_t benchDeliver(const PduSubmit &part, char *hex) noexcept {
+	constexpr std::string_view smsc = "07911326040000F0";
+	constexpr std::string_view timestamp = "62016121436500";
+	const std::string_view submit = part.hex;
+	const bool isUdh = ('4' == submit[2]);
+	const size_t digits = strtoul(std::string(submit.substr(6, 2)).c_str(), nullptr, 16);
+	const size_t address = 2 * (2 + (digits + 1) / 2);
+
+	std::string pdu(smsc);
+	pdu.append(isUdh ? "44" : "04").append(submit.substr(6, address + 4)).append(timestamp);
+	pdu.append(submit.substr(6 + address + 4));
+	strcpy(hex, pdu.c_str());
+	return pdu.length();
+}
+
+// smsbench [count] - codec speed: septets packed/unpacked and messages encoded/decoded
+static int smsBench(int argc, char **argv) {
+	const int count = (1 < argc) ? atoi(argv[1]) : 10000;
+	if (2 < argc || count <= 0)
+		return ESP_ERR_INVALID_ARG;
+
+	uint8_t septets[pduSeptetsMax], unpacked[pduSeptetsMax], octets[pduUserDataMax], reference[pduUserDataMax];
+	for (size_t i = 0; i < pduSeptetsMax; ++i)
+		septets[i] = static_cast<uint8_t>((i * 37 + 11) & 0x7F);
+
+	volatile size_t sink = 0;	// keeps the loops
+	int64_t start = esp_timer_get_time();
+	for (int i = 0; i < count; ++i)
+		sink = sink + benchPack(septets, pduSeptetsMax, reference);
+	const int64_t bitwiseUs = esp_timer_get_time() - start;
+
+	start = esp_timer_get_time();
+	for (int i = 0; i < count; ++i)
+		sink = sink + pduPack(septets, pduSeptetsMax, octets);
+	const int64_t packUs = esp_timer_get_time() - start;
+
+	start = esp_timer_get_time();
+	for (int i = 0; i < count; ++i)
+		sink = sink + pduUnpack(octets, pduSeptetsMax, unpacked);
+	const int64_t unpackUs = esp_timer_get_time() - start;
+
+	const bool isPackOk = (0 == memcmp(octets, reference, pduUserDataMax));
+	const bool isUnpackOk = (0 == memcmp(septets, unpacked, pduSeptetsMax));
+	printf("%s: %d x %zu septets, pack %" PRId64 " ns (bitwise %" PRId64 " ns) %s, unpack %" PRId64 " ns %s\n", MODULE,
+		   count, pduSeptetsMax, packUs * 1000 / count, bitwiseUs * 1000 / count, isPackOk ? "ok" : "MISMATCH",
+		   unpackUs * 1000 / count, isUnpackOk ? "ok" : "MISMATCH");
+
+	// GSM with the extension table and UCS-2, 3 parts each
+	static const char *const texts[] = {
+		"Prices: 10{EUR} [~5%], see https://example.com/a|b?c=d^e and reply by 18:00 or call back later. "
+		"The quick brown fox jumps over the lazy dog 0123456789 times; @home $ ¥ è é ù ì ò Ç Ø ø Å å Δ _ Φ Γ Λ Ω Π Ψ "
+		"Σ Θ Ξ Æ æ ß É ¤ ¡ Ä Ö Ñ Ü § ¿ ä ö ñ ü à. Lorem ipsum dolor sit amet, consectetur adipiscing elit, sed do "
+		"eiusmod tempor incididunt ut labore et dolore magna aliqua.",
+		"Привет! Это длинное сообщение в UCS-2, оно не помещается в одну часть и делится на несколько. "
+		"Emoji 😀 не разрываются между частями. Съешь же ещё этих мягких французских булок да выпей чаю.",
+	};
+
+	PduSubmit *parts = new (std::nothrow) PduSubmit[pduPartsMax];
+	PduDeliver *message = new (std::nothrow) PduDeliver;
+	char *hex = new (std::nothrow) char[pduHexMax + 1];
+	esp_err_t result = (isPackOk && isUnpackOk) ? ESP_OK : ESP_FAIL;
+	if (nullptr == parts || nullptr == message || nullptr == hex)
+		result = ESP_ERR_NO_MEM;
+
+	const int messages = (count + 99) / 100;
+	for (size_t t = 0; ESP_OK == result && t < sizeof(texts) / sizeof(*texts); ++t) {
+		size_t total = 0;
+		start = esp_timer_get_time();
+		for (int i = 0; i < messages; ++i)
+			total = pduSubmit("+420123456789", texts[t], static_cast<uint8_t>(i), parts);
+		const int64_t submitUs = esp_timer_get_time() - start;
+
+		std::string joined;
+		int64_t deliverUs = 0;
+		for (size_t j = 0; j < total; ++j) {
+			const size_t length = benchDeliver(parts[j], hex);
+			start = esp_timer_get_time();
+			for (int i = 0; i < messages; ++i)
+				pduDeliver(std::string_view(hex, length), *message);
+			deliverUs += esp_timer_get_time() - start;
+			joined.append(message->text, message->length);
+		}
+
+		const bool isOk = (0 != total && joined == texts[t]);
+		printf("%s: %zu bytes %s in %zu parts, submit %" PRId64 " us, deliver %" PRId64 " us %s\n", MODULE,
+			   strlen(texts[t]), (0 != total && PduCoding::Ucs2 == message->coding) ? "UCS-2" : "GSM", total,
+			   submitUs / messages, deliverUs / messages, isOk ? "ok" : "MISMATCH");
+		if (!isOk)
+			result = ESP_FAIL;
+	}
+
+	delete[] hex;
+	delete message;
+	delete[] parts;
+	return result;
+}
+
+esp_err_t smsInit() noexcept {
+	smsLock = xSemaphoreCreateMutex();
+	smsFree = xSemaphoreCreateCounting(smsWindow, smsWindow);
+	if (nullptr == smsLock || nullptr == smsFree)
+		return ESP_ERR_NO_MEM;
+
+	for (const Urc urc : { Urc::SmsReady, Urc::Cmti }) {
+		const esp_err_t result = urcRegister(urc, &smsOnUrc);
+		if (ESP_OK != result)
+			return result;
+	}
+	const esp_err_t result = consoleAdd("sms", "SMS in PDU mode [send <number> <text>] [read <index>]", &smsCommand);
+	return (ESP_OK == result) ? consoleAdd("smsbench", "Measure SMS PDU codec [count]", &smsBench) : result;
+}
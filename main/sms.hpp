@@ -0,0 +1,56 @@
+// vim: tabstop=4 shiftwidth=4 noexpandtab colorcolumn=120 :
+// This file is part of the Sim800 (https://github.com/beranat/sim800).
+// Copyright (c) 2021 Anatoly L. Berenblit.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 3.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <freertos/FreeRTOS.h>
+#include <esp_err.h>
+
+#include "pdu.hpp"
+
+// SMS in PDU mode (AT+CMGF=0). Parts of outgoing messages are queued back to back, up to smsWindow AT+CMGS at once.
+// Incoming ones are announced by +CMTI (AT+CNMI=2,1), read by the index (AT+CMGR) and deleted, concatenated parts
+// are joined before the message is delivered.
+
+constexpr unsigned int smsWindow = 4;		// AT+CMGS in the AT queue
+constexpr size_t smsAssemblies = 2;			// concatenated messages received at once
+constexpr size_t smsTextMax = pduPartsMax * pduTextMax;
+
+struct SmsMessage {
+	const char *sender;
+	const char *timestamp;	// yy/MM/dd,hh:mm:ss+zz of the first part
+	PduCoding coding;
+	size_t length;
+	const char *text;		// UTF-8, zero terminated
+};
+
+struct SmsOutgoing {
+	const char *number;		// international with `+'
+	const char *text;		// UTF-8
+};
+
+// Message on the receiver task, valid only inside the call, must not block
+typedef void (*SmsCallback)(const SmsMessage &message, void *arg);
+
+// Returns when every part is accepted by the network, a part not queued in `wait' fails the rest (ESP_ERR_TIMEOUT)
+esp_err_t smsSend(const SmsOutgoing *messages, size_t count, TickType_t wait = portMAX_DELAY) noexcept;
+esp_err_t smsSend(const char *number, const char *text, TickType_t wait = portMAX_DELAY) noexcept;
+// nullptr - messages are printed
+esp_err_t smsRegister(SmsCallback callback, void *arg) noexcept;
+
+esp_err_t smsInit() noexcept;
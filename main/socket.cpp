@@ -0,0 +1,766 @@
+// vim: tabstop=4 shiftwidth=4 noexpandtab colorcolumn=120 :
+// This file is part of the Sim800 (https://github.com/beranat/sim800).
+// Copyright (c) 2021 Anatoly L. Berenblit.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 3.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+#include <atomic>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string_view>
+
+#include <esp_log.h>
+#include <esp_timer.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+
+#include "sdkconfig.h"
+
+#include "console.hpp"
+#include "dlog.hpp"
+#include "at.hpp"
+#include "urc.hpp"
+#include "sim.hpp"
+#include "socket.hpp"
+
+constexpr const char *MODULE = "socket";
+
+constexpr TickType_t socketCommandTimeout = pdMS_TO_TICKS(5000);
+constexpr TickType_t socketSendTimeout = pdMS_TO_TICKS(10000);
+constexpr TickType_t socketShutTimeout = pdMS_TO_TICKS(65000);
+constexpr TickType_t socketBearerTimeout = pdMS_TO_TICKS(85000);	// AT+CIICR
+constexpr TickType_t socketSchedulePoll = pdMS_TO_TICKS(100);		// AT queue was full
+constexpr TickType_t socketEchoWait = pdMS_TO_TICKS(300);
+
+// Smaller room is not worth a read command, the modem keeps the data meanwhile
+constexpr size_t socketPullMin = 256;
+
+struct Socket {
+	std::atomic<SocketState> state { SocketState::Closed };
+	SocketCallback callback = nullptr;
+	void *arg = nullptr;
+	SemaphoreHandle_t connected = nullptr;	// CONNECT OK/FAIL arrived
+	std::atomic<bool> isConnectOk { false };
+
+	// Send in progress (sendLock), segments are queued by the scheduler under scheduleLock
+	SemaphoreHandle_t sendLock = nullptr;
+	SemaphoreHandle_t sendDone = nullptr;	// all queued segments are completed
+	const uint8_t *tx = nullptr;
+	size_t txLength = 0;
+	size_t txOffset = 0;
+	unsigned int inFlight = 0;
+	bool isSendFailed = false;
+
+	// AT+CIPRXGET=2 is queued, more data arrived meanwhile (+CIPRXGET: 1), left in the modem after the read
+	std::atomic<bool> isPulling { false };
+	std::atomic<bool> isReadable { false };
+	size_t remaining = 0;
+
+	// single producer (receiver) ring of the buffered connection
+	std::atomic<size_t> head { 0 };
+	std::atomic<size_t> tail { 0 };
+	SemaphoreHandle_t readable = nullptr;
+	uint8_t ring[socketBuffer];
+
+	std::atomic<uint32_t> sent { 0 };
+	std::atomic<uint32_t> received { 0 };
+	std::atomic<uint32_t> dropped { 0 };	// pushed data over the full ring
+};
+
+static Socket sockets[socketMax];
+static SemaphoreHandle_t socketLock = nullptr;	// connect/close/bearer
+static std::atomic<bool> socketIsBearer = false;
+
+// Send window of all connections, served round robin. A single task runs the scheduler at a time (segments of
+// a connection are queued in order), others ask it for another pass
+static SemaphoreHandle_t scheduleLock = nullptr;
+static unsigned int scheduleInFlight = 0;
+static int scheduleNext = 0;
+static std::atomic<bool> scheduleIsRunning = false;
+static std::atomic<bool> scheduleIsAgain = false;
+
+class SocketGuard final {
+	SemaphoreHandle_t lock_;
+	public:
+		explicit SocketGuard(SemaphoreHandle_t lock) noexcept : lock_(lock) {
+			xSemaphoreTake(lock_, portMAX_DELAY);
+		}
+		~SocketGuard() {
+			xSemaphoreGive(lock_);
+		}
+};
+
+static Socket *socketOf(int id) noexcept {
+	return (0 <= id && id < socketMax) ? &sockets[id] : nullptr;
+}
+
+static int socketId(const Socket &socket) noexcept {
+	return static_cast<int>(&socket - sockets);
+}
+
+// Comma separated numbers of a response, returns the number parsed
+static size_t socketNumbers(std::string_view args, unsigned int *values, size_t count) noexcept {
+	size_t parsed = 0;
+	while (parsed < count && !args.empty()) {
+		while (!args.empty() && ' ' == args.front())
+			args.remove_prefix(1);
+		if (args.empty() || args.front() < '0' || '9' < args.front())
+			break;
+
+		unsigned int value = 0;
+		while (!args.empty() && '0' <= args.front() && args.front() <= '9') {
+			value = value * 10 + (args.front() - '0');
+			args.remove_prefix(1);
+		}
+		values[parsed++] = value;
+		if (!args.empty() && ',' == args.front())
+			args.remove_prefix(1);
+	}
+	return parsed;
+}
+
+static size_t socketFree(const Socket &socket) noexcept {
+	return socketBuffer - (socket.head.load(std::memory_order_acquire) - socket.tail.load(std::memory_order_acquire));
+}
+
+static void socketClosed(Socket &socket) noexcept {
+	if (SocketState::Closed == socket.state.exchange(SocketState::Closed))
+		return;
+	ESP_LOGI(MODULE, "%d closed, sent %" PRIu32 ", received %" PRIu32, socketId(socket), socket.sent.load(),
+			 socket.received.load());
+	if (nullptr != socket.callback)
+		socket.callback(socketId(socket), nullptr, 0, socket.arg);
+	else
+		xSemaphoreGive(socket.readable);
+}
+
+static void socketData(const uint8_t *data, size_t length, void *arg) noexcept {
+	Socket &socket = *reinterpret_cast<Socket *>(arg);
+	socket.received += length;
+	if (SocketState::Closed == socket.state.load())
+		return;
+	if (nullptr != socket.callback) {
+		socket.callback(socketId(socket), data, length, socket.arg);
+		return;
+	}
+
+	// pulled data always fits (read length is the free room), pushed one may not
+	const size_t room = socketFree(socket);
+	if (length > room) {
+		socket.dropped += length - room;
+		length = room;
+	}
+	const size_t head = socket.head.load(std::memory_order_relaxed);
+	for (size_t i = 0; i < length; ++i)
+		socket.ring[(head + i) % socketBuffer] = data[i];
+	socket.head.store(head + length, std::memory_order_release);
+	xSemaphoreGive(socket.readable);
+}
+
+static void socketPull(Socket &socket) noexcept;
+
+// +CIPRXGET: 2,<id>,<length>,<remaining> (the manual calls them reqlength/cnflength), data follows the line.
+// +CIPRXGET: 1,<id> is more data arrived.
+static void socketPullLine(std::string_view line, void *) noexcept {
+	size_t prefix = 0;
+	if (Urc::Ciprxget != urcClassify(line, &prefix))
+		return;
+
+	unsigned int values[4];
+	const size_t count = socketNumbers(line.substr(prefix), values, 4);
+	Socket *socket = (2 <= count) ? socketOf(values[1]) : nullptr;
+	if (nullptr == socket)
+		return;
+	if (1 == values[0])
+		socket->isReadable = true;
+	else if (4 == count && 2 == values[0]) {
+		socket->remaining = values[3];
+		if (!simExpect(values[2], &socketData, socket))
+			DLOG(Error, MODULE, "%d data block is not expected", socketId(*socket));
+	}
+}
+
+static void socketPullDone(AtResult result, int, void *arg) noexcept {
+	Socket &socket = *reinterpret_cast<Socket *>(arg);
+	socket.isPulling = false;
+	if (AtResult::Ok != result)
+		DLOG(Warn, MODULE, "%d receive %s", socketId(socket), atResultName(result));
+	else if (0 != socket.remaining)
+		socket.isReadable = true;
+
+	// +CIPRXGET: 1 of other connections might come as our lines
+	for (Socket &s : sockets) {
+		if (s.isReadable && !s.isPulling)
+			socketPull(s);
+	}
+}
+
+// Single read per connection is queued at a time, its completion queues the next one while the modem has data
+// and the connection has room for it
+void socketPull(Socket &socket) noexcept {
+	while (socket.isPulling.exchange(true)) {
+		// done callback checks the flag after it drops isPulling
+		socket.isReadable = true;
+		if (socket.isPulling)
+			return;
+	}
+
+	socket.isReadable = false;
+	if (SocketState::Closed == socket.state.load()) {
+		socket.isPulling = false;
+		return;
+	}
+
+	size_t length = socketMss;
+	if (nullptr == socket.callback) {
+		const size_t room = socketFree(socket);
+		if (room < socketPullMin) {
+			// socketRecv() pulls when it frees the ring, recheck the room it might free meanwhile
+			socket.isReadable = true;
+			socket.isPulling = false;
+			if (socketPullMin <= socketFree(socket) && socket.isReadable.exchange(false))
+				socketPull(socket);
+			return;
+		}
+		if (length > room)
+			length = room;
+	}
+
+	socket.remaining = 0;
+	AtRequest request;
+	snprintf(request.command, sizeof(request.command), "AT+CIPRXGET=2,%d,%zu", socketId(socket), length);
+	request.timeout = socketCommandTimeout;
+	request.onLine = &socketPullLine;
+	request.onDone = &socketPullDone;
+	request.arg = &socket;
+	if (ESP_OK != atSubmit(request, 0)) {
+		socket.isReadable = true;
+		socket.isPulling = false;
+		DLOG(Warn, MODULE, "%d receive is not queued", socketId(socket));
+	}
+}
+
+static void scheduleRun() noexcept;
+
+// Segment is done, its slot goes to the next connection
+static void socketSent(AtResult result, int, void *arg) noexcept {
+	Socket &socket = *reinterpret_cast<Socket *>(arg);
+	{
+		const SocketGuard guard(scheduleLock);
+		--scheduleInFlight;
+		if (AtResult::Ok != result)
+			socket.isSendFailed = true;
+		if (0 == --socket.inFlight && (socket.isSendFailed || socket.txOffset == socket.txLength))
+			xSemaphoreGive(socket.sendDone);
+	}
+	scheduleRun();
+}
+
+// Reserves the next segment under scheduleLock, false when the window is full or nothing is to send
+static bool scheduleNextSegment(AtRequest &request) noexcept {
+	const SocketGuard guard(scheduleLock);
+	if (scheduleInFlight >= socketWindow)
+		return false;
+
+	Socket *socket = nullptr;
+	for (int i = 0; i < socketMax && nullptr == socket; ++i) {
+		Socket &s = sockets[(scheduleNext + i) % socketMax];
+		if (s.txOffset < s.txLength && !s.isSendFailed)
+			socket = &s;
+	}
+	if (nullptr == socket)
+		return false;
+
+	const size_t left = socket->txLength - socket->txOffset;
+	const size_t segment = (left < socketMss) ? left : socketMss;
+	snprintf(request.command, sizeof(request.command), "AT+CIPSEND=%d,%zu", socketId(*socket), segment);
+	request.timeout = socketSendTimeout;
+	request.data = socket->tx + socket->txOffset;
+	request.dataLength = segment;
+	request.onDone = &socketSent;
+	request.arg = socket;
+
+	socket->txOffset += segment;
+	++socket->inFlight;
+	++scheduleInFlight;
+	return true;
+}
+
+// Segment is not queued, it is the last reserved one of the connection (single scheduler)
+static void scheduleRollback(const AtRequest &request) noexcept {
+	Socket &socket = *reinterpret_cast<Socket *>(request.arg);
+	const SocketGuard guard(scheduleLock);
+	socket.txOffset -= request.dataLength;
+	--scheduleInFlight;
+	if (0 == --socket.inFlight && socket.isSendFailed)
+		xSemaphoreGive(socket.sendDone);
+}
+
+// Queues segments while the window has room, a connection at a time from the one after the last served.
+// Requests are submitted w/o scheduleLock: the engine may complete a failed one (socketSent) right in atSubmit.
+void scheduleRun() noexcept {
+	scheduleIsAgain = true;
+	while (scheduleIsAgain.load() && !scheduleIsRunning.exchange(true)) {
+		scheduleIsAgain = false;
+
+		AtRequest request;
+		while (scheduleNextSegment(request)) {
+			Socket &socket = *reinterpret_cast<Socket *>(request.arg);
+			if (ESP_OK != atSubmit(request, 0)) {
+				scheduleRollback(request);
+				break;	// sender polls
+			}
+			socket.sent += request.dataLength;
+			scheduleNext = (socketId(socket) + 1) % socketMax;
+		}
+		scheduleIsRunning = false;
+	}
+}
+
+// Whether the send is over: everything is acked or it failed and nothing is in flight
+static bool scheduleCancel(Socket &socket) noexcept {
+	const SocketGuard guard(scheduleLock);
+	socket.isSendFailed = true;
+	return 0 == socket.inFlight;
+}
+
+static void socketOnUrc(Urc urc, std::string_view line, std::string_view args, void *) noexcept {
+	switch (urc) {
+		case Urc::Ciprxget: {
+			unsigned int values[2];
+			Socket *socket = (2 == socketNumbers(args, values, 2) && 1 == values[0]) ? socketOf(values[1]) : nullptr;
+			if (nullptr != socket)
+				socketPull(*socket);
+			break;
+		}
+		case Urc::Receive: {
+			// +RECEIVE,<id>,<length>: and the data
+			unsigned int values[2];
+			Socket *socket = (2 == socketNumbers(args, values, 2)) ? socketOf(values[0]) : nullptr;
+			if (nullptr != socket && !simExpect(values[1], &socketData, socket))
+				DLOG(Error, MODULE, "%d data block is not expected", socketId(*socket));
+			break;
+		}
+		case Urc::Connection: {
+			Socket &socket = sockets[line[0] - '0'];
+			if ("CONNECT OK" == args || "ALREADY CONNECT" == args || "CONNECT FAIL" == args) {
+				socket.isConnectOk = ("CONNECT FAIL" != args);
+				xSemaphoreGive(socket.connected);
+			} else if ("CLOSED" == args)
+				socketClosed(socket);
+			break;
+		}
+		case Urc::PdpDeact:
+			ESP_LOGW(MODULE, "Bearer is deactivated");
+			socketIsBearer = false;
+			for (Socket &s : sockets)
+				socketClosed(s);
+			break;
+		default:
+			break;
+	}
+}
+
+// Multiple connections, pulled (pushed) receive, quick send and the PDP context (IP INITIAL -> IP GPRSACT ->
+// IP STATUS)
+static bool socketBearer() noexcept {
+	if (socketIsBearer)
+		return true;
+
+	char apn[atCommandMax];
+	snprintf(apn, sizeof(apn), "AT+CSTT=\"%s\"", CONFIG_SIM800_APN);
+	const struct {
+		const char *command;
+		TickType_t timeout;
+	} steps[] = {
+		{ "AT+CIPSHUT", socketShutTimeout },
+		{ "AT+CIPMUX=1", socketCommandTimeout },
+#if CONFIG_SIM800_SOCKET_PUSH
+		{ "AT+CIPRXGET=0", socketCommandTimeout },
+#else
+		{ "AT+CIPRXGET=1", socketCommandTimeout },
+#endif
+		{ "AT+CIPQSEND=1", socketCommandTimeout },
+		{ apn, socketCommandTimeout },
+		{ "AT+CIICR", socketBearerTimeout },
+	};
+	for (const auto &step : steps) {
+		if (AtResult::Ok != atCommand(step.command, nullptr, step.timeout)) {
+			ESP_LOGE(MODULE, "Bearer %s failed", step.command);
+			return false;
+		}
+	}
+
+	// local address is the only line of the answer, the modem needs the query before AT+CIPSTART
+	AtResponse response;
+	AtRequest request;
+	strcpy(request.command, "AT+CIFSR");
+	request.response = &response;
+	request.isLineResult = true;
+	if (AtResult::Ok != atCommand(request) || 0 == response.lines) {
+		ESP_LOGE(MODULE, "Bearer has no address");
+		return false;
+	}
+
+	ESP_LOGI(MODULE, "Bearer is up, %s", response.text);
+	socketIsBearer = true;
+	return true;
+}
+
+SocketState socketState(int id) noexcept {
+	const Socket *socket = socketOf(id);
+	return (nullptr != socket) ? socket->state.load() : SocketState::Closed;
+}
+
+esp_err_t socketConnect(SocketType type, const char *host, uint16_t port, SocketCallback callback, void *arg,
+						int *id) noexcept {
+	if (nullptr == host)
+		return ESP_ERR_INVALID_ARG;
+
+	Socket *socket = nullptr;
+	char command[atCommandMax];
+	{
+		const SocketGuard guard(socketLock);
+		for (Socket &s : sockets) {
+			if (SocketState::Closed == s.state.load()) {
+				socket = &s;
+				break;
+			}
+		}
+		if (nullptr == socket)
+			return ESP_ERR_NO_MEM;
+		if (!socketBearer())
+			return ESP_FAIL;
+
+		const int length = snprintf(command, sizeof(command), "AT+CIPSTART=%d,\"%s\",\"%s\",%u", socketId(*socket),
+									(SocketType::Udp == type) ? "UDP" : "TCP", host, port);
+		if (length < 0 || sizeof(command) <= static_cast<size_t>(length))
+			return ESP_ERR_INVALID_ARG;
+
+		socket->callback = callback;
+		socket->arg = arg;
+		socket->sent = 0;
+		socket->received = 0;
+		socket->dropped = 0;
+		socket->isPulling = false;
+		socket->isReadable = false;
+		socket->head = 0;
+		socket->tail = 0;
+		socket->isConnectOk = false;
+		xSemaphoreTake(socket->connected, 0);
+		xSemaphoreTake(socket->readable, 0);
+		socket->state = SocketState::Connecting;
+	}
+
+	// connections are set up in parallel, the slot is ours
+	const int n = socketId(*socket);
+	if (AtResult::Ok != atCommand(command, nullptr, socketCommandTimeout) ||
+			pdTRUE != xSemaphoreTake(socket->connected, socketConnectTimeout) || !socket->isConnectOk) {
+		ESP_LOGW(MODULE, "%d %s:%u connect failed", n, host, port);
+		snprintf(command, sizeof(command), "AT+CIPCLOSE=%d", n);
+		atCommand(command, nullptr, socketCommandTimeout);
+		socket->state = SocketState::Closed;
+		return ESP_FAIL;
+	}
+
+	socket->state = SocketState::Connected;
+	if (nullptr != id)
+		*id = n;
+	ESP_LOGI(MODULE, "%d connected to %s:%u", n, host, port);
+	return ESP_OK;
+}
+
+esp_err_t socketSend(int id, const void *data, size_t length, TickType_t wait) noexcept {
+	Socket *socket = socketOf(id);
+	if (nullptr == socket || (nullptr == data && 0 != length))
+		return ESP_ERR_INVALID_ARG;
+
+	const SocketGuard guard(socket->sendLock);
+	if (SocketState::Connected != socket->state.load())
+		return ESP_ERR_INVALID_STATE;
+	if (0 == length)
+		return ESP_OK;
+
+	{
+		const SocketGuard schedule(scheduleLock);
+		socket->tx = reinterpret_cast<const uint8_t *>(data);
+		socket->txLength = length;
+		socket->txOffset = 0;
+		socket->isSendFailed = false;
+		xSemaphoreTake(socket->sendDone, 0);
+	}
+
+	// the engine completes every request, sendDone comes when the last queued segment is done
+	esp_err_t result = ESP_OK;
+	const TickType_t start = xTaskGetTickCount();
+	while (true) {
+		scheduleRun();
+		if (pdTRUE == xSemaphoreTake(socket->sendDone, socketSchedulePoll))
+			break;
+		if (SocketState::Connected != socket->state.load())
+			result = ESP_FAIL;
+		else if (portMAX_DELAY != wait && xTaskGetTickCount() - start >= wait)
+			result = ESP_ERR_TIMEOUT;
+		else
+			continue;
+
+		if (!scheduleCancel(*socket))
+			xSemaphoreTake(socket->sendDone, portMAX_DELAY);
+		break;
+	}
+
+	{
+		const SocketGuard schedule(scheduleLock);
+		if (ESP_OK == result && socket->isSendFailed)
+			result = ESP_FAIL;
+		socket->tx = nullptr;
+		socket->txLength = 0;
+		socket->txOffset = 0;
+	}
+
+	if (ESP_OK != result)
+		ESP_LOGW(MODULE, "%d send %zu error %s", id, length, esp_err_to_name(result));
+	return result;
+}
+
+int socketRecv(int id, void *data, size_t length, TickType_t wait) noexcept {
+	Socket *socket = socketOf(id);
+	if (nullptr == socket || nullptr != socket->callback)
+		return -1;
+
+	size_t tail = socket->tail.load(std::memory_order_relaxed);
+	size_t available = socket->head.load(std::memory_order_acquire) - tail;
+	while (0 == available) {
+		if (SocketState::Closed == socket->state.load())
+			return -1;
+		if (pdTRUE != xSemaphoreTake(socket->readable, wait))
+			return 0;
+		available = socket->head.load(std::memory_order_acquire) - tail;
+	}
+
+	if (length > available)
+		length = available;
+	uint8_t *bytes = reinterpret_cast<uint8_t *>(data);
+	for (size_t i = 0; i < length; ++i)
+		bytes[i] = socket->ring[(tail + i) % socketBuffer];
+	socket->tail.store(tail + length, std::memory_order_release);
+
+	// the modem holds what did not fit
+	if (socketPullMin <= socketFree(*socket) && socket->isReadable.exchange(false))
+		socketPull(*socket);
+	return static_cast<int>(length);
+}
+
+esp_err_t socketClose(int id) noexcept {
+	Socket *socket = socketOf(id);
+	if (nullptr == socket)
+		return ESP_ERR_INVALID_ARG;
+
+	const SocketGuard guard(socketLock);
+	if (SocketState::Closed == socket->state.load())
+		return ESP_OK;
+
+	char command[atCommandMax];
+	snprintf(command, sizeof(command), "AT+CIPCLOSE=%d", id);
+	const AtResult result = atCommand(command, nullptr, socketCommandTimeout);
+	socketClosed(*socket);
+	return (AtResult::Ok == result) ? ESP_OK : ESP_FAIL;
+}
+
+static const char *socketStateName(SocketState state) noexcept {
+	switch (state) {
+		case SocketState::Closed:
+			return "closed";
+		case SocketState::Connecting:
+			return "connecting";
+		case SocketState::Connected:
+			return "connected";
+	}
+	return "unknown";
+}
+
+// Text to the connection and what comes back in a while
+static int socketCommandSend(int id, const char *text) {
+	const esp_err_t result = socketSend(id, text, strlen(text), socketSendTimeout);
+	if (ESP_OK != result)
+		return result;
+
+	char buffer[128];
+	int length;
+	while (0 < (length = socketRecv(id, buffer, sizeof(buffer), socketEchoWait)))
+		fwrite(buffer, 1, length, stdout);
+	printf("\n");
+	return ESP_OK;
+}
+
+// Connections of the bench send the same stream at once and read the echo back
+struct Bench {
+	int id;
+	size_t length;
+	int64_t sentUs;		// till the last segment is acked
+	int64_t echoedUs;
+	size_t mismatches;
+	esp_err_t result;
+	SemaphoreHandle_t done;
+};
+
+constexpr size_t benchBlock = socketWindow * socketMss;
+constexpr TickType_t benchEchoTimeout = pdMS_TO_TICKS(30000);
+
+static uint8_t benchByte(size_t offset) noexcept {
+	return static_cast<uint8_t>(offset % 251);
+}
+
+static void benchTask(void *arg) noexcept {
+	Bench &bench = *reinterpret_cast<Bench *>(arg);
+	uint8_t block[benchBlock];
+	for (size_t i = 0; i < sizeof(block); ++i)
+		block[i] = benchByte(i);
+
+	const int64_t start = esp_timer_get_time();
+	for (size_t offset = 0; ESP_OK == bench.result && offset < bench.length; offset += sizeof(block)) {
+		const size_t length = (bench.length - offset < sizeof(block)) ? bench.length - offset : sizeof(block);
+		bench.result = socketSend(bench.id, block, length);
+	}
+	bench.sentUs = esp_timer_get_time() - start;
+
+	// stream offsets are block offsets, the echo of a short last block is short too
+	size_t received = 0;
+	while (ESP_OK == bench.result && received < bench.length) {
+		const int length = socketRecv(bench.id, block, sizeof(block), benchEchoTimeout);
+		if (length <= 0) {
+			bench.result = (0 == length) ? ESP_ERR_TIMEOUT : ESP_FAIL;
+			break;
+		}
+		for (int i = 0; i < length; ++i, ++received) {
+			if (block[i] != benchByte(received % benchBlock))
+				++bench.mismatches;
+		}
+	}
+	bench.echoedUs = esp_timer_get_time() - start;
+
+	xSemaphoreGive(bench.done);
+	vTaskDelete(nullptr);
+}
+
+// socket bench <host> <port> <connections> <bytes>
+static int socketBench(const char *host, uint16_t port, int connections, size_t length) {
+	if (connections < 1 || socketMax < connections || 0 == length)
+		return ESP_ERR_INVALID_ARG;
+
+	Bench benches[socketMax];
+	SemaphoreHandle_t done = xSemaphoreCreateCounting(socketMax, 0);
+	if (nullptr == done)
+		return ESP_ERR_NO_MEM;
+
+	int started = 0;
+	esp_err_t result = ESP_OK;
+	for (; ESP_OK == result && started < connections; ++started) {
+		Bench &bench = benches[started];
+		bench = Bench { -1, length, 0, 0, 0, ESP_OK, done };
+		result = socketConnect(SocketType::Tcp, host, port, nullptr, nullptr, &bench.id);
+		if (ESP_OK != result)
+			break;
+	}
+
+	const int64_t start = esp_timer_get_time();
+	int running = 0;
+	for (; ESP_OK == result && running < started; ++running) {
+		if (pdPASS != xTaskCreate(&benchTask, "socketbench", 4096 + benchBlock, &benches[running], 5, nullptr))
+			result = ESP_ERR_NO_MEM;
+	}
+	for (int i = 0; i < running; ++i)
+		xSemaphoreTake(done, portMAX_DELAY);
+	const int64_t us = esp_timer_get_time() - start;
+
+	for (int i = 0; i < started; ++i) {
+		const Bench &bench = benches[i];
+		if (i < running) {
+			printf("  %d: %zu bytes sent %" PRId64 " ms, echoed %" PRId64 " ms, %zu mismatches, %s\n", bench.id,
+				   bench.length, bench.sentUs / 1000, bench.echoedUs / 1000, bench.mismatches,
+				   esp_err_to_name(bench.result));
+			if (ESP_OK == result)
+				result = bench.result;
+		}
+		socketClose(bench.id);
+	}
+	vSemaphoreDelete(done);
+
+	if (0 != running && 0 < us) {
+		const int64_t bytes = static_cast<int64_t>(length) * running;
+		printf("%s: %d connections, %" PRId64 " bytes each way in %" PRId64 " ms, %" PRId64 " B/s\n", MODULE, running,
+			   bytes, us / 1000, bytes * 1000000 / us);
+	}
+	return result;
+}
+
+// socket [connect tcp|udp <host> <port>] | [send <id> <text>] | [close <id>] |
+//        [bench <host> <port> <connections> <bytes>]
+static int socketCommand(int argc, char **argv) {
+	if (5 == argc && 0 == strcmp(argv[1], "connect")) {
+		const bool isUdp = (0 == strcmp(argv[2], "udp"));
+		if (!isUdp && 0 != strcmp(argv[2], "tcp"))
+			return ESP_ERR_INVALID_ARG;
+
+		int id = -1;
+		const esp_err_t result = socketConnect(isUdp ? SocketType::Udp : SocketType::Tcp, argv[3],
+											   static_cast<uint16_t>(atoi(argv[4])), nullptr, nullptr, &id);
+		if (ESP_OK == result)
+			printf("%s: %d\n", MODULE, id);
+		return result;
+	}
+	if (4 == argc && 0 == strcmp(argv[1], "send"))
+		return socketCommandSend(atoi(argv[2]), argv[3]);
+	if (3 == argc && 0 == strcmp(argv[1], "close"))
+		return socketClose(atoi(argv[2]));
+	if (6 == argc && 0 == strcmp(argv[1], "bench"))
+		return socketBench(argv[2], static_cast<uint16_t>(atoi(argv[3])), atoi(argv[4]), strtoul(argv[5], nullptr, 0));
+	if (1 != argc)
+		return ESP_ERR_INVALID_ARG;
+
+	printf("%s: bearer %s\n", MODULE, socketIsBearer ? "up" : "down");
+	for (const Socket &socket : sockets) {
+		printf("  %d %s, sent %" PRIu32 ", received %" PRIu32 ", buffered %zu, dropped %" PRIu32 "\n",
+			   socketId(socket), socketStateName(socket.state.load()), socket.sent.load(), socket.received.load(),
+			   socket.head.load() - socket.tail.load(), socket.dropped.load());
+	}
+	return ESP_OK;
+}
+
+esp_err_t socketInit() noexcept {
+	socketLock = xSemaphoreCreateMutex();
+	scheduleLock = xSemaphoreCreateMutex();
+	if (nullptr == socketLock || nullptr == scheduleLock)
+		return ESP_ERR_NO_MEM;
+
+	for (Socket &socket : sockets) {
+		socket.sendLock = xSemaphoreCreateMutex();
+		socket.sendDone = xSemaphoreCreateBinary();
+		socket.connected = xSemaphoreCreateBinary();
+		socket.readable = xSemaphoreCreateBinary();
+		if (nullptr == socket.sendLock || nullptr == socket.sendDone || nullptr == socket.connected ||
+				nullptr == socket.readable)
+			return ESP_ERR_NO_MEM;
+	}
+
+	for (const Urc urc : { Urc::Ciprxget, Urc::Receive, Urc::Connection, Urc::PdpDeact }) {
+		const esp_err_t result = urcRegister(urc, &socketOnUrc);
+		if (ESP_OK != result)
+			return result;
+	}
+	return consoleAdd("socket", "Modem TCP/UDP connections [connect tcp|udp <host> <port>] [send <id> <text>] "
+					  "[close <id>] [bench <host> <port> <connections> <bytes>]", &socketCommand);
+}
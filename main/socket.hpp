@@ -0,0 +1,62 @@
+// vim: tabstop=4 shiftwidth=4 noexpandtab colorcolumn=120 :
+// This file is part of the Sim800 (https://github.com/beranat/sim800).
+// Copyright (c) 2021 Anatoly L. Berenblit.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 3.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <freertos/FreeRTOS.h>
+#include <esp_err.h>
+
+// Connections of the modem IP stack (AT+CIPMUX=1, AT+CIPSTART) over the AT channel. Sends are split into socketMss
+// segments, up to socketWindow of them (of all connections, round robin) are queued at once and the modem acks them
+// into its buffer (AT+CIPQSEND=1) instead of waiting for the peer. Received data is pulled (AT+CIPRXGET) while the
+// connection has room for it (the modem holds the rest, TCP window closes) or pushed (+RECEIVE, SIM800_SOCKET_PUSH),
+// the callback gets it straight from the receive ring.
+
+constexpr int socketMax = 6;				// SIM800 connections 0..5
+constexpr size_t socketMss = 1460;			// AT+CIPSEND and AT+CIPRXGET=2 limit
+constexpr size_t socketBuffer = 2048;		// receive ring of a connection w/o callback
+constexpr unsigned int socketWindow = 4;	// segments in the AT queue
+constexpr TickType_t socketConnectTimeout = pdMS_TO_TICKS(75000);
+
+enum class SocketType : uint8_t {
+	Tcp,
+	Udp,
+};
+
+enum class SocketState : uint8_t {
+	Closed,
+	Connecting,
+	Connected,
+};
+
+// Data on the receiver task, valid only inside the call, must not block. nullptr/0 - the connection is closed.
+typedef void (*SocketCallback)(int id, const uint8_t *data, size_t length, void *arg);
+
+// Brings the GPRS bearer up (AT+CSTT with CONFIG_SIM800_APN, AT+CIICR) on the first use.
+// Callback gets the data, otherwise it is buffered for socketRecv().
+esp_err_t socketConnect(SocketType type, const char *host, uint16_t port, SocketCallback callback, void *arg,
+						int *id) noexcept;
+// Returns when all the data is accepted by the modem, data must be valid till then. Segments not queued in `wait'
+// are dropped (ESP_ERR_TIMEOUT).
+esp_err_t socketSend(int id, const void *data, size_t length, TickType_t wait = portMAX_DELAY) noexcept;
+// Returns received length (0 on timeout) or -1 if the connection is closed and nothing is left
+int socketRecv(int id, void *data, size_t length, TickType_t wait) noexcept;
+esp_err_t socketClose(int id) noexcept;
+SocketState socketState(int id) noexcept;
+
+esp_err_t socketInit() noexcept;
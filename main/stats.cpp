@@ -0,0 +1,156 @@
+// vim: tabstop=4 shiftwidth=4 noexpandtab colorcolumn=120 :
+// This file is part of the Sim800 (https://github.com/beranat/sim800).
+// Copyright (c) 2021 Anatoly L. Berenblit.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 3.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <esp_log.h>
+#include <esp_timer.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include "console.hpp"
+#include "stats.hpp"
+
+constexpr const char *MODULE = "stats";
+
+constexpr unsigned int streamStackSize = 3072;
+constexpr UBaseType_t streamPriority = tskIDLE_PRIORITY + 1;
+constexpr uint32_t streamPeriodMinMs = 100;
+
+static const char *const counterNames[] = {
+	"recv bytes", "send bytes", "lines", "lines truncated", "recv flushes", "parse errors", "uart overflows",
+	"uart errors", "nvs reads", "nvs writes", "nvs commits", "mux frames", "mux errors",
+};
+static_assert(sizeof(counterNames) / sizeof(counterNames[0]) == static_cast<size_t>(StatsCounter::Count));
+
+static const char *const histogramNames[] = {"at command", "console"};
+static_assert(sizeof(histogramNames) / sizeof(histogramNames[0]) == static_cast<size_t>(StatsHistogram::Count));
+
+struct Histogram {
+	std::atomic<uint32_t> buckets[statsBuckets];
+	std::atomic<uint32_t> count;
+	std::atomic<uint32_t> sumUs;	// wraps after 71 minutes of summary latency, `stats reset'
+	std::atomic<uint32_t> maxUs;
+};
+
+std::atomic<uint32_t> statsCounters[static_cast<size_t>(StatsCounter::Count)] = {};
+static Histogram histograms[static_cast<size_t>(StatsHistogram::Count)] = {};
+static std::atomic<int64_t> resetTime = 0;	// us, written by console only
+
+static TaskHandle_t streamHandle = nullptr;
+static std::atomic<uint32_t> streamPeriodMs = 0;
+
+void statsRecord(StatsHistogram histogram, int64_t us) noexcept {
+	Histogram &h = histograms[static_cast<size_t>(histogram)];
+	const uint32_t value = (us < 0) ? 0 : (us > UINT32_MAX) ? UINT32_MAX : static_cast<uint32_t>(us);
+
+	size_t bucket = 0;
+	while (bucket < statsBuckets - 1 && value > statsBucketsUs[bucket])
+		++bucket;
+	h.buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+	h.count.fetch_add(1, std::memory_order_relaxed);
+	h.sumUs.fetch_add(value, std::memory_order_relaxed);
+
+	uint32_t max = h.maxUs.load(std::memory_order_relaxed);
+	while (value > max && !h.maxUs.compare_exchange_weak(max, value, std::memory_order_relaxed))
+		;
+}
+
+void statsReset() noexcept {
+	for (auto &counter : statsCounters)
+		counter.store(0, std::memory_order_relaxed);
+	for (auto &h : histograms) {
+		for (auto &bucket : h.buckets)
+			bucket.store(0, std::memory_order_relaxed);
+		h.count.store(0, std::memory_order_relaxed);
+		h.sumUs.store(0, std::memory_order_relaxed);
+		h.maxUs.store(0, std::memory_order_relaxed);
+	}
+	resetTime = esp_timer_get_time();
+}
+
+static void statsDump() noexcept {
+	printf("%s: %" PRId64 " ms\n", MODULE, (esp_timer_get_time() - resetTime.load()) / 1000);
+	for (size_t i = 0; i < static_cast<size_t>(StatsCounter::Count); ++i)
+		printf("  %-16s %" PRIu32 "\n", counterNames[i], statsCounters[i].load(std::memory_order_relaxed));
+
+	for (size_t i = 0; i < static_cast<size_t>(StatsHistogram::Count); ++i) {
+		const Histogram &h = histograms[i];
+		const uint32_t count = h.count.load(std::memory_order_relaxed);
+		printf("  %-16s %" PRIu32, histogramNames[i], count);
+		if (0 == count) {
+			printf("\n");
+			continue;
+		}
+		printf(", avg %" PRIu32 " max %" PRIu32 " us\n   ", h.sumUs.load(std::memory_order_relaxed) / count,
+			   h.maxUs.load(std::memory_order_relaxed));
+		for (size_t bucket = 0; bucket < statsBuckets; ++bucket) {
+			const uint32_t value = h.buckets[bucket].load(std::memory_order_relaxed);
+			if (0 == value)
+				continue;
+			if (bucket < statsBuckets - 1)
+				printf(" <=%" PRIu32 "us:%" PRIu32, statsBucketsUs[bucket], value);
+			else
+				printf(" >%" PRIu32 "us:%" PRIu32, statsBucketsUs[bucket - 1], value);
+		}
+		printf("\n");
+	}
+}
+
+static void streamTask(void *) {
+	for (;;) {
+		const uint32_t period = streamPeriodMs.load();
+		ulTaskNotifyTake(pdTRUE, (0 != period) ? pdMS_TO_TICKS(period) : portMAX_DELAY);
+		if (0 != streamPeriodMs.load())
+			statsDump();
+	}
+}
+
+// stats [reset|stop|<period ms>]
+static int statsCommand(int argc, char **argv) {
+	if (1 == argc) {
+		statsDump();
+		return ESP_OK;
+	}
+	if (2 != argc)
+		return ESP_ERR_INVALID_ARG;
+
+	if (0 == strcmp(argv[1], "reset"))
+		statsReset();
+	else if (0 == strcmp(argv[1], "stop"))
+		streamPeriodMs = 0;
+	else {
+		char *end = nullptr;
+		const unsigned long period = strtoul(argv[1], &end, 10);
+		if (end == argv[1] || '\0' != *end || period < streamPeriodMinMs)
+			return ESP_ERR_INVALID_ARG;
+		streamPeriodMs = period;
+	}
+	xTaskNotifyGive(streamHandle);
+	return ESP_OK;
+}
+
+esp_err_t statsInit() noexcept {
+	resetTime = esp_timer_get_time();
+	if (pdPASS != xTaskCreate(streamTask, "stats", streamStackSize, nullptr, streamPriority, &streamHandle)) {
+		ESP_LOGE(MODULE, "Task create error");
+		return ESP_ERR_NO_MEM;
+	}
+	return consoleAdd("stats", "Runtime counters and latencies [reset|stop|<period ms>]", &statsCommand);
+}
@@ -0,0 +1,67 @@
+// vim: tabstop=4 shiftwidth=4 noexpandtab colorcolumn=120 :
+// This file is part of the Sim800 (https://github.com/beranat/sim800).
+// Copyright (c) 2021 Anatoly L. Berenblit.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 3.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include <esp_err.h>
+
+// Runtime counters and latency histograms (`stats' console command), relaxed 32-bit atomics - cheap from any task
+
+enum class StatsCounter : uint8_t {
+	RecvBytes,
+	SendBytes,
+	Lines,
+	LinesTruncated,
+	RecvFlushes,
+	ParseErrors,
+	UartOverflows,
+	UartErrors,
+	NvsReads,
+	NvsWrites,
+	NvsCommits,
+	MuxFrames,
+	MuxErrors,
+	Count,
+};
+
+enum class StatsHistogram : uint8_t {
+	AtCommand,	// command sent to final result
+	Console,	// console command run
+	Count,
+};
+
+// Upper bucket bounds, the last bucket is unbounded
+constexpr uint32_t statsBucketsUs[] = {
+	250, 500, 1000, 2000, 5000, 10000, 20000, 50000, 100000, 200000, 500000, 1000000, 2000000, 5000000,
+};
+constexpr size_t statsBuckets = sizeof(statsBucketsUs) / sizeof(statsBucketsUs[0]) + 1;
+
+extern std::atomic<uint32_t> statsCounters[static_cast<size_t>(StatsCounter::Count)];
+
+esp_err_t statsInit() noexcept;
+void statsReset() noexcept;
+void statsRecord(StatsHistogram histogram, int64_t us) noexcept;
+
+inline void statsAdd(StatsCounter counter, uint32_t value = 1) noexcept {
+	statsCounters[static_cast<size_t>(counter)].fetch_add(value, std::memory_order_relaxed);
+}
+
+inline uint32_t statsGet(StatsCounter counter) noexcept {
+	return statsCounters[static_cast<size_t>(counter)].load(std::memory_order_relaxed);
+}
@@ -13,14 +13,24 @@
 //
 // You should have received a copy of the GNU General Public License
 // along with this program. If not, see <http://www.gnu.org/licenses/>.
+#include <cassert>
 #include <cstring>
+#include <cstddef>
 
 #include <atomic>
 #include <string>
 
 #include <esp_log.h>
+#include <esp_crc.h>
+#include <esp_system.h>
 #include <nvs_flash.h>
 
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+
+#include "dlog.hpp"
+#include "stats.hpp"
 #include "storage.hpp"
 constexpr const char *MODULE = "STORAGE";
 
@@ -121,36 +131,54 @@ Subsystem &Subsystem::getInstance() noexcept {
 	return instance;
 }
 
-} // namespace
+struct SnapshotHeader {
+	uint16_t version;
+	uint16_t length;	// payload
+	uint32_t crc;	// header (crc is zero) and payload
+};
 
-template <class T> T get(nvs_handle_t handle, const char *name, T def, esp_err_t (*fn)(nvs_handle_t, const char *,
-						 T *)) noexcept {
-	T value;
-	const esp_err_t result = fn(handle, name, &value);
-	if (ESP_OK == result) {
-		ESP_LOGI(MODULE, "Storage get %s", name);
-		return value;
-	}
+uint32_t snapshotCrc(SnapshotHeader header, const void *payload) noexcept {
+	header.crc = 0;
+	const uint32_t crc = esp_crc32_le(0, reinterpret_cast<const uint8_t *>(&header), sizeof(header));
+	return esp_crc32_le(crc, reinterpret_cast<const uint8_t *>(payload), header.length);
+}
 
-	ESP_LOGI(MODULE, "Storage get %s - %d", name, static_cast<int>(result));
-	if (ESP_ERR_NVS_NOT_FOUND == result)
-		return def;
+// String (or its absence) in the NVS manner: empty when the buffer is short, length w/o terminator is returned
+size_t copyString(char *value, size_t size, std::string_view source) noexcept {
+	if (source.length() < size) {
+		memmove(value, source.data(), source.length());	// default may be the buffer itself
+		value[source.length()] = '\0';
+	} else if (0 != size)
+		value[0] = '\0';
+	return source.length();
+}
 
-	ESP_LOGW(MODULE, "Storage get `%s' error %s (%d)", name,  esp_err_to_name(result), static_cast<int>(result));
-	return def;
+// Runtime name + "-float", empty if it is too long
+void floatKey(const char *name, char (&key)[storageKeyMax + 1]) noexcept {
+	const size_t length = strlen(name);
+	if (length + sizeof(storageFloatSuffix) > sizeof(key)) {
+		ESP_LOGW(MODULE, "Storage key `%s%s' is too long", name, storageFloatSuffix);
+		key[0] = '\0';
+		return;
+	}
+	memcpy(key, name, length);
+	memcpy(key + length, storageFloatSuffix, sizeof(storageFloatSuffix));
 }
 
-template <class T> bool set(nvs_handle_t handle, const char *name, const T &value, esp_err_t (*fn)(nvs_handle_t,
-							const char *, T)) noexcept {
-	ESP_LOGI(MODULE, "Save %s", name);
+class Guard final {
+	SemaphoreHandle_t lock_;
 
-	const esp_err_t result = fn(handle, name, value);
-	if (ESP_OK == result)
-		return true;
+public:
+	explicit Guard(SemaphoreHandle_t lock) noexcept : lock_(lock) {
+		xSemaphoreTake(lock_, portMAX_DELAY);
+	}
 
-	ESP_LOGW(MODULE, "Storage set `%s' error %s (%d)", name,  esp_err_to_name(result), static_cast<int>(result));
-	return false;
-}
+	~Guard() noexcept {
+		xSemaphoreGive(lock_);
+	}
+};
+
+} // namespace
 
 Storage &Storage::getInstance() noexcept {
 	static Storage instance;
@@ -161,11 +189,19 @@ Storage::Storage() noexcept {
 	if (!++Subsystem::getInstance())
 		return;
 
+	lock_ = xSemaphoreCreateMutex();
+	if (nullptr == lock_ || pdPASS != xTaskCreate(&flushTask, "storage", flushStack, this, flushPriority, &task_)) {
+		--Subsystem::getInstance();
+		ESP_LOGE(MODULE, "Cache init error");
+		return;
+	}
+
 	nvs_handle_t handle;
 	const esp_err_t open = nvs_open(MODULE, NVS_READWRITE, &handle);
 	if (ESP_OK == open) {
 		isValid_ = true;
 		handle_ = handle;
+		esp_register_shutdown_handler(&onShutdown);
 	} else {
 		--Subsystem::getInstance();
 		ESP_LOGE(MODULE, "Open error %s (%d)", esp_err_to_name(open), static_cast<int>(open));
@@ -175,126 +211,459 @@ Storage::Storage() noexcept {
 
 Storage::~Storage() noexcept {
 	if (isValid_) {
-		nvs_close(handle_);
+		flush();
 		isValid_ = false;
+		nvs_close(handle_);
 		--Subsystem::getInstance();
 	}
 }
 
-int Storage::get(const char *name, int def) const noexcept {
-	static_assert(sizeof(def) == sizeof(int32_t));
-	if (!*this) {
-		ESP_LOGW(MODULE, "Storage not inited %s use default value", name);
-		return def;
+// Changes during the delay are written by the same flush, the later ones start the next delay
+void Storage::flushTask(void *arg) noexcept {
+	Storage &storage = *reinterpret_cast<Storage *>(arg);
+	while (true) {
+		ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+		vTaskDelay(pdMS_TO_TICKS(flushDelayMs));
+		ulTaskNotifyTake(pdTRUE, 0);
+		storage.flush();
 	}
-	return ::get(handle_, name, def, &nvs_get_i32);
 }
 
+void Storage::onShutdown() noexcept {
+	getInstance().flush();
+}
 
-unsigned Storage::get(const char *name, unsigned def) const noexcept {
-	static_assert(sizeof(def) == sizeof(uint32_t));
+Storage::Entry *Storage::find(const char *name, Type type) const noexcept {
+	for (Entry &entry : cache_) {
+		if (type == entry.type && 0 == strncmp(entry.key, name, sizeof(entry.key)))
+			return &entry;
+	}
+	return nullptr;
+}
+
+// Cached entry (loaded on miss), nullptr if the name is invalid or the value does not fit the cache
+Storage::Entry *Storage::acquire(const char *name, Type type) const noexcept {
+	const size_t length = strlen(name);
+	if (length > keyMax) {
+		ESP_LOGW(MODULE, "Storage key `%s' is too long", name);
+		return nullptr;
+	}
+
+	Entry *entry = find(name, type);
+	if (nullptr != entry)
+		return entry;
+
+	// free entry, otherwise the next clean one round robin, when all are dirty - write them back
+	for (size_t i = 0; nullptr == entry && i < cacheEntries; ++i) {
+		if (Type::None == cache_[i].type)
+			entry = &cache_[i];
+	}
+	for (size_t i = 0; nullptr == entry && i < cacheEntries; ++i) {
+		Entry &victim = cache_[victim_];
+		victim_ = (victim_ + 1) % cacheEntries;
+		if (State::Dirty != victim.state)
+			entry = &victim;
+	}
+	if (nullptr == entry) {
+		flushLocked();
+		entry = &cache_[victim_];
+		victim_ = (victim_ + 1) % cacheEntries;
+		if (State::Dirty == entry->state)
+			return nullptr;
+	}
+
+	memcpy(entry->key, name, length + 1);
+	entry->type = type;
+	if (load(*entry))
+		return entry;
+
+	entry->type = Type::None;
+	return nullptr;
+}
+
+bool Storage::load(Entry &entry) const noexcept {
+	statsAdd(StatsCounter::NvsReads);
+	esp_err_t result = ESP_ERR_NOT_SUPPORTED;
+	switch (entry.type) {
+		case Type::I32:
+			result = nvs_get_i32(handle_, entry.key, &entry.i32);
+			break;
+		case Type::U32:
+			result = nvs_get_u32(handle_, entry.key, &entry.u32);
+			break;
+		case Type::Str: {
+			size_t length = sizeof(entry.str);
+			result = nvs_get_str(handle_, entry.key, entry.str, &length);
+			if (ESP_ERR_NVS_INVALID_LENGTH == result)
+				return false;	// read through
+		}
+		break;
+		case Type::None:
+			break;
+	}
+
+	DLOG(Debug, MODULE, "Storage load %s - %d", entry.key, static_cast<int>(result));
+	switch (result) {
+		case ESP_OK:
+			entry.state = State::Clean;
+			return true;
+		case ESP_ERR_NVS_NOT_FOUND:
+			entry.state = State::Missing;
+			return true;
+		default:
+			ESP_LOGW(MODULE, "Storage get `%s' error %s (%d)", entry.key, esp_err_to_name(result),
+					 static_cast<int>(result));
+			return false;
+	}
+}
+
+void Storage::changed() noexcept {
+	xTaskNotifyGive(task_);
+}
+
+bool Storage::flushLocked() const noexcept {
+	bool isOk = true;
+	unsigned int count = 0;
+	for (Entry &entry : cache_) {
+		if (State::Dirty != entry.state)
+			continue;
+
+		statsAdd(StatsCounter::NvsWrites);
+		esp_err_t result = ESP_ERR_NOT_SUPPORTED;
+		switch (entry.type) {
+			case Type::I32:
+				result = nvs_set_i32(handle_, entry.key, entry.i32);
+				break;
+			case Type::U32:
+				result = nvs_set_u32(handle_, entry.key, entry.u32);
+				break;
+			case Type::Str:
+				result = nvs_set_str(handle_, entry.key, entry.str);
+				break;
+			case Type::None:
+				break;
+		}
+
+		if (ESP_OK != result) {
+			ESP_LOGW(MODULE, "Storage set `%s' error %s (%d)", entry.key, esp_err_to_name(result),
+					 static_cast<int>(result));
+			isOk = false;
+			continue;
+		}
+		entry.state = State::Clean;
+		isCommitPending_ = true;
+		++count;
+	}
+
+	if (isCommitPending_) {
+		statsAdd(StatsCounter::NvsCommits);
+		const esp_err_t result = nvs_commit(handle_);
+		if (ESP_OK == result)
+			isCommitPending_ = false;
+		else {
+			ESP_LOGE(MODULE, "Commit error %s (%d)", esp_err_to_name(result), static_cast<int>(result));
+			isOk = false;
+		}
+	}
+
+	if (0 != count)
+		DLOG(Debug, MODULE, "Storage flush %u value(s)", count);
+	return isOk;
+}
+
+bool Storage::flush() noexcept {
+	if (!*this)
+		return false;
+
+	const Guard guard(lock_);
+	return flushLocked();
+}
+
+template <class T> T Storage::getCached(const char *name, T def, Type type, T Entry::*value) const noexcept {
 	if (!*this) {
 		ESP_LOGW(MODULE, "Storage not inited %s use default value", name);
 		return def;
 	}
-	return ::get(handle_, name, def, &nvs_get_u32);
+
+	const Guard guard(lock_);
+	const Entry *entry = acquire(name, type);
+	return (nullptr != entry && State::Missing != entry->state) ? entry->*value : def;
 }
 
-float Storage::get(const char *name, float def) const noexcept {
-	static_assert(sizeof(def) == sizeof(uint32_t));
+template <class T> bool Storage::setCached(const char *name, T value, Type type, T Entry::*member) noexcept {
 	if (!*this) {
 		ESP_LOGW(MODULE, "Storage not inited %s use default value", name);
-		return def;
+		return false;
 	}
 
-	std::string fname(name);
-	fname.append("-float");
+	const Guard guard(lock_);
+	Entry *entry = acquire(name, type);
+	if (nullptr == entry)
+		return false;
 
-	uint32_t value;
-	const esp_err_t result = nvs_get_u32(handle_, fname.c_str(), &value);
-	if (ESP_OK == result) {
-		float v;
-		memcpy(&v, &value, sizeof(value));
-		return v;
+	if (State::Missing != entry->state && value == entry->*member)
+		return true;
+
+	DLOG(Debug, MODULE, "Save %s", name);
+	entry->*member = value;
+	if (State::Dirty != entry->state) {
+		entry->state = State::Dirty;
+		changed();
 	}
+	return true;
+}
 
-	if (ESP_ERR_NVS_NOT_FOUND != result)
-		ESP_LOGE(MODULE, "Storage %s get error %s (%d)", name,  esp_err_to_name(result), static_cast<int>(result));
+int Storage::get(const char *name, int def) const noexcept {
+	static_assert(sizeof(def) == sizeof(int32_t));
+	return getCached<int32_t>(name, def, Type::I32, &Entry::i32);
+}
 
-	return def;
+unsigned Storage::get(const char *name, unsigned def) const noexcept {
+	static_assert(sizeof(def) == sizeof(uint32_t));
+	return getCached<uint32_t>(name, def, Type::U32, &Entry::u32);
 }
 
-std::string Storage::get(const char *name, std::string_view def) const noexcept {
-	constexpr size_t defaultLength = 64;
+float Storage::getFloat(const char *key, float def) const noexcept {
+	static_assert(sizeof(def) == sizeof(uint32_t));
+	if (0 == *key)
+		return def;
 
+	uint32_t value;
+	memcpy(&value, &def, sizeof(value));
+	value = getCached<uint32_t>(key, value, Type::U32, &Entry::u32);
+
+	float v;
+	memcpy(&v, &value, sizeof(value));
+	return v;
+}
+
+float Storage::get(const char *name, float def) const noexcept {
+	char key[keyMax + 1];
+	floatKey(name, key);
+	return getFloat(key, def);
+}
+
+size_t Storage::get(const char *name, char *value, size_t size, std::string_view def) const noexcept {
 	if (!*this) {
 		ESP_LOGW(MODULE, "Storage not inited %s use default value", name);
-		return std::string(def);
+		return copyString(value, size, def);
 	}
-	std::string value(defaultLength, '?');
 
-	for (bool isCompleted = false; !isCompleted;) {
-		isCompleted = true;
-		size_t length = value.length();
-		const esp_err_t result = nvs_get_str(handle_, name, value.data(), &length);
-		switch (result) {
-			case ESP_OK:
-				value.resize(length-1);
-				break;
-			case ESP_ERR_NVS_INVALID_LENGTH:
-				isCompleted = false;
-				value.resize(length);
-				break;
-			default:
-				ESP_LOGE(MODULE, "Storage %s get error %s (%d)", name,  esp_err_to_name(result), static_cast<int>(result));
-				[[fallthrough]];
-			case ESP_ERR_NVS_NOT_FOUND:
-				value = def;
-				break;
-		}
-	};
+	const Guard guard(lock_);
+	const Entry *entry = acquire(name, Type::Str);
+	if (nullptr != entry)
+		return copyString(value, size, (State::Missing != entry->state) ? std::string_view(entry->str) : def);
+
+	// long value is not cached
+	size_t length = size;
+	statsAdd(StatsCounter::NvsReads);
+	const esp_err_t result = nvs_get_str(handle_, name, (0 != size) ? value : nullptr, &length);
+	switch (result) {
+		case ESP_OK:	// value or the size query
+			return length - 1;
+		case ESP_ERR_NVS_INVALID_LENGTH:
+			if (0 != size)
+				value[0] = '\0';
+			return length - 1;
+		default:
+			ESP_LOGE(MODULE, "Storage %s get error %s (%d)", name,  esp_err_to_name(result), static_cast<int>(result));
+			[[fallthrough]];
+		case ESP_ERR_NVS_NOT_FOUND:
+			return copyString(value, size, def);
+	}
+}
 
+std::string Storage::get(const char *name, std::string_view def) const noexcept {
+	char buffer[cacheStringMax];
+	const size_t length = get(name, buffer, sizeof(buffer), def);
+	if (length < sizeof(buffer))
+		return std::string(buffer, length);
+
+	std::string value(length, '\0');
+	const size_t actual = get(name, value.data(), length + 1, def);	// C++17 string keeps room for terminator
+	value.resize((actual <= length) ? actual : 0);
 	return value;
 }
 
 bool Storage::set(const char *name, int value) noexcept {
-	ESP_LOGI(MODULE, "Save int %s", name);
 	static_assert(sizeof(value) == sizeof(int32_t));
-	if (!*this) {
-		ESP_LOGW(MODULE, "Storage not inited %s use default value", name);
-		return false;
-	}
-	return ::set(handle_, name, value, &nvs_set_i32);
+	return setCached<int32_t>(name, value, Type::I32, &Entry::i32);
 }
 
 bool Storage::set(const char *name, unsigned value) noexcept {
-	ESP_LOGI(MODULE, "Save uint %s", name);
 	static_assert(sizeof(value) == sizeof(uint32_t));
+	return setCached<uint32_t>(name, value, Type::U32, &Entry::u32);
+}
+
+bool Storage::setFloat(const char *key, float value) noexcept {
+	static_assert(sizeof(value) == sizeof(uint32_t));
+	if (0 == *key)
+		return false;
+
+	uint32_t v;
+	memcpy(&v, &value, sizeof(v));
+	return setCached<uint32_t>(key, v, Type::U32, &Entry::u32);
+}
+
+bool Storage::set(const char *name, float value) noexcept {
+	char key[keyMax + 1];
+	floatKey(name, key);
+	return setFloat(key, value);
+}
+
+bool Storage::set(const char *name, const char *value) noexcept {
 	if (!*this) {
 		ESP_LOGW(MODULE, "Storage not inited %s use default value", name);
 		return false;
 	}
-	return ::set(handle_, name, value, &nvs_set_u32);
+
+	const Guard guard(lock_);
+	const size_t length = strlen(value) + 1;
+	Entry *entry = (length <= cacheStringMax) ? acquire(name, Type::Str) : find(name, Type::Str);
+	if (length <= cacheStringMax && nullptr != entry) {
+		if (State::Missing != entry->state && 0 == strcmp(entry->str, value))
+			return true;
+
+		DLOG(Debug, MODULE, "Save %s", name);
+		memcpy(entry->str, value, length);
+		if (State::Dirty != entry->state) {
+			entry->state = State::Dirty;
+			changed();
+		}
+		return true;
+	}
+
+	// long value (or the stored one is long) - written through, the cached copy is dropped
+	if (nullptr != entry)
+		entry->type = Type::None;
+
+	DLOG(Debug, MODULE, "Save %s", name);
+	statsAdd(StatsCounter::NvsWrites);
+	const esp_err_t result = nvs_set_str(handle_, name, value);
+	if (ESP_OK != result) {
+		ESP_LOGW(MODULE, "Storage set `%s' error %s (%d)", name,  esp_err_to_name(result), static_cast<int>(result));
+		return false;
+	}
+	isCommitPending_ = true;
+	changed();
+	return true;
 }
 
-bool Storage::set(const char *name, float value) noexcept {
-	static_assert(sizeof(value) == sizeof(uint32_t));
+bool Storage::load(const StorageSchema &schema, void *data) noexcept {
 	if (!*this) {
-		ESP_LOGW(MODULE, "Storage not inited %s use default value", name);
+		ESP_LOGW(MODULE, "Storage not inited %s use default value", schema.name);
 		return false;
 	}
 
-	std::string fname(name);
-	fname.append("-float");
-	uint32_t v;
-	memcpy(&v, &value, sizeof(v));
-	return ::set(handle_, fname.c_str(), v, &nvs_set_u32);
+	bool isCurrent = false, isMigrated = false;
+	{
+		const Guard guard(lock_);
+		size_t length = 0;
+		statsAdd(StatsCounter::NvsReads);
+		esp_err_t result = nvs_get_blob(handle_, schema.name, nullptr, &length);
+
+		if (ESP_OK == result && (length < sizeof(SnapshotHeader) || length > snapshotMax))
+			result = ESP_ERR_NVS_INVALID_LENGTH;
+		if (ESP_OK == result)
+			result = nvs_get_blob(handle_, schema.name, snapshot_, &length);
+
+		if (ESP_OK == result) {
+			SnapshotHeader header;
+			memcpy(&header, snapshot_, sizeof(header));
+			const uint8_t *payload = snapshot_ + sizeof(header);
+
+			if (header.length != length - sizeof(header) || header.crc != snapshotCrc(header, payload))
+				ESP_LOGW(MODULE, "Snapshot %s is corrupted", schema.name);
+			else if (schema.version == header.version && schema.length == header.length) {
+				memcpy(data, payload, header.length);
+				isCurrent = true;
+			} else if (header.version < schema.version && nullptr != schema.migrate) {
+				isMigrated = schema.migrate(header.version, payload, header.length, data);
+				ESP_LOGI(MODULE, "Snapshot %s migration %u to %u %s", schema.name, header.version, schema.version,
+						 isMigrated ? "done" : "failed");
+			} else
+				ESP_LOGW(MODULE, "Snapshot %s version %u is not supported", schema.name, header.version);
+		} else if (ESP_ERR_NVS_NOT_FOUND != result)
+			ESP_LOGW(MODULE, "Snapshot %s error %s (%d)", schema.name, esp_err_to_name(result), static_cast<int>(result));
+	}
+
+	if (isCurrent)
+		return true;
+
+	if (!isMigrated)
+		loadLegacy(schema, data);
+	save(schema, data);
+	return false;
 }
 
-bool Storage::set(const char *name, const char *value) noexcept {
+// Per-key values (defaults are kept for missing ones)
+void Storage::loadLegacy(const StorageSchema &schema, void *data) const noexcept {
+	uint8_t *bytes = reinterpret_cast<uint8_t *>(data);
+	for (size_t i = 0; i < schema.fieldCount; ++i) {
+		const StorageField &field = schema.fields[i];
+		void *value = bytes + field.offset;
+		switch (field.type) {
+			case StorageField::Type::I32: {
+				int32_t v;
+				memcpy(&v, value, sizeof(v));
+				v = get(field.key, static_cast<int>(v));
+				memcpy(value, &v, sizeof(v));
+			}
+			break;
+			case StorageField::Type::U32: {
+				uint32_t v;
+				memcpy(&v, value, sizeof(v));
+				v = get(field.key, static_cast<unsigned>(v));
+				memcpy(value, &v, sizeof(v));
+			}
+			break;
+			case StorageField::Type::Float: {
+				float v;
+				memcpy(&v, value, sizeof(v));
+				v = get(field.key, v);
+				memcpy(value, &v, sizeof(v));
+			}
+			break;
+			case StorageField::Type::Str: {
+				// default is the field itself, kept when the legacy value does not fit
+				char *str = reinterpret_cast<char *>(value);
+				const std::string_view def(str, strnlen(str, field.size));
+				if (get(field.key, nullptr, 0, def) < field.size)
+					get(field.key, str, field.size, def);
+			}
+			break;
+		}
+	}
+}
+
+bool Storage::save(const StorageSchema &schema, const void *data) noexcept {
 	if (!*this) {
-		ESP_LOGW(MODULE, "Storage not inited %s use default value", name);
+		ESP_LOGW(MODULE, "Storage not inited %s use default value", schema.name);
+		return false;
+	}
+
+	const size_t length = sizeof(SnapshotHeader) + schema.length;
+	if (length > snapshotMax || schema.length > UINT16_MAX) {
+		ESP_LOGE(MODULE, "Snapshot %s is too long", schema.name);
 		return false;
 	}
-	return ::set<const char *>(handle_, name, value, &nvs_set_str);
+
+	SnapshotHeader header { schema.version, static_cast<uint16_t>(schema.length), 0 };
+	header.crc = snapshotCrc(header, data);
+
+	const Guard guard(lock_);
+	memcpy(snapshot_, &header, sizeof(header));
+	memcpy(snapshot_ + sizeof(header), data, schema.length);
+	statsAdd(StatsCounter::NvsWrites);
+	const esp_err_t result = nvs_set_blob(handle_, schema.name, snapshot_, length);
+	if (ESP_OK != result) {
+		ESP_LOGW(MODULE, "Snapshot %s save error %s (%d)", schema.name, esp_err_to_name(result),
+				 static_cast<int>(result));
+		return false;
+	}
+
+	DLOG(Debug, MODULE, "Save %s v%u", schema.name, schema.version);
+	isCommitPending_ = true;
+	changed();
+	return true;
 }
@@ -15,19 +15,121 @@
 // along with this program. If not, see <http://www.gnu.org/licenses/>.
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
 #include <string>
+#include <string_view>
 #include <nvs_flash.h>
 
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+
+constexpr size_t storageKeyMax = 15;	// NVS limit w/o terminator
+constexpr const char storageFloatSuffix[] = "-float";
+
+// Key built and checked by the compiler, see storageFloatKey()
+template <size_t N> struct StorageKey {
+	char value[N] = {};
+};
+
+// Field of a snapshot struct kept as a separate NVS key by the firmware before snapshots (float key gets "-float")
+struct StorageField {
+	enum class Type : uint8_t {
+		I32,
+		U32,
+		Float,
+		Str,
+	};
+
+	const char *key;
+	Type type;
+	size_t offset;
+	size_t size;	// Str capacity with terminator
+};
+
+// Converts payload of an older version into data (holds defaults), false - use legacy keys instead
+typedef bool (*StorageMigration)(uint16_t version, const void *payload, size_t length, void *data);
+
+// Plain struct stored as one versioned NVS blob: {version, length, crc32} header + payload
+struct StorageSchema {
+	const char *name;
+	uint16_t version;
+	size_t length;
+	StorageMigration migrate = nullptr;
+	const StorageField *fields = nullptr;
+	size_t fieldCount = 0;
+};
+
+// Write-back cache in front of NVS: reads are served from RAM after the first load, writes are kept dirty and
+// committed in a batch by flush() - explicit, flushDelayMs after the first change (own task, NVS writes and page
+// erases stay off the timer task), on restart (shutdown handler).
+// Strings over cacheStringMax bypass the cache (written to NVS at once, committed by flush()).
 class Storage {
 	Storage(const Storage &&) = delete;
 	Storage &operator=(const Storage &&) = delete;
 
+public:
+	static constexpr size_t keyMax = storageKeyMax;
+	static constexpr size_t cacheEntries = 16;
+	static constexpr size_t cacheStringMax = 64;	// with terminator
+	static constexpr unsigned int flushDelayMs = 5000;
+	static constexpr uint32_t flushStack = 3072;
+	static constexpr UBaseType_t flushPriority = tskIDLE_PRIORITY + 1;
+	static constexpr size_t snapshotMax = 1024;	// blob with header
+
+private:
+	enum class Type : uint8_t {
+		None,
+		I32,
+		U32,
+		Str,
+	};
+
+	enum class State : uint8_t {
+		Missing,	// not in NVS, default is returned
+		Clean,
+		Dirty,
+	};
+
+	struct Entry {
+		char key[keyMax + 1];
+		Type type;
+		State state;
+		union {
+			int32_t i32;
+			uint32_t u32;
+			char str[cacheStringMax];
+		};
+	};
+
 	bool isValid_  = false;
+	mutable bool isCommitPending_ = false;	// written to NVS, nvs_commit() is due
 	nvs_handle_t handle_ {};
+	SemaphoreHandle_t lock_ = nullptr;
+	TaskHandle_t task_ = nullptr;	// notified on a change, flushes after the delay
+	mutable Entry cache_[cacheEntries] {};
+	mutable size_t victim_ = 0;
+	uint8_t snapshot_[snapshotMax] {};	// blob of load/save, guarded by lock_
 
 	Storage() noexcept;
 	virtual ~Storage() noexcept;
 
+	Entry *find(const char *name, Type type) const noexcept;
+	Entry *acquire(const char *name, Type type) const noexcept;
+	bool load(Entry &entry) const noexcept;
+	void loadLegacy(const StorageSchema &schema, void *data) const noexcept;
+	void changed() noexcept;
+	bool flushLocked() const noexcept;
+
+	template <class T> T getCached(const char *name, T def, Type type, T Entry::*value) const noexcept;
+	template <class T> bool setCached(const char *name, T value, Type type, T Entry::*member) noexcept;
+	float getFloat(const char *key, float def) const noexcept;
+	bool setFloat(const char *key, float value) noexcept;
+
+	static void flushTask(void *arg) noexcept;
+	static void onShutdown() noexcept;
+
 public:
 	constexpr bool operator !() const noexcept {
 		return !isValid_;
@@ -38,11 +140,46 @@ public:
 	float get(const char *name, float def) const noexcept;
 	std::string get(const char *name, std::string_view def) const noexcept;
 
+	// Heap free string access: zero terminated value (default when missing) into value[size], returns its length
+	// w/o terminator; when it does not fit (length >= size) value is left empty.
+	size_t get(const char *name, char *value, size_t size, std::string_view def) const noexcept;
+	template <size_t N> size_t get(const char *name, char (&value)[N], std::string_view def) const noexcept {
+		return get(name, value, N, def);
+	}
+
+	// Float under the compile-time suffixed key (no runtime key building)
+	template <size_t N> float get(const StorageKey<N> &key, float def) const noexcept {
+		return getFloat(key.value, def);
+	}
+
 	bool set(const char *name, int value) noexcept;
 	bool set(const char *name, unsigned value) noexcept;
 	bool set(const char *name, float value) noexcept;
 	bool set(const char *name, const char *value) noexcept;
 
+	template <size_t N> bool set(const StorageKey<N> &key, float value) noexcept {
+		return setFloat(key.value, value);
+	}
+
+	// Snapshot into data (defaults on input): current blob, migrated older one or legacy keys (saved as blob then).
+	// Returns false when the current blob was not valid.
+	bool load(const StorageSchema &schema, void *data) noexcept;
+	bool save(const StorageSchema &schema, const void *data) noexcept;
+
+	// Write dirty values and commit, true if NVS is up to date
+	bool flush() noexcept;
+
 	static Storage &getInstance() noexcept;
 };
 
+// Key of the float value, e.g. get(storageFloatKey("volt"), 3.7f) reads "volt-float"
+template <size_t N> constexpr StorageKey<N + sizeof(storageFloatSuffix) - 1> storageFloatKey(const char (&name)[N]) noexcept {
+	static_assert(N - 1 + sizeof(storageFloatSuffix) - 1 <= storageKeyMax, "NVS key is too long");
+
+	StorageKey<N + sizeof(storageFloatSuffix) - 1> key;
+	for (size_t i = 0; i + 1 < N; ++i)
+		key.value[i] = name[i];
+	for (size_t i = 0; i < sizeof(storageFloatSuffix); ++i)
+		key.value[N - 1 + i] = storageFloatSuffix[i];
+	return key;
+}
@@ -0,0 +1,193 @@
+// vim: tabstop=4 shiftwidth=4 noexpandtab colorcolumn=120 :
+// This file is part of the Sim800 (https://github.com/beranat/sim800).
+// Copyright (c) 2021 Anatoly L. Berenblit.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 3.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+#include <atomic>
+#include <string_view>
+
+#include <esp_log.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include "urc.hpp"
+
+constexpr const char *MODULE = "urc";
+
+namespace {
+
+// Left child - right sibling trie, index 0 is the root and means "none" for links
+struct Node {
+	char c;
+	uint16_t child;
+	uint16_t sibling;
+	Urc urc;
+};
+
+constexpr size_t nodesCount() noexcept {
+	size_t count = 1;
+	for (const UrcPrefix &p : urcPrefixes)
+		count += p.prefix.length();
+	return count;
+}
+
+struct Trie {
+	Node nodes[nodesCount()];
+	size_t used;
+};
+
+constexpr Trie build() noexcept {
+	Trie trie {};
+	trie.used = 1;
+
+	for (const UrcPrefix &p : urcPrefixes) {
+		uint16_t node = 0;
+		for (const char c : p.prefix) {
+			uint16_t prev = 0, child = trie.nodes[node].child;
+			while (0 != child && c != trie.nodes[child].c) {
+				prev = child;
+				child = trie.nodes[child].sibling;
+			}
+
+			if (0 == child) {
+				child = static_cast<uint16_t>(trie.used++);
+				trie.nodes[child] = Node { c, 0, 0, Urc::None };
+				if (0 == prev)
+					trie.nodes[node].child = child;
+				else
+					trie.nodes[prev].sibling = child;
+			}
+			node = child;
+		}
+		trie.nodes[node].urc = p.urc;
+	}
+	return trie;
+}
+
+constexpr Trie trie = build();
+
+constexpr Urc classify(std::string_view line, size_t *prefix) noexcept {
+	Urc found = Urc::None;
+	uint16_t node = 0;
+	for (size_t i = 0; i < line.length(); ++i) {
+		uint16_t child = trie.nodes[node].child;
+		while (0 != child && line[i] != trie.nodes[child].c)
+			child = trie.nodes[child].sibling;
+		if (0 == child)
+			break;
+
+		node = child;
+		if (Urc::None != trie.nodes[node].urc) {
+			found = trie.nodes[node].urc;
+			if (nullptr != prefix)
+				*prefix = i + 1;
+		}
+	}
+	return found;
+}
+
+constexpr bool verify() noexcept {
+	for (const UrcPrefix &p : urcPrefixes) {
+		if (p.urc != classify(p.prefix, nullptr))
+			return false;
+	}
+	return Urc::None == classify("OK", nullptr) && Urc::Creg == classify("+CREG: 1,1", nullptr);
+}
+
+static_assert(nodesCount() < UINT16_MAX, "Too many URC prefixes");
+static_assert(verify(), "URC prefixes must be unique");
+
+struct Slot {
+	std::atomic<UrcHandler> fn { nullptr };
+	std::atomic<void *> arg { nullptr };
+};
+
+Slot slots[static_cast<size_t>(Urc::Count)][urcHandlersMax];
+
+// (un)registrations are serialized in a critical section (no logging inside), dispatch is lock free
+portMUX_TYPE slotsMux = portMUX_INITIALIZER_UNLOCKED;
+
+class SlotsGuard final {
+	public:
+		SlotsGuard() noexcept {
+			portENTER_CRITICAL(&slotsMux);
+		}
+		~SlotsGuard() {
+			portEXIT_CRITICAL(&slotsMux);
+		}
+};
+
+} // namespace
+
+Urc urcClassify(std::string_view line, size_t *prefix) noexcept {
+	return classify(line, prefix);
+}
+
+esp_err_t urcRegister(Urc urc, UrcHandler fn, void *arg) noexcept {
+	if (Urc::None == urc || Urc::Count <= urc || nullptr == fn)
+		return ESP_ERR_INVALID_ARG;
+
+	{
+		const SlotsGuard guard;
+		for (Slot &slot : slots[static_cast<size_t>(urc)]) {
+			if (nullptr != slot.fn.load(std::memory_order_relaxed))
+				continue;
+
+			// arg is published before handler, dispatch loads handler first
+			slot.arg.store(arg, std::memory_order_relaxed);
+			slot.fn.store(fn, std::memory_order_release);
+			return ESP_OK;
+		}
+	}
+
+	ESP_LOGE(MODULE, "No free slot for %s", urcName(urc));
+	return ESP_ERR_NO_MEM;
+}
+
+esp_err_t urcUnregister(Urc urc, UrcHandler fn, void *arg) noexcept {
+	if (Urc::None == urc || Urc::Count <= urc || nullptr == fn)
+		return ESP_ERR_INVALID_ARG;
+
+	const SlotsGuard guard;
+	for (Slot &slot : slots[static_cast<size_t>(urc)]) {
+		if (fn == slot.fn.load(std::memory_order_acquire) && arg == slot.arg.load(std::memory_order_relaxed)) {
+			slot.fn.store(nullptr, std::memory_order_release);
+			return ESP_OK;
+		}
+	}
+	return ESP_ERR_NOT_FOUND;
+}
+
+void urcDispatch(Urc urc, std::string_view line, size_t prefix) noexcept {
+	if (Urc::None == urc || Urc::Count <= urc)
+		return;
+
+	std::string_view args = line.substr(prefix);
+	while (!args.empty() && ' ' == args.front())
+		args.remove_prefix(1);
+
+	for (Slot &slot : slots[static_cast<size_t>(urc)]) {
+		const UrcHandler fn = slot.fn.load(std::memory_order_acquire);
+		if (nullptr != fn)
+			fn(urc, line, args, slot.arg.load(std::memory_order_relaxed));
+	}
+}
+
+const char *urcName(Urc urc) noexcept {
+	for (const UrcPrefix &p : urcPrefixes) {
+		if (urc == p.urc)
+			return p.prefix.data();
+	}
+	return "?";
+}
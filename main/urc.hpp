@@ -0,0 +1,117 @@
+// vim: tabstop=4 shiftwidth=4 noexpandtab colorcolumn=120 :
+// This file is part of the Sim800 (https://github.com/beranat/sim800).
+// Copyright (c) 2021 Anatoly L. Berenblit.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 3.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+#include <esp_err.h>
+
+// Unsolicited result codes known to the dispatcher
+enum class Urc : uint8_t {
+	None,
+	Rdy,
+	CallReady,
+	SmsReady,
+	Cfun,
+	Cpin,
+	Creg,
+	Cgreg,
+	Csqn,
+	Psuttz,
+	Ctzv,
+	Ring,
+	Clip,
+	Cmti,
+	Cmt,
+	Cusd,
+	PdpDeact,
+	Closed,
+	ConnectOk,
+	ConnectFail,
+	AlreadyConnect,
+	SendOk,
+	SendFail,
+	Receive,
+	Ciprxget,
+	Connection,
+	HttpAction,
+	PowerDown,
+	UnderVoltage,
+	OverVoltage,
+	Count
+};
+
+struct UrcPrefix {
+	std::string_view prefix;
+	Urc urc;
+};
+
+// Lines are classified by the longest prefix, the trie is built from this table at compile time
+constexpr UrcPrefix urcPrefixes[] = {
+	{ "RDY", Urc::Rdy },
+	{ "Call Ready", Urc::CallReady },
+	{ "SMS Ready", Urc::SmsReady },
+	{ "+CFUN:", Urc::Cfun },
+	{ "+CPIN:", Urc::Cpin },
+	{ "+CREG:", Urc::Creg },
+	{ "+CGREG:", Urc::Cgreg },
+	{ "+CSQN:", Urc::Csqn },
+	{ "*PSUTTZ:", Urc::Psuttz },
+	{ "+CTZV:", Urc::Ctzv },
+	{ "RING", Urc::Ring },
+	{ "+CLIP:", Urc::Clip },
+	{ "+CMTI:", Urc::Cmti },
+	{ "+CMT:", Urc::Cmt },
+	{ "+CUSD:", Urc::Cusd },
+	{ "+PDP: DEACT", Urc::PdpDeact },
+	{ "CLOSED", Urc::Closed },
+	{ "CONNECT OK", Urc::ConnectOk },
+	{ "CONNECT FAIL", Urc::ConnectFail },
+	{ "ALREADY CONNECT", Urc::AlreadyConnect },
+	{ "SEND OK", Urc::SendOk },
+	{ "SEND FAIL", Urc::SendFail },
+	{ "+RECEIVE,", Urc::Receive },
+	{ "+CIPRXGET:", Urc::Ciprxget },
+	// AT+CIPMUX=1 connection state "<n>, CONNECT OK|CONNECT FAIL|ALREADY CONNECT|CLOSED"
+	{ "0, ", Urc::Connection },
+	{ "1, ", Urc::Connection },
+	{ "2, ", Urc::Connection },
+	{ "3, ", Urc::Connection },
+	{ "4, ", Urc::Connection },
+	{ "5, ", Urc::Connection },
+	{ "+HTTPACTION:", Urc::HttpAction },
+	{ "NORMAL POWER DOWN", Urc::PowerDown },
+	{ "UNDER-VOLTAGE", Urc::UnderVoltage },
+	{ "OVER-VOLTAGE", Urc::OverVoltage },
+};
+
+constexpr size_t urcHandlersMax = 4;	// per URC
+
+// Called on the receiver task, must not block. args - rest of the line after the prefix w/o leading spaces.
+typedef void (*UrcHandler)(Urc urc, std::string_view line, std::string_view args, void *arg);
+
+// Single pass classification, Urc::None for not a URC; length of the matched prefix is stored in prefix
+Urc urcClassify(std::string_view line, size_t *prefix = nullptr) noexcept;
+
+esp_err_t urcRegister(Urc urc, UrcHandler fn, void *arg = nullptr) noexcept;
+esp_err_t urcUnregister(Urc urc, UrcHandler fn, void *arg = nullptr) noexcept;
+
+// Call handlers of already classified line
+void urcDispatch(Urc urc, std::string_view line, size_t prefix) noexcept;
+
+const char *urcName(Urc urc) noexcept;